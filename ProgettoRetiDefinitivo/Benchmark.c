@@ -0,0 +1,628 @@
+//Generatore di carico per l'intera piattaforma: avvia ServerV, ServerG e Centro Vaccinale in una cartella temporanea,
+//registra una popolazione di Green Pass e poi, da molte connessioni concorrenti, esegue per la durata indicata un
+//miscuglio di registrazioni (protocollo dell'Utente verso il Centro Vaccinale), verifiche (protocollo del ClientS
+//verso il ServerG) e modifiche del report (protocollo del ClientT verso il ServerG). Al termine stampa per ogni
+//operazione il throughput e le latenze p50, p99 e p999, come testo oppure in JSON.
+//
+//Con -T ripete la prova per ognuno dei trasporti indicati fra ServerG, Centro Vaccinale e ServerV, con server nuovi
+//ogni volta: tcp (porta 1025), unix (socket Unix del ServerV) e memoria (canali in memoria condivisa fra il pool del
+//ServerG ed il ServerV, canale.h), stampando i risultati di ciascuno.
+//
+//Con -k esegue invece, senza avviare i server, il microbenchmark della validazione dei codici fiscali (codice.h):
+//versione scalare e vettoriale sugli stessi codici, in parte non validi, controllando che gli esiti coincidano.
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>      // libreria standard del C per la gestione delle situazioni di errore
+#include <string.h>
+#include <limits.h>
+#include <stdint.h>
+#include <time.h>
+#include <signal.h>     //contiene le costanti per la gestione dei segnali fra processi
+#include <fcntl.h>
+#include <dirent.h>     //contiene le definizioni per la lettura delle directory
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h> //contiene le definizioni dei socket
+#include <arpa/inet.h>  // contiene le definizioni per le operazioni Internet
+#include "codice.h"     //validazione del codice fiscale, per generare codici validi e per il microbenchmark
+#include "registrazione.h" //registrazione compatta dell'Utente
+#include "rete.h"       //lettura e scrittura bufferizzate dei messaggi a campi
+#define BUFF_MAX_SIZE 1024  //dimensione dei campi nome e cognome del pacchetto dell'Utente
+#define COD_SIZE 17         //16 byte per il codice della tessera sanitaria e 1 byte per il carattere terminatore
+#define ACK_SIZE 64         //dimensione dell'ack del Centro Vaccinale all'Utente e del ServerG al ClientS
+#define ACK_SIZE_CT 60      //dimensione dell'esito inviato dal ServerG al ClientS ed al ClientT
+#define BENVENUTO 108       //dimensione del benvenuto del ServerG al ClientS
+#define PORTA_CV 1024
+#define PORTA_SV 1025
+#define PORTA_SG 1026
+#define TIMEOUT 10          //secondi di attesa massima di una risposta
+#define N_OPERAZIONI 3
+#define OPZIONI_MAX 1024
+#define TRASPORTI_POOL "-p 4"   //opzioni del ServerG con -T senza -G: il canale in memoria condivisa richiede il pool
+
+//Operazioni eseguite dal generatore di carico
+enum { REGISTRAZIONE, VERIFICA, MODIFICA };
+const char *nomi[N_OPERAZIONI] = {"registrazione", "verifica", "modifica_report"};
+
+//Struct del pacchetto che l'Utente invia al Centro Vaccinale
+typedef struct {
+    char nome[BUFF_MAX_SIZE];
+    char cognome[BUFF_MAX_SIZE];
+    char cod_fisc[COD_SIZE];
+} VACCINAZIONE;
+
+//Struct del pacchetto del ClientT
+typedef struct {
+    char cod_fisc[COD_SIZE];
+    char report;
+} REPORT;
+
+//Latenze di un tipo di operazione, in nanosecondi
+typedef struct {
+    uint64_t *campioni;
+    size_t n;
+    size_t cap;
+    uint64_t errori;
+} MISURE;
+
+//Stato di un client concorrente
+typedef struct {
+    pthread_t tid;
+    int id;
+    unsigned seme;
+    MISURE misure[N_OPERAZIONI];
+    uint64_t primo, ultimo;         //codici registrati durante il caricamento della popolazione
+} CLIENT;
+
+int n_client = 16, durata = 10, popolazione = 1000, json = 0;
+int peso[N_OPERAZIONI] = {10, 80, 10};
+uint64_t prossimo_codice;           //prossimo codice da registrare, condiviso dai client
+struct timespec fine_prova;
+pid_t server[3];
+char cartella[64] = "";           //cartella temporanea di lavoro dei server
+
+uint64_t adesso_ns() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+//Funzione che apre una connessione verso la porta locale indicata. Restituisce il socket oppure -1
+int connetti(int porta) {
+    struct sockaddr_in servaddr;
+    struct timeval attesa = {TIMEOUT, 0};
+    int sock_fd;
+
+    if ((sock_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) return -1;
+    memset(&servaddr, 0, sizeof(servaddr));
+    servaddr.sin_family = AF_INET;
+    servaddr.sin_port = htons(porta);
+    servaddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    setsockopt(sock_fd, SOL_SOCKET, SO_RCVTIMEO, &attesa, sizeof(attesa));
+    if (connect(sock_fd, (struct sockaddr *)&servaddr, sizeof(servaddr)) < 0) {
+        close(sock_fd);
+        return -1;
+    }
+    return sock_fd;
+}
+
+//Codice fiscale valido, diverso per ogni n: le prime sei lettere contano n in base 26 (oltre 300 milioni di codici)
+//e l'ultimo carattere è quello di controllo
+void codice(uint64_t n, char cod_fisc[COD_SIZE]) {
+    int i;
+
+    for (i = 5; i >= 0; i--, n /= 26) cod_fisc[i] = 'A' + n % 26;
+    memcpy(cod_fisc + 6, "80A01H501", 9);
+    cod_fisc[15] = codice_controllo(cod_fisc);
+    cod_fisc[16] = 0;
+}
+
+//Registrazione di un Green Pass con il protocollo dell'Utente: benvenuto, registrazione compatta (o pacchetto completo
+//se il Centro Vaccinale non indica la versione 2) ed ack del Centro Vaccinale.
+//Restituisce 0 oppure -1 in caso di errore o registrazione non riuscita
+int registrazione(uint64_t n) {
+    VACCINAZIONE pacchetto;
+    char buffer[BUFF_MAX_SIZE];
+    unsigned char len_ack;
+    int sock_fd, benvenuto, esito = -1;
+    size_t len;
+    RETE r;
+
+    if ((sock_fd = connetti(PORTA_CV)) < 0) return -1;
+    rete_inizia(&r, sock_fd);
+    memset(&pacchetto, 0, sizeof(pacchetto));
+    strcpy(pacchetto.nome, "Prova");
+    strcpy(pacchetto.cognome, "Carico");
+    codice(n, pacchetto.cod_fisc);
+    if (rete_leggi(&r, &benvenuto, sizeof(int)) == 0 && benvenuto > 0 && benvenuto <= BUFF_MAX_SIZE &&
+        rete_leggi(&r, buffer, benvenuto) == 0) {
+        if (reg_versione_benvenuto(buffer, benvenuto) >= 2) {
+            len = reg_codifica(buffer, pacchetto.nome, pacchetto.cognome, pacchetto.cod_fisc);
+            if (rete_scrivi(&r, buffer, len) == 0 && rete_leggi(&r, &len_ack, sizeof(len_ack)) == 0 &&
+                rete_leggi(&r, buffer, len_ack) == 0) {
+                buffer[len_ack] = 0;
+                if (strstr(buffer, "successo")) esito = 0;
+            }
+        } else if (rete_scrivi(&r, &pacchetto, sizeof(pacchetto)) == 0 && rete_leggi(&r, buffer, ACK_SIZE) == 0) {
+            buffer[ACK_SIZE - 1] = 0;
+            if (strstr(buffer, "successo")) esito = 0;
+        }
+    }
+    close(sock_fd);
+    return esito;
+}
+
+//Verifica di un Green Pass con il protocollo interattivo del ClientS, senza le attese del client.
+//Restituisce 1 se il Green Pass esiste, 0 se il codice è inesistente, -1 in caso di errore o servizio non disponibile
+int verifica(uint64_t n) {
+    char bit = '0', buffer[BENVENUTO], cod_fisc[COD_SIZE];
+    int sock_fd, esito = -1;
+    RETE r;
+
+    if ((sock_fd = connetti(PORTA_SG)) < 0) return -1;
+    rete_inizia(&r, sock_fd);
+    codice(n, cod_fisc);
+    if (rete_scrivi(&r, &bit, sizeof(char)) == 0 && rete_leggi(&r, buffer, BENVENUTO) == 0 &&
+        rete_scrivi(&r, cod_fisc, COD_SIZE) == 0 && rete_leggi(&r, buffer, ACK_SIZE) == 0 &&
+        rete_leggi(&r, buffer, ACK_SIZE_CT) == 0) {
+        buffer[ACK_SIZE_CT - 1] = 0;
+        if (strstr(buffer, "inesistente")) esito = 0;
+        else if (strncmp(buffer, "Il Green Pass", 13) == 0) esito = 1;
+    }
+    close(sock_fd);
+    return esito;
+}
+
+//Modifica del report con il protocollo del ClientT. Restituisce 0 oppure -1 in caso di errore, servizio non
+//disponibile o Green Pass occupato
+int modifica(uint64_t n, char report) {
+    char bit = '1', buffer[ACK_SIZE_CT];
+    REPORT pacchetto;
+    int sock_fd, esito = -1;
+    RETE r;
+
+    if ((sock_fd = connetti(PORTA_SG)) < 0) return -1;
+    rete_inizia(&r, sock_fd);
+    memset(&pacchetto, 0, sizeof(pacchetto));
+    codice(n, pacchetto.cod_fisc);
+    pacchetto.report = report;
+    if (rete_scrivi(&r, &bit, sizeof(char)) == 0 && rete_scrivi(&r, &pacchetto, sizeof(REPORT)) == 0 &&
+        rete_leggi(&r, buffer, ACK_SIZE_CT) == 0) {
+        buffer[ACK_SIZE_CT - 1] = 0;
+        if (strstr(buffer, "successo")) esito = 0;
+    }
+    close(sock_fd);
+    return esito;
+}
+
+//Microbenchmark della validazione di n codici, un quarto dei quali non validi per il formato o per il carattere di
+//controllo: ogni versione valida tutti i codici più volte e ne viene stampato il tempo medio per codice
+void microbenchmark_codici(int n) {
+    char *codici, *scalare, *vettoriale;
+    uint64_t inizio, tempo[2];
+    int k, ripetizione, ripetizioni = 20000000 / n + 1, validi = 0, diversi = 0;
+
+    codici = malloc((size_t)n * COD_SIZE);
+    scalare = malloc(n);
+    vettoriale = malloc(n);
+    if (codici == NULL || scalare == NULL || vettoriale == NULL) {
+        perror("malloc() error");
+        exit(1);
+    }
+    srand(1);
+    for (k = 0; k < n; k++) {
+        codice((uint64_t)rand() * rand(), codici + (size_t)k * COD_SIZE);
+        if (k % 8 == 1) codici[(size_t)k * COD_SIZE + 15] = 'A' + (codici[(size_t)k * COD_SIZE + 15] - 'A' + 1) % 26;
+        if (k % 8 == 5) codici[(size_t)k * COD_SIZE + rand() % 15] = "0A#"[rand() % 3];
+    }
+
+    inizio = adesso_ns();
+    for (ripetizione = 0; ripetizione < ripetizioni; ripetizione++) {
+        for (k = 0; k < n; k++) scalare[k] = codice_valido_scalare(codici + (size_t)k * COD_SIZE);
+        __asm__ volatile("" : : "r"(scalare) : "memory");
+    }
+    tempo[0] = adesso_ns() - inizio;
+    inizio = adesso_ns();
+    for (ripetizione = 0; ripetizione < ripetizioni; ripetizione++) {
+        codice_valida_molti(n, codici, COD_SIZE, vettoriale);
+        __asm__ volatile("" : : "r"(vettoriale) : "memory");
+    }
+    tempo[1] = adesso_ns() - inizio;
+
+    for (k = 0; k < n; k++) {
+        validi += scalare[k];
+        diversi += scalare[k] != vettoriale[k];
+    }
+    if (json) {
+        printf("{\"codici\": %d, \"validi\": %d, \"esiti_diversi\": %d, \"scalare_ns\": %.2f, \"vettoriale_ns\": %.2f}\n", n, validi, diversi,
+               (double)tempo[0] / ripetizioni / n, (double)tempo[1] / ripetizioni / n);
+    } else {
+        printf("%d codici, %d validi, %d validazioni per versione\n", n, validi, ripetizioni * n);
+        printf("%-12s %10.2f ns/codice\n", "scalare", (double)tempo[0] / ripetizioni / n);
+        printf("%-12s %10.2f ns/codice (%.1fx)\n", "vettoriale", (double)tempo[1] / ripetizioni / n, (double)tempo[0] / tempo[1]);
+        printf("esiti diversi: %d\n", diversi);
+    }
+    free(codici);
+    free(scalare);
+    free(vettoriale);
+    if (diversi > 0) exit(1);
+}
+
+//Restituisce 1 se la porta locale è già in ascolto (non può essere occupata con bind), 0 altrimenti. Con SO_REUSEADDR,
+//come nei server, le connessioni chiuse da poco di una prova precedente non occupano la porta
+int porta_occupata(int porta) {
+    struct sockaddr_in addr;
+    int fd, occupata, riuso = 1;
+
+    if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) return 0;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &riuso, sizeof(riuso));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(porta);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    occupata = bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 && errno == EADDRINUSE;
+    close(fd);
+    return occupata;
+}
+
+//Attende che la porta sia in ascolto. Restituisce 0 oppure -1 dopo 10 secondi
+int attendi_porta(int porta) {
+    int i;
+
+    for (i = 0; i < 200; i++) {
+        if (porta_occupata(porta)) return 0;
+        usleep(50000);
+    }
+    return -1;
+}
+
+//Funzione che avvia un server in un nuovo gruppo di processi, con la cartella temporanea come cartella di lavoro e
+//l'output nel file nome.log. Le opzioni sono separate da spazi
+pid_t avvia_server(const char *eseguibili, const char *nome, const char *opzioni) {
+    char percorso[PATH_MAX], log[PATH_MAX], *argv[32], *copia;
+    int argc = 0, fd;
+    pid_t pid;
+
+    snprintf(percorso, sizeof(percorso), "%s/%s", eseguibili, nome);
+    snprintf(log, sizeof(log), "%s/%s.log", cartella, nome);
+    if ((pid = fork()) < 0) {
+        perror("fork() error");
+        exit(1);
+    }
+    if (pid > 0) return pid;
+
+    setpgid(0, 0);
+    if (chdir(cartella) < 0 || (fd = open(log, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0) {
+        perror("avvia_server() error");
+        _exit(1);
+    }
+    dup2(fd, STDOUT_FILENO);
+    dup2(fd, STDERR_FILENO);
+    close(fd);
+
+    argv[argc++] = percorso;
+    if (opzioni != NULL && (copia = strdup(opzioni)) != NULL) {
+        for (argv[argc] = strtok(copia, " "); argv[argc] != NULL && argc < 30; argv[argc] = strtok(NULL, " ")) argc++;
+    }
+    argv[argc] = NULL;
+    execv(percorso, argv);
+    perror("execv() error");
+    _exit(1);
+}
+
+//Funzione che termina i server avviati e rimuove la cartella temporanea
+void termina_server() {
+    char percorso[PATH_MAX];
+    struct dirent *voce;
+    DIR *dir;
+    int i;
+
+    for (i = 2; i >= 0; i--) {
+        if (server[i] <= 0) continue;
+        kill(-server[i], SIGTERM);
+        waitpid(server[i], NULL, 0);
+        server[i] = 0;
+    }
+    if (cartella[0] == 0 || (dir = opendir(cartella)) == NULL) return;
+    while ((voce = readdir(dir)) != NULL) {
+        if (strcmp(voce->d_name, ".") == 0 || strcmp(voce->d_name, "..") == 0) continue;
+        snprintf(percorso, sizeof(percorso), "%s/%s", cartella, voce->d_name);
+        unlink(percorso);
+    }
+    closedir(dir);
+    rmdir(cartella);
+    cartella[0] = 0;
+}
+
+void handler(int sign) {
+    (void)sign;
+    termina_server();
+    exit(1);
+}
+
+void registra_misura(MISURE *m, uint64_t ns, int errore) {
+    uint64_t *campioni;
+
+    if (errore) {
+        m->errori++;
+        return;
+    }
+    if (m->n == m->cap) {
+        m->cap = m->cap ? m->cap * 2 : 4096;
+        if ((campioni = realloc(m->campioni, m->cap * sizeof(uint64_t))) == NULL) {
+            perror("realloc() error");
+            exit(1);
+        }
+        m->campioni = campioni;
+    }
+    m->campioni[m->n++] = ns;
+}
+
+//Thread che registra la parte della popolazione assegnata al client
+void *carica_popolazione(void *arg) {
+    CLIENT *c = arg;
+    uint64_t n;
+
+    for (n = c->primo; n < c->ultimo; n++) {
+        if (registrazione(n) < 0) {
+            fprintf(stderr, "Registrazione del codice %llu non riuscita\n", (unsigned long long)n);
+            termina_server();
+            exit(1);
+        }
+    }
+    return NULL;
+}
+
+//Thread di un client concorrente: fino alla fine della prova sceglie un'operazione secondo i pesi e ne misura la
+//latenza, dalla connessione all'ultima risposta
+void *client(void *arg) {
+    CLIENT *c = arg;
+    struct timespec t;
+    uint64_t inizio, n;
+    int op, r, totale = peso[0] + peso[1] + peso[2], errore;
+
+    for (;;) {
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        if (t.tv_sec > fine_prova.tv_sec || (t.tv_sec == fine_prova.tv_sec && t.tv_nsec >= fine_prova.tv_nsec)) break;
+
+        r = rand_r(&c->seme) % totale;
+        op = r < peso[0] ? REGISTRAZIONE : r < peso[0] + peso[1] ? VERIFICA : MODIFICA;
+        inizio = adesso_ns();
+        if (op == REGISTRAZIONE) {
+            n = __atomic_fetch_add(&prossimo_codice, 1, __ATOMIC_RELAXED);
+            errore = registrazione(n) < 0;
+        } else if (op == VERIFICA) {
+            n = rand_r(&c->seme) % popolazione;
+            errore = verifica(n) != 1;
+        } else {
+            n = rand_r(&c->seme) % popolazione;
+            errore = modifica(n, rand_r(&c->seme) % 2 ? '1' : '0') < 0;
+        }
+        registra_misura(&c->misure[op], adesso_ns() - inizio, errore);
+    }
+    return NULL;
+}
+
+int confronta(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+//Percentile p (fra 0 e 1) dei campioni ordinati, in microsecondi
+double percentile(MISURE *m, double p) {
+    if (m->n == 0) return 0;
+    return m->campioni[(size_t)(p * (m->n - 1))] / 1000.0;
+}
+
+//Funzione che unisce le misure dei client e stampa i risultati come testo o JSON, con il trasporto se non è NULL
+void stampa_risultati(CLIENT *clienti, double secondi, const char *trasporto) {
+    MISURE totale[N_OPERAZIONI];
+    double media;
+    uint64_t somma;
+    size_t k;
+    int op, i;
+
+    for (op = 0; op < N_OPERAZIONI; op++) {
+        memset(&totale[op], 0, sizeof(MISURE));
+        for (i = 0; i < n_client; i++) {
+            for (k = 0; k < clienti[i].misure[op].n; k++) registra_misura(&totale[op], clienti[i].misure[op].campioni[k], 0);
+            totale[op].errori += clienti[i].misure[op].errori;
+        }
+        qsort(totale[op].campioni, totale[op].n, sizeof(uint64_t), confronta);
+    }
+
+    if (json && trasporto != NULL) printf("{\"trasporto\": \"%s\", ", trasporto);
+    else if (json) printf("{");
+    if (json) printf("\"client\": %d, \"durata_s\": %.3f, \"popolazione\": %d, \"operazioni\": {", n_client, secondi, popolazione);
+    else {
+        if (trasporto != NULL) printf("Trasporto %s\n", trasporto);
+        printf("%d client, %.1f secondi, popolazione di %d Green Pass, latenze in microsecondi\n\n", n_client, secondi, popolazione);
+        printf("%-16s %10s %8s %10s %10s %10s %10s %10s %10s\n", "operazione", "richieste", "errori", "op/s", "media", "p50", "p99", "p999", "max");
+    }
+    for (op = 0; op < N_OPERAZIONI; op++) {
+        for (somma = 0, k = 0; k < totale[op].n; k++) somma += totale[op].campioni[k];
+        media = totale[op].n ? somma / 1000.0 / totale[op].n : 0;
+        if (json) {
+            printf("%s\"%s\": {\"richieste\": %zu, \"errori\": %llu, \"op_s\": %.1f, \"media_us\": %.1f, \"p50_us\": %.1f, \"p99_us\": %.1f, \"p999_us\": %.1f, \"max_us\": %.1f}",
+                   op ? ", " : "", nomi[op], totale[op].n, (unsigned long long)totale[op].errori, totale[op].n / secondi, media,
+                   percentile(&totale[op], 0.5), percentile(&totale[op], 0.99), percentile(&totale[op], 0.999), percentile(&totale[op], 1));
+        } else {
+            printf("%-16s %10zu %8llu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n", nomi[op], totale[op].n, (unsigned long long)totale[op].errori,
+                   totale[op].n / secondi, media, percentile(&totale[op], 0.5), percentile(&totale[op], 0.99),
+                   percentile(&totale[op], 0.999), percentile(&totale[op], 1));
+        }
+        free(totale[op].campioni);
+    }
+    if (json) printf("}}\n");
+    else if (trasporto != NULL) printf("\n");
+}
+
+//Funzione che scrive in sv, sg e cv le opzioni dei tre server per il trasporto indicato: con unix e memoria il
+//ServerV ascolta anche sul socket Unix della cartella di lavoro, che ServerG e Centro Vaccinale raggiungono con un
+//cluster di un solo nodo; con memoria il ServerG apre i canali in memoria condivisa
+void prepara_trasporto(const char *trasporto, const char *opzioni_sv, const char *opzioni_sg, const char *opzioni_cv, char *sv, char *sg, char *cv) {
+    char percorso[PATH_MAX];
+    FILE *f;
+
+    snprintf(sv, OPZIONI_MAX, "%s", opzioni_sv ? opzioni_sv : "");
+    snprintf(sg, OPZIONI_MAX, "%s", opzioni_sg ? opzioni_sg : "");
+    snprintf(cv, OPZIONI_MAX, "%s", opzioni_cv ? opzioni_cv : "");
+    if (trasporto == NULL || strcmp(trasporto, "tcp") == 0) return;
+
+    snprintf(percorso, sizeof(percorso), "%s/locale.conf", cartella);
+    if ((f = fopen(percorso, "w")) == NULL) {
+        perror("fopen() error");
+        termina_server();
+        exit(1);
+    }
+    fprintf(f, "sv %s/sv.sock 0\n", cartella);
+    fclose(f);
+    snprintf(sv + strlen(sv), OPZIONI_MAX - strlen(sv), " -u %s/sv.sock", cartella);
+    snprintf(sg + strlen(sg), OPZIONI_MAX - strlen(sg), " -s locale.conf%s", strcmp(trasporto, "memoria") == 0 ? " -m" : "");
+    snprintf(cv + strlen(cv), OPZIONI_MAX - strlen(cv), " -s locale.conf");
+}
+
+//Funzione che esegue una prova completa con il trasporto indicato (NULL per le sole opzioni ricevute): avvia i
+//server se avvia è 1, carica la popolazione, esegue il carico per la durata indicata e ne stampa i risultati
+void esegui_prova(const char *eseguibili, const char *opzioni_sv, const char *opzioni_sg, const char *opzioni_cv, int avvia, const char *trasporto) {
+    char sv[OPZIONI_MAX], sg[OPZIONI_MAX], cv[OPZIONI_MAX];
+    CLIENT *clienti;
+    uint64_t inizio, per_client;
+    int i, op, trovati, tentativi;
+
+    //Avvio dei server in una cartella temporanea, così archivio e WAL partono vuoti
+    if (avvia) {
+        if (porta_occupata(PORTA_CV) || porta_occupata(PORTA_SV) || porta_occupata(PORTA_SG)) {
+            fprintf(stderr, "Le porte %d-%d sono già in uso: terminare i server oppure usare -x\n", PORTA_CV, PORTA_SG);
+            exit(1);
+        }
+        strcpy(cartella, "/tmp/benchmark-XXXXXX");
+        if (mkdtemp(cartella) == NULL) {
+            perror("mkdtemp() error");
+            exit(1);
+        }
+        prepara_trasporto(trasporto, opzioni_sv, opzioni_sg, opzioni_cv, sv, sg, cv);
+        server[0] = avvia_server(eseguibili, "ServerV", sv);
+        if (attendi_porta(PORTA_SV) == 0) server[1] = avvia_server(eseguibili, "ServerG", sg);
+        if (server[1] > 0 && attendi_porta(PORTA_SG) == 0) server[2] = avvia_server(eseguibili, "CentroVaccinale", cv);
+        if (server[2] <= 0 || attendi_porta(PORTA_CV) < 0) {
+            fprintf(stderr, "Avvio dei server non riuscito, vedere i log in %s\n", cartella);
+            cartella[0] = 0;
+            termina_server();
+            exit(1);
+        }
+    }
+
+    if ((clienti = calloc(n_client, sizeof(CLIENT))) == NULL) {
+        perror("calloc() error");
+        exit(1);
+    }
+
+    //Caricamento della popolazione, diviso fra i client. I codici registrati durante la prova seguono la popolazione
+    per_client = (popolazione + n_client - 1) / n_client;
+    for (i = 0; i < n_client; i++) {
+        clienti[i].id = i;
+        clienti[i].seme = 12345 + i;
+        clienti[i].primo = i * per_client < (uint64_t)popolazione ? i * per_client : (uint64_t)popolazione;
+        clienti[i].ultimo = (i + 1) * per_client < (uint64_t)popolazione ? (i + 1) * per_client : (uint64_t)popolazione;
+        if (pthread_create(&clienti[i].tid, NULL, carica_popolazione, &clienti[i]) != 0) {
+            perror("pthread_create() error");
+            exit(1);
+        }
+    }
+    for (i = 0; i < n_client; i++) pthread_join(clienti[i].tid, NULL);
+    prossimo_codice = popolazione;
+
+    //L'ack del Centro Vaccinale precede l'invio del Green Pass al ServerV: si attende che l'ultimo codice di ogni
+    //client sia verificabile
+    for (tentativi = 0; tentativi < 100; tentativi++) {
+        for (trovati = 0, i = 0; i < n_client; i++) trovati += clienti[i].primo == clienti[i].ultimo || verifica(clienti[i].ultimo - 1) == 1;
+        if (trovati == n_client) break;
+        usleep(100000);
+    }
+    if (tentativi == 100) {
+        fprintf(stderr, "I Green Pass registrati non sono verificabili\n");
+        termina_server();
+        exit(1);
+    }
+
+    //Prova
+    clock_gettime(CLOCK_MONOTONIC, &fine_prova);
+    fine_prova.tv_sec += durata;
+    inizio = adesso_ns();
+    for (i = 0; i < n_client; i++) {
+        if (pthread_create(&clienti[i].tid, NULL, client, &clienti[i]) != 0) {
+            perror("pthread_create() error");
+            exit(1);
+        }
+    }
+    for (i = 0; i < n_client; i++) pthread_join(clienti[i].tid, NULL);
+
+    stampa_risultati(clienti, (adesso_ns() - inizio) / 1e9, trasporto);
+    for (i = 0; i < n_client; i++) for (op = 0; op < N_OPERAZIONI; op++) free(clienti[i].misure[op].campioni);
+    free(clienti);
+    termina_server();
+}
+
+int main(int argc, char **argv) {
+    char eseguibili[PATH_MAX] = ".", *opzioni_sv = NULL, *opzioni_sg = NULL, *opzioni_cv = NULL;
+    char *trasporti = NULL, *trasporto, *copia = NULL;
+    int opt, avvia = 1, micro = 0;
+
+    //Opzioni: -c client concorrenti, -t durata della prova in secondi, -n Green Pass registrati prima della prova,
+    //-m pesi registrazione:verifica:modifica, -d cartella degli eseguibili dei server, -V -G -C opzioni di ServerV,
+    //ServerG e Centro Vaccinale, -x usa i server già in esecuzione invece di avviarli, -j risultati in JSON,
+    //-k microbenchmark della validazione con il numero di codici indicato,
+    //-T trasporti da confrontare separati da virgole (tcp, unix, memoria)
+    while ((opt = getopt(argc, argv, "c:t:n:m:d:V:G:C:xjk:T:")) != -1) {
+        if (opt == 'c') n_client = atoi(optarg);
+        else if (opt == 't') durata = atoi(optarg);
+        else if (opt == 'n') popolazione = atoi(optarg);
+        else if (opt == 'm' && sscanf(optarg, "%d:%d:%d", &peso[0], &peso[1], &peso[2]) == 3) continue;
+        else if (opt == 'd' && realpath(optarg, eseguibili) != NULL) continue;
+        else if (opt == 'V') opzioni_sv = optarg;
+        else if (opt == 'G') opzioni_sg = optarg;
+        else if (opt == 'C') opzioni_cv = optarg;
+        else if (opt == 'x') avvia = 0;
+        else if (opt == 'j') json = 1;
+        else if (opt == 'k') micro = atoi(optarg);
+        else if (opt == 'T') trasporti = optarg;
+        else {
+            fprintf(stderr, "usage: %s [-c client] [-t secondi] [-n popolazione] [-m registrazioni:verifiche:modifiche] [-d cartella eseguibili] [-V opzioni ServerV] [-G opzioni ServerG] [-C opzioni Centro Vaccinale] [-x] [-j] [-k codici] [-T tcp,unix,memoria]\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (micro > 0) {
+        microbenchmark_codici(micro);
+        return 0;
+    }
+    if (n_client < 1 || durata < 1 || popolazione < 1 || peso[0] < 0 || peso[1] < 0 || peso[2] < 0 || peso[0] + peso[1] + peso[2] == 0) {
+        fprintf(stderr, "Parametri non validi\n");
+        exit(1);
+    }
+    if (trasporti != NULL && (!avvia || (copia = strdup(trasporti)) == NULL)) {
+        fprintf(stderr, "-T richiede che i server siano avviati dal benchmark\n");
+        exit(1);
+    }
+    for (trasporto = trasporti ? strtok(copia, ",") : NULL; trasporto != NULL; trasporto = strtok(NULL, ",")) {
+        if (strcmp(trasporto, "tcp") != 0 && strcmp(trasporto, "unix") != 0 && strcmp(trasporto, "memoria") != 0) {
+            fprintf(stderr, "Trasporto non valido: %s (tcp, unix, memoria)\n", trasporto);
+            exit(1);
+        }
+    }
+    if (strcmp(eseguibili, ".") == 0 && getcwd(eseguibili, sizeof(eseguibili)) == NULL) {
+        perror("getcwd() error");
+        exit(1);
+    }
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, handler);
+
+    //Con -T una prova per ogni trasporto, con le stesse opzioni
+    if (trasporti == NULL) esegui_prova(eseguibili, opzioni_sv, opzioni_sg, opzioni_cv, avvia, NULL);
+    for (trasporto = trasporti ? strtok(trasporti, ",") : NULL; trasporto != NULL; trasporto = strtok(NULL, ",")) {
+        esegui_prova(eseguibili, opzioni_sv, opzioni_sg ? opzioni_sg : TRASPORTI_POOL, opzioni_cv, avvia, trasporto);
+    }
+    exit(0);
+}
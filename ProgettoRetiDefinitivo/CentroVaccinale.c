@@ -9,9 +9,23 @@
 #include <arpa/inet.h>  // contiene le definizioni per le operazioni Internet
 #include <time.h>
 #include <signal.h>     //contiene le costanti per la gestione dei segnali fra processi
+#include "greenpass.h"  //record del Green Pass condiviso con il ServerV
+#include "codice.h"     //validazione del codice fiscale della tessera sanitaria
+#include "protocollo.h" //protocollo a frame usato per inviare i Green Pass al ServerV
+#include "coda.h"       //coda durevole dei Green Pass da inviare al ServerV
+#include "registrazione.h" //messaggi della registrazione scambiati con l'Utente
+#include "anello.h"     //cluster di ServerV ed assegnazione dei codici con hashing consistente
+#include "rete.h"       //lettura e scrittura bufferizzate dei messaggi a campi
+#include <pthread.h>
+#include <sys/time.h>
 #define BUFF_MAX_SIZE 1024      //dimensione massima del buffer
 #define COD_SIZE 17      //16 byte per il codice della tessera sanitaria e 1 byte per il carattere terminatore
 #define ACK_SIZE 64 	//dimesione dell'ACK inviato all'Utente dal Centro Vaccinale
+#define MESI_VALIDITA 4  //mesi di validità del Green Pass
+#define CODA_LOTTO 256          //Green Pass inviati al ServerV in ogni gruppo
+#define CODA_PAUSA_MIN 100      //millisecondi di attesa prima di ritentare la connessione al ServerV
+#define CODA_PAUSA_MAX 8000     //attesa massima fra due tentativi
+#define CODA_TIMEOUT 10         //secondi di attesa massima delle conferme del ServerV
 
 //Struct del pacchetto che il Centro Vaccinale deve ricevere dall'Utente
 typedef struct {
@@ -20,54 +34,9 @@ typedef struct {
     char cod_fisc[COD_SIZE];
 } VACCINAZIONE;
 
-//Struct che permette di salvare una data
-typedef struct {
-    int giorno;
-    int mese;
-    int anno;
-} DATE;
-
-//Struct del pacchetto inviato dal Centro Vaccinale al ServerV 
-typedef struct {
-    char cod_fisc[COD_SIZE];
-    DATE data_inizio;	//data di inizio validità del Green Pass
-    DATE data_fine;		//data di fine validità del Green Pass
-} GP;
-
-//Legge esattamente count byte s iterando opportunamente le letture
-ssize_t full_read(int fd, void *buffer, size_t count) {
-    size_t n_left;
-    ssize_t n_read;
-    n_left = count;
-    while (n_left > 0) {  // ciclo ripetuto fintanto che non vengono letti tutti i bytes
-        if ((n_read = read(fd, buffer, n_left)) < 0) {
-            if (errno == EINTR) continue; // errno=codice di errore dell'ultima System Call
-            else exit(n_read);
-        } else if (n_read == 0) break; // se sono 0 si chiude il descrittore,si esce dal ciclo e viene restituito n_left
-        n_left -= n_read;
-        buffer += n_read;
-    }
-    buffer = 0;
-    return n_left;
-}
-
-
-//Scrive esattamente count byte s iterando opportunamente le scritture
-ssize_t full_write(int fd, const void *buffer, size_t count) {
-    size_t n_left;
-    ssize_t n_written;
-    n_left = count;
-    while (n_left > 0) {          // ciclo ripetuto fintanto che non vengono scritti tutti i bytes
-        if ((n_written = write(fd, buffer, n_left)) < 0) {
-            if (errno == EINTR) continue; //errno=codice di errore dell'ultima System Call
-            else exit(n_written);	 //Se non è una System Call, esci con un errore
-        }
-        n_left -= n_written;
-        buffer += n_written;
-    }
-    buffer = 0;
-    return n_left;
-}
+CODA coda;      //Green Pass emessi e non ancora confermati dal ServerV
+ANELLO anello;  //ServerV del cluster e assegnazione dei codici
+int sock_sv[ANELLO_MAX_NODI]; //connessioni persistenti del thread di invio con ogni ServerV, -1 se da ristabilire
 
 //Handler che cattura il segnale CTRL-C e stampa un messaggio di arrivederci.
 void handler (int sign){
@@ -80,136 +49,229 @@ void handler (int sign){
     }
 }
 
-//Funzione per il calcolo della data di scadenza e della data di inizio validità del Green Pass
-
-void creazione_df(DATE *data_fine) {
-    time_t ticks;   //struttura per la gestione della data
-    ticks = time(NULL); //Estrapoliamo l'ora esatta della macchina e lo assegniamo alla variabile
+//Funzione per il calcolo della data di inizio validità del Green Pass, cioè il giorno in cui il certificato viene
+//emesso, e della data di scadenza MESI_VALIDITA mesi dopo. Il giorno corrente viene letto dal valore aggiornato da
+//data_avvia, senza chiamare localtime ad ogni richiesta
+void creazione_date(GP *greenP) {
+    int32_t oggi = data_oggi();
+    int giorno, mese, anno;
 
-    //Dichiarazione strutture per la conversione della data da stringa ad intero
-    struct tm *data_f = localtime(&ticks);
-    data_f->tm_mon += 5;           //Sommiamo 5 perchè i mesi vanno da 0 ad 11 (cioè 4 mesi di scadenza)
-    data_f->tm_year += 1900;       //Sommiamo 1900 perchè gli anni partono dal 122 (2022 - 1900)
+    greenP->inizio = gp_giorno_limitato(oggi);
+    greenP->fine = gp_giorno_limitato(data_piu_mesi(oggi, MESI_VALIDITA));
 
-    //Effettuiamo il controllo nel caso in cui il vaccino sia stato fatto nel mese di settembre, ottobre, novembre o dicembre, comportando un aumento dell'anno
-    if (data_f->tm_mon == 13) { //se 13 è settembre si incrementano 4 mesi, arrivando a gennaio dell'anno successivo
-        data_f->tm_mon = 1;
-        data_f->tm_year++;
-    }
-    if (data_f->tm_mon == 14) { //se 14 è ottobre si incrementano 4 mesi, arrivando a febbraio dell'anno successivo
-        data_f->tm_mon = 2;
-        data_f->tm_year++;
-    }
-    if (data_f->tm_mon == 15) { //if 15 è novembre quindi si incrementano 4 mesi, arrivando a marzo dell'anno successivo
-        data_f->tm_mon = 3;
-        data_f->tm_year++;
-    }
-    if (data_f->tm_mon == 16) { //if 16 è dicembre quindi si incrementano 4 mesi, arrivando a aprile dell'anno successivo
-        data_f->tm_mon = 4;
-        data_f->tm_year++;
-    }
+    data_da_giorni(greenP->inizio, &giorno, &mese, &anno);
+    printf("La data di inizio validità del green pass e': %02d:%02d:%02d\n", giorno, mese, anno);
+    data_da_giorni(greenP->fine, &giorno, &mese, &anno);
+    printf("La data di fine validità del Green Pass e': %02d:%02d:%02d\n", giorno, mese, anno);
+}
 
-    printf("La data di fine validità del Green Pass e': %02d:%02d:%02d\n", data_f->tm_mday, data_f->tm_mon, data_f->tm_year);
 
-    //Assegnamo i valori ai parametri di ritorno
-    data_fine->giorno = data_f->tm_mday ;
-    data_fine->mese = data_f->tm_mon;
-    data_fine->anno = data_f->tm_year;
+//Funzione che apre la connessione persistente con il ServerV s del cluster usata dal thread di invio, con il protocollo
+//a frame. Restituisce il descrittore del socket oppure -1 se il ServerV non è raggiungibile
+int connessione_sv(int s) {
+    int sock_fd;
+    struct timeval attesa = {CODA_TIMEOUT, 0};
+    const struct sockaddr *indirizzo;
+    socklen_t len;
+    char bit = '2';
+
+    indirizzo = anello_indirizzo(&anello, s, &len);
+    if ((sock_fd = anello_socket(&anello, s)) < 0) return -1;
+
+    //Un ServerV bloccato fa scadere le letture e le scritture, e la connessione viene ristabilita
+    setsockopt(sock_fd, SOL_SOCKET, SO_RCVTIMEO, &attesa, sizeof(attesa));
+    setsockopt(sock_fd, SOL_SOCKET, SO_SNDTIMEO, &attesa, sizeof(attesa));
+    if (connect(sock_fd, indirizzo, len) < 0 ||
+        send(sock_fd, &bit, sizeof(char), MSG_NOSIGNAL) != sizeof(char)) {
+        close(sock_fd);
+        return -1;
+    }
+    return sock_fd;
 }
 
-//Funzione per calcolare la data di inizio validità del GP, cioè la data esatta in cui il certificato viene emesso
-void creazione_di(DATE *data_inizio) {
-    time_t ticks;
-    ticks = time(NULL);
+//Funzione che invia i frame di b sulla connessione con il ServerV s e ne riceve le conferme, attese in tutto,
+//segnandole in confermati. Restituisce 0 oppure -1 se la connessione si è interrotta
+int conferme_sv(int s, BUFFER *b, int attese, int n, const GP *greenP, char *confermati) {
+    const char *dati;
+    char cod_fisc[GP_CARATTERI + 1];
+    int64_t k;
+    ssize_t letti;
+    uint8_t op;
+    uint32_t id, len;
+
+    if (rete_invia_dati(sock_sv[s], b->dati, b->len) < 0) return -1;
+
+    b->len = 0;
+    while (attese > 0) {
+        while ((k = proto_estrai_frame(b->dati, b->len, &op, &id, &dati, &len, NULL)) > 0) {
+            if (id < (uint32_t)n && !confermati[id]) {
+                if (op == OP_ERRORE) {
+                    gp_decodifica(cod_fisc, greenP[id].codice);
+                    printf("Green Pass di %s rifiutato dal ServerV %s\n", cod_fisc, anello.nodi[s].nome);
+                    fflush(stdout);
+                }
+                confermati[id] = op == OP_ERRORE || (op == (OP_INSERISCI | OP_RISPOSTA) && len == 1 && dati[0] == '0');
+                attese -= confermati[id];
+            }
+            buffer_scarta(b, k);
+        }
+        if (k < 0 || buffer_riserva(b, b->len + 1 + n * (PROTO_TESTA + 1)) < 0) return -1;
+        if (attese == 0) break;
+        if ((letti = recv(sock_sv[s], b->dati + b->len, b->cap - b->len, 0)) < 0 && errno == EINTR) continue;
+        if (letti <= 0) return -1;
+        b->len += letti;
+    }
+    return 0;
+}
 
-    //Dichiarazione strutture per la conversione della data da stringa ad intero
-    struct tm *data_i = localtime(&ticks);
-    data_i->tm_mon += 1;           //Sommiamo 1 perchè i mesi vanno da 0 ad 11
-    data_i->tm_year += 1900;       //Sommiamo 1900 perchè gli anni partono dal 122 (2022 - 1900)
+//Funzione che invia n Green Pass della coda, ciascuno al ServerV del cluster a cui appartiene il suo codice, con un
+//frame OP_INSERISCI con id uguale alla posizione nel gruppo, e ne attende le conferme, che arrivano quando il Green Pass
+//è durevole nel WAL del ServerV e possono arrivare in un ordine diverso. Tutti i ServerV ricevono le loro richieste
+//prima che vengano attese le conferme. Un Green Pass rifiutato (OP_ERRORE) viene scartato, perché non verrebbe mai
+//accettato. Le connessioni interrotte vengono chiuse, ed in guasto viene salvato l'ultimo ServerV non raggiungibile.
+//Restituisce quanti Green Pass, a partire dal primo, sono confermati: meno di n se una connessione si è interrotta
+int invio_gruppo(int n, const GP *greenP, char *confermati, int *guasto) {
+    BUFFER frame[ANELLO_MAX_NODI];
+    char cod_fisc[GP_CARATTERI + 1];
+    int attese[ANELLO_MAX_NODI], i, s;
+
+    memset(frame, 0, sizeof(frame));
+    memset(attese, 0, sizeof(attese));
+    memset(confermati, 0, n);
+    for (i = 0; i < n; i++) {
+        gp_decodifica(cod_fisc, greenP[i].codice);
+        s = anello_nodo(&anello, cod_fisc);
+        if (proto_aggiungi_frame(&frame[s], OP_INSERISCI, i, &greenP[i], sizeof(GP)) < 0) break;
+        attese[s]++;
+    }
 
-    printf("La data di inizio validità del green pass e': %02d:%02d:%02d\n", data_i->tm_mday, data_i->tm_mon, data_i->tm_year);
+    for (s = 0; s < anello.n; s++) {
+        if (attese[s] == 0) continue;
+        if (sock_sv[s] < 0) sock_sv[s] = connessione_sv(s);
+        if (sock_sv[s] >= 0 && conferme_sv(s, &frame[s], attese[s], n, greenP, confermati) == 0) continue;
+        if (sock_sv[s] >= 0) close(sock_sv[s]);
+        sock_sv[s] = -1;
+        *guasto = s;
+    }
+    for (s = 0; s < anello.n; s++) buffer_libera(&frame[s]);
 
-    //Assegnamo i valori ai parametri di ritorno
-    data_inizio->giorno = data_i->tm_mday ;
-    data_inizio->mese = data_i->tm_mon;
-    data_inizio->anno = data_i->tm_year;
+    for (i = 0; i < n && confermati[i]; i++);
+    return i;
 }
 
+//Thread che invia ai ServerV i Green Pass della coda, a gruppi di al massimo CODA_LOTTO, su una connessione persistente
+//per ogni ServerV del cluster: i Green Pass aggiunti mentre un gruppo attende le conferme partono con il gruppo
+//successivo. La coda avanza solo fino al primo Green Pass non confermato: se un ServerV non è raggiungibile, o la
+//connessione si interrompe, i Green Pass restano nella coda e le connessioni vengono ristabilite con un'attesa
+//crescente fino a CODA_PAUSA_MAX millisecondi; quelli già confermati da altri ServerV vengono inviati di nuovo, senza
+//effetti perché l'inserimento sostituisce il Green Pass con lo stesso codice
+void *invio_coda(void *arg) {
+    GP greenP[CODA_LOTTO];
+    char confermati[CODA_LOTTO];
+    int64_t attesa;
+    int n, pausa = CODA_PAUSA_MIN, avvisato = 0, guasto;
+    (void)arg;
 
-//Funzione che invia al ServerV un Green Pass con data inizio e fine validità ed infine il codice fiscale della tessera sanitaria
-void invio_GP(GP greenP) {
-    int sock_fd;
-    struct sockaddr_in serveraddr;
-    char bit, buffer[BUFF_MAX_SIZE];
-
-    bit = '1'; //Inizializzazione del bit a 1 da inviare al ServerV
-
-    //Creazione del descrittore del socket
-    if ((sock_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-        perror("socket() error");
-        exit(1);
-    }
+    for (;;) {
+        if ((attesa = coda_in_attesa(&coda)) <= 0) {
+            coda_attendi(&coda, 1000);
+            continue;
+        }
 
-    
-    serveraddr.sin_family = AF_INET;
-    serveraddr.sin_port = htons(1025); //porta
+        n = attesa < CODA_LOTTO ? attesa : CODA_LOTTO;
+        if (coda_leggi(&coda, n, greenP) < 0) {
+            perror("coda_leggi() error");
+            exit(1);
+        }
+        guasto = -1;
+        if ((attesa = invio_gruppo(n, greenP, confermati, &guasto)) > 0 && coda_conferma(&coda, attesa) < 0) {
+            perror("coda_conferma() error");
+            exit(1);
+        }
+        if (attesa == n) {
+            if (avvisato) printf("ServerV di nuovo raggiungibili: Green Pass in coda inviati\n");
+            fflush(stdout);
+            avvisato = 0;
+            pausa = CODA_PAUSA_MIN;
+            continue;
+        }
 
-	//Conversione dell'indirizzo IP in un indirizzo di rete scritto in network order
-    if (inet_pton(AF_INET, "127.0.0.1", &serveraddr.sin_addr) <= 0) {
-        perror("inet_pton() error");
-        exit(1);
+        if (!avvisato && guasto >= 0) printf("ServerV %s (%s:%d) non raggiungibile: %lld Green Pass in coda\n", anello.nodi[guasto].nome,
+                                            anello.nodi[guasto].host, anello.nodi[guasto].porta, (long long)coda_in_attesa(&coda));
+        fflush(stdout);
+        avvisato = 1;
+        usleep(pausa * 1000);
+        pausa = pausa * 2 < CODA_PAUSA_MAX ? pausa * 2 : CODA_PAUSA_MAX;
     }
+    return NULL;
+}
 
-    // Connessione con il server
-    if (connect(sock_fd, (struct sockaddr *)&serveraddr, sizeof(serveraddr)) < 0) {
-        perror("connect() error");
-        exit(1);
-    }
+//Funzione che invia all'Utente l'ack con il testo indicato, nel formato della versione del protocollo usata dall'Utente
+void invio_ack(RETE *r, int versione, const char *testo) {
+    char buffer[BUFF_MAX_SIZE];
+    size_t len;
 
-    //Invia un bit di valore 1 al ServerV per notificare che la comunicazione deve avvenire con il Centro Vaccinale
-    if (full_write(sock_fd, &bit, sizeof(char)) < 0) {
-        perror("full_write() error");
-        exit(1);
+    if (versione >= 2) len = reg_ack(buffer, testo);
+    else {
+        memset(buffer, 0, ACK_SIZE);
+        snprintf(buffer, ACK_SIZE, "%s", testo);
+        len = ACK_SIZE;
     }
+    if(rete_scrivi(r, buffer, len) < 0 || rete_invia(r) < 0) perror("rete_scrivi() error");
+}
 
-    //Invo del Green Pass al ServerV
-    if (full_write(sock_fd, &greenP, sizeof(greenP)) < 0) {
-        perror("full_write() error");
-        exit(1);
+//Funzione che riceve la registrazione dell'Utente, compatta oppure come pacchetto VACCINAZIONE, riconoscendo il formato
+//dal primo byte. Restituisce la versione del protocollo usata dall'Utente, oppure -1 se la registrazione non è valida o
+//la connessione è stata chiusa
+int ricezione_registrazione(RETE *r, VACCINAZIONE *pacchetto) {
+    char testa[REG_TESTA];
+    size_t len_nome, len_cognome;
+    int versione;
+
+    if (rete_leggi(r, testa, sizeof(char)) != 0) return -1;
+
+    //Pacchetto VACCINAZIONE di un Utente della versione 1: il primo byte è quello del nome
+    if ((versione = reg_versione(testa[0])) == 1) {
+        pacchetto->nome[0] = testa[0];
+        if (rete_leggi(r, (char *)pacchetto + 1, sizeof(VACCINAZIONE) - 1) != 0) return -1;
+        pacchetto->nome[BUFF_MAX_SIZE - 1] = pacchetto->cognome[BUFF_MAX_SIZE - 1] = 0;
+        return 1;
     }
 
-    close(sock_fd);
+    //Registrazione compatta: nome e cognome vengono copiati nel pacchetto con il terminatore
+    if (versione < 2 || versione > REG_VERSIONE || rete_leggi(r, testa + 1, REG_TESTA - 1) != 0 ||
+        reg_lunghezze(testa, &len_nome, &len_cognome) < 0 ||
+        rete_leggi(r, pacchetto->nome, len_nome) != 0 || rete_leggi(r, pacchetto->cognome, len_cognome) != 0) return -1;
+    pacchetto->nome[len_nome] = 0;
+    pacchetto->cognome[len_cognome] = 0;
+    memcpy(pacchetto->cod_fisc, testa + REG_TESTA - REG_CODICE, REG_CODICE);
+    pacchetto->cod_fisc[COD_SIZE - 1] = 0;
+    return versione;
 }
 
     //Funzione per la gestione della comunicazione con l'Utente
 void risposta_utente(int connectfd) {
     char buffer[BUFF_MAX_SIZE];
-    int benvenuto, dim_pacchetto;
+    int versione;
+    size_t benvenuto;
     VACCINAZIONE pacchetto;
     GP greenP;
-
-    
-
-    //Stampa del messaggo di benvenuto da inviare all'Utente quando si collega al Centro Vaccinale
-    snprintf(buffer, BUFF_MAX_SIZE, "--- Benvenuto nel centro vaccinale --- \nImmettere nome, cognome e codice fiscale della tessera sanitaria per inserirli sulla piattaforma.\n");
-    benvenuto = sizeof(buffer);
-   
- //Invio dei bytes di scrittura del buffer
-    if(full_write(connectfd, &benvenuto, sizeof(int)) < 0) {
-        perror("full_write() error");
-        exit(1);
-    }
-    
-//Invio del benvenuto
-    if(full_write(connectfd, buffer, benvenuto) < 0) {
-        perror("full_write() error");
-        exit(1);
+    RETE r;
+
+    //Messaggio di benvenuto da inviare all'Utente quando si collega al Centro Vaccinale, preceduto dalla sua lunghezza
+    //e seguito dalla versione del protocollo, con un'unica scrittura
+    benvenuto = reg_benvenuto(buffer, "--- Benvenuto nel centro vaccinale --- \nImmettere nome, cognome e codice fiscale della tessera sanitaria per inserirli sulla piattaforma.\n");
+    rete_inizia(&r, connectfd);
+    if(rete_scrivi(&r, buffer, benvenuto) < 0) {
+        perror("rete_scrivi() error");
+        close(connectfd);
+        return;
     }
 
     //Riceziome delle informazioni per il Green Pass inviate dall'Utente
-    if(full_read(connectfd, &pacchetto, sizeof(VACCINAZIONE)) < 0) {
-        perror("full_read() error");
-        exit(1);
+    if ((versione = ricezione_registrazione(&r, &pacchetto)) < 0) {
+        close(connectfd);
+        return;
     }
 
     printf("\nI dati ricevuti sono:\n");
@@ -217,34 +279,81 @@ void risposta_utente(int connectfd) {
     printf("Cognome: %s\n", pacchetto.cognome);
     printf("Codice Fiscale Tessera Sanitaria: %s\n\n", pacchetto.cod_fisc);
 
-   //Notifica della corretta ricezione dei dati inviati all'Utente
-    snprintf(buffer, ACK_SIZE, "Inserimento dei dati avvenuto con successo");
-    if(full_write(connectfd, buffer, ACK_SIZE) < 0) {
-        perror("full_write() error");
-        exit(1);
+    //Compressione del codice fiscale della tessera sanitaria inviato dall'Utente nel Green Pass da inviare al ServerV:
+    //un codice fiscale non valido (formato o carattere di controllo) viene rifiutato
+    pacchetto.cod_fisc[COD_SIZE - 1] = 0;
+    if (!codice_valido(pacchetto.cod_fisc) || gp_codifica(greenP.codice, pacchetto.cod_fisc) < 0) {
+        invio_ack(&r, versione, "Codice fiscale della tessera sanitaria non valido");
+        close(connectfd);
+        return;
     }
 
-    //Copia del codice fiscale della tessera sanitaria inviato dall'Utente nel Green Pass da inviare al ServerV
-    strcpy(greenP.cod_fisc, pacchetto.cod_fisc);
-   
- //Si ottiene la data di inizo validità del Green Pass
-    creazione_di(&greenP.data_inizio);
+    //Date di inizio e fine validità (4 mesi), salvate nel Green Pass come giorni dal 1 gennaio 1970
+    creazione_date(&greenP);
+    greenP.flags = GP_VALIDO;
+    greenP.versione = GP_VERSIONE;
 
-    //Creazione della data di scadenza (4 mesi)
-    creazione_df(&greenP.data_fine);
+    //Il nuovo Green Pass viene salvato nella coda, da cui il thread di invio lo trasmette al ServerV: la registrazione
+    //viene confermata all'Utente quando è durevole, senza attendere il ServerV
+    if (coda_accoda(&coda, &greenP) < 0) {
+        perror("coda_accoda() error");
+        invio_ack(&r, versione, "Registrazione non riuscita, riprovare");
+    } else invio_ack(&r, versione, "Inserimento dei dati avvenuto con successo");
 
     close(connectfd);
-
-    //Invio del nuovo Green Pass al CentroVaccinale
-    invio_GP(greenP);
 }
 
-int main(int argc, char const *argv[]) {
-    int listenfd, connectfd;
+int main(int argc, char *argv[]) {
+    int listenfd, connectfd, opzione, riuso = 1;
     VACCINAZIONE pacchetto;
     struct sockaddr_in servaddr;
     pid_t pid;
+    pthread_t tid;
+    char *file_coda = "greenpass.coda", *file_anello = NULL;
+    int64_t in_attesa;
     signal(SIGINT,handler); //Cattura il segnale CTRL-C
+
+    while ((opzione = getopt(argc, argv, "q:s:")) != -1) {
+        switch (opzione) {
+        case 'q':
+            file_coda = optarg;
+            break;
+        case 's':
+            file_anello = optarg;
+            break;
+        default:
+            fprintf(stderr, "Uso: %s [-q coda] [-s cluster]\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    //ServerV a cui inviare i Green Pass di ogni codice: quelli del file di configurazione del cluster (anello.h),
+    //altrimenti il solo ServerV 127.0.0.1:1025
+    if ((file_anello ? anello_carica(&anello, file_anello) : anello_singolo(&anello, "127.0.0.1", 1025)) < 0) {
+        perror("anello_carica() error");
+        exit(1);
+    }
+    for (opzione = 0; opzione < ANELLO_MAX_NODI; opzione++) sock_sv[opzione] = -1;
+
+    //Apertura della coda dei Green Pass da inviare al ServerV: quelli non confermati prima di un'interruzione vengono
+    //inviati di nuovo
+    if ((in_attesa = coda_apri(&coda, file_coda)) < 0) {
+        perror("coda_apri() error");
+        exit(1);
+    }
+    if (in_attesa > 0) printf("%lld Green Pass in coda da inviare al ServerV\n", (long long)in_attesa);
+    fflush(stdout);
+    if (pthread_create(&tid, NULL, invio_coda, NULL) != 0) {
+        perror("pthread_create() error");
+        exit(1);
+    }
+    pthread_detach(tid);
+
+    //Avvio dell'aggiornamento del giorno corrente, condiviso con i processi figli
+    if (data_avvia() < 0) {
+        perror("data_avvia() error");
+        exit(1);
+    }
     
 //Creazione descrizione del socket
     if ((listenfd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
@@ -257,6 +366,13 @@ int main(int argc, char const *argv[]) {
     servaddr.sin_addr.s_addr = htonl(INADDR_ANY);
     servaddr.sin_port = htons(1024);
 
+    //Permette di riavviare subito il Centro Vaccinale, ad esempio per inviare i Green Pass rimasti nella coda, anche se
+    //restano connessioni chiuse da poco sulla porta
+    if (setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &riuso, sizeof(riuso)) < 0) {
+        perror("setsockopt() error");
+        exit(1);
+    }
+
     //Assegnazione della porta al server
     if (bind(listenfd, (struct sockaddr *)&servaddr, sizeof(servaddr)) < 0) {
         perror("bind() error");
@@ -7,56 +7,94 @@
 #include <sys/types.h>
 #include <sys/socket.h> //contiene le definizioni dei socket
 #include <arpa/inet.h>  // contiene le definizioni per le operazioni Internet
+#include <stdint.h>
+#include "rete.h"       //lettura e scrittura bufferizzate dei messaggi a campi
 #define BUFF_MAX_SIZE 1024   //dimensione massima del buffer
 #define ACK_SIZE_SG 64     //dimensione dell'ack ricevuto dal ServerG
 #define BENVENUTO 108 //dimensione del messaggio di benvenuto 
 #define ACK_SIZE_CS 60       //dimensione dell'ack ricevuto dal ClientS
 #define COD_SIZE 17 //16 byte per il codice della tessera sanitaria e 1 byte per il carattere terminatore
+#define BATCH_MAX 1024  //codici che il ServerG accetta in un'unica richiesta di verifica
 
 
-//Legge esattamente count byte s iterando opportunamente le letture
-ssize_t full_read(int fd, void *buffer, size_t count) {
-    size_t n_left;
-    ssize_t n_read;
-    n_left = count;
-    while (n_left > 0) {  // ciclo ripetuto fintanto che non vengono letti tutti i bytes
-        if ((n_read = read(fd, buffer, n_left)) < 0) {
-            if (errno == EINTR) continue; // errno=codice di errore dell'ultima System Call
-            else exit(n_read);
-        } else if (n_read == 0) break; // se sono 0 si chiude il descrittore,si esce dal ciclo e viene restituito n_left
-        n_left -= n_read;
-        buffer += n_read;
-    }
-    buffer = 0;
-    return n_left;
+//Funzione che restituisce il messaggio corrispondente all'esito della verifica di un codice
+const char *messaggio_esito(char esito) {
+    if (esito == '1') return "Il Green Pass è valido";
+    if (esito == '0') return "Il Green Pass non è valido";
+    if (esito == '2') return "Il codice fiscale della tessera sanitaria è inesistente";
+    if (esito == 'F') return "Codice fiscale della tessera sanitaria non valido";
+    return "Servizio di verifica non disponibile, riprovare";
 }
 
+//Funzione che invia al ServerG n codici con un'unica richiesta e stampa l'esito di ciascuno
+void invia_batch(RETE *r, char (*codici)[COD_SIZE], uint32_t n) {
+    char esiti[BATCH_MAX];
+    uint32_t k, n_rete = htonl(n);
 
-//Scrive esattamente count byte s iterando opportunamente le scritture
-ssize_t full_write(int fd, const void *buffer, size_t count) {
-    size_t n_left;
-    ssize_t n_written;
-    n_left = count;
-    while (n_left > 0) {          // ciclo ripetuto fintanto che non vengono scritti tutti i bytes
-        if ((n_written = write(fd, buffer, n_left)) < 0) {
-            if (errno == EINTR) continue; //errno=codice di errore dell'ultima System Call
-            else exit(n_written); //Se non è una System Call, esci con un errore
-        }
-        n_left -= n_written;
-        buffer += n_written;
+    if (rete_scrivi(r, &n_rete, sizeof(uint32_t)) < 0 || rete_scrivi(r, codici, n * COD_SIZE) < 0) {
+        perror("rete_scrivi() error");
+        exit(1);
     }
-    buffer = 0;
-    return n_left;
+    if (rete_leggi(r, esiti, n) != 0) {
+        perror("rete_leggi() error");
+        exit(1);
+    }
+    for (k = 0; k < n; k++) printf("%s: %s\n", codici[k], messaggio_esito(esiti[k]));
 }
 
+//Funzione della modalità non interattiva: legge un codice per riga da input e li verifica a gruppi di per_richiesta
+void verifica_batch(RETE *r, FILE *input, uint32_t per_richiesta) {
+    char (*codici)[COD_SIZE], riga[BUFF_MAX_SIZE];
+    uint32_t n = 0;
+    size_t len;
 
+    if ((codici = malloc(per_richiesta * COD_SIZE)) == NULL) {
+        perror("malloc() error");
+        exit(1);
+    }
+    while (fgets(riga, BUFF_MAX_SIZE, input) != NULL) {
+        len = strcspn(riga, "\r\n");
+        riga[len] = 0;
+        if (len == 0) continue;
+        if (len != COD_SIZE - 1) {
+            printf("%s: Numero caratteri non corretto!\n", riga);
+            continue;
+        }
+        memcpy(codici[n++], riga, COD_SIZE);
+        if (n == per_richiesta) {
+            invia_batch(r, codici, n);
+            n = 0;
+        }
+    }
+    if (n > 0) invia_batch(r, codici, n);
+    free(codici);
+}
 
-int main() {
-    int sock_fd;
+int main(int argc, char **argv) {
+    int sock_fd, opt, batch = 0;
     struct sockaddr_in serveraddr;
     char bit, report, buffer[BUFF_MAX_SIZE], cod_fisc[COD_SIZE];
+    uint32_t per_richiesta = BATCH_MAX;
+    FILE *input = stdin;
+    RETE rete;
+
+    //Opzioni: -b modalità non interattiva, i codici vengono letti uno per riga dal file indicato o dallo standard input
+    //e verificati a gruppi; -n numero di codici per richiesta (al massimo BATCH_MAX)
+    while ((opt = getopt(argc, argv, "bn:")) != -1) {
+        if (opt == 'b') batch = 1;
+        else if (opt == 'n') per_richiesta = atoi(optarg);
+        else {
+            fprintf(stderr, "usage: %s [-b [-n codici per richiesta] [file]]\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (per_richiesta < 1 || per_richiesta > BATCH_MAX) per_richiesta = BATCH_MAX;
+    if (batch && optind < argc && (input = fopen(argv[optind], "r")) == NULL) {
+        perror("fopen() error");
+        exit(1);
+    }
 
-    bit = '0'; //Inizializzazione del bit a 0 per inviarlo al ServerG
+    bit = batch ? '2' : '0'; //Inizializzazione del bit a 0 (2 per la modalità non interattiva) per inviarlo al ServerG
 
     //Creazione del descrittore del socket
     if ((sock_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
@@ -80,15 +118,23 @@ int main() {
         exit(1);
     }
 
-    //Invia un bit di valore 0 al ServerG per notificare che la comunicazione deve avvenire con il ClientS
-    if (full_write(sock_fd, &bit, sizeof(char)) < 0) {
-        perror("full_write() error");
+    //Invia un bit di valore 0 al ServerG per notificare che la comunicazione deve avvenire con il ClientS: parte
+    //insieme alla prima richiesta
+    rete_inizia(&rete, sock_fd);
+    if (rete_scrivi(&rete, &bit, sizeof(char)) < 0) {
+        perror("rete_scrivi() error");
         exit(1);
     }
 
+    if (batch) {
+        verifica_batch(&rete, input, per_richiesta);
+        close(sock_fd);
+        exit(0);
+    }
+
     //Ricezione del benvenuto dal ServerG
-    if (full_read(sock_fd, buffer, BENVENUTO) < 0) {
-        perror("full_read() error");
+    if (rete_leggi(&rete, buffer, BENVENUTO) != 0) {
+        perror("rete_leggi() error");
         exit(1);
     }
     printf("%s\n\n", buffer);
@@ -111,14 +157,14 @@ int main() {
     }
 
     //Invio del numero di tessera sanitaria al ServerG
-    if (full_write(sock_fd, cod_fisc, COD_SIZE)) {
-        perror("full_write() error");
+    if (rete_scrivi(&rete, cod_fisc, COD_SIZE) < 0) {
+        perror("rete_scrivi() error");
         exit(1);
     }
 
     //Ricezione dell'ack
-    if (full_read(sock_fd, buffer, ACK_SIZE_SG) < 0) {
-        perror("full_read() error");
+    if (rete_leggi(&rete, buffer, ACK_SIZE_SG) != 0) {
+        perror("rete_leggi() error");
         exit(1);
     }
     printf("\n%s\n\n", buffer);
@@ -129,8 +175,8 @@ int main() {
     sleep(4);
     
     //Ricezione ACK dal ServerG
-    if (full_read(sock_fd, buffer, ACK_SIZE_CS) < 0) {
-        perror("full_read() error");
+    if (rete_leggi(&rete, buffer, ACK_SIZE_CS) != 0) {
+        perror("rete_leggi() error");
         exit(1);
     }
     printf("%s\n", buffer);
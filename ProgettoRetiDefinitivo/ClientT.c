@@ -7,6 +7,7 @@
 #include <sys/types.h>
 #include <sys/socket.h> //contiene le definizioni dei socket
 #include <arpa/inet.h>  // contiene le definizioni per le operazioni Internet
+#include "rete.h"       //lettura e scrittura bufferizzate dei messaggi a campi
 #define BUFF_MAX_SIZE 1024   //dimensione massima del buffer
 #define COD_SIZE 17         //dimensione del codice di tessera sanitaria 16 byte ed 1 del terminatore
 #define ACK_SIZE_SG 64        //dimensione dell'ack ricevuto dal ServerG
@@ -18,48 +19,12 @@ typedef struct  {
     char report;				 //referto di validità del Green Pass
 } REPORT;
 
-//Legge esattamente count byte s iterando opportunamente le letture. 
-ssize_t full_read(int fd, void *buffer, size_t count) {
-    size_t n_left;
-    ssize_t n_read;
-    n_left = count;
-    while (n_left > 0) {  // ciclo ripetuto fintanto che non vengono letti tutti i bytes
-        if ((n_read = read(fd, buffer, n_left)) < 0) {
-            if (errno == EINTR) continue; // errno=codice di errore dell'ultima System Call
-            else exit(n_read);
-        } else if (n_read == 0) break; // se sono 0 si chiude il descrittore,si esce dal ciclo e viene restituito n_left
-        n_left -= n_read;
-        buffer += n_read;
-    }
-    buffer = 0;
-    return n_left;
-}
-
-
-
-//Scrive esattamente count byte s iterando opportunamente le scritture. 
-ssize_t full_write(int fd, const void *buffer, size_t count) {
-    size_t n_left;
-    ssize_t n_written;
-    n_left = count;
-    while (n_left > 0) {          // ciclo ripetuto fintanto che non vengono scritti tutti i bytes
-        if ((n_written = write(fd, buffer, n_left)) < 0) {
-            if (errno == EINTR) continue; //errno=codice di errore dell'ultima System Call
-            else exit(n_written); //Se non è una System Call, esci con un errore
-        }
-        n_left -= n_written;
-        buffer += n_written;
-    }
-    buffer = 0;
-    return n_left;
-}
-
-
 int main(int argc, char **argv) {
     int sock_fd;
     struct sockaddr_in serveraddr;
     REPORT pacchetto;
     char bit, buffer[BUFF_MAX_SIZE];
+    RETE rete;
 
     bit = '1'; //Inizializzazione del bit a 1 da inviare al ServerG
 
@@ -85,9 +50,11 @@ int main(int argc, char **argv) {
         exit(1);
     }
 
-    //Invia un bit di valore 1 al ServerG per notificare che la comunicazione deve avvenire con il ClientT
-    if (full_write(sock_fd, &bit, sizeof(char)) < 0) {
-        perror("full_write() error");
+    //Invia un bit di valore 1 al ServerG per notificare che la comunicazione deve avvenire con il ClientT: parte
+    //insieme al pacchetto report
+    rete_inizia(&rete, sock_fd);
+    if (rete_scrivi(&rete, &bit, sizeof(char)) < 0) {
+        perror("rete_scrivi() error");
         exit(1);
     }
 
@@ -127,14 +94,14 @@ int main(int argc, char **argv) {
     else printf("\nInoltro richiesta di invalidazione del Green Pass!\n");
 
     //Invio del pacchetto report al ServerG
-    if (full_write(sock_fd, &pacchetto, sizeof(REPORT)) < 0) {
-        perror("full_write() error");
+    if (rete_scrivi(&rete, &pacchetto, sizeof(REPORT)) < 0) {
+        perror("rete_scrivi() error");
         exit(1);
     }
 
     //Ricezio del messaggio di report dal ServerG
-    if (full_read(sock_fd, buffer, ACK_SIZE_CT) < 0) {
-        perror("full_read() error");
+    if (rete_leggi(&rete, buffer, ACK_SIZE_CT) != 0) {
+        perror("rete_leggi() error");
         exit(1);
     }
 
@@ -0,0 +1,216 @@
+//Strumento di ribilanciamento del cluster di ServerV (anello.h): quando cambia il file di configurazione del cluster,
+//ad esempio per aggiungere un ServerV, copia ogni Green Pass dal ServerV che lo possiede con la vecchia configurazione
+//a quello che lo possiede con la nuova.
+//
+//Ogni ServerV della vecchia configurazione viene letto per intero con OP_ELENCA; i Green Pass di cui non è il
+//proprietario (copie lasciate da un ribilanciamento precedente) vengono ignorati, gli altri vengono inviati con
+//OP_TRASFERISCI, che conserva il report, al nuovo proprietario se ha un nome diverso. L'archivio non prevede la
+//cancellazione: le vecchie copie restano nei ServerV di origine ma non vengono più lette, perché ServerG e Centro
+//Vaccinale cercano ogni codice solo nel suo proprietario.
+//
+//Va eseguito con ServerG e Centro Vaccinale fermi (le modifiche avvenute durante la copia andrebbero perse), che vanno
+//poi avviati con la nuova configurazione:
+//  ./Ribilancia -o vecchio.conf -n nuovo.conf [-d]
+//Con -d conta soltanto i Green Pass da spostare, senza inviarli.
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>      // libreria standard del C per la gestione delle situazioni di errore
+#include <string.h>
+#include <stdint.h>
+#include <endian.h>
+#include <sys/time.h>
+#include <sys/socket.h> //contiene le definizioni dei socket
+#include <arpa/inet.h>  // contiene le definizioni per le operazioni Internet
+#include "greenpass.h"  //formato binario del Green Pass
+#include "protocollo.h" //protocollo a frame fra ServerG e ServerV
+#include "anello.h"     //cluster di ServerV ed assegnazione dei codici con hashing consistente
+#include "rete.h"       //invio dei frame accumulati
+#define TIMEOUT 30      //secondi di attesa massima di una risposta
+
+ANELLO vecchio, nuovo;
+int sock_nuovo[ANELLO_MAX_NODI];        //connessioni con i ServerV della nuova configurazione, -1 se non ancora aperte
+BUFFER frame[ANELLO_MAX_NODI];          //trasferimenti da inviare ad ogni ServerV della nuova configurazione
+int attese[ANELLO_MAX_NODI];
+uint64_t spostati[ANELLO_MAX_NODI];
+
+//Funzione che apre una connessione a frame con il nodo i dell'anello. In caso di errore termina il programma
+int connessione(const ANELLO *a, int i) {
+    int sock_fd;
+    struct timeval attesa = {TIMEOUT, 0};
+    char bit = '2';
+
+    if ((sock_fd = anello_connetti(a, i)) < 0) {
+        fprintf(stderr, "ServerV %s (%s:%d) non raggiungibile: %s\n", a->nodi[i].nome, a->nodi[i].host, a->nodi[i].porta, strerror(errno));
+        exit(1);
+    }
+    setsockopt(sock_fd, SOL_SOCKET, SO_RCVTIMEO, &attesa, sizeof(attesa));
+    setsockopt(sock_fd, SOL_SOCKET, SO_SNDTIMEO, &attesa, sizeof(attesa));
+    if (send(sock_fd, &bit, sizeof(char), MSG_NOSIGNAL) != sizeof(char)) {
+        perror("send() error");
+        exit(1);
+    }
+    return sock_fd;
+}
+
+//Funzione che invia tutti i byte del buffer e lo svuota. In caso di errore termina il programma
+void invio(int sock_fd, BUFFER *b) {
+    if (rete_invia_dati(sock_fd, b->dati, b->len) < 0) {
+        perror("rete_invia_dati() error");
+        exit(1);
+    }
+    b->len = 0;
+}
+
+//Funzione che riceve in ingresso il prossimo frame, dopo aver scartato quello precedente di scarta byte.
+//Restituisce i byte occupati dal frame. In caso di errore termina il programma
+int64_t ricezione_frame(int sock_fd, BUFFER *ingresso, int64_t scarta, uint8_t *op, uint32_t *id, const char **dati, uint32_t *len) {
+    size_t fabbisogno = PROTO_TESTA;
+    int64_t k;
+    ssize_t n;
+
+    buffer_scarta(ingresso, scarta);
+    while ((k = proto_estrai_frame(ingresso->dati, ingresso->len, op, id, dati, len, &fabbisogno)) == 0) {
+        if (buffer_riserva(ingresso, fabbisogno > ingresso->len + 4096 ? fabbisogno : ingresso->len + 4096) < 0) {
+            perror("buffer_riserva() error");
+            exit(1);
+        }
+        if ((n = recv(sock_fd, ingresso->dati + ingresso->len, ingresso->cap - ingresso->len, 0)) < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            fprintf(stderr, "Connessione con il ServerV interrotta\n");
+            exit(1);
+        }
+        ingresso->len += n;
+    }
+    if (k < 0) {
+        fprintf(stderr, "Frame non valido dal ServerV\n");
+        exit(1);
+    }
+    return k;
+}
+
+//Funzione che invia ai ServerV della nuova configurazione i trasferimenti accumulati ed attende che siano durevoli
+void invio_trasferimenti() {
+    BUFFER ingresso = {0};
+    const char *dati;
+    int64_t k = 0;
+    uint32_t id, len;
+    uint8_t op;
+    int s;
+
+    for (s = 0; s < nuovo.n; s++) {
+        if (attese[s] == 0) continue;
+        if (sock_nuovo[s] < 0) sock_nuovo[s] = connessione(&nuovo, s);
+        invio(sock_nuovo[s], &frame[s]);
+    }
+    for (s = 0; s < nuovo.n; s++) {
+        for (ingresso.len = 0, k = 0; attese[s] > 0; attese[s]--) {
+            k = ricezione_frame(sock_nuovo[s], &ingresso, k, &op, &id, &dati, &len);
+            if (op != (OP_TRASFERISCI | OP_RISPOSTA) || len != 1 || dati[0] != '0') {
+                fprintf(stderr, "Trasferimento rifiutato dal ServerV %s\n", nuovo.nodi[s].nome);
+                exit(1);
+            }
+        }
+    }
+    buffer_libera(&ingresso);
+}
+
+//Funzione che legge tutto l'archivio del ServerV s della vecchia configurazione e prepara il trasferimento dei
+//Green Pass che cambiano proprietario. Restituisce i Green Pass letti
+uint64_t ribilancia_nodo(int s, int prova) {
+    BUFFER richiesta = {0}, ingresso = {0};
+    const char *dati;
+    char cod_fisc[GP_CARATTERI + 1];
+    uint64_t posizione = 0, letti = 0;
+    int64_t k = 0;
+    uint32_t id, len, i, n;
+    uint8_t op;
+    int sock_fd, d;
+    GP greenP;
+
+    sock_fd = connessione(&vecchio, s);
+    for (;;) {
+        posizione = htobe64(posizione);
+        if (proto_aggiungi_frame(&richiesta, OP_ELENCA, 0, &posizione, sizeof(uint64_t)) < 0) {
+            perror("proto_aggiungi_frame() error");
+            exit(1);
+        }
+        invio(sock_fd, &richiesta);
+        k = ricezione_frame(sock_fd, &ingresso, k, &op, &id, &dati, &len);
+        if (op != (OP_ELENCA | OP_RISPOSTA) || len < sizeof(uint64_t) || (len - sizeof(uint64_t)) % sizeof(GP) != 0) {
+            fprintf(stderr, "Il ServerV %s non supporta l'elenco dei Green Pass\n", vecchio.nodi[s].nome);
+            exit(1);
+        }
+        memcpy(&posizione, dati, sizeof(uint64_t));
+        posizione = be64toh(posizione);
+        if ((n = (len - sizeof(uint64_t)) / sizeof(GP)) == 0) break;
+
+        for (i = 0; i < n; i++) {
+            memcpy(&greenP, dati + sizeof(uint64_t) + i * sizeof(GP), sizeof(GP));
+            gp_decodifica(cod_fisc, greenP.codice);
+            //Copia lasciata da un ribilanciamento precedente, oppure Green Pass che non cambia proprietario
+            if (anello_nodo(&vecchio, cod_fisc) != s) continue;
+            d = anello_nodo(&nuovo, cod_fisc);
+            if (strcmp(nuovo.nodi[d].nome, vecchio.nodi[s].nome) == 0) continue;
+            spostati[d]++;
+            if (prova) continue;
+            if (proto_aggiungi_frame(&frame[d], OP_TRASFERISCI, 0, &greenP, sizeof(GP)) < 0) {
+                perror("proto_aggiungi_frame() error");
+                exit(1);
+            }
+            attese[d]++;
+        }
+        letti += n;
+        invio_trasferimenti();
+    }
+    close(sock_fd);
+    buffer_libera(&richiesta);
+    buffer_libera(&ingresso);
+    return letti;
+}
+
+int main(int argc, char **argv) {
+    char *file_vecchio = NULL, *file_nuovo = NULL;
+    uint64_t letti, totale = 0;
+    int opzione, prova = 0, s;
+
+    while ((opzione = getopt(argc, argv, "o:n:d")) != -1) {
+        switch (opzione) {
+        case 'o':
+            file_vecchio = optarg;
+            break;
+        case 'n':
+            file_nuovo = optarg;
+            break;
+        case 'd':
+            prova = 1;
+            break;
+        default:
+            file_vecchio = NULL;
+        }
+    }
+    if (file_vecchio == NULL || file_nuovo == NULL) {
+        fprintf(stderr, "Uso: %s -o vecchio.conf -n nuovo.conf [-d]\n", argv[0]);
+        exit(1);
+    }
+    if (anello_carica(&vecchio, file_vecchio) < 0 || anello_carica(&nuovo, file_nuovo) < 0) {
+        perror("anello_carica() error");
+        exit(1);
+    }
+
+    for (s = 0; s < ANELLO_MAX_NODI; s++) sock_nuovo[s] = -1;
+    //Le repliche contengono gli stessi Green Pass dei loro primari e li ricevono da loro
+    for (s = 0; s < vecchio.n; s++) {
+        if (vecchio.nodi[s].primario >= 0) continue;
+        letti = ribilancia_nodo(s, prova);
+        totale += letti;
+        printf("ServerV %s: %llu Green Pass letti\n", vecchio.nodi[s].nome, (unsigned long long)letti);
+    }
+    for (s = 0; s < nuovo.n; s++) {
+        if (sock_nuovo[s] >= 0) close(sock_nuovo[s]);
+        if (nuovo.nodi[s].primario >= 0) continue;
+        printf("ServerV %s: %llu Green Pass %s\n", nuovo.nodi[s].nome, (unsigned long long)spostati[s], prova ? "da spostare" : "spostati");
+    }
+    printf("Totale: %llu Green Pass letti\n", (unsigned long long)totale);
+    return 0;
+}
\ No newline at end of file
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE     //necessario per accept4 e per l'affinità dei worker
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -9,26 +10,37 @@
 #include <arpa/inet.h>  // contiene le definizioni per le operazioni Internet
 #include <time.h>
 #include <signal.h>     //contiene le costanti per la gestione dei segnali fra processi
+#include <stdint.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>  //contiene le opzioni del protocollo TCP
+#include <sys/mman.h>       //contiene le definizioni per la memoria condivisa fra i processi
+#include <sys/epoll.h>      //contiene le definizioni per la gestione degli eventi sui descrittori
+#include <sys/eventfd.h>    //contiene le definizioni dei contatori con cui un thread risveglia un'epoll
+#include "protocollo.h"     //protocollo a frame con il ServerV
+#include "greenpass.h"      //record del Green Pass ricevuto dal ServerV
+#include "metriche.h"       //contatori ed istogrammi delle latenze esposti sulla porta di amministrazione
+#include "codice.h"         //validazione del codice fiscale della tessera sanitaria
+#include "anello.h"         //cluster di ServerV ed assegnazione dei codici con hashing consistente
+#include "rete.h"           //lettura e scrittura bufferizzate dei messaggi a campi
+#include "canale.h"         //canale in memoria condivisa con un ServerV sulla stessa macchina
 #define BUFF_MAX_SIZE 1024  //dimensione massima del buffer
 #define BENVENUTO 108	// dimensione del messaggio di benvenuto
 #define COD_SIZE 17    //dimensione del codice di tessera sanitaria 16 byte ed 1 del terminatore
 #define ACK_SIZE 64
 #define ACK_SIZE_CT 60
-
-//Struct che permette di salvare una data
-typedef struct {
-    int giorno;
-    int mese;
-    int anno;
-} DATE;
-
-//Struct del pacchetto inviato dal Centro Vaccinale al Server Vaccinale avente il codice fiscale della tessera sanitaria dell'Utente e la data di inizio e fine validità del Green Pass
-typedef struct {
-    char cod_fisc[COD_SIZE];
-    char report;
-    DATE data_inizio;
-    DATE data_fine;
-} GP;
+#define POOL_CONTROLLO 5    //secondi di inattività dopo i quali una connessione del pool viene controllata
+#define POOL_TIMEOUT 2      //secondi di attesa massima di una risposta del ServerV su una connessione del pool
+#define POOL_RICHIESTE 1024 //richieste che possono attendere contemporaneamente una risposta con il protocollo a frame
+#define BATCH_FRAME 256     //richieste inviate al ServerV con un'unica scrittura
+#define BATCH_MAX 1024      //codici che il ClientS può inviare in un'unica richiesta di verifica
+#define BATCH_MOLTI 64      //codici verificati con un'unica richiesta OP_VERIFICA_MOLTI
+#define CACHE_VOCI 65536    //Green Pass conservati nella cache delle verifiche
+#define CACHE_STRISCE 64    //lock della cache: ognuno protegge le voci con lo stesso resto
+#define PORTA_ADMIN 1126    //porta locale delle metriche
+#define WORKER_MAX 64       //worker della modalità ad eventi
+#define EVENTI_MAX 256      //eventi restituiti da una singola epoll_wait
+#define CONN_BUFFER 4096    //spazio libero minimo per ogni lettura di una connessione nella modalità ad eventi
 
 //Struct del pacchetto inviato dal Client T 
 typedef struct  {
@@ -36,41 +48,101 @@ typedef struct  {
     char report;		 //referto di validità del Green Pass
 } REPORT;
 
-//Legge esattamente count byte s iterando opportunamente le letture
-ssize_t full_read(int fd, void *buffer, size_t count) {
-    size_t n_left;
-    ssize_t n_read;
-    n_left = count;
-    while (n_left > 0) {  // ciclo ripetuto fintanto che non vengono letti tutti i bytes
-        if ((n_read = read(fd, buffer, n_left)) < 0) {
-            if (errno == EINTR) continue; // errno=codice di errore dell'ultima System Call
-            else exit(n_read);
-        } else if (n_read == 0) break; // se sono 0 si chiude il descrittore,si esce dal ciclo e viene restituito n_left
-        n_left -= n_read;
-        buffer += n_read;
-    }
-    buffer = 0;
-    return n_left;
-}
+//Connessione persistente verso il ServerV
+typedef struct {
+    int fd;                 //descrittore del socket, -1 se la connessione deve essere ristabilita
+    int nodo;               //ServerV del cluster a cui è collegata
+    int occupata;           //vecchio protocollo: 1 se un thread la sta usando
+    time_t ultimo_uso;      //istante dell'ultima operazione riuscita
+    pthread_mutex_t invio;  //protocollo a frame: serializza le scritture dei thread che condividono la connessione
+    CANALE *canale;         //canale in memoria condivisa in cui passano i frame, NULL se passano dal socket
+} CONNESSIONE_SV;
+
+//Richiesta inviata con il protocollo a frame ed in attesa della risposta del ServerV
+typedef struct {
+    int usata;
+    uint32_t id;            //id della richiesta: posizione nella tabella più un contatore, così una risposta in ritardo
+                            //non viene scambiata per quella di una richiesta successiva
+    int conn;               //connessione su cui è stata inviata
+    int stato;              //0 in attesa, 1 risposta ricevuta, -1 connessione interrotta
+    uint8_t op;             //operazione della risposta
+    char *risposta;         //buffer del thread in attesa, di dimensione max
+    uint32_t max, len;
+    pthread_cond_t pronta;
+} RICHIESTA_SV;
+
+//Pool di connessioni persistenti verso il ServerV condiviso dai thread che servono i client
+typedef struct {
+    CONNESSIONE_SV *conn;
+    int n;                  //numero di connessioni, 0 se il pool non è attivo
+    int per_nodo;           //connessioni verso ogni ServerV: quelle del nodo s vanno da s * per_nodo a (s + 1) * per_nodo - 1
+    int compatibile;        //1 per usare il vecchio protocollo a byte, una richiesta alla volta per connessione
+    int memoria;            //1 per usare un canale in memoria condivisa con i ServerV raggiungibili con un socket Unix
+    pthread_mutex_t lock;
+    pthread_cond_t libera;  //segnala che una connessione o una richiesta è tornata disponibile
+    pthread_cond_t riaperta;//segnala ai thread lettori che una connessione è stata ristabilita da una richiesta
+    RICHIESTA_SV *richieste;
+    uint32_t generazione;
+    int prossima;           //connessione su cui inviare la prossima richiesta, a rotazione
+} POOL;
+
+//Voce della cache delle verifiche: l'esito ricevuto dal ServerV (1 valido, 0 non valido, 2 inesistente)
+typedef struct {
+    char cod_fisc[COD_SIZE];
+    char esito;             //0 voce vuota
+    int32_t giorno;         //giorno in cui il ServerV ha valutato la validità
+    time_t scadenza;
+} VOCE_CACHE;
 
+//Lock di un gruppo di voci; la versione cambia ad ogni invalidazione, così una verifica che ha interrogato il ServerV
+//prima della modifica di un report non può salvare nella cache il Green Pass precedente
+typedef struct {
+    pthread_mutex_t lock;
+    uint64_t versione;
+} STRISCIA_CACHE;
 
-//Scrive esattamente count byte s iterando opportunamente le scritture
-ssize_t full_write(int fd, const void *buffer, size_t count) {
-    size_t n_left;
-    ssize_t n_written;
-    n_left = count;
-    while (n_left > 0) {          // ciclo ripetuto fintanto che non vengono scritti tutti i bytes
-        if ((n_written = write(fd, buffer, n_left)) < 0) {
-            if (errno == EINTR) continue; // errno=codice di errore dell'ultima System Call
-            else exit(n_written); //Se non è una System Call, esci con un errore
-        }
-        n_left -= n_written;
-        buffer += n_written;
-    }
-    buffer = 0;
-    return n_left;
-}
+//Cache delle verifiche condivisa da tutti i processi figli o thread del ServerG
+typedef struct {
+    int ttl;                //secondi di validità di una voce, 0 se la cache non è attiva
+    STRISCIA_CACHE strisce[CACHE_STRISCE];
+    VOCE_CACHE voci[CACHE_VOCI];
+} CACHE;
 
+//Metriche di un worker della modalità ad eventi: ogni worker ha il proprio socket di ascolto, quindi i contatori
+//mostrano come il kernel distribuisce le connessioni fra i worker
+typedef struct {
+    uint64_t connessioni;   //connessioni accettate dal worker
+    uint64_t aperte;        //connessioni del worker ancora aperte
+    uint64_t richieste;     //verifiche e modifiche del report ricevute dal worker
+    uint64_t giri;          //giri di eventi in cui il worker ha interrogato il ServerV
+} METRICHE_WORKER;
+
+//Metriche del ServerG, condivise dai processi figli e dai thread. Le risposte ai client si misurano dalla ricezione
+//della richiesta completa all'invio dell'esito
+typedef struct {
+    uint64_t connessioni;
+    uint64_t verifiche;             //codici verificati per il ClientS, anche nelle richieste a gruppi
+    uint64_t modifiche;             //report inoltrati per il ClientT
+    uint64_t richieste_batch;
+    uint64_t cache_trovati;
+    uint64_t cache_mancanti;
+    uint64_t sv_errori;             //operazioni fallite perché il ServerV non è raggiungibile
+    uint64_t report_occupati;
+    uint64_t codici_non_validi;     //codici rifiutati senza interrogare il ServerV
+    ISTOGRAMMA risposta_verifica;
+    ISTOGRAMMA risposta_modifica;
+    ISTOGRAMMA risposta_batch;
+    ISTOGRAMMA sv_cerca;            //andata e ritorno verso il ServerV, per ogni chiamata di operazioni_sv
+    ISTOGRAMMA sv_report;
+    ISTOGRAMMA attesa_pool;         //attesa di una connessione libera o di posizioni nella tabella delle richieste
+    METRICHE_WORKER worker[WORKER_MAX];
+} METRICHE;
+
+POOL pool;
+ANELLO anello;      //ServerV del cluster e assegnazione dei codici
+CACHE *cache;
+METRICHE *metriche;
+int n_worker;       //worker della modalità ad eventi, 0 con un processo o un thread per ogni client
 
 //Handler che cattura il segnale CTRL-C e stampa un messaggio di arrivederci.
 void handler (int sign){
@@ -85,278 +157,1578 @@ void handler (int sign){
 
 
 
-//Funzione per estrapolare la data corrente del sistema, usata per effettuare le operazioni di verifica del Green Pass
-void creazione_dc(DATE *data_inizio) {
-    time_t ticks;
-    ticks = time(NULL);
+ //Funzione che crea una connessione con il ServerV s del cluster, restituisce il descrittore del socket oppure -1
+int connetti_sv(int s) {
+    return anello_connetti(&anello, s);
+}
 
-    //Dichiarazione strutture per la conversione della data da stringa ad intero
-    struct tm *data_i = localtime(&ticks);
-    data_i->tm_mon += 1;           //Sommiamo 1 perchè i mesi vanno da 0 ad 11
-    data_i->tm_year += 1900;       //Sommiamo 1900 perchè gli anni partono dal 122 (2022 - 1900)
+//Funzione che apre il canale in memoria condivisa sulla connessione Unix sock_fd con il ServerV: invia il bit 5, ne
+//attende la conferma e gli passa il canale. Restituisce il canale oppure NULL
+CANALE *apri_canale(int sock_fd) {
+    char bit = '5';
 
-    //Assegnamo i valori ai parametri di ritorno
-    data_inizio->giorno = data_i->tm_mday ;
-    data_inizio->mese = data_i->tm_mon;
-    data_inizio->anno = data_i->tm_year;
+    if (rete_invia_dati(sock_fd, &bit, sizeof(char)) < 0 || recv(sock_fd, &bit, sizeof(char), MSG_WAITALL) != sizeof(char)) return NULL;
+    if (bit != '5') {
+        errno = EPROTO;
+        return NULL;
+    }
+    return canale_crea(sock_fd);
 }
 
- //Funzione per la verifica del Green Pass. Riceve un codice fiscale della tessera sanitaria dal Client S, chiede al ServerV il report 
- //ed infine comunica l'esito al Client S
+//Funzione che apre una connessione persistente del pool verso il ServerV s: invia subito il bit 0 (2 per il protocollo
+//a frame), così il ServerV la tratta come una connessione del ServerG su cui arriveranno più operazioni. Con -m, se
+//il ServerV è sulla stessa macchina, i frame passano invece per un canale in memoria condivisa salvato in *canale
+int apri_connessione_pool(int s, CANALE **canale) {
+    int sock_fd, attivo = 1;
+    struct timeval timeout = {POOL_TIMEOUT, 0};
+    char bit = pool.compatibile ? '0' : '2';
+
+    if ((sock_fd = connetti_sv(s)) < 0) return -1;
+    if (pool.memoria && anello.nodi[s].locale) {
+        setsockopt(sock_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(sock_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        if ((*canale = apri_canale(sock_fd)) == NULL) {
+            perror("apri_canale() error");
+            close(sock_fd);
+            return -1;
+        }
+        return sock_fd;
+    }
 
-char verifica_cd(char cod_fisc[]) {
-    int sock_fd, benvenuto, dim_pacchetto;
-    struct sockaddr_in serveraddr;
-    char buffer[BUFF_MAX_SIZE], report, bit;
-    GP greenP;
-    DATE data_corrente;
-
-//Inizializziamo il bit a 0 per notificare al ServerV che la comunicazione deve avvenire con il ServerG
-    bit = '0';
-
-    //Creazione del descrittore del socket
-    if ((sock_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-        perror("socket error");
-        exit(1);
+    //Senza timeout un ServerV bloccato bloccherebbe per sempre il thread che usa la connessione. Con il protocollo
+    //a frame la lettura è affidata al thread lettore, che resta in attesa anche sulle connessioni inattive
+    setsockopt(sock_fd, IPPROTO_TCP, TCP_NODELAY, &attivo, sizeof(attivo));
+    if (pool.compatibile) setsockopt(sock_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(sock_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    if (rete_invia_dati(sock_fd, &bit, sizeof(char)) < 0) {
+        close(sock_fd);
+        return -1;
+    }
+    return sock_fd;
+}
+
+//Funzione che esegue n operazioni sul ServerV attraverso una connessione già aperta: scrive il bit dell'operazione
+//ed i dati di tutte le operazioni, che partono insieme a quanto già scritto su r prima di attendere le risposte, poi
+//riceve i report e, per la richiesta di un Green Pass esistente, il Green Pass; per una modifica del report rimasta
+//occupata, i tentativi ripetuti dal ServerV in ripetuti[k]. Il ServerV esegue le operazioni di una connessione
+//nell'ordine in cui le riceve. Restituisce 0 oppure -1 se la connessione non è più utilizzabile
+int richiesta_sv(RETE *r, char bit, int n, const char *dati, size_t len, char *report, GP *greenP, char *ripetuti) {
+    char tentativi;
+    int k;
+
+    for (k = 0; k < n; k++) {
+        if (rete_scrivi(r, &bit, sizeof(char)) < 0 || rete_scrivi(r, dati + k * len, len) < 0) return -1;
+    }
+    for (k = 0; k < n; k++) {
+        if (rete_leggi(r, &report[k], sizeof(char)) != 0) return -1;
+        if (bit == '1' && report[k] == '1' && rete_leggi(r, &greenP[k], sizeof(GP)) != 0) return -1;
+        if (bit == '0' && report[k] == '3') {
+            if (rete_leggi(r, &tentativi, sizeof(char)) != 0) return -1;
+            if (ripetuti) ripetuti[k] = tentativi;
+        }
     }
+    return 0;
+}
 
-    
-    serveraddr.sin_family = AF_INET;
-    serveraddr.sin_port = htons(1025);
+//Funzione che attende una connessione libera del pool verso il ServerV s e la riserva al thread chiamante
+int pool_prendi(int s) {
+    int i;
+    uint64_t inizio = metriche_adesso();
 
-     //Conversione dell’indirizzo IP in un indirizzo di rete in network order.
-    if (inet_pton(AF_INET, "127.0.0.1", &serveraddr.sin_addr) <= 0) {
-        perror("inet_pton error");
-        exit(1);
+    pthread_mutex_lock(&pool.lock);
+    for (;;) {
+        for (i = s * pool.per_nodo; i < (s + 1) * pool.per_nodo; i++) {
+            if (!pool.conn[i].occupata) {
+                pool.conn[i].occupata = 1;
+                pthread_mutex_unlock(&pool.lock);
+                metriche_registra_da(&metriche->attesa_pool, inizio);
+                return i;
+            }
+        }
+        pthread_cond_wait(&pool.libera, &pool.lock);
     }
+}
 
-    //Connessione con il server
-    if (connect(sock_fd, (struct sockaddr *)&serveraddr, sizeof(serveraddr)) < 0) {
-        perror("connect() error");
-        exit(1);
+//Funzione che restituisce la connessione al pool; se l'operazione non è riuscita la connessione viene chiusa
+//e sarà ristabilita dal prossimo thread che la userà
+void pool_rilascia(int i, int riuscita) {
+    pthread_mutex_lock(&pool.lock);
+    if (riuscita) pool.conn[i].ultimo_uso = time(NULL);
+    else if (pool.conn[i].fd >= 0) {
+        close(pool.conn[i].fd);
+        pool.conn[i].fd = -1;
     }
+    pool.conn[i].occupata = 0;
+    pthread_cond_signal(&pool.libera);
+    pthread_mutex_unlock(&pool.lock);
+}
 
-    //Invia un bit di valore 0 al ServerV per notificarlo che la comunicazione deve avvenire con il ServerG
-    if (full_write(sock_fd, &bit, sizeof(char)) < 0) {
-        perror("full_write() error");
-        exit(1);
+//Funzione che invia n richieste con il protocollo a frame sulla connessione i, con un'unica scrittura, e ne attende
+//le risposte mentre altri thread possono usare la stessa connessione. La richiesta k ha i dati dati + k * len e la sua
+//risposta viene copiata in risposte + k * max fino a max byte, salvandone la lunghezza in lunghezze[k].
+//Restituisce 0 oppure -1 se la connessione si è interrotta o il ServerV non ha risposto entro POOL_TIMEOUT secondi
+int richieste_frame(int i, int n, uint8_t op, const char *dati, uint32_t len, char *risposte, uint32_t max, uint32_t *lunghezze) {
+    RICHIESTA_SV *r;
+    BUFFER frame = {0};
+    struct timespec scadenza;
+    int slot[BATCH_FRAME], liberi, k, j, inviata = 0, esito = 0;
+    uint64_t inizio = metriche_adesso();
+
+    //Prenota n posizioni nella tabella delle richieste in attesa, tutte insieme così due thread non possono
+    //bloccarsi a vicenda con prenotazioni parziali
+    pthread_mutex_lock(&pool.lock);
+    for (;;) {
+        for (j = liberi = 0; j < POOL_RICHIESTE && liberi < n; j++) if (!pool.richieste[j].usata) slot[liberi++] = j;
+        if (liberi == n) break;
+        pthread_cond_wait(&pool.libera, &pool.lock);
+    }
+    for (k = 0; k < n; k++) {
+        r = &pool.richieste[slot[k]];
+        r->usata = 1;
+        r->id = (++pool.generazione * POOL_RICHIESTE) + slot[k];
+        r->conn = i;
+        r->stato = 0;
+        r->risposta = risposte + (size_t)k * max;
+        r->max = max;
+    }
+    pthread_mutex_unlock(&pool.lock);
+    metriche_registra_da(&metriche->attesa_pool, inizio);
+
+    //Le scritture sono serializzate, le risposte vengono consegnate dal thread lettore della connessione
+    for (k = 0; k < n && esito == 0; k++) esito = proto_aggiungi_frame(&frame, op, pool.richieste[slot[k]].id, dati + (size_t)k * len, len);
+    if (esito == 0) {
+        pthread_mutex_lock(&pool.conn[i].invio);
+        if (pool.conn[i].fd >= 0) {
+            if (pool.conn[i].canale != NULL) inviata = canale_scrivi(pool.conn[i].canale, frame.dati, frame.len, POOL_TIMEOUT * 1000) == 0;
+            else inviata = rete_invia_dati(pool.conn[i].fd, frame.dati, frame.len) == 0;
+            if (!inviata) shutdown(pool.conn[i].fd, SHUT_RDWR);   //il thread lettore ristabilirà la connessione
+        }
+        pthread_mutex_unlock(&pool.conn[i].invio);
+    }
+    buffer_libera(&frame);
+
+    clock_gettime(CLOCK_REALTIME, &scadenza);
+    scadenza.tv_sec += POOL_TIMEOUT;
+    esito = inviata ? 0 : -1;
+    pthread_mutex_lock(&pool.lock);
+    for (k = 0; k < n; k++) {
+        r = &pool.richieste[slot[k]];
+        while (esito == 0 && r->stato == 0) {
+            if (pthread_cond_timedwait(&r->pronta, &pool.lock, &scadenza) == ETIMEDOUT) break;
+        }
+        if (r->stato == 1 && r->op == (op | OP_RISPOSTA)) lunghezze[k] = r->len;
+        else esito = -1;
+        r->usata = 0;
     }
+    pthread_cond_broadcast(&pool.libera);
+    pthread_mutex_unlock(&pool.lock);
+    return esito;
+}
 
-    bit = '1';
+//Funzione che invia una sola richiesta con il protocollo a frame sulla connessione i.
+//Restituisce la lunghezza della risposta oppure -1
+int richiesta_frame(int i, uint8_t op, const void *dati, uint32_t len, void *risposta, uint32_t max) {
+    uint32_t lunghezza;
 
-    //Invia un bit di valore 1 al ServerV affichè effettui la verifica del Green Pass
-    if (full_write(sock_fd, &bit, sizeof(char)) < 0) {
-        perror("full_write() error");
-        exit(1);
+    if (richieste_frame(i, 1, op, dati, len, risposta, max, &lunghezza) < 0) return -1;
+    return lunghezza;
+}
+
+//Funzione che usa fd, con il suo canale *canale, come connessione i del pool, se nel frattempo un altro thread non
+//l'ha già ristabilita. Restituisce il descrittore della connessione i e ne salva il canale in *canale
+int installa_connessione(int i, int fd, CANALE **canale) {
+    pthread_mutex_lock(&pool.lock);
+    if (pool.conn[i].fd >= 0) {
+        canale_chiudi(*canale);
+        close(fd);
+        fd = pool.conn[i].fd;
+        *canale = pool.conn[i].canale;
+    } else {
+        pool.conn[i].fd = fd;
+        pool.conn[i].canale = *canale;
+        pool.conn[i].ultimo_uso = time(NULL);
+        pthread_cond_broadcast(&pool.riaperta);
     }
+    pthread_mutex_unlock(&pool.lock);
+    return fd;
+}
+
+//Funzione che esegue n richieste con il protocollo a frame scegliendo a rotazione una connessione attiva del pool
+//verso il ServerV s, a gruppi di BATCH_FRAME. Come per il vecchio protocollo, se la connessione si interrompe le richieste vengono
+//ripetute una volta su un'altra; se nessuna connessione è attiva ne viene ristabilita una senza attendere il thread
+//lettore. Restituisce 0 oppure -1
+int frame_sv(int s, uint8_t op, int n, const char *dati, uint32_t len, char *risposte, uint32_t max, uint32_t *lunghezze) {
+    int i, j, k, m, fd, libera, tentativo;
+    CANALE *canale = NULL;
+
+    for (; n > 0; n -= m, dati += (size_t)m * len, risposte += (size_t)m * max, lunghezze += m) {
+        m = n < BATCH_FRAME ? n : BATCH_FRAME;
+        for (tentativo = 0; tentativo < 2; tentativo++) {
+            pthread_mutex_lock(&pool.lock);
+            for (k = 0, i = -1; k < pool.per_nodo && i < 0; k++) {
+                j = s * pool.per_nodo + pool.prossima++ % pool.per_nodo;
+                if (pool.conn[j].fd >= 0) i = j;
+            }
+            //Posizione in cui installare una nuova connessione se nessuna è attiva
+            libera = s * pool.per_nodo + pool.prossima % pool.per_nodo;
+            pthread_mutex_unlock(&pool.lock);
+            if (i < 0) {
+                if ((fd = apri_connessione_pool(s, &canale)) < 0) return -1;
+                i = libera;
+                installa_connessione(i, fd, &canale);
+                canale = NULL;
+            }
+            if (richieste_frame(i, m, op, dati, len, risposte, max, lunghezze) == 0) break;
+        }
+        if (tentativo == 2) return -1;
+    }
+    return 0;
+}
+
+//Thread che legge le risposte del ServerV da una connessione del pool con il protocollo a frame, o dal suo canale in
+//memoria condivisa, e le consegna ai thread in attesa in base all'id. Se la connessione si interrompe, le richieste
+//in attesa falliscono e la connessione viene ristabilita
+void *lettore_pool(void *arg) {
+    int i = (intptr_t)arg, j, fd;
+    CANALE *canale;
+    BUFFER ingresso = {0};
+    RICHIESTA_SV *r;
+    struct timespec scadenza;
+    const char *dati;
+    int64_t k;
+    ssize_t n;
+    size_t letti;
+    uint8_t op;
+    uint32_t id, len;
+
+    for (;;) {
+        pthread_mutex_lock(&pool.lock);
+        fd = pool.conn[i].fd;
+        canale = pool.conn[i].canale;
+        pthread_mutex_unlock(&pool.lock);
+        if (fd < 0) {
+            canale = NULL;
+            if ((fd = apri_connessione_pool(pool.conn[i].nodo, &canale)) < 0) {
+                //Nuovo tentativo dopo un secondo, o prima se la connessione viene ristabilita da una richiesta
+                clock_gettime(CLOCK_REALTIME, &scadenza);
+                scadenza.tv_sec += 1;
+                pthread_mutex_lock(&pool.lock);
+                if (pool.conn[i].fd < 0) pthread_cond_timedwait(&pool.riaperta, &pool.lock, &scadenza);
+                pthread_mutex_unlock(&pool.lock);
+                continue;
+            }
+            fd = installa_connessione(i, fd, &canale);
+        }
+
+        ingresso.len = 0;
+        for (k = 0; k >= 0;) {
+            if (buffer_riserva(&ingresso, ingresso.len + BUFF_MAX_SIZE) < 0) break;
+            if (canale != NULL) n = canale_leggi(canale, ingresso.dati + ingresso.len, ingresso.cap - ingresso.len);
+            else if ((n = read(fd, ingresso.dati + ingresso.len, ingresso.cap - ingresso.len)) < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            ingresso.len += n;
+
+            letti = 0;
+            pthread_mutex_lock(&pool.lock);
+            while ((k = proto_estrai_frame(ingresso.dati + letti, ingresso.len - letti, &op, &id, &dati, &len, NULL)) > 0) {
+                r = &pool.richieste[id % POOL_RICHIESTE];
+                if (r->usata && r->id == id && r->stato == 0) {
+                    memcpy(r->risposta, dati, len < r->max ? len : r->max);
+                    r->op = op;
+                    r->len = len;
+                    r->stato = 1;
+                    pthread_cond_signal(&r->pronta);
+                }
+                letti += k;
+            }
+            pool.conn[i].ultimo_uso = time(NULL);
+            pthread_mutex_unlock(&pool.lock);
+            buffer_scarta(&ingresso, letti);
+        }
+
+        //Connessione interrotta: nessun thread sta scrivendo quando viene invalidata
+        printf("Connessione %d del pool verso il ServerV interrotta, riconnessione\n", i);
+        pthread_mutex_lock(&pool.conn[i].invio);
+        pthread_mutex_lock(&pool.lock);
+        pool.conn[i].fd = -1;
+        pool.conn[i].canale = NULL;
+        for (j = 0; j < POOL_RICHIESTE; j++) {
+            r = &pool.richieste[j];
+            if (r->usata && r->conn == i && r->stato == 0) {
+                r->stato = -1;
+                pthread_cond_signal(&r->pronta);
+            }
+        }
+        pthread_mutex_unlock(&pool.lock);
+        pthread_mutex_unlock(&pool.conn[i].invio);
+        canale_chiudi(canale);
+        close(fd);
+    }
+    return NULL;
+}
+
+//Funzione che verifica n codici con il protocollo a frame inviando al ServerV s richieste OP_VERIFICA_MOLTI di
+//BATCH_MOLTI codici ciascuna, su cui il ServerV sovrappone le ricerche; l'ultimo gruppo viene completato con codici
+//vuoti, che il ServerV scarta subito. Salva gli esiti in esiti. Restituisce 0 oppure -1
+int verifica_molti_sv(int s, int n, const char *codici, char *esiti) {
+    int gruppi = (n + BATCH_MOLTI - 1) / BATCH_MOLTI, k, esito = -1;
+    char *dati, *risposte;
+    uint32_t *lunghezze;
+
+    dati = calloc(gruppi * BATCH_MOLTI, COD_SIZE);
+    risposte = malloc(gruppi * BATCH_MOLTI);
+    lunghezze = malloc(gruppi * sizeof(uint32_t));
+    if (dati != NULL && risposte != NULL && lunghezze != NULL) {
+        memcpy(dati, codici, (size_t)n * COD_SIZE);
+        esito = frame_sv(s, OP_VERIFICA_MOLTI, gruppi, dati, BATCH_MOLTI * COD_SIZE, risposte, BATCH_MOLTI, lunghezze);
+        for (k = 0; esito == 0 && k < n; k++) esiti[k] = lunghezze[k / BATCH_MOLTI] == BATCH_MOLTI ? risposte[k] : 'E';
+    }
+    free(dati);
+    free(risposte);
+    free(lunghezze);
+    return esito;
+}
+
+//Funzione che esegue n operazioni sul ServerV s del cluster con un'unica chiamata: il bit 1 richiede i Green Pass, il bit 3 solo
+//l'esito della loro verifica, il bit 0 modifica i report. I dati dell'operazione k sono dati + k * len; il suo report viene salvato in report[k] e, per un Green
+//Pass esistente, il Green Pass in greenP[k]. Le operazioni vengono inviate a gruppi di BATCH_FRAME senza attendere le
+//risposte. Senza pool viene aperta una connessione per ogni chiamata; con il pool viene usata una connessione
+//persistente e, se questa si è interrotta, le operazioni vengono ripetute una volta su una connessione nuova
+//(entrambe le operazioni possono essere ripetute senza effetti collaterali). Con il protocollo a frame più thread
+//condividono la stessa connessione. Il report 3 indica una modifica del report non eseguita perché il Green Pass è
+//rimasto occupato: se ripetuti non è NULL vi vengono salvati i tentativi ripetuti dal ServerV. Con il protocollo a
+//frame più verifiche vengono raggruppate in richieste OP_VERIFICA_MOLTI.
+//Restituisce 0 oppure -1 se il ServerV non è raggiungibile
+int esegui_operazioni_nodo(int s, char bit, int n, const char *dati, size_t len, char *report, GP *greenP, char *ripetuti) {
+    int sock_fd, i, k, m, tentativo;
+    char dispatch = '0', *risposte;
+    uint32_t *lunghezze;
+    RETE r;
+
+    if (!pool.compatibile && pool.n > 0 && bit == '3' && n > 1) return verifica_molti_sv(s, n, dati, report);
+    if (!pool.compatibile && pool.n > 0) {
+        risposte = malloc((size_t)n * (1 + sizeof(GP)));
+        lunghezze = malloc(n * sizeof(uint32_t));
+        if (risposte == NULL || lunghezze == NULL || frame_sv(s, bit == '1' ? OP_CERCA : bit == '3' ? OP_VERIFICA : OP_REPORT, n, dati, len, risposte, 1 + sizeof(GP), lunghezze) < 0) {
+            free(risposte);
+            free(lunghezze);
+            return -1;
+        }
+        for (k = 0; k < n; k++) {
+            report[k] = lunghezze[k] > 0 ? risposte[k * (1 + sizeof(GP))] : 'E';
+            if (bit == '1' && report[k] == '1') {
+                if (lunghezze[k] == 1 + sizeof(GP)) memcpy(&greenP[k], risposte + k * (1 + sizeof(GP)) + 1, sizeof(GP));
+                else report[k] = 'E';
+            }
+            if (bit == '0' && report[k] == '3' && ripetuti) ripetuti[k] = lunghezze[k] > 1 ? risposte[k * (1 + sizeof(GP)) + 1] : 0;
+        }
+        free(risposte);
+        free(lunghezze);
+        return 0;
+    }
+
+    for (; n > 0; n -= m, dati += m * len, report += m, greenP = greenP ? greenP + m : NULL, ripetuti = ripetuti ? ripetuti + m : NULL) {
+        m = n < BATCH_FRAME ? n : BATCH_FRAME;
+        if (pool.n == 0) {
+            //Un ServerV non raggiungibile, per esempio una replica, lascia proseguire con gli altri
+            if ((sock_fd = connetti_sv(s)) < 0) {
+                perror("connect() error");
+                return -1;
+            }
 
-    //Invia il codice fiscale della tessera sanitaria ricevuto dal ClientS al SeverV
-    if (full_write(sock_fd, cod_fisc, COD_SIZE)) {
-        perror("full_write() error");
+            //Invia un bit di valore 0 al ServerV per notificarlo che la comunicazione deve avvenire con il ServerG, insieme
+            //alle operazioni
+            rete_inizia(&r, sock_fd);
+            if (rete_scrivi(&r, &dispatch, sizeof(char)) < 0 || richiesta_sv(&r, bit, m, dati, len, report, greenP, ripetuti) < 0) {
+                perror("richiesta_sv() error");
+                close(sock_fd);
+                return -1;
+            }
+            close(sock_fd);
+            continue;
+        }
+
+        for (tentativo = 0; tentativo < 2; tentativo++) {
+            i = pool_prendi(s);
+            if (pool.conn[i].fd < 0) pool.conn[i].fd = apri_connessione_pool(s, NULL);
+            rete_inizia(&r, pool.conn[i].fd);
+            if (pool.conn[i].fd >= 0 && richiesta_sv(&r, bit, m, dati, len, report, greenP, ripetuti) == 0) {
+                pool_rilascia(i, 1);
+                break;
+            }
+            pool_rilascia(i, 0);
+        }
+        if (tentativo == 2) return -1;
+    }
+    return 0;
+}
+
+//Funzione che esegue n operazioni come esegui_operazioni_nodo, ciascuna sul ServerV del cluster a cui appartiene il suo
+//codice (all'inizio dei dati, anche per il pacchetto REPORT). Le operazioni vengono ordinate per ServerV, eseguite
+//con una chiamata per ogni ServerV coinvolto e gli esiti vengono riportati nell'ordine originale. Le ricerche e le
+//verifiche vengono inviate a turno alle repliche del ServerV, se ne ha, e ripetute sul primario se la replica non è
+//raggiungibile. Le operazioni di un ServerV non raggiungibile ricevono il report E, le altre proseguono.
+//Restituisce 0 oppure -1 se nessuno dei ServerV coinvolti è raggiungibile
+int esegui_operazioni_sv(char bit, int n, const char *dati, size_t len, char *report, GP *greenP, char *ripetuti) {
+    static unsigned turno;
+    int inizio[ANELLO_MAX_NODI + 1], *nodo, *ordine, s, d, k, j, riuscite = 0, fallite = 0;
+    char *dati_nodo, *report_nodo, *ripetuti_nodo = NULL;
+    GP *gp_nodo = NULL;
+
+    if (anello.n == 1) return esegui_operazioni_nodo(0, bit, n, dati, len, report, greenP, ripetuti);
+
+    nodo = malloc(n * sizeof(int));
+    ordine = malloc(n * sizeof(int));
+    dati_nodo = malloc((size_t)n * len);
+    report_nodo = malloc(n);
+    if (greenP) gp_nodo = malloc(n * sizeof(GP));
+    if (ripetuti) ripetuti_nodo = calloc(n, sizeof(char));
+    if (nodo == NULL || ordine == NULL || dati_nodo == NULL || report_nodo == NULL || (greenP && gp_nodo == NULL) || (ripetuti && ripetuti_nodo == NULL)) {
+        fallite = 1;
+        goto fine;
+    }
+
+    //Ordinamento per conteggio: inizio[s] è la posizione delle operazioni del ServerV s
+    memset(inizio, 0, sizeof(inizio));
+    for (k = 0; k < n; k++) inizio[(nodo[k] = anello_nodo(&anello, dati + (size_t)k * len)) + 1]++;
+    for (s = 0; s < anello.n; s++) inizio[s + 1] += inizio[s];
+    for (k = 0; k < n; k++) {
+        j = inizio[nodo[k]]++;
+        ordine[j] = k;
+        memcpy(dati_nodo + (size_t)j * len, dati + (size_t)k * len, len);
+    }
+    for (s = anello.n; s > 0; s--) inizio[s] = inizio[s - 1];
+    inizio[0] = 0;
+
+    for (s = 0; s < anello.n; s++) {
+        if ((j = inizio[s + 1] - inizio[s]) == 0) continue;
+        d = bit != '0' ? anello_lettura(&anello, s, __atomic_fetch_add(&turno, 1, __ATOMIC_RELAXED)) : s;
+        if (esegui_operazioni_nodo(d, bit, j, dati_nodo + (size_t)inizio[s] * len, len, report_nodo + inizio[s],
+                                   gp_nodo ? gp_nodo + inizio[s] : NULL, ripetuti_nodo ? ripetuti_nodo + inizio[s] : NULL) == 0 ||
+            (d != s && esegui_operazioni_nodo(s, bit, j, dati_nodo + (size_t)inizio[s] * len, len, report_nodo + inizio[s],
+                                              gp_nodo ? gp_nodo + inizio[s] : NULL, ripetuti_nodo ? ripetuti_nodo + inizio[s] : NULL) == 0)) riuscite++;
+        else {
+            memset(report_nodo + inizio[s], 'E', j);
+            fallite++;
+        }
+    }
+    for (j = 0; j < n; j++) {
+        k = ordine[j];
+        report[k] = report_nodo[j];
+        if (greenP && report[k] == '1') greenP[k] = gp_nodo[j];
+        if (ripetuti) ripetuti[k] = ripetuti_nodo[j];
+    }
+
+fine:
+    free(nodo);
+    free(ordine);
+    free(dati_nodo);
+    free(report_nodo);
+    free(gp_nodo);
+    free(ripetuti_nodo);
+    return riuscite > 0 || fallite == 0 ? 0 : -1;
+}
+
+//Funzione che esegue le operazioni sul ServerV come esegui_operazioni_sv, misurando il tempo di andata e ritorno
+int operazioni_sv(char bit, int n, const char *dati, size_t len, char *report, GP *greenP, char *ripetuti) {
+    uint64_t inizio = metriche_adesso();
+    int esito = esegui_operazioni_sv(bit, n, dati, len, report, greenP, ripetuti);
+
+    metriche_registra_da(bit != '0' ? &metriche->sv_cerca : &metriche->sv_report, inizio);
+    if (esito < 0) metriche_conta(&metriche->sv_errori, 1);
+    return esito;
+}
+
+//Funzione che esegue una sola operazione sul ServerV. Restituisce 0 oppure -1 se il ServerV non è raggiungibile
+int operazione_sv(char bit, const void *dati, size_t len, char *report, GP *greenP) {
+    return operazioni_sv(bit, 1, dati, len, report, greenP, NULL);
+}
+
+//Thread che controlla periodicamente le connessioni libere del pool: quelle inattive da POOL_CONTROLLO secondi
+//ricevono il bit 2 (OP_PING con il protocollo a frame) a cui il ServerV risponde con lo stesso bit, quelle interrotte
+//vengono ristabilite. Con il protocollo a frame la riconnessione è compito del thread lettore: una connessione che
+//non risponde viene chiusa così che il lettore se ne accorga
+void *controllo_pool(void *arg) {
+    int i, riuscita;
+    char bit;
+    time_t adesso;
+    RETE r;
+    (void)arg;
+
+    for (;;) {
+        sleep(POOL_CONTROLLO);
+        for (i = 0; i < pool.n && !pool.compatibile; i++) {
+            pthread_mutex_lock(&pool.lock);
+            riuscita = pool.conn[i].fd < 0 || time(NULL) - pool.conn[i].ultimo_uso < POOL_CONTROLLO;
+            pthread_mutex_unlock(&pool.lock);
+            if (riuscita || richiesta_frame(i, OP_PING, NULL, 0, NULL, 0) == 0) continue;
+
+            pthread_mutex_lock(&pool.conn[i].invio);
+            if (pool.conn[i].fd >= 0) shutdown(pool.conn[i].fd, SHUT_RDWR);
+            pthread_mutex_unlock(&pool.conn[i].invio);
+        }
+        for (i = 0; i < pool.n && pool.compatibile; i++) {
+            pthread_mutex_lock(&pool.lock);
+            adesso = time(NULL);
+            if (pool.conn[i].occupata || (pool.conn[i].fd >= 0 && adesso - pool.conn[i].ultimo_uso < POOL_CONTROLLO)) {
+                pthread_mutex_unlock(&pool.lock);
+                continue;
+            }
+            pool.conn[i].occupata = 1;
+            pthread_mutex_unlock(&pool.lock);
+
+            riuscita = 0;
+            if (pool.conn[i].fd >= 0) {
+                bit = '2';
+                rete_inizia(&r, pool.conn[i].fd);
+                riuscita = rete_scrivi(&r, &bit, sizeof(char)) == 0 && rete_leggi(&r, &bit, sizeof(char)) == 0 && bit == '2';
+                if (!riuscita) {
+                    printf("Connessione %d del pool verso il ServerV interrotta, riconnessione\n", i);
+                    close(pool.conn[i].fd);
+                    pool.conn[i].fd = -1;
+                }
+            }
+            if (pool.conn[i].fd < 0) riuscita = (pool.conn[i].fd = apri_connessione_pool(pool.conn[i].nodo, NULL)) >= 0;
+            pool_rilascia(i, riuscita);
+        }
+    }
+    return NULL;
+}
+
+//Funzione che crea il pool di n connessioni persistenti verso ogni ServerV del cluster ed avvia il thread di controllo
+void avvia_pool(int n) {
+    pthread_t controllo, lettore;
+    int i;
+
+    pool.per_nodo = n;
+    pool.n = n = n * anello.n;
+    if ((pool.conn = calloc(n, sizeof(CONNESSIONE_SV))) == NULL) {
+        perror("calloc() error");
+        exit(1);
+    }
+    if ((pool.richieste = calloc(POOL_RICHIESTE, sizeof(RICHIESTA_SV))) == NULL) {
+        perror("calloc() error");
+        exit(1);
+    }
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.libera, NULL);
+    pthread_cond_init(&pool.riaperta, NULL);
+    for (i = 0; i < POOL_RICHIESTE; i++) pthread_cond_init(&pool.richieste[i].pronta, NULL);
+
+    //Le connessioni che non si riescono ad aprire ora verranno aperte al primo utilizzo, dal thread di controllo o,
+    //con il protocollo a frame, dal thread lettore della connessione
+    for (i = 0; i < n; i++) {
+        pthread_mutex_init(&pool.conn[i].invio, NULL);
+        pool.conn[i].nodo = i / pool.per_nodo;
+        pool.conn[i].fd = apri_connessione_pool(pool.conn[i].nodo, &pool.conn[i].canale);
+        pool.conn[i].ultimo_uso = time(NULL);
+        if (!pool.compatibile) {
+            if ((errno = pthread_create(&lettore, NULL, lettore_pool, (void *)(intptr_t)i)) != 0) {
+                perror("pthread_create() error");
+                exit(1);
+            }
+            pthread_detach(lettore);
+        }
+    }
+    if ((errno = pthread_create(&controllo, NULL, controllo_pool, NULL)) != 0) {
+        perror("pthread_create() error");
         exit(1);
     }
+    printf("Pool di %d connessioni verso %d ServerV (%s)\n", n, anello.n, pool.compatibile ? "vecchio protocollo" : pool.memoria ? "protocollo a frame, in memoria condivisa con i ServerV locali" : "protocollo a frame");
+}
+
+//Funzione che crea la cache delle verifiche in memoria condivisa, prima che vengano creati i processi figli
+void avvia_cache(int ttl) {
+    pthread_mutexattr_t attr;
+    int i;
 
-    //Ricezione del report dal ServerV
-    if (full_read(sock_fd, &report, sizeof(char)) < 0) {
-        perror("full_read() error");
+    if ((cache = mmap(NULL, sizeof(CACHE), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+        perror("mmap() error");
         exit(1);
     }
+    cache->ttl = ttl;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    for (i = 0; i < CACHE_STRISCE; i++) pthread_mutex_init(&cache->strisce[i].lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    printf("Cache delle verifiche: %d Green Pass, validità %d secondi\n", CACHE_VOCI, ttl);
+}
 
-    if (report == '1') {
-        //Ricezione dell'esito della verifica dal ServerV, se 0 non valido se 1 valido
-        if (full_read(sock_fd, &greenP, sizeof(GP)) < 0) {
-            perror("full_read() error");
-            exit(1);
-        }
+//Funzione che restituisce la posizione nella cache del codice indicato (hash FNV-1a)
+uint32_t cache_posizione(const char *cod_fisc) {
+    uint32_t h = 2166136261u;
+    int i;
 
-        close(sock_fd);
+    for (i = 0; i < COD_SIZE - 1 && cod_fisc[i]; i++) h = (h ^ (unsigned char)cod_fisc[i]) * 16777619u;
+    return h % CACHE_VOCI;
+}
 
-        //Funzione per ricavare la data corrente
-        creazione_dc(&data_corrente);
+//Funzione che blocca il lock delle voci che comprendono la posizione p. Un processo figlio terminato mentre
+//possedeva il lock non blocca gli altri: le voci protette vengono svuotate
+STRISCIA_CACHE *cache_blocca(uint32_t p) {
+    STRISCIA_CACHE *striscia = &cache->strisce[p % CACHE_STRISCE];
+    uint32_t i;
 
-     	//Se l'anno corrente è maggiore dell'anno di scadenza del Green Pass, quest'ultimo non è valido dunque assegniamo al report il valore di 0
-         //Se l'anno della scadenza del Green Pass è valido ma il mese corrente è maggiore del mese di scadenza, quest'ultimo non è valido e assegniamo al report il valore di 0
-         //Se l'anno e il mese della scadenza del Green Pass sono validi ma il giorno corrente è maggiore del giorno di scadenza, quest'ultimo non è valido e assegniamo al report il valore di 0
-        
-        if (data_corrente.anno > greenP.data_fine.anno) report = '0';
-        if (report == '1' && data_corrente.mese > greenP.data_fine.mese) report = '0';
-        if (report == '1' && data_corrente.giorno > greenP.data_fine.giorno) report = '0';
-        if (report == '1' && greenP.report == '0') report = '0'; //Se il Green Pass è valido temporalmente MA il report (esito del tampone) è negativo, allora il GP non è valido
+    if (pthread_mutex_lock(&striscia->lock) == EOWNERDEAD) {
+        for (i = p % CACHE_STRISCE; i < CACHE_VOCI; i += CACHE_STRISCE) cache->voci[i].esito = 0;
+        striscia->versione++;
+        pthread_mutex_consistent(&striscia->lock);
     }
+    return striscia;
+}
 
-    return report;
+//Funzione che cerca un codice nella cache. Restituisce 1 se è presente e non scaduto, salvando l'esito ricevuto dal
+//ServerV; altrimenti restituisce 0 e salva in versione il valore da passare a cache_inserisci
+int cache_cerca(const char *cod_fisc, char *esito, uint64_t *versione) {
+    uint32_t p = cache_posizione(cod_fisc);
+    STRISCIA_CACHE *striscia;
+    VOCE_CACHE *voce = &cache->voci[p];
+    int trovato;
+
+    striscia = cache_blocca(p);
+    trovato = voce->esito != 0 && voce->scadenza > time(NULL) && voce->giorno == data_oggi() && strncmp(voce->cod_fisc, cod_fisc, COD_SIZE - 1) == 0;
+    if (trovato) *esito = voce->esito;
+    *versione = striscia->versione;
+    pthread_mutex_unlock(&striscia->lock);
+    metriche_conta(trovato ? &metriche->cache_trovati : &metriche->cache_mancanti, 1);
+    return trovato;
+}
+
+//Funzione che salva nella cache l'esito ricevuto dal ServerV per un codice, se nel frattempo le voci non sono state
+//invalidate. La voce scade dopo ttl secondi e comunque alla mezzanotte, quando cambia il giorno della verifica
+void cache_inserisci(const char *cod_fisc, char esito, uint64_t versione) {
+    uint32_t p = cache_posizione(cod_fisc);
+    STRISCIA_CACHE *striscia;
+    VOCE_CACHE *voce = &cache->voci[p];
+
+    if (esito != '0' && esito != '1' && esito != '2') return;
+
+    striscia = cache_blocca(p);
+    if (striscia->versione == versione) {
+        strncpy(voce->cod_fisc, cod_fisc, COD_SIZE - 1);
+        voce->cod_fisc[COD_SIZE - 1] = 0;
+        voce->esito = esito;
+        voce->giorno = data_oggi();
+        voce->scadenza = time(NULL) + cache->ttl;
+    }
+    pthread_mutex_unlock(&striscia->lock);
+}
+
+//Funzione che rimuove un codice dalla cache dopo la modifica del suo report
+void cache_invalida(const char *cod_fisc) {
+    uint32_t p = cache_posizione(cod_fisc);
+    STRISCIA_CACHE *striscia;
+
+    striscia = cache_blocca(p);
+    if (strncmp(cache->voci[p].cod_fisc, cod_fisc, COD_SIZE - 1) == 0) cache->voci[p].esito = 0;
+    striscia->versione++;
+    pthread_mutex_unlock(&striscia->lock);
+}
+
+ //Funzione per la verifica del Green Pass. Riceve un codice fiscale della tessera sanitaria dal Client S, chiede al ServerV
+ //l'esito ed infine lo comunica al Client S: 1 valido, 0 scaduto o tampone positivo, 2 inesistente, F codice fiscale
+ //non valido (senza interrogare il ServerV), E se il ServerV non è raggiungibile
+
+char verifica_cd(char cod_fisc[]) {
+    char esito;
+    uint64_t versione;
+
+    if (!codice_valido(cod_fisc)) {
+        metriche_conta(&metriche->codici_non_validi, 1);
+        return 'F';
+    }
+
+    //Un codice verificato di recente viene verificato senza interrogare il ServerV; altrimenti invia il codice fiscale
+    //della tessera sanitaria ricevuto dal ClientS al SeverV con il bit 3, affinchè valuti la validità del Green Pass
+    //accanto all'archivio (data di scadenza e report), e riceve solo l'esito
+    if (cache == NULL || !cache_cerca(cod_fisc, &esito, &versione)) {
+        if (operazione_sv('3', cod_fisc, COD_SIZE, &esito, NULL) < 0) return 'E';
+        if (cache != NULL) cache_inserisci(cod_fisc, esito, versione);
+    }
+    return esito;
+}
+
+//Funzione per la verifica di n Green Pass con un'unica chiamata al ServerV: salva in esiti[k] l'esito del codice k
+//con gli stessi valori di verifica_cd
+void verifica_batch(int n, char (*codici)[COD_SIZE], char *esiti) {
+    char (*mancanti)[COD_SIZE], *ricevuti, *validi;
+    uint64_t *versioni;
+    int k, j, m = 0;
+
+    mancanti = malloc(n * COD_SIZE);
+    ricevuti = malloc(n);
+    validi = malloc(n);
+    versioni = malloc(n * sizeof(uint64_t));
+    if (mancanti == NULL || ricevuti == NULL || validi == NULL || versioni == NULL) {
+        memset(esiti, 'E', n);
+        goto fine;
+    }
+
+    //I codici non validi vengono scartati tutti insieme; al ServerV vengono richiesti solo i codici assenti dalla
+    //cache, che vengono poi salvati
+    codice_valida_molti(n, (char *)codici, COD_SIZE, validi);
+    for (k = 0; k < n; k++) {
+        if (!validi[k]) {
+            esiti[k] = 'F';
+            metriche_conta(&metriche->codici_non_validi, 1);
+            continue;
+        }
+        if (cache != NULL && cache_cerca(codici[k], &esiti[k], &versioni[m])) continue;
+        memcpy(mancanti[m++], codici[k], COD_SIZE);
+        esiti[k] = 0;
+    }
+    if (m > 0 && operazioni_sv('3', m, (char *)mancanti, COD_SIZE, ricevuti, NULL, NULL) < 0) {
+        for (k = 0; k < n; k++) if (esiti[k] == 0) esiti[k] = 'E';
+    } else {
+        for (k = j = 0; k < n; k++) {
+            if (esiti[k] != 0) continue;
+            esiti[k] = ricevuti[j];
+            if (cache != NULL) cache_inserisci(codici[k], ricevuti[j], versioni[j]);
+            j++;
+        }
+    }
+
+fine:
+    free(mancanti);
+    free(ricevuti);
+    free(validi);
+    free(versioni);
+}
+
+//Funzione che scrive in buffer (ACK_SIZE_CT byte) il messaggio per il ClientS corrispondente all'esito della verifica
+void risposta_verifica(char esito, char *buffer) {
+    memset(buffer, 0, ACK_SIZE_CT);
+    if (esito == '1') strcpy(buffer, "Il Green Pass è valido, operazione terminata!");
+    else if (esito == '0') strcpy(buffer, "Il Green Pass non è valido, operazione terminata!");
+    else if (esito == 'F') strcpy(buffer, "Codice fiscale della tessera sanitaria non valido");
+    else if (esito == 'E') strcpy(buffer, "Servizio di verifica non disponibile, riprovare");
+    else strcpy(buffer, "Il codice fiscale della tessera sanitaria è inesistente");
+}
+
+//Funzione che scrive in buffer (ACK_SIZE_CT byte) il messaggio per il ClientT corrispondente al report ricevuto dal
+//ServerV, con i tentativi ripetuti se il Green Pass è rimasto occupato
+void risposta_report(char report, int ripetuti, char *buffer) {
+    memset(buffer, 0, ACK_SIZE_CT);
+    if (report == 'E') strcpy(buffer, "Servizio non disponibile, riprovare");
+    else if (report == 'F') strcpy(buffer, "Codice fiscale della tessera sanitaria non valido");
+    else if (report == '1') strcpy(buffer, "Il codice fiscale della tessera sanitaria è inesistente");
+    else if (report == '3') snprintf(buffer, ACK_SIZE_CT, "Green Pass occupato, %d tentativi: riprovare", ripetuti);
+    else strcpy(buffer, "--- Operazione conclusa con successo ---");
 }
 
 //Funzione che gestisce la comunicazione con l'Utente
-void ricezione_cd(int connectfd) {
+void ricezione_cd(RETE *r) {
     char report, buffer[BUFF_MAX_SIZE], cod_fisc[COD_SIZE];
     int index, benvenuto, dim_pacchetto;
+    uint64_t ricevuta;
 
     //Stampa del messaggo di benvenuto da inviare al ClientS quando si connette ServerG
     snprintf(buffer, BENVENUTO, "--- Benvenuto nel ServerG ---\nInserire il codice fiscale della tessera per verificarne la validità");
     buffer[BENVENUTO - 1] = 0;
-    if(full_write(connectfd, buffer, BENVENUTO) < 0) {
-        perror("full_write() error");
-        exit(1);
+    if(rete_scrivi(r, buffer, BENVENUTO) < 0) {
+        perror("rete_scrivi() error");
+        return;
     }
 
     //Ricezione del codice fiscale dal Client S
-    if(full_read(connectfd, cod_fisc, COD_SIZE) < 0) {
-        perror("full_read error");
-        exit(1);
+    if(rete_leggi(r, cod_fisc, COD_SIZE) != 0) {
+        perror("rete_leggi() error");
+        return;
     }
+    ricevuta = metriche_adesso();
+    metriche_conta(&metriche->verifiche, 1);
 
-    //Notifica della corretta ricezione dei dati
+    //Notifica della corretta ricezione dei dati, che parte insieme all'esito
     snprintf(buffer, ACK_SIZE, "I dati sono stati ricevuti correttamente!");
     buffer[ACK_SIZE - 1] = 0;
-    if(full_write(connectfd, buffer, ACK_SIZE) < 0) {
-        perror("full_write() error");
-        exit(1);
+    if(rete_scrivi(r, buffer, ACK_SIZE) < 0) {
+        perror("rete_scrivi() error");
+        return;
     }
 
     //Funzione che invia il codice fiscale della tessera sanitaria al ServerV, riceve l'esito da quest'ultimo ed infine lo invia al Client S
     report = verifica_cd(cod_fisc);
 
     //Invio del report di validità del Green Pass al Client S
-    if (report == '1') {
-        strcpy(buffer, "Il Green Pass è valido, operazione terminata!");
-        if(full_write(connectfd, buffer, ACK_SIZE_CT) < 0) {
-            perror("full_write() error");
-            exit(1);
+    risposta_verifica(report, buffer);
+    if(rete_scrivi(r, buffer, ACK_SIZE_CT) < 0 || rete_invia(r) < 0) {
+        perror("rete_scrivi() error");
+        return;
+    }
+    metriche_registra_da(&metriche->risposta_verifica, ricevuta);
+}
+
+//Funzione che inoltra al ServerV il pacchetto ricevuto dal ClientT con il bit 0, affinchè modifichi il report del
+//Green Pass, e restituisce il report ricevuto dal ServerV oppure 'E' se il ServerV non è raggiungibile.
+//Per il report 3 (Green Pass occupato) in ripetuti vengono salvati i tentativi ripetuti dal ServerV
+char invio_report(REPORT pacchetto, int *ripetuti) {
+    char report, tentativi = 0;
+
+    if (operazioni_sv('0', 1, (char *)&pacchetto, sizeof(REPORT), &report, NULL, &tentativi) < 0) report = 'E';
+    *ripetuti = (unsigned char)tentativi;
+
+    //Anche se la risposta non è arrivata la modifica potrebbe essere avvenuta: il codice viene comunque rimosso dalla cache
+    if (cache != NULL) cache_invalida(pacchetto.cod_fisc);
+    return report;
+}
+
+void ricezione_report(RETE *r) {
+    REPORT pacchetto;
+    char report, buffer[BUFF_MAX_SIZE];
+    int ripetuti;
+    uint64_t ricevuta;
+
+
+   //Lettura dei dati del pacchetto REPORT inviato dal ClientT
+    if (rete_leggi(r, &pacchetto, sizeof(REPORT)) != 0) {
+        perror("rete_leggi() error");
+        return;
+    }
+    ricevuta = metriche_adesso();
+    metriche_conta(&metriche->modifiche, 1);
+
+    //Un codice fiscale non valido non viene inoltrato al ServerV
+    pacchetto.cod_fisc[COD_SIZE - 1] = 0;
+    if (!codice_valido(pacchetto.cod_fisc)) {
+        metriche_conta(&metriche->codici_non_validi, 1);
+        report = 'F';
+    } else report = invio_report(pacchetto, &ripetuti);
+    if (report == '3') metriche_conta(&metriche->report_occupati, 1);
+
+    risposta_report(report, ripetuti, buffer);
+    if(rete_scrivi(r, buffer, ACK_SIZE_CT) < 0 || rete_invia(r) < 0) {
+        perror("rete_scrivi() error");
+        return;
+    }
+    metriche_registra_da(&metriche->risposta_modifica, ricevuta);
+}
+
+//Funzione che gestisce un ClientS che verifica più Green Pass per volta (lettori automatici agli ingressi): per ogni
+//richiesta riceve il numero n di codici in network order seguito dagli n codici, e risponde con n esiti di un byte
+//(1 valido, 0 non valido, 2 inesistente, F codice fiscale non valido, E servizio non disponibile). Non ci sono benvenuto ed ACK e la connessione
+//resta aperta per altre richieste finché il ClientS non la chiude
+void ricezione_batch(RETE *r) {
+    char (*codici)[COD_SIZE], esiti[BATCH_MAX];
+    uint32_t n, k;
+    int esito;
+    uint64_t ricevuta;
+
+    if ((codici = malloc(BATCH_MAX * COD_SIZE)) == NULL) {
+        perror("malloc() error");
+        return;
+    }
+    while ((esito = rete_leggi(r, &n, sizeof(uint32_t))) == 0) {
+        n = ntohl(n);
+        if (n == 0 || n > BATCH_MAX) {
+            printf("Numero di codici non valido: %u\n", n);
+            break;
         }
-    } else if (report == '0') {
-        strcpy(buffer, "Il Green Pass non è valido, operazione terminata!");
-        if(full_write(connectfd, buffer, ACK_SIZE_CT) < 0) {
-            perror("full_write() error");
-            exit(1);
+        if (rete_leggi(r, codici, n * COD_SIZE) != 0) {
+            perror("rete_leggi() error");
+            break;
         }
-    } else {
-        strcpy(buffer, "Il codice fiscale della tessera sanitaria è inesistente");
-        if(full_write(connectfd, buffer, ACK_SIZE_CT) < 0) {
-            perror("full_write() error");
-            exit(1);
+        for (k = 0; k < n; k++) codici[k][COD_SIZE - 1] = 0;
+        ricevuta = metriche_adesso();
+        metriche_conta(&metriche->richieste_batch, 1);
+        metriche_conta(&metriche->verifiche, n);
+
+        verifica_batch(n, codici, esiti);
+        if (rete_scrivi(r, esiti, n) < 0) {
+            perror("rete_scrivi() error");
+            break;
         }
+        metriche_registra_da(&metriche->risposta_batch, ricevuta);
     }
+    if (esito < 0) perror("rete_leggi() error");
+    free(codici);
+}
 
-    close(connectfd);
+//Funzione che stampa le metriche sulla connessione della porta di amministrazione
+void stampa_metriche(FILE *f) {
+    char nome[64];
+    int i;
+
+    metriche_stampa_contatore(f, "connessioni", &metriche->connessioni);
+    metriche_stampa_contatore(f, "verifiche", &metriche->verifiche);
+    metriche_stampa_contatore(f, "modifiche", &metriche->modifiche);
+    metriche_stampa_contatore(f, "richieste_batch", &metriche->richieste_batch);
+    metriche_stampa_contatore(f, "cache_trovati", &metriche->cache_trovati);
+    metriche_stampa_contatore(f, "cache_mancanti", &metriche->cache_mancanti);
+    metriche_stampa_contatore(f, "sv_errori", &metriche->sv_errori);
+    metriche_stampa_contatore(f, "report_occupati", &metriche->report_occupati);
+    metriche_stampa_contatore(f, "codici_non_validi", &metriche->codici_non_validi);
+    metriche_stampa_istogramma(f, "risposta_verifica", &metriche->risposta_verifica);
+    metriche_stampa_istogramma(f, "risposta_modifica", &metriche->risposta_modifica);
+    metriche_stampa_istogramma(f, "risposta_batch", &metriche->risposta_batch);
+    metriche_stampa_istogramma(f, "sv_cerca", &metriche->sv_cerca);
+    metriche_stampa_istogramma(f, "sv_report", &metriche->sv_report);
+    metriche_stampa_istogramma(f, "attesa_pool", &metriche->attesa_pool);
+    for (i = 0; i < n_worker; i++) {
+        snprintf(nome, sizeof(nome), "worker_%d_connessioni", i);
+        metriche_stampa_contatore(f, nome, &metriche->worker[i].connessioni);
+        snprintf(nome, sizeof(nome), "worker_%d_aperte", i);
+        metriche_stampa_contatore(f, nome, &metriche->worker[i].aperte);
+        snprintf(nome, sizeof(nome), "worker_%d_richieste", i);
+        metriche_stampa_contatore(f, nome, &metriche->worker[i].richieste);
+        snprintf(nome, sizeof(nome), "worker_%d_giri", i);
+        metriche_stampa_contatore(f, nome, &metriche->worker[i].giri);
+    }
+}
+
+//Funzione che gestisce la connessione di un client, usata sia dai processi figli che dai thread della modalità con il pool
+void gestisci_client(int connectfd) {
+    char bit;
+    RETE r;
+
+		// Il ServerG riceve come primo messaggio un bit , il quale può assumere come valori 0, 1 o 2, per distinguere le connessioni
+       		// Se riceve 1, gestirà la connessione con il Client T
+       		// Se riceve 0, allora gestirà la connessione con il Client S
+       		// Se riceve 2, il Client S invierà più codici per volta
+
+    rete_inizia(&r, connectfd);
+    if (rete_leggi(&r, &bit, sizeof(char)) != 0) {
+        perror("rete_leggi() error");
+        return;
+    }
+    if (bit == '1') ricezione_report(&r);   //Ricezione delle informazioni dal ClientT
+    else if (bit == '0') ricezione_cd(&r);  //Ricezione delle informazioni dal ClientS
+    else if (bit == '2') ricezione_batch(&r); //Verifica di più codici inviati dal ClientS
+    else printf("Client non riconosciuto\n");
 }
 
-char invio_report(REPORT pacchetto) {
-    int sock_fd;
-    struct sockaddr_in serveraddr;
-    char bit, buffer[BUFF_MAX_SIZE], report;
+//Thread che gestisce un client nella modalità con il pool: le connessioni verso il ServerV sono condivise fra i thread
+void *thread_client(void *arg) {
+    int connectfd = (intptr_t)arg;
 
-    bit = '0';
+    gestisci_client(connectfd);
+    close(connectfd);
+    return NULL;
+}
 
-    //Creazione del descrittore del socket
-    if ((sock_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+//Funzione che crea il socket di ascolto sulla porta 1026. Con condivisa il socket usa SO_REUSEPORT e non si blocca:
+//più socket sulla stessa porta, uno per worker, ricevono ciascuno una parte delle connessioni. In caso di errore
+//termina il programma
+int apri_ascolto(int condivisa) {
+    int listenfd, riuso = 1;
+    struct sockaddr_in servaddr;
+
+    //Creazione descrizione del socket
+    if ((listenfd = socket(AF_INET, SOCK_STREAM | (condivisa ? SOCK_NONBLOCK : 0), 0)) < 0) {
         perror("socket() error");
         exit(1);
     }
 
-    
-    serveraddr.sin_family = AF_INET;
-    serveraddr.sin_port = htons(1025);
+    memset(&servaddr, 0, sizeof(servaddr));
+    servaddr.sin_family = AF_INET;
+    servaddr.sin_addr.s_addr = htonl(INADDR_ANY);
+    servaddr.sin_port = htons(1026);
 
-    //Conversione dell'indirizzo IP dal formato dotted decimal a stringa di bit
-    if (inet_pton(AF_INET, "127.0.0.1", &serveraddr.sin_addr) <= 0) {
-        perror("inet_pton() error");
+    //Permette di riavviare subito il ServerG anche se restano connessioni chiuse da poco sulla porta
+    if (setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &riuso, sizeof(riuso)) < 0 ||
+        (condivisa && setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, &riuso, sizeof(riuso)) < 0)) {
+        perror("setsockopt() error");
         exit(1);
     }
 
-    //Connessione con il server
-    if (connect(sock_fd, (struct sockaddr *)&serveraddr, sizeof(serveraddr)) < 0) {
-        perror("connect() error");
+    //Assegnazione della porta al server
+    if (bind(listenfd, (struct sockaddr *)&servaddr, sizeof(servaddr)) < 0) {
+        perror("bind() error");
         exit(1);
     }
 
-    //Invia un bit di valore 0 al ServerV per notificarlo che deve comunicare con il ServerV
-    if (full_write(sock_fd, &bit, sizeof(char)) < 0) {
-        perror("full_write() error");
+    //Mette il socket in modalità di ascolto in attesa di nuove connessioni
+    if (listen(listenfd, 1024) < 0) {
+        perror("listen() error");
         exit(1);
     }
+    return listenfd;
+}
 
-    //Invia un bit di valore 0 al ServerV per notificarlo che deve effettuare la modifica del report del Green Pass
-    if (full_write(sock_fd, &bit, sizeof(char)) < 0) {
-        perror("full_write() error");
-        exit(1);
+//Fasi della comunicazione con un client nella modalità ad eventi, le stesse di gestisci_client
+enum {
+    CLIENT_BIT,         //in attesa del bit che distingue il client
+    CLIENT_CODICE,      //in attesa del codice da verificare del ClientS
+    CLIENT_REPORT,      //in attesa del pacchetto REPORT del ClientT
+    CLIENT_BATCH,       //in attesa di una richiesta con più codici del ClientS
+    CLIENT_CONCLUSA     //risposta pronta, la connessione si chiude quando è stata inviata
+};
+
+//Stato di una connessione nella modalità ad eventi
+typedef struct CLIENT {
+    int fd;
+    int stato;
+    BUFFER ingresso;            //byte ricevuti, i primi letti sono già stati elaborati
+    size_t letti;
+    BUFFER uscita;              //risposte pronte da inviare, i primi inviati sono già stati inviati
+    size_t inviati;
+    uint32_t n;                 //codici della richiesta completa in attesa del giro, 0 se non ce n'è una
+    int chiusa;                 //il client ha chiuso la connessione: si chiude dopo aver risposto alle richieste ricevute
+    int rotta;                  //connessione da chiudere appena eseguito il giro
+    int scrittura;              //1 se la connessione attende l'evento di scrittura invece di quello di lettura
+    uint64_t ricevuta;          //istante della ricezione della richiesta, da cui si misura la risposta
+    struct CLIENT *prossimo;    //lista delle connessioni con una richiesta nel giro
+} CLIENT;
+
+//Richieste complete di un giro di eventi, copiate dalle connessioni ed eseguite sul ServerV dall'esecutore del worker
+typedef struct {
+    CLIENT *clienti;            //connessioni del giro, fuori dall'epoll finché il giro non è concluso
+    char (*codici)[COD_SIZE], *esiti;
+    REPORT *pacchetti, *validi;
+    char *report, *ripetuti;
+    int n_codici, n_report, n_validi;
+    int fallito;                //memoria esaurita: tutte le richieste del giro ricevono l'esito di errore
+} GIRO;
+
+//Parametri di un worker della modalità ad eventi. Il worker affida il giro al proprio esecutore, che lo esegue sul
+//ServerV senza toccare le connessioni e lo segnala concluso scrivendo sull'eventfd registrato nell'epoll
+typedef struct {
+    int id;
+    int listenfd;
+    int evento;                 //eventfd con cui l'esecutore segnala la fine del giro
+    pthread_mutex_t lock;
+    pthread_cond_t affidato;
+    int stato;                  //GIRO_LIBERO, GIRO_AFFIDATO o GIRO_ESEGUITO, protetto da lock
+    GIRO giro;
+} WORKER;
+
+enum {
+    GIRO_LIBERO,        //nessun giro in corso: il prossimo può essere affidato all'esecutore
+    GIRO_AFFIDATO,      //giro in esecuzione sul ServerV
+    GIRO_ESEGUITO       //giro eseguito, le risposte attendono di essere aggiunte alle connessioni dal worker
+};
+
+//Funzione che chiude una connessione della modalità ad eventi, rimuovendola automaticamente dall'epoll.
+//Una connessione con una richiesta nel giro viene chiusa quando il giro è stato eseguito
+void chiudi_client(int w, CLIENT *c) {
+    if (c->n > 0) {
+        c->rotta = 1;
+        return;
     }
+    metriche_conta(&metriche->worker[w].aperte, -1);
+    close(c->fd);
+    buffer_libera(&c->ingresso);
+    buffer_libera(&c->uscita);
+    free(c);
+}
 
-    //Invio del pacchetto ricevuto dal ClientT al ServerV
-    if (full_write(sock_fd, &pacchetto, sizeof(REPORT)) < 0) {
-        perror("full_write() error");
-        exit(1);
+//Funzione che elabora i byte ricevuti seguendo le stesse fasi di ricezione_cd, ricezione_report e ricezione_batch,
+//fino alla prima richiesta completa, che resta nel buffer ed attende il giro in c->n.
+//Restituisce 0 quando servono altri byte o la richiesta è completa, -1 se la connessione va chiusa
+int elabora_client(CLIENT *c) {
+    char buffer[BENVENUTO];
+    uint32_t n;
+    size_t disponibili;
+
+    while (c->n == 0) {
+        disponibili = c->ingresso.len - c->letti;
+        switch (c->stato) {
+        case CLIENT_BIT:
+            if (disponibili < sizeof(char)) return 0;
+            if (c->ingresso.dati[c->letti] == '1') c->stato = CLIENT_REPORT;
+            else if (c->ingresso.dati[c->letti] == '2') c->stato = CLIENT_BATCH;
+            else if (c->ingresso.dati[c->letti] == '0') {
+                //Messaggio di benvenuto per il ClientS
+                memset(buffer, 0, BENVENUTO);
+                snprintf(buffer, BENVENUTO, "--- Benvenuto nel ServerG ---\nInserire il codice fiscale della tessera per verificarne la validità");
+                if (buffer_aggiungi(&c->uscita, buffer, BENVENUTO) < 0) return -1;
+                c->stato = CLIENT_CODICE;
+            } else {
+                printf("Client non riconosciuto\n");
+                return -1;
+            }
+            c->letti += sizeof(char);
+            break;
+
+        case CLIENT_CODICE:
+            if (disponibili < COD_SIZE) return 0;
+            //Notifica della corretta ricezione dei dati, prima dell'esito
+            memset(buffer, 0, ACK_SIZE);
+            snprintf(buffer, ACK_SIZE, "I dati sono stati ricevuti correttamente!");
+            if (buffer_aggiungi(&c->uscita, buffer, ACK_SIZE) < 0) return -1;
+            c->n = 1;
+            break;
+
+        case CLIENT_REPORT:
+            if (disponibili < sizeof(REPORT)) return 0;
+            c->n = 1;
+            break;
+
+        case CLIENT_BATCH:
+            if (disponibili < sizeof(uint32_t)) return 0;
+            memcpy(&n, c->ingresso.dati + c->letti, sizeof(uint32_t));
+            n = ntohl(n);
+            if (n == 0 || n > BATCH_MAX) {
+                printf("Numero di codici non valido: %u\n", n);
+                return -1;
+            }
+            if (disponibili < sizeof(uint32_t) + (size_t)n * COD_SIZE) return 0;
+            c->letti += sizeof(uint32_t);
+            c->n = n;
+            break;
+
+        default:
+            return 0;
+        }
     }
+    return 0;
+}
 
-    //Ricezione del report dal ServerG
-    if (full_read(sock_fd, &report, sizeof(report)) < 0) {
-        perror("full_read() error");
-        exit(1);
+//Funzione che invia le risposte pronte senza bloccarsi: se il socket è pieno attende l'evento di scrittura.
+//Restituisce 1 se le risposte sono state inviate completamente, 0 se l'invio proseguirà con l'evento di scrittura,
+//-1 se la connessione è stata chiusa
+int invia_client(int w, int epfd, CLIENT *c) {
+    struct epoll_event ev;
+    ssize_t n;
+
+    while (c->inviati < c->uscita.len) {
+        if ((n = send(c->fd, c->uscita.dati + c->inviati, c->uscita.len - c->inviati, MSG_NOSIGNAL)) < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) {
+                if (!c->scrittura) {
+                    ev.events = EPOLLOUT;
+                    ev.data.ptr = c;
+                    if (epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev) < 0) break;
+                    c->scrittura = 1;
+                }
+                return 0;
+            }
+            break;
+        }
+        c->inviati += n;
+    }
+
+    if (c->inviati < c->uscita.len || ((c->stato == CLIENT_CONCLUSA || c->chiusa) && c->n == 0)) {
+        chiudi_client(w, c);
+        return -1;
+    }
+    c->uscita.len = c->inviati = 0;
+
+    //Se le risposte sono state completate dall'evento di scrittura si torna ad attendere la lettura
+    if (c->scrittura) {
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+        c->scrittura = 0;
     }
+    return 1;
+}
 
-    close(sock_fd);
+//Funzione che elabora i byte ricevuti ed invia le risposte pronte. Una connessione con una richiesta completa viene
+//aggiunta alla lista giro
+void servi_client(int w, int epfd, CLIENT *c, CLIENT **giro) {
+    int completa;
 
-    return report;
+    if (c->n == 0) {
+        if (elabora_client(c) < 0) {
+            chiudi_client(w, c);
+            return;
+        }
+        if (c->n > 0) {
+            c->ricevuta = metriche_adesso();
+            c->prossimo = *giro;
+            *giro = c;
+        }
+    }
+    completa = c->n > 0;
+    invia_client(w, epfd, c);
+
+    //La connessione con una richiesta completa esce dall'epoll fino alla fine del suo giro: un client che chiude o
+    //che ha già riempito il buffer di ricezione renderebbe il socket sempre pronto, e la richiesta non cambia
+    if (completa) epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
 }
 
-void ricezione_report(int connectfd) {
-    REPORT pacchetto;
-    char report, buffer[BUFF_MAX_SIZE];
+//Funzione che legge i byte disponibili sul socket senza bloccarsi.
+//Restituisce 0 se il socket è vuoto, -1 se il client ha chiuso la connessione o in caso di errore
+int ricevi_client(CLIENT *c) {
+    ssize_t n;
 
+    //I byte già elaborati vengono scartati per fare spazio a quelli nuovi
+    if (c->letti > 0) {
+        buffer_scarta(&c->ingresso, c->letti);
+        c->letti = 0;
+    }
 
-   //Lettura dei dati del pacchetto REPORT inviato dal ClientT
-    if (full_read(connectfd, &pacchetto, sizeof(REPORT)) < 0) {
-        perror("full_read() error");
-        exit(1);
+    //Oltre la richiesta più lunga del ClientS si smette di leggere: il resto verrà letto al prossimo evento
+    while (c->ingresso.len < sizeof(uint32_t) + BATCH_MAX * COD_SIZE) {
+        if (buffer_riserva(&c->ingresso, c->ingresso.len + CONN_BUFFER) < 0) return -1;
+        if ((n = recv(c->fd, c->ingresso.dati + c->ingresso.len, c->ingresso.cap - c->ingresso.len, 0)) < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN ? 0 : -1;
+        }
+        if (n == 0) return -1;
+        c->ingresso.len += n;
+    }
+    return 0;
+}
+
+//Funzione che prepara il giro g con le richieste complete ricevute dal worker w in un giro di eventi: i codici di
+//tutte le verifiche ed i pacchetti di tutte le modifiche del report vengono copiati dai buffer delle connessioni
+//nell'ordine della lista, così l'esecutore non legge le connessioni mentre il worker continua a servirle
+void prepara_giro(int w, GIRO *g, CLIENT *giro) {
+    CLIENT *c;
+    int k, j;
+
+    memset(g, 0, sizeof(GIRO));
+    g->clienti = giro;
+    for (c = giro; c != NULL; c = c->prossimo) {
+        if (c->stato == CLIENT_REPORT) g->n_report++;
+        else g->n_codici += c->n;
+    }
+    metriche_conta(&metriche->worker[w].richieste, g->n_codici + g->n_report);
+    metriche_conta(&metriche->worker[w].giri, 1);
+
+    g->fallito = (g->n_codici > 0 && ((g->codici = malloc((size_t)g->n_codici * COD_SIZE)) == NULL || (g->esiti = malloc(g->n_codici)) == NULL)) ||
+                 (g->n_report > 0 && ((g->pacchetti = malloc(g->n_report * sizeof(REPORT))) == NULL || (g->validi = malloc(g->n_report * sizeof(REPORT))) == NULL ||
+                                      (g->report = malloc(g->n_report)) == NULL || (g->ripetuti = calloc(g->n_report, sizeof(char))) == NULL));
+
+    for (c = giro, k = j = 0; c != NULL && !g->fallito; c = c->prossimo) {
+        if (c->stato == CLIENT_REPORT) memcpy(&g->pacchetti[j++], c->ingresso.dati + c->letti, sizeof(REPORT));
+        else {
+            memcpy(g->codici[k], c->ingresso.dati + c->letti, (size_t)c->n * COD_SIZE);
+            k += c->n;
+        }
+    }
+}
+
+//Funzione che esegue insieme le richieste del giro g: i codici di tutte le verifiche con un'unica verifica_batch e
+//tutte le modifiche del report con un'unica chiamata a operazioni_sv, così le connessioni del giro condividono le
+//richieste al ServerV. Viene eseguita dall'esecutore del worker e non tocca le connessioni
+void esegui_giro(GIRO *g) {
+    int k, j;
+
+    if (g->fallito) return;
+    if (g->n_codici > 0) {
+        for (k = 0; k < g->n_codici; k++) g->codici[k][COD_SIZE - 1] = 0;
+        metriche_conta(&metriche->verifiche, g->n_codici);
+        verifica_batch(g->n_codici, g->codici, g->esiti);
     }
 
-    report = invio_report(pacchetto);
+    //Come in ricezione_report, i codici fiscali non validi non vengono inoltrati al ServerV
+    if (g->n_report > 0) {
+        metriche_conta(&metriche->modifiche, g->n_report);
+        for (j = 0; j < g->n_report; j++) {
+            g->pacchetti[j].cod_fisc[COD_SIZE - 1] = 0;
+            if (codice_valido(g->pacchetti[j].cod_fisc)) g->validi[g->n_validi++] = g->pacchetti[j];
+            else metriche_conta(&metriche->codici_non_validi, 1);
+        }
+        if (g->n_validi > 0 && operazioni_sv('0', g->n_validi, (char *)g->validi, sizeof(REPORT), g->report, NULL, g->ripetuti) < 0) memset(g->report, 'E', g->n_validi);
+        for (j = 0; j < g->n_validi; j++) if (cache != NULL) cache_invalida(g->validi[j].cod_fisc);
+    }
+}
+
+//Funzione che aggiunge le risposte del giro g eseguito all'uscita di ogni connessione, che passa alla fase
+//successiva, e libera la memoria del giro
+void concludi_giro(GIRO *g) {
+    char buffer[ACK_SIZE_CT];
+    CLIENT *c;
+    int k, j, n_validi;
+
+    for (c = g->clienti, k = j = n_validi = 0; c != NULL; c = c->prossimo) {
+        if (c->stato == CLIENT_REPORT) {
+            if (g->fallito) risposta_report('E', 0, buffer);
+            else if (!codice_valido(g->pacchetti[j].cod_fisc)) risposta_report('F', 0, buffer);
+            else {
+                if (g->report[n_validi] == '3') metriche_conta(&metriche->report_occupati, 1);
+                risposta_report(g->report[n_validi], (unsigned char)g->ripetuti[n_validi], buffer);
+                n_validi++;
+            }
+            j++;
+            if (buffer_aggiungi(&c->uscita, buffer, ACK_SIZE_CT) < 0) c->rotta = 1;
+            metriche_registra_da(&metriche->risposta_modifica, c->ricevuta);
+            c->letti += sizeof(REPORT);
+            c->stato = CLIENT_CONCLUSA;
+        } else if (c->stato == CLIENT_CODICE) {
+            risposta_verifica(g->fallito ? 'E' : g->esiti[k], buffer);
+            k++;
+            if (buffer_aggiungi(&c->uscita, buffer, ACK_SIZE_CT) < 0) c->rotta = 1;
+            metriche_registra_da(&metriche->risposta_verifica, c->ricevuta);
+            c->letti += COD_SIZE;
+            c->stato = CLIENT_CONCLUSA;
+        } else {
+            //La connessione a gruppi resta in attesa di altre richieste
+            if (g->fallito ? buffer_riserva(&c->uscita, c->uscita.len + c->n) < 0 : buffer_aggiungi(&c->uscita, g->esiti + k, c->n) < 0) c->rotta = 1;
+            else if (g->fallito) {
+                memset(c->uscita.dati + c->uscita.len, 'E', c->n);
+                c->uscita.len += c->n;
+            }
+            k += c->n;
+            metriche_conta(&metriche->richieste_batch, 1);
+            metriche_registra_da(&metriche->risposta_batch, c->ricevuta);
+            c->letti += (size_t)c->n * COD_SIZE;
+        }
+    }
+
+    free(g->codici);
+    free(g->esiti);
+    free(g->pacchetti);
+    free(g->validi);
+    free(g->report);
+    free(g->ripetuti);
+}
+
+//Thread esecutore di un worker: esegue sul ServerV un giro alla volta, mentre il worker continua ad accettare
+//connessioni ed a ricevere richieste, poi lo segnala concluso sull'eventfd del worker
+void *esecutore(void *arg) {
+    WORKER *l = arg;
+    uint64_t uno = 1;
 
-    if (report == '1') {
-        strcpy(buffer, "Il codice fiscale della tessera sanitaria è inesistente");
-        if(full_write(connectfd, buffer, ACK_SIZE_CT) < 0) {
-            perror("full_write() error");
+    for (;;) {
+        pthread_mutex_lock(&l->lock);
+        while (l->stato != GIRO_AFFIDATO) pthread_cond_wait(&l->affidato, &l->lock);
+        pthread_mutex_unlock(&l->lock);
+
+        esegui_giro(&l->giro);
+
+        pthread_mutex_lock(&l->lock);
+        l->stato = GIRO_ESEGUITO;
+        pthread_mutex_unlock(&l->lock);
+        while (write(l->evento, &uno, sizeof(uno)) < 0 && errno == EINTR);
+    }
+    return NULL;
+}
+
+//Funzione che affida all'esecutore le richieste complete della lista giro. Le connessioni sono già fuori dall'epoll
+//(servi_client) e vi rientrano quando il giro è concluso: il worker non ne legge altri byte e non ne modifica i buffer
+void affida_giro(WORKER *l, CLIENT *giro) {
+    prepara_giro(l->id, &l->giro, giro);
+    pthread_mutex_lock(&l->lock);
+    l->stato = GIRO_AFFIDATO;
+    pthread_cond_signal(&l->affidato);
+    pthread_mutex_unlock(&l->lock);
+}
+
+//Funzione che conclude il giro eseguito dall'esecutore: le connessioni ricevono le risposte e tornano nell'epoll;
+//quelle che hanno già ricevuto la richiesta successiva vengono aggiunte alla lista giro
+void ritira_giro(WORKER *l, int epfd, CLIENT **giro) {
+    struct epoll_event ev;
+    CLIENT *c, *prossimo;
+    uint64_t eventi;
+
+    while (read(l->evento, &eventi, sizeof(eventi)) < 0 && errno == EINTR);
+    pthread_mutex_lock(&l->lock);
+    if (l->stato != GIRO_ESEGUITO) {
+        pthread_mutex_unlock(&l->lock);
+        return;
+    }
+    l->stato = GIRO_LIBERO;
+    pthread_mutex_unlock(&l->lock);
+
+    concludi_giro(&l->giro);
+    for (c = l->giro.clienti; c != NULL; c = prossimo) {
+        prossimo = c->prossimo;
+        c->n = 0;
+        ev.events = c->scrittura ? EPOLLOUT : EPOLLIN;
+        ev.data.ptr = c;
+        if (c->rotta || epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev) < 0) chiudi_client(l->id, c);
+        else servi_client(l->id, epfd, c, giro);
+    }
+}
+
+//Worker della modalità ad eventi: possiede il proprio socket di ascolto SO_REUSEPORT, un'epoll e le proprie
+//connessioni. Le richieste complete di un giro di eventi vengono inoltrate al ServerV insieme dall'esecutore del
+//worker; le richieste che si completano mentre un giro è in corso attendono il giro successivo. Le risposte vengono
+//inviate senza bloccarsi
+void *worker(void *arg) {
+    WORKER *l = arg;
+    struct epoll_event ev, eventi[EVENTI_MAX];
+    CLIENT *c, *giro = NULL;
+    cpu_set_t cpu;
+    pthread_t thread;
+    int epfd, connectfd, n, i, attivo = 1, libero = 1;
+
+    //Ogni worker viene assegnato ad un core diverso; l'esecutore, quasi sempre in attesa del ServerV, lo eredita
+    CPU_ZERO(&cpu);
+    CPU_SET(l->id % sysconf(_SC_NPROCESSORS_ONLN), &cpu);
+    if ((errno = pthread_setaffinity_np(pthread_self(), sizeof(cpu), &cpu)) != 0) perror("pthread_setaffinity_np() error");
+
+    if ((epfd = epoll_create1(0)) < 0) {
+        perror("epoll_create1() error");
+        exit(1);
+    }
+    if ((l->evento = eventfd(0, EFD_CLOEXEC)) < 0) {
+        perror("eventfd() error");
+        exit(1);
+    }
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, l->listenfd, &ev) < 0) {
+        perror("epoll_ctl() error");
+        exit(1);
+    }
+    ev.data.ptr = l;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, l->evento, &ev) < 0) {
+        perror("epoll_ctl() error");
+        exit(1);
+    }
+    pthread_mutex_init(&l->lock, NULL);
+    pthread_cond_init(&l->affidato, NULL);
+    l->stato = GIRO_LIBERO;
+    if ((errno = pthread_create(&thread, NULL, esecutore, l)) != 0) {
+        perror("pthread_create() error");
+        exit(1);
+    }
+
+    for (;;) {
+        if ((n = epoll_wait(epfd, eventi, EVENTI_MAX, -1)) < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait() error");
             exit(1);
         }
-    } else {
-        strcpy(buffer, "--- Operazione conclusa con successo ---");
-        if(full_write(connectfd, buffer, ACK_SIZE_CT) < 0) {
-            perror("full_write() error");
+
+        for (i = 0; i < n; i++) {
+            //Nuove connessioni sul socket di ascolto del worker
+            if (eventi[i].data.ptr == NULL) {
+                while ((connectfd = accept4(l->listenfd, NULL, NULL, SOCK_NONBLOCK)) >= 0) {
+                    if ((c = calloc(1, sizeof(CLIENT))) == NULL) {
+                        close(connectfd);
+                        continue;
+                    }
+                    c->fd = connectfd;
+                    c->stato = CLIENT_BIT;
+                    //Il benvenuto, l'ACK e l'esito vengono inviati appena pronti, senza attendere l'ACK TCP del precedente
+                    setsockopt(connectfd, IPPROTO_TCP, TCP_NODELAY, &attivo, sizeof(attivo));
+                    metriche_conta(&metriche->connessioni, 1);
+                    metriche_conta(&metriche->worker[l->id].connessioni, 1);
+                    metriche_conta(&metriche->worker[l->id].aperte, 1);
+                    ev.events = EPOLLIN;
+                    ev.data.ptr = c;
+                    if (epoll_ctl(epfd, EPOLL_CTL_ADD, connectfd, &ev) < 0) chiudi_client(l->id, c);
+                }
+                continue;
+            }
+
+            //Giro concluso dall'esecutore; le connessioni a gruppi possono avere già ricevuto la richiesta
+            //successiva, che entra nel giro seguente
+            if (eventi[i].data.ptr == l) {
+                ritira_giro(l, epfd, &giro);
+                libero = 1;
+                continue;
+            }
+
+            c = eventi[i].data.ptr;
+            if (c->scrittura) {
+                if (invia_client(l->id, epfd, c) == 1) servi_client(l->id, epfd, c, &giro);
+                continue;
+            }
+
+            //Se il client chiude dopo aver inviato le richieste complete, queste vengono comunque eseguite
+            if (ricevi_client(c) < 0) c->chiusa = 1;
+            servi_client(l->id, epfd, c, &giro);
+        }
+
+        //Le richieste complete ricevute finora vengono eseguite insieme, appena l'esecutore è libero
+        if (libero && giro != NULL) {
+            affida_giro(l, giro);
+            giro = NULL;
+            libero = 0;
+        }
+    }
+    return NULL;
+}
+
+//Funzione che avvia la modalità ad eventi con n worker, al posto di un processo o di un thread per ogni client.
+//I socket di ascolto vengono creati tutti prima di avviare i worker, così un errore termina subito il ServerG
+void avvia_eventi(int n) {
+    pthread_t *thread;
+    WORKER *worker_eventi;
+    int i;
+
+    thread = calloc(n, sizeof(pthread_t));
+    worker_eventi = calloc(n, sizeof(WORKER));
+    if (thread == NULL || worker_eventi == NULL) {
+        perror("calloc() error");
+        exit(1);
+    }
+    for (i = 0; i < n; i++) {
+        worker_eventi[i].id = i;
+        worker_eventi[i].listenfd = apri_ascolto(1);
+    }
+
+    printf("Modalità ad eventi con %d worker, ognuno con il proprio socket sulla porta 1026\n", n);
+    for (i = 0; i < n; i++) {
+        if ((errno = pthread_create(&thread[i], NULL, worker, &worker_eventi[i])) != 0) {
+            perror("pthread_create() error");
             exit(1);
         }
     }
+    for (i = 0; i < n; i++) pthread_join(thread[i], NULL);
 }
 
-int main() {
-    int listenfd, connectfd;
-    struct sockaddr_in servaddr;
+int main(int argc, char **argv) {
+    int listenfd, connectfd, opt, ttl = 0, porta_admin = PORTA_ADMIN, i;
+    char *file_anello = NULL;
     pid_t pid;
-    char bit;
+    pthread_t thread;
 
     signal(SIGINT,handler); //Cattura il segnale CTRL-C
-    
-//Creazione descrizione del socket
-    if ((listenfd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-        perror("socket() error");
-        exit(1);
+    signal(SIGPIPE, SIG_IGN); //Un client che chiude la connessione non deve terminare il ServerG
+
+    //Opzioni: -p numero di connessioni persistenti verso il ServerV; con il pool ogni client è gestito da un thread.
+    //-L usa sulle connessioni del pool il vecchio protocollo a byte invece di quello a frame;
+    //-c cache delle verifiche, con la validità in secondi di ogni voce;
+    //-a porta locale delle metriche (0 = disattivata);
+    //-s configurazione del cluster di ServerV (anello.h), altrimenti il solo ServerV 127.0.0.1:1025;
+    //-e modalità ad eventi con il numero di worker indicato (0 = uno per core), ognuno con il proprio socket di ascolto;
+    //-m canali in memoria condivisa sulle connessioni del pool verso i ServerV con un socket Unix (canale.h)
+    n_worker = -1;
+    while ((opt = getopt(argc, argv, "p:Lc:a:s:e:m")) != -1) {
+        if (opt == 'p') pool.n = atoi(optarg);
+        else if (opt == 'L') pool.compatibile = 1;
+        else if (opt == 'c') ttl = atoi(optarg);
+        else if (opt == 'a') porta_admin = atoi(optarg);
+        else if (opt == 's') file_anello = optarg;
+        else if (opt == 'e') n_worker = atoi(optarg);
+        else if (opt == 'm') pool.memoria = 1;
+        else {
+            fprintf(stderr, "usage: %s [-p connessioni verso ogni ServerV] [-L] [-c validità cache in secondi] [-a porta metriche] [-s cluster] [-e worker] [-m]\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (n_worker == 0) n_worker = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n_worker > WORKER_MAX) n_worker = WORKER_MAX;
+    //I worker non possono bloccarsi su una connessione verso il ServerV aperta per ogni operazione: senza -p usano
+    //un pool con una connessione per worker
+    if (n_worker > 0 && pool.n == 0) pool.n = n_worker;
+    if (n_worker < 0) n_worker = 0;
+    if (pool.memoria && (pool.n == 0 || pool.compatibile)) {
+        printf("I canali in memoria condivisa richiedono il pool con il protocollo a frame: -m ignorata\n");
+        pool.memoria = 0;
     }
 
-    
-    servaddr.sin_family = AF_INET;
-    servaddr.sin_addr.s_addr = htonl(INADDR_ANY);
-    servaddr.sin_port = htons(1026);
-
-    //Assegnazione della porta al server
-    if (bind(listenfd, (struct sockaddr *)&servaddr, sizeof(servaddr)) < 0) {
-        perror("bind() error");
+    //ServerV a cui inviare le operazioni di ogni codice
+    if ((file_anello ? anello_carica(&anello, file_anello) : anello_singolo(&anello, "127.0.0.1", 1025)) < 0) {
+        perror("anello_carica() error");
         exit(1);
     }
+    if (file_anello != NULL) {
+        for (i = 0; i < anello.n; i++) {
+            if (anello.nodi[i].primario >= 0) printf("ServerV %s: %s:%d, replica di %s\n", anello.nodi[i].nome, anello.nodi[i].host, anello.nodi[i].porta, anello.nodi[anello.nodi[i].primario].nome);
+            else printf("ServerV %s: %s:%d, peso %d\n", anello.nodi[i].nome, anello.nodi[i].host, anello.nodi[i].porta, anello.nodi[i].peso);
+        }
+    }
 
-    //Mette il socket in modalità di ascolto in attesa di nuove connessioni
-    if (listen(listenfd, 1024) < 0) {
-        perror("listen() error");
+    //Le metriche vengono create prima del pool e dei processi figli, la porta di amministrazione è servita da un
+    //thread del processo padre
+    if ((metriche = metriche_crea(sizeof(METRICHE))) == NULL) {
+        perror("metriche_crea() error");
+        exit(1);
+    }
+    //Il giorno corrente usato per le verifiche viene aggiornato da un thread del processo padre
+    if (data_avvia() < 0) {
+        perror("data_avvia() error");
         exit(1);
     }
+    if (porta_admin > 0 && metriche_avvia_admin(porta_admin, stampa_metriche) < 0) perror("metriche_avvia_admin() error");
+    else if (porta_admin > 0) printf("Metriche sulla porta locale %d\n", porta_admin);
+    if (pool.n > 0) avvia_pool(pool.n);
+    if (ttl > 0) avvia_cache(ttl);
+    if (n_worker > 0) {
+        avvia_eventi(n_worker);
+        exit(0);
+    }
+    listenfd = apri_ascolto(0);
 
     for (;;) {
     printf("In attesa di Green Pass da verificare\n");
@@ -367,6 +1739,16 @@ int main() {
             perror("accept() error");
             exit(1);
         }
+        metriche_conta(&metriche->connessioni, 1);
+
+        //Con il pool attivo il client viene gestito da un thread, che condivide le connessioni verso il ServerV
+        if (pool.n > 0) {
+            if ((errno = pthread_create(&thread, NULL, thread_client, (void *)(intptr_t)connectfd)) != 0) {
+                perror("pthread_create() error");
+                close(connectfd);
+            } else pthread_detach(thread);
+            continue;
+        }
 
         //Creazione del processo figlio;
         if ((pid = fork()) < 0) {
@@ -377,19 +1759,7 @@ int main() {
         if (pid == 0) {
             close(listenfd);
 
-            
-
-		// Il ServerG riceve come primo messaggio un bit , il quale può assumere come valori 0 o 1, per distinguere due connessioni diverse
-       		// Se riceve 1, il processo figlio gestirà la connessione con il Client T
-       		// Se riceve 0, allora il processo figlio gestirà la connessione con il Client S
-
-            if (full_read(connectfd, &bit, sizeof(char)) < 0) {
-                perror("full_read() error");
-                exit(1);
-            }
-            if (bit == '1') ricezione_report(connectfd);   //Ricezione delle informazioni dal ClientT
-            else if (bit == '0') ricezione_cd(connectfd);  //Ricezione delle informazioni dal ClientS
-            else printf("Client non riconosciuto\n");
+            gestisci_client(connectfd);
 
             close(connectfd);
             exit(0);
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE     //necessario per accept4 e per l'affinità dei thread
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -9,10 +10,43 @@
 #include <sys/types.h>
 #include <sys/socket.h> //contiene le definizioni dei socket.
 #include <arpa/inet.h>  // contiene le definizioni per le operazioni Internet.
+#include <netinet/tcp.h>  //contiene le opzioni del protocollo TCP
 #include <time.h>
 #include <signal.h>     //contiene le costanti per la gestione dei segnali fra processi.
+#include <stddef.h>
+#include <dirent.h>     //contiene le definizioni per la lettura delle directory
+#include <pthread.h>
+#include <sched.h>
+#include <endian.h>     //conversione degli interi a 64 bit in network order
+#include <sys/epoll.h>  //contiene le definizioni per la gestione degli eventi sui descrittori
+#include <sys/un.h>     //contiene le definizioni dei socket Unix
+#include <poll.h>
+#include "greenpass.h"  //record del Green Pass condiviso con il Centro Vaccinale ed il ServerG
+#include "archivio.h"   //archivio dei Green Pass mappato in memoria
+#include "wal.h"        //write-ahead log delle modifiche all'archivio
+#include "protocollo.h" //protocollo a frame con il ServerG
+#include "bloom.h"      //filtro di Bloom sui codici presenti nell'archivio
+#include "metriche.h"   //contatori ed istogrammi delle latenze esposti sulla porta di amministrazione
+#include "anello.h"     //indirizzo del primario di una replica
+#include "uring.h"      //io_uring per la modalità ad eventi senza una chiamata di sistema per ogni recv e send
+#include "rete.h"       //lettura e scrittura bufferizzate dei messaggi a campi
+#include "canale.h"     //canale in memoria condivisa con un ServerG sulla stessa macchina
 #define BUFF_MAX_SIZE 2048   //dimensione massima del buffer
 #define COD_SIZE 17        //dimensione del codice di tessera sanitaria 16 byte ed 1 del terminatore
+#define WAL_INSERIMENTO 1  //record del WAL: Green Pass ricevuto dal Centro Vaccinale
+#define WAL_REPORT 2       //record del WAL: modifica del report richiesta dal ClientT
+#define WAL_POSIZIONE 3    //record del WAL di una replica: LSN del primario fino al quale i record sono applicati
+#define EVENTI_MAX 256     //eventi restituiti da una singola epoll_wait
+#define URING_VOCI 1024    //richieste che un thread della modalità io_uring può preparare in un giro
+#define BLOOM_BIT 10       //bit del filtro di Bloom per ogni Green Pass (circa 1% di falsi positivi)
+#define CONN_BUFFER 4096   //spazio libero minimo per ogni lettura di una connessione nella modalità ad eventi
+#define REPORT_TENTATIVI 16 //tentativi ripetuti di acquisire un Green Pass modificato da un'altra richiesta
+#define PORTA_ADMIN 1125   //porta locale delle metriche
+#define PORTA 1025         //porta predefinita del ServerV
+#define ELENCA_MAX 4096    //Green Pass inviati in ogni risposta OP_ELENCA
+#define REPLICA_LOTTO (256 * 1024) //byte di record del WAL inviati ad una replica in ogni frame
+#define REPLICA_BATTITO 1000 //millisecondi fra due frame inviati ad una replica anche senza record
+#define REPLICA_PAUSA_MAX 8000 //attesa massima in millisecondi prima di ricollegarsi al primario
 
 //Struct del pacchetto del ClientT 
 typedef struct  {
@@ -27,253 +61,2002 @@ typedef struct {
     int anno;
 } DATE;
 
-//Struct del pacchetto inviato dal Centro Vaccinale al ServerV
+//Green Pass nel formato precedente, con il codice e le date in chiaro: serve solo per convertire gli archivi, le
+//cartelle con un file per tessera ed i record del WAL scritti prima del formato compresso di greenpass.h
 typedef struct {
     char cod_fisc[COD_SIZE];
     char report; //0 Green Pass non valido, 1 Green Pass valido
     DATE data_inizio;		//data di inizio validità del Green Pass
     DATE data_fine;			//data di fine validità del Green Pass
-} GP;
+} GP_VECCHIO;
 
-//Legge esattamente count byte s iterando opportunamente le letture
-ssize_t full_read(int fd, void *buffer, size_t count) {
-    size_t n_left;
-    ssize_t n_read;
-    n_left = count;
-    while (n_left > 0) {  // ciclo ripetuto fintanto che non vengono letti tutti i bytes
-        if ((n_read = read(fd, buffer, n_left)) < 0) {
-            if (errno == EINTR) continue; // errno=codice di errore dell'ultima System Call
-            else exit(n_read);
-        } else if (n_read == 0) break; // se sono 0 si chiude il descrittore,si esce dal ciclo e viene restituito n_left
-        n_left -= n_read;
-        buffer += n_read;
+_Static_assert(ARCHIVIO_CHIAVE == GP_CODICE, "la chiave dell'archivio è il codice compresso");
+
+//Metriche del ServerV, condivise dai processi figli e dai thread. Le latenze delle risposte partono dalla ricezione
+//della richiesta; quelle durevoli includono l'attesa del WAL
+typedef struct {
+    uint64_t connessioni;
+    uint64_t inserimenti;           //Green Pass ricevuti dal Centro Vaccinale o con OP_INSERISCI
+    uint64_t ricerche;
+    uint64_t report;
+    uint64_t report_occupati;       //modifiche rifiutate perché il Green Pass è rimasto occupato
+    uint64_t ping;
+    uint64_t errori;                //richieste non valide
+    uint64_t repliche;              //repliche collegate a questo ServerV
+    uint64_t canali;                //canali in memoria condivisa aperti dai ServerG
+    uint64_t uring_chiamate;        //chiamate io_uring_enter dei thread della modalità io_uring
+    ISTOGRAMMA connessione_cv;      //dall'accept alla chiusura della connessione del Centro Vaccinale
+    ISTOGRAMMA risposta_immediata;  //ricerche, ping e report di codici inesistenti
+    ISTOGRAMMA risposta_durevole;   //inserimenti e report, dopo l'attesa del WAL
+    ISTOGRAMMA ricerca;             //filtro di Bloom e ricerca nell'archivio
+    ISTOGRAMMA attesa_archivio;     //attesa del lock dell'archivio in registra_gp
+    ISTOGRAMMA attesa_report;       //acquisizione del Green Pass in registra_report, tentativi compresi
+    ISTOGRAMMA wal;                 //attesa della sincronizzazione del WAL
+} METRICHE;
+
+//Stato di una replica, aggiornato dal thread di replica del processo padre e letto dalla porta di amministrazione
+typedef struct {
+    ANELLO primario;                //indirizzo del primario
+    char posizione[1024];           //file in cui viene salvato lsn ad ogni checkpoint
+    uint64_t lsn;                   //LSN del primario fino al quale i record sono applicati
+    int valida;                     //0 se lsn non è noto: serve una copia completa dell'archivio del primario
+    uint64_t lsn_primario;          //LSN durevole del primario indicato nell'ultimo frame ricevuto
+    uint64_t allineata;             //ultimo istante in cui la replica era allineata al primario
+    uint64_t collegata;
+    uint64_t copie;                 //copie complete dell'archivio del primario
+    uint64_t record;                //record del WAL del primario applicati
+} REPLICA;
+
+//Archivio che contiene tutti i Green Pass ed il log delle sue modifiche, condivisi dai processi figli
+ARCHIVIO archivio;
+WAL wal;
+BLOOM *filtro;
+pid_t pid_padre;
+int tentativi_report = REPORT_TENTATIVI;
+METRICHE *metriche;
+uint64_t accettata;     //istante dell'accept della connessione servita dal processo figlio
+int sola_lettura;       //1 per una replica: inserimenti e modifiche del report vengono rifiutati
+REPLICA replica;
+
+
+//Funzione che stampa l'occupazione di memoria del filtro di Bloom e la sua probabilità di falso positivo, stimata e
+//osservata sulle ricerche dei codici inesistenti
+void stampa_filtro() {
+    printf("Filtro di Bloom: %llu KB, %u bit impostati per codice, %llu codici, falsi positivi stimati %.3f%%\n",
+           (unsigned long long)bloom_memoria(filtro) / 1024, filtro->k, (unsigned long long)filtro->inseriti, bloom_fpr_stimata(filtro) * 100);
+    printf("Ricerche di codici inesistenti: %llu escluse dal filtro, %llu falsi positivi (%.3f%%)\n",
+           (unsigned long long)filtro->negativi, (unsigned long long)filtro->falsi_positivi, bloom_fpr_osservata(filtro) * 100);
+}
+
+//Funzione che costruisce il filtro di Bloom con tutti i codici dell'archivio, dimensionato per capacita Green Pass
+void costruisci_filtro(uint64_t capacita) {
+    uint64_t n, n_record = archivio_dimensione(&archivio);
+
+    if (capacita < 2 * n_record) capacita = 2 * n_record;
+    if ((filtro = bloom_crea(capacita, BLOOM_BIT)) == NULL) {
+        perror("bloom_crea() error");
+        exit(1);
+    }
+    for (n = 0; n < n_record; n++) bloom_aggiungi(filtro, archivio_hash(archivio_record(&archivio, n)));
+    stampa_filtro();
+}
+
+//Funzione che stampa lo stato di una replica: il ritardo in byte è la parte del WAL del primario non ancora applicata,
+//quello in millisecondi il tempo trascorso da quando la replica era allineata, 0 se lo è ancora
+void stampa_replica(FILE *f) {
+    uint64_t lsn = __atomic_load_n(&replica.lsn, __ATOMIC_RELAXED), primario = __atomic_load_n(&replica.lsn_primario, __ATOMIC_RELAXED);
+    uint64_t collegata = __atomic_load_n(&replica.collegata, __ATOMIC_RELAXED), byte = primario > lsn ? primario - lsn : 0;
+    uint64_t ms = collegata && byte == 0 ? 0 : (metriche_adesso() - __atomic_load_n(&replica.allineata, __ATOMIC_RELAXED)) / 1000000;
+
+    metriche_stampa_contatore(f, "replica_collegata", &collegata);
+    metriche_stampa_contatore(f, "replica_lsn", &lsn);
+    metriche_stampa_contatore(f, "replica_lsn_primario", &primario);
+    metriche_stampa_contatore(f, "replica_ritardo_byte", &byte);
+    metriche_stampa_contatore(f, "replica_ritardo_ms", &ms);
+    metriche_stampa_contatore(f, "replica_record", &replica.record);
+    metriche_stampa_contatore(f, "replica_copie", &replica.copie);
+}
+
+//Funzione che stampa le metriche sulla connessione della porta di amministrazione
+void stampa_metriche(FILE *f) {
+    metriche_stampa_contatore(f, "connessioni", &metriche->connessioni);
+    metriche_stampa_contatore(f, "inserimenti", &metriche->inserimenti);
+    metriche_stampa_contatore(f, "ricerche", &metriche->ricerche);
+    metriche_stampa_contatore(f, "report", &metriche->report);
+    metriche_stampa_contatore(f, "report_occupati", &metriche->report_occupati);
+    metriche_stampa_contatore(f, "ping", &metriche->ping);
+    metriche_stampa_contatore(f, "errori", &metriche->errori);
+    metriche_stampa_contatore(f, "repliche", &metriche->repliche);
+    metriche_stampa_contatore(f, "canali", &metriche->canali);
+    metriche_stampa_contatore(f, "uring_chiamate", &metriche->uring_chiamate);
+    metriche_stampa_contatore(f, "bloom_negativi", &filtro->negativi);
+    metriche_stampa_contatore(f, "bloom_falsi_positivi", &filtro->falsi_positivi);
+    metriche_stampa_istogramma(f, "connessione_cv", &metriche->connessione_cv);
+    metriche_stampa_istogramma(f, "risposta_immediata", &metriche->risposta_immediata);
+    metriche_stampa_istogramma(f, "risposta_durevole", &metriche->risposta_durevole);
+    metriche_stampa_istogramma(f, "ricerca", &metriche->ricerca);
+    metriche_stampa_istogramma(f, "attesa_archivio", &metriche->attesa_archivio);
+    metriche_stampa_istogramma(f, "attesa_report", &metriche->attesa_report);
+    metriche_stampa_istogramma(f, "wal", &metriche->wal);
+    if (sola_lettura) stampa_replica(f);
+}
+
+//Funzione che cerca il Green Pass associato al codice. I codici esclusi dal filtro di Bloom non vengono cercati
+//nell'archivio. Restituisce 1 se il Green Pass esiste, 0 altrimenti
+int cerca_gp(const char *cod_fisc, GP *greenP) {
+    char chiave[ARCHIVIO_CHIAVE];
+    int trovato;
+    uint64_t inizio = metriche_adesso();
+
+    metriche_conta(&metriche->ricerche, 1);
+    //Un codice che non si può comprimere non può essere nell'archivio
+    if (gp_codifica((uint8_t *)chiave, cod_fisc) < 0 || !bloom_contiene(filtro, archivio_hash(chiave))) {
+        __atomic_fetch_add(&filtro->negativi, 1, __ATOMIC_RELAXED);
+        metriche_registra_da(&metriche->ricerca, inizio);
+        return 0;
+    }
+    if ((trovato = archivio_cerca(&archivio, chiave, greenP)) < 0) {
+        perror("archivio_cerca() error");
+        exit(1);
     }
-    buffer = 0;
-    return n_left;
+    if (!trovato) __atomic_fetch_add(&filtro->falsi_positivi, 1, __ATOMIC_RELAXED);
+    metriche_registra_da(&metriche->ricerca, inizio);
+    return trovato;
 }
 
+//Funzione che cerca n codici insieme, il k-esimo in codici + k * COD_SIZE, salvando in trovati[k] 1 se il Green Pass
+//esiste, copiato in greenP[k], altrimenti 0. Prima vengono calcolati tutti gli hash anticipando il caricamento dei
+//blocchi del filtro di Bloom, poi i codici ammessi dal filtro vengono cercati con archivio_cerca_molti, che sovrappone
+//le attese della memoria delle diverse ricerche. Restituisce 0 oppure -1 se la memoria non è sufficiente
+int cerca_molti(int n, const char *codici, GP *greenP, int *trovati) {
+    char (*chiavi)[ARCHIVIO_CHIAVE];
+    uint64_t *hash, inizio = metriche_adesso();
+    int *posizioni, *esiti, k, j, m = 0, negativi = 0, falsi_positivi = 0;
+    GP *ricevuti;
 
-//Scrive esattamente count byte s iterando opportunamente le scritture
-ssize_t full_write(int fd, const void *buffer, size_t count) {
-    size_t n_left;
-    ssize_t n_written;
-    n_left = count;
-    while (n_left > 0) {          // ciclo ripetuto fintanto che non vengono scritti tutti i bytes
-        if ((n_written = write(fd, buffer, n_left)) < 0) {
-            if (errno == EINTR) continue; //errno=codice di errore dell'ultima System Call
-            else exit(n_written); //Se non è una System Call, esci con un errore
+    chiavi = malloc((size_t)n * ARCHIVIO_CHIAVE);
+    hash = malloc(n * sizeof(uint64_t));
+    posizioni = malloc(n * sizeof(int));
+    esiti = malloc(n * sizeof(int));
+    ricevuti = malloc(n * sizeof(GP));
+    if (chiavi == NULL || hash == NULL || posizioni == NULL || esiti == NULL || ricevuti == NULL) {
+        free(chiavi);
+        free(hash);
+        free(posizioni);
+        free(esiti);
+        free(ricevuti);
+        return -1;
+    }
+
+    //Un codice che non si può comprimere non può essere nell'archivio
+    for (k = 0; k < n; k++) {
+        trovati[k] = 0;
+        if (gp_codifica((uint8_t *)chiavi[m], codici + (size_t)k * COD_SIZE) < 0) {
+            negativi++;
+            continue;
+        }
+        hash[m] = archivio_hash(chiavi[m]);
+        bloom_anticipa(filtro, hash[m]);
+        posizioni[m++] = k;
+    }
+    for (k = j = 0; k < m; k++) {
+        if (!bloom_contiene(filtro, hash[k])) {
+            negativi++;
+            continue;
         }
-        n_left -= n_written;
-        buffer += n_written;
+        memcpy(chiavi[j], chiavi[k], ARCHIVIO_CHIAVE);
+        hash[j] = hash[k];
+        posizioni[j++] = posizioni[k];
     }
-    buffer = 0;
-    return n_left;
+    if (archivio_cerca_molti(&archivio, j, (char *)chiavi, hash, ricevuti, esiti) < 0) {
+        perror("archivio_cerca_molti() error");
+        exit(1);
+    }
+    for (k = 0; k < j; k++) {
+        if (!esiti[k]) falsi_positivi++;
+        else greenP[posizioni[k]] = ricevuti[k];
+        trovati[posizioni[k]] = esiti[k];
+    }
+
+    __atomic_fetch_add(&filtro->negativi, negativi, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&filtro->falsi_positivi, falsi_positivi, __ATOMIC_RELAXED);
+    metriche_conta(&metriche->ricerche, n);
+    metriche_registra_n(&metriche->ricerca, (metriche_adesso() - inizio) / n, n);
+    free(chiavi);
+    free(hash);
+    free(posizioni);
+    free(esiti);
+    free(ricevuti);
+    return 0;
 }
 
+//Funzione che valuta accanto all'archivio la validità del Green Pass associato al codice nel giorno corrente (data
+//di scadenza e report). Restituisce '1' se è valido, '0' se è scaduto o il tampone è positivo, '2' se non esiste
+char verifica_gp(const char *cod_fisc) {
+    GP greenP;
+
+    if (!cerca_gp(cod_fisc, &greenP)) return '2';
+    return '0' + gp_valido(&greenP, data_oggi());
+}
 
+//Thread del processo padre che attende il segnale CTRL-C e stampa un messaggio di arrivederci. SIGINT è bloccato in
+//tutti gli altri thread, quindi il checkpoint viene eseguito fuori da un handler: un thread interrotto mentre possiede
+//il lock del WAL non potrebbe riprenderlo dall'handler senza bloccarsi
+void *thread_uscita(void *arg) {
+    sigset_t *segnali = arg;
+    int sign;
 
-//Handler che cattura il segnale CTRL-C e stampa un messaggio di arrivederci.
-void handler (int sign){
-    if (sign == SIGINT) {
-        printf("\nUscita in corso...\n");
-        sleep(2); //attende 2 secondi prima della prossima operazione
-        printf("***Grazie per aver utilizzato il nostro servizio***\n");
-        exit(0);
+    while (sigwait(segnali, &sign) != 0 || sign != SIGINT);
+    printf("\nUscita in corso...\n");
+
+    //Il processo padre rende durevole l'archivio e svuota il log, così al riavvio non c'è nulla da ripristinare
+    if (wal_checkpoint(&wal) < 0) perror("wal_checkpoint() error");
+    stampa_filtro();
+    sleep(2); //attende 2 secondi prima della prossima operazione
+    printf("***Grazie per aver utilizzato il nostro servizio***\n");
+    exit(0);
+}
+
+//Funzione che inserisce un Green Pass nell'archivio e lo registra nel WAL, restituendo l'LSN che deve essere durevole
+//prima di rispondere. La registrazione avviene mentre si possiede il lock dell'archivio, così l'ordine del log
+//coincide con quello delle modifiche
+int64_t registra_gp(GP *greenP) {
+    int64_t lsn;
+    uint64_t inizio;
+
+    //Il codice entra nel filtro prima che il Green Pass sia visibile nell'archivio, così una ricerca concorrente
+    //non può essere esclusa dal filtro dopo averlo trovato
+    bloom_aggiungi(filtro, archivio_hash((char *)greenP->codice));
+    metriche_conta(&metriche->inserimenti, 1);
+    inizio = metriche_adesso();
+    if (archivio_blocca(&archivio) < 0) {
+        perror("archivio_blocca() error");
+        exit(1);
+    }
+    metriche_registra_da(&metriche->attesa_archivio, inizio);
+    if (archivio_inserisci_bloccato(&archivio, greenP) < 0) {
+        perror("archivio_inserisci() error");
+        exit(1);
     }
+    if ((lsn = wal_scrivi(&wal, WAL_INSERIMENTO, greenP, sizeof(GP))) < 0) {
+        perror("wal_scrivi() error");
+        exit(1);
+    }
+    archivio_sblocca(&archivio);
+    return lsn;
 }
 
-//Funzione che invia un GP richiesto dal ServerG
-void invio_gp(int connectfd) {
+//Funzione che assegna al Green Pass n dell'archivio, acquisito dal chiamante, il report ricevuto dal ClientT: viene
+//scritto il solo byte dei flag
+void assegna_report(uint64_t n, char report) {
+    uint8_t *flags = (uint8_t *)archivio_record(&archivio, n) + offsetof(GP, flags);
+    uint8_t valore = __atomic_load_n(flags, __ATOMIC_RELAXED);
+
+    __atomic_store_n(flags, report == '0' ? valore & ~GP_VALIDO : valore | GP_VALIDO, __ATOMIC_RELAXED);
+}
+
+//Funzione che controlla la versione di un Green Pass ricevuto dal Centro Vaccinale e lo rende valido, come
+//ogni Green Pass appena generato. Restituisce 0 oppure -1 se il Green Pass ha un formato diverso
+int prepara_gp(GP *greenP) {
+    if (greenP->versione != GP_VERSIONE) {
+        printf("Green Pass in un formato non supportato (versione %d)\n", greenP->versione);
+        metriche_conta(&metriche->errori, 1);
+        return -1;
+    }
+    greenP->flags = GP_VALIDO;
+    return 0;
+}
+
+//Funzione che converte un Green Pass del formato precedente. Restituisce 0 oppure -1 se il codice non è valido
+int converti_gp(const GP_VECCHIO *vecchio, GP *greenP) {
+    if (gp_codifica(greenP->codice, vecchio->cod_fisc) < 0) return -1;
+    greenP->inizio = gp_giorno(vecchio->data_inizio.giorno, vecchio->data_inizio.mese, vecchio->data_inizio.anno);
+    greenP->fine = gp_giorno(vecchio->data_fine.giorno, vecchio->data_fine.mese, vecchio->data_fine.anno);
+    greenP->flags = vecchio->report == '0' ? 0 : GP_VALIDO;
+    greenP->versione = GP_VERSIONE;
+    return 0;
+}
+
+//Funzione che assegna il report al Green Pass nell'archivio e registra la modifica nel WAL. Il Green Pass viene
+//acquisito con un compare-and-swap sul suo contatore di versione, senza il lock dell'archivio: le modifiche di
+//Green Pass diversi e le ricerche proseguono in parallelo, e la modifica nel WAL precede quelle successive dello
+//stesso Green Pass. Restituisce 1 se il Green Pass esiste, salvando in lsn l'LSN che deve essere durevole prima di
+//rispondere, 0 se non esiste, -1 se è rimasto occupato da altre modifiche: in ripetuti i tentativi ripetuti
+int registra_report(REPORT *pacchetto, int64_t *lsn, int *ripetuti) {
+    char chiave[ARCHIVIO_CHIAVE];
+    uint64_t n, inizio;
+    int esito;
+
+    //Un codice escluso dal filtro non esiste: non serve consultare l'archivio
+    *ripetuti = 0;
+    metriche_conta(&metriche->report, 1);
+    if (gp_codifica((uint8_t *)chiave, pacchetto->cod_fisc) < 0 || !bloom_contiene(filtro, archivio_hash(chiave))) {
+        __atomic_fetch_add(&filtro->negativi, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    inizio = metriche_adesso();
+    if ((esito = archivio_acquisisci(&archivio, chiave, tentativi_report, ripetuti, &n)) == -1) {
+        perror("archivio_acquisisci() error");
+        exit(1);
+    }
+    metriche_registra_da(&metriche->attesa_report, inizio);
+    if (esito == -2) {
+        metriche_conta(&metriche->report_occupati, 1);
+        return -1;
+    }
+    if (esito == 0) {
+        __atomic_fetch_add(&filtro->falsi_positivi, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    assegna_report(n, pacchetto->report);
+    if ((*lsn = wal_scrivi(&wal, WAL_REPORT, pacchetto, sizeof(REPORT))) < 0) {
+        archivio_rilascia(&archivio, n);
+        perror("wal_scrivi() error");
+        exit(1);
+    }
+    archivio_rilascia(&archivio, n);
+    return 1;
+}
+
+//Funzione che attende che il WAL sia durevole fino a lsn. Group commit: la sincronizzazione del log viene condivisa
+//con gli altri processi e thread che stanno scrivendo
+void attendi_wal(int64_t lsn) {
+    uint64_t inizio = metriche_adesso();
+
+    if (wal_attendi(&wal, lsn) < 0) {
+        perror("wal_attendi() error");
+        exit(1);
+    }
+    metriche_registra_da(&metriche->wal, inizio);
+}
+
+//Funzione che riapplica all'archivio un record del WAL durante il ripristino
+int applica_wal(uint8_t tipo, const void *dati, uint16_t len) {
+    const REPORT *pacchetto = dati;
+    char chiave[ARCHIVIO_CHIAVE];
+    GP greenP;
+    uint64_t n;
+    int esito, ripetuti;
+
+    if (tipo == WAL_INSERIMENTO && len == sizeof(GP)) return archivio_inserisci(&archivio, dati);
+
+    //Green Pass registrati prima del formato compresso
+    if (tipo == WAL_INSERIMENTO && len == sizeof(GP_VECCHIO)) return converti_gp(dati, &greenP) < 0 ? 0 : archivio_inserisci(&archivio, &greenP);
+
+    //Posizione di una replica, salvata dopo ogni gruppo di record applicati
+    if (tipo == WAL_POSIZIONE && len == sizeof(uint64_t) && sola_lettura) {
+        memcpy(&replica.lsn, dati, sizeof(uint64_t));
+        replica.valida = 1;
+        return 0;
+    }
+
+    if (tipo == WAL_REPORT && len == sizeof(REPORT)) {
+        if (gp_codifica((uint8_t *)chiave, pacchetto->cod_fisc) < 0) return 0;
+        if ((esito = archivio_acquisisci(&archivio, chiave, 0, &ripetuti, &n)) == 1) {
+            assegna_report(n, pacchetto->report);
+            archivio_rilascia(&archivio, n);
+        }
+        return esito;
+    }
+    return 0;
+}
+
+//Funzione che salva la posizione della replica nel suo file, sostituendolo solo quando il nuovo è durevole.
+//Restituisce 0 oppure -1 in caso di errore
+int salva_posizione(uint64_t lsn) {
+    char temp[sizeof(replica.posizione) + 8], testo[32];
+    int fd, len;
+
+    snprintf(temp, sizeof(temp), "%s.tmp", replica.posizione);
+    if ((fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0) return -1;
+    len = snprintf(testo, sizeof(testo), "%llu\n", (unsigned long long)lsn);
+    if (write(fd, testo, len) != len || fdatasync(fd) < 0) {
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    return rename(temp, replica.posizione);
+}
+
+//Funzione che rende durevole l'archivio prima che il WAL venga svuotato. Una replica salva anche la sua posizione,
+//perché i record WAL_POSIZIONE vengono eliminati dal checkpoint: i record applicati fino a quella posizione sono
+//tutti nell'archivio appena sincronizzato
+int sincronizza_archivio(void *arg) {
+    if (archivio_sincronizza(arg) < 0) return -1;
+    return sola_lettura && replica.valida ? salva_posizione(replica.lsn) : 0;
+}
+
+//Funzione che invia un GP richiesto dal ServerG. Restituisce 0 oppure -1 se la connessione si è interrotta
+int invio_gp(RETE *r) {
     char report, cod_fisc[COD_SIZE];
-    int fd;
+    int trovato;
     GP greenP;
+    uint64_t ricevuta;
 
     //Riceve il codice della tessera sanitaria dal ServerG
-    if (full_read(connectfd, cod_fisc, COD_SIZE) < 0) {
-        perror("full_read() error");
-        exit(1);
+    if (rete_leggi(r, cod_fisc, COD_SIZE) != 0) {
+        perror("rete_leggi() error");
+        return -1;
     }
+    ricevuta = metriche_adesso();
 
-    //Apre il file rinominato "cod_fisc", cioè il codice ricevuto dal ServerG
-    fd = open(cod_fisc, O_RDONLY, 0777);
+    //Cerca nell'archivio il Green Pass associato al codice ricevuto dal ServerG
+    trovato = cerca_gp(cod_fisc, &greenP);
 
 
-    // Se il codice della tessera sanitaria inviato dal Client T non esiste, la variabile errno cattura l'evento ed 
-       // invierà un report uguale ad 1 al ServerG, il quale aggiornerà il Client T dell'inesistenza del codice fiscale 
-       // altrimenti invierà un report uguale a 0 per indicare che l'operazione è avvenuta correttamente
+    // Se il codice della tessera sanitaria inviato dal Client S non esiste, invierà un report uguale a 2 al ServerG,
+       // il quale aggiornerà il Client S dell'inesistenza del codice fiscale
+       // altrimenti invierà un report uguale ad 1 seguito dal Green Pass
 
 
-    if (errno == 2) {
+    if (!trovato) {
         printf("Il codice della tessera sanitaria è inesistente, riprovare\n");
         report = '2';
         
 	//Invia il report al ServerG
-        if (full_write(connectfd, &report, sizeof(char)) < 0) {
-            perror("full_write() error");
-            exit(1);
+        if (rete_scrivi(r, &report, sizeof(char)) < 0) {
+            perror("rete_scrivi() error");
+            return -1;
         }
     } else {
+        report = '1';
 
-        //Accesso in mutua esclusione al file in lettura
+        //Invia il report al ServerG
         
-		if (flock(fd, LOCK_EX) < 0) {
-            perror("flock() error");
-            exit(1);
+		if (rete_scrivi(r, &report, sizeof(char)) < 0) {
+            perror("rete_scrivi() error");
+            return -1;
         }
 
-        //Lettura del Green Pass dal file 
+        //Invio del Green Pass richiesto al ServerG il quale controllerà la sua validità
         
-		if (read(fd, &greenP, sizeof(GP)) < 0) {
-            perror("read() error");
-            exit(1);
+		if(rete_scrivi(r, &greenP, sizeof(GP)) < 0) {
+            perror("rete_scrivi() error");
+            return -1;
         }
+    }
+    metriche_registra_da(&metriche->risposta_immediata, ricevuta);
+    return 0;
+}
 
-        //Sblocchiamo il lock
-        
-		if(flock(fd, LOCK_UN) < 0) {
-            perror("flock() error");
-            exit(1);
-        }
+//Funzione che risponde alla verifica di un Green Pass richiesta dal ServerG con un solo byte: l'esito di verifica_gp.
+//Restituisce 0 oppure -1 se la connessione si è interrotta
+int invio_esito(RETE *r) {
+    char esito, cod_fisc[COD_SIZE];
+    uint64_t ricevuta;
 
-        close(fd);
-        report = '1';
+    //Riceve il codice della tessera sanitaria dal ServerG
+    if (rete_leggi(r, cod_fisc, COD_SIZE) != 0) {
+        perror("rete_leggi() error");
+        return -1;
+    }
+    ricevuta = metriche_adesso();
 
-        //Invia il report al ServerG
-        
-		if (full_write(connectfd, &report, sizeof(char)) < 0) {
-            perror("full_write() error");
-            exit(1);
+    esito = verifica_gp(cod_fisc);
+    if (rete_scrivi(r, &esito, sizeof(char)) < 0) {
+        perror("rete_scrivi() error");
+        return -1;
+    }
+    metriche_registra_da(&metriche->risposta_immediata, ricevuta);
+    return 0;
+}
+
+//Funzione per la modifica del report di un Green Pass richiesto dal ClientT. Restituisce 0 oppure -1 se la
+//connessione si è interrotta
+int modifica_report(RETE *r) {
+    REPORT pacchetto;
+    int trovato, ripetuti;
+    int64_t lsn;
+    char report[2];
+    uint64_t ricevuta;
+
+    //Riceve il pacchetto dal ServerG ottenuto dal Client T avente il codice fiscale della tessera sanitaria ed il referto del tampone
+    if (rete_leggi(r, &pacchetto, sizeof(REPORT)) != 0) {
+        perror("rete_leggi() error");
+        return -1;
+    }
+    ricevuta = metriche_adesso();
+
+    //Assegnazione del report ricevuto dal Client T al Green Pass corrispondente, direttamente nell'archivio
+    if ((trovato = registra_report(&pacchetto, &lsn, &ripetuti)) > 0) attendi_wal(lsn);
+
+   // Se il codice fiscale della tessera sanitaria proveniente dal Client T è inesistente, invierà un report uguale ad 1
+        // al ServerG, il quale aggiornerà il Client T dell'inesistenza del codice fiscale
+        // se il Green Pass è rimasto occupato da altre modifiche invierà un report uguale a 3 seguito dai tentativi ripetuti
+        // altrimenti invierà un report uguale a 0 per indicare che l'operazione è avvenuta correttamente
+
+    if (!trovato) {
+        printf("Il codice della tessera sanitaria è inesistente, riprovare!\n");
+        report[0] = '1';
+    } else if (trovato < 0) {
+        printf("Il Green Pass è occupato da altre modifiche dopo %d tentativi\n", ripetuti);
+        report[0] = '3';
+        report[1] = ripetuti;
+    } else report[0] = '0';
+
+    //Invia il report al ServerG
+    if (rete_scrivi(r, report, trovato < 0 ? 2 : sizeof(char)) < 0) {
+        perror("rete_scrivi() error");
+        return -1;
+    }
+    metriche_registra_da(trovato > 0 ? &metriche->risposta_durevole : &metriche->risposta_immediata, ricevuta);
+    return 0;
+}
+
+
+  //Funzione che gestisce la comunicazione con il ServerG: Estrae il Green Pass associato al relativo codice fiscale della tessera saniteria ricevuto dal file system e lo invia al ServerG
+
+void comunicazione_SV(RETE *r) {
+    char bit;
+
+       // Il ServerV riceve un bit dal ServerG, il quale può assumere come valori 0, 1 o 2, per distinguere le operazioni
+       // Se riceve 0, il ServerV gestirà l'operazione per la modifica del referto di un Green Pass
+       // Se riceve 1, il ServerV gestirà l'operazione per l'invio di un Green Pass al ServerG
+       // Se riceve 2, il ServerV risponde con lo stesso bit: il ServerG controlla che la connessione sia ancora attiva
+       // Se riceve 3, il ServerV valuta la validità del Green Pass e invia solo l'esito
+       // La connessione resta aperta per altre operazioni finché il ServerG non la chiude (pool di connessioni del ServerG)
+       // Le risposte alle operazioni già ricevute partono insieme quando serve attendere la prossima operazione
+    
+    for (;;) {
+        if (rete_leggi(r, &bit, sizeof(char)) != 0) break;
+        if (bit == '0' && sola_lettura) {
+            printf("Replica in sola lettura: modifica del report rifiutata\n\n");
+            metriche_conta(&metriche->errori, 1);
+            break;
+        }
+        if (bit == '0') {
+            if (modifica_report(r) < 0) break;
+        } else if (bit == '1') {
+            if (invio_gp(r) < 0) break;
+        } else if (bit == '3') {
+            if (invio_esito(r) < 0) break;
+        } else if (bit == '2') {
+            metriche_conta(&metriche->ping, 1);
+            if (rete_scrivi(r, &bit, sizeof(char)) < 0) {
+                perror("rete_scrivi() error");
+                break;
+            }
+        } else {
+            printf("Dato non valido\n\n");
+            metriche_conta(&metriche->errori, 1);
+            break;
         }
+    }
+}
 
-        //Invio del Green Pass richiesto al ServerG il quale controllerà la sua validità
-        
-		if(full_write(connectfd, &greenP, sizeof(GP)) < 0) {
-            perror("full_write() error");
-            exit(1);
+//Funzione che gestisce la comunicazione con il Centro Vaccinale. Inoltre salva i dati ricevuti dal Centro Vaccinale nell'archivio
+void comunicazione_CV(RETE *r) {
+    GP greenP;
+    uint64_t ricevuta;
+
+    //Ricezione del Green Pass dal Centro Vaccinale
+    if (rete_leggi(r, &greenP, sizeof(GP)) != 0) {
+        perror("rete_leggi() error");
+        return;
+    }
+    ricevuta = metriche_adesso();
+    if (sola_lettura) {
+        printf("Replica in sola lettura: Green Pass del Centro Vaccinale rifiutato\n\n");
+        metriche_conta(&metriche->errori, 1);
+        return;
+    }
+
+    //Un Green Pass appena generato è valido di default
+    if (prepara_gp(&greenP) < 0) return;
+
+    //Inserimento del Green Pass nell'archivio, sostituendo quello precedente associato alla stessa tessera sanitaria
+    attendi_wal(registra_gp(&greenP));
+    metriche_registra_da(&metriche->risposta_durevole, ricevuta);
+}
+
+//Funzione che esegue una richiesta OP_CERCA_MOLTI o OP_VERIFICA_MOLTI con i codici contenuti nei dati ed aggiunge ad
+//immediate un'unica risposta con i risultati di tutti i codici. Restituisce -1 se la memoria non è sufficiente
+int esegui_molti(uint8_t op, uint32_t id, const char *dati, uint32_t len, BUFFER *immediate) {
+    int n = len / COD_SIZE, k, *trovati, esito = -1;
+    size_t dim = op == OP_CERCA_MOLTI ? 1 + sizeof(GP) : sizeof(char);
+    char *risposta;
+    GP *greenP;
+    int32_t oggi = data_oggi();
+
+    trovati = malloc(n * sizeof(int));
+    greenP = malloc(n * sizeof(GP));
+    risposta = calloc(n, dim);
+    if (trovati != NULL && greenP != NULL && risposta != NULL && cerca_molti(n, dati, greenP, trovati) == 0) {
+        for (k = 0; k < n; k++) {
+            if (op == OP_VERIFICA_MOLTI) risposta[k] = trovati[k] ? '0' + gp_valido(&greenP[k], oggi) : '2';
+            else {
+                risposta[k * dim] = trovati[k] ? '1' : '2';
+                if (trovati[k]) memcpy(risposta + k * dim + 1, &greenP[k], sizeof(GP));
+            }
         }
+        esito = proto_aggiungi_frame(immediate, op | OP_RISPOSTA, id, risposta, n * dim);
     }
+    free(trovati);
+    free(greenP);
+    free(risposta);
+    return esito;
 }
 
+//Funzione che esegue una richiesta OP_ELENCA: aggiunge ad immediate fino a ELENCA_MAX Green Pass dell'archivio a partire
+//da quello indicato nei dati, preceduti dalla posizione da cui proseguire. Restituisce -1 se la memoria non è sufficiente
+int esegui_elenca(uint32_t id, const char *dati, BUFFER *immediate) {
+    uint64_t inizio, prossimo;
+    int64_t n;
+    char *risposta;
+    int esito;
+
+    memcpy(&inizio, dati, sizeof(uint64_t));
+    inizio = be64toh(inizio);
+    if ((risposta = malloc(sizeof(uint64_t) + ELENCA_MAX * sizeof(GP))) == NULL) return -1;
+    if ((n = archivio_scorri(&archivio, inizio, ELENCA_MAX, risposta + sizeof(uint64_t))) < 0) {
+        free(risposta);
+        return proto_aggiungi_frame(immediate, OP_ERRORE, id, NULL, 0);
+    }
+    prossimo = htobe64(inizio + n);
+    memcpy(risposta, &prossimo, sizeof(uint64_t));
+    esito = proto_aggiungi_frame(immediate, OP_ELENCA | OP_RISPOSTA, id, risposta, sizeof(uint64_t) + n * sizeof(GP));
+    free(risposta);
+    return esito;
+}
 
-//Funzione per la modifica del report di un Green Pass richiesto dal ClientT
-void modifica_report(int connectfd) {
+//Funzione che esegue una richiesta del protocollo a frame. La risposta viene aggiunta ad immediate, oppure a differite
+//se si tratta di una scrittura che può essere confermata solo quando il WAL è durevole fino a lsn.
+//Restituisce -1 se la memoria non è sufficiente
+int esegui_frame(uint8_t op, uint32_t id, const char *dati, uint32_t len, BUFFER *immediate, BUFFER *differite, int64_t *lsn) {
+    char risposta[1 + sizeof(GP)], cod_fisc[COD_SIZE];
     REPORT pacchetto;
     GP greenP;
-    int fd;
-    char report;
+    int64_t l;
+    int trovato, ripetuti;
 
-    //Riceve il pacchetto dal ServerG ottenuto dal Client T avente il codice fiscale della tessera sanitaria ed il referto del tampone
-    if (full_read(connectfd, &pacchetto, sizeof(REPORT)) < 0) {
-        perror("full_read() error");
-        exit(1);
+    switch (op) {
+    case OP_CERCA:
+        if (len > COD_SIZE) break;
+        memset(cod_fisc, 0, COD_SIZE);
+        memcpy(cod_fisc, dati, len);
+        trovato = cerca_gp(cod_fisc, &greenP);
+        risposta[0] = trovato ? '1' : '2';
+        if (trovato) memcpy(risposta + 1, &greenP, sizeof(GP));
+        return proto_aggiungi_frame(immediate, op | OP_RISPOSTA, id, risposta, trovato ? 1 + sizeof(GP) : sizeof(char));
+
+    case OP_VERIFICA:
+        if (len > COD_SIZE) break;
+        memset(cod_fisc, 0, COD_SIZE);
+        memcpy(cod_fisc, dati, len);
+        risposta[0] = verifica_gp(cod_fisc);
+        return proto_aggiungi_frame(immediate, op | OP_RISPOSTA, id, risposta, sizeof(char));
+
+    case OP_CERCA_MOLTI:
+    case OP_VERIFICA_MOLTI:
+        if (len == 0 || len % COD_SIZE != 0) break;
+        return esegui_molti(op, id, dati, len, immediate);
+
+    case OP_REPORT:
+        if (len != sizeof(REPORT) || sola_lettura) break;
+        memcpy(&pacchetto, dati, sizeof(REPORT));
+        if ((trovato = registra_report(&pacchetto, &l, &ripetuti)) <= 0) {
+            risposta[0] = trovato ? '3' : '1';
+            risposta[1] = ripetuti;
+            return proto_aggiungi_frame(immediate, op | OP_RISPOSTA, id, risposta, trovato ? 2 : sizeof(char));
+        }
+        if (l > *lsn) *lsn = l;
+        risposta[0] = '0';
+        return proto_aggiungi_frame(differite, op | OP_RISPOSTA, id, risposta, sizeof(char));
+
+    case OP_INSERISCI:
+        if (len != sizeof(GP) || sola_lettura) break;
+        memcpy(&greenP, dati, sizeof(GP));
+        if (prepara_gp(&greenP) < 0) return proto_aggiungi_frame(immediate, OP_ERRORE, id, NULL, 0);
+        if ((l = registra_gp(&greenP)) > *lsn) *lsn = l;
+        risposta[0] = '0';
+        return proto_aggiungi_frame(differite, op | OP_RISPOSTA, id, risposta, sizeof(char));
+
+    case OP_TRASFERISCI:
+        //Green Pass spostato da un altro ServerV del cluster: viene registrato così com'è, report compreso
+        if (len != sizeof(GP) || sola_lettura) break;
+        memcpy(&greenP, dati, sizeof(GP));
+        if (greenP.versione != GP_VERSIONE) return proto_aggiungi_frame(immediate, OP_ERRORE, id, NULL, 0);
+        if ((l = registra_gp(&greenP)) > *lsn) *lsn = l;
+        risposta[0] = '0';
+        return proto_aggiungi_frame(differite, op | OP_RISPOSTA, id, risposta, sizeof(char));
+
+    case OP_ELENCA:
+        if (len != sizeof(uint64_t)) break;
+        return esegui_elenca(id, dati, immediate);
+
+    case OP_PING:
+        metriche_conta(&metriche->ping, 1);
+        return proto_aggiungi_frame(immediate, op | OP_RISPOSTA, id, NULL, 0);
     }
+    metriche_conta(&metriche->errori, 1);
+    return proto_aggiungi_frame(immediate, OP_ERRORE, id, NULL, 0);
+}
 
-    //Apertura del file contenente il Green Pass relativo al codice fiscale della tessera ricevuto dal Client T
-    fd = open(pacchetto.cod_fisc, O_RDWR , 0777);
+//Funzione che invia tutti i byte del buffer senza SIGPIPE. Restituisce 0 oppure -1 se la connessione è interrotta
+int invio_buffer(int sock_fd, const BUFFER *b) {
+    return rete_invia_dati(sock_fd, b->dati, b->len);
+}
 
-   // Se il codice fiscale della tessera sanitaria proveniente dal Client T è inesistente, la variabile errno cattura l'evento ed 
-        // invierà un report uguale ad 1 al ServerG, il quale aggiornerà il Client T dell'inesistenza del codice fiscale 
-        // altrimenti invierà un report uguale a 0 per indicare che l'operazione è avvenuta correttamente
+//Funzione che invia tutti i byte del buffer sulla connessione oppure, se canale non è NULL, nel canale in memoria
+//condivisa. Restituisce 0 oppure -1 se la connessione è interrotta
+int invio_risposte(int sock_fd, CANALE *canale, const BUFFER *b) {
+    return canale != NULL ? canale_scrivi(canale, b->dati, b->len, -1) : invio_buffer(sock_fd, b);
+}
 
-    if (errno == 2) {
-        printf("Il codice della tessera sanitaria è inesistente, riprovare!\n");
-        report = '1';
-    } else {
+//Funzione che gestisce una connessione del ServerG con il protocollo a frame. Tutte le richieste già ricevute vengono
+//eseguite insieme: le risposte alle ricerche sono inviate subito, quelle alle scritture dopo un'unica attesa del WAL,
+//quindi possono arrivare in un ordine diverso da quello delle richieste. I byte già ricevuti nel buffer di r sono i
+//primi frame. Con un canale in memoria condivisa i frame passano dal canale invece che dalla connessione
+void comunicazione_frame(RETE *r, CANALE *canale) {
+    BUFFER ingresso = {0}, immediate = {0}, differite = {0};
+    int connectfd = r->fd;
+    const char *dati;
+    int64_t k, lsn;
+    ssize_t n;
+    size_t letti, dim;
+    uint8_t op;
+    uint32_t id, len;
+    uint64_t ricevuta, n_immediate, n_differite;
+    int attivo = 1, leggi;
 
-        //Accesso in mutua esclusione al file in lettura
-        if(flock(fd, LOCK_EX | LOCK_NB) < 0) {
-            perror("flock() error");
-            exit(1);
+    //Le risposte immediate e quelle differite partono con scritture separate: senza l'algoritmo di Nagle la seconda
+    //non attende l'ACK TCP della prima
+    setsockopt(connectfd, IPPROTO_TCP, TCP_NODELAY, &attivo, sizeof(attivo));
+    if (buffer_riserva(&ingresso, RETE_BUFFER) < 0) return;
+    ingresso.len = rete_estrai(r, ingresso.dati, RETE_BUFFER);
+
+    for (leggi = ingresso.len == 0;; leggi = 1) {
+        if (leggi) {
+            if (buffer_riserva(&ingresso, ingresso.len + CONN_BUFFER) < 0) break;
+            if (canale != NULL) n = canale_leggi(canale, ingresso.dati + ingresso.len, ingresso.cap - ingresso.len);
+            else if ((n = read(connectfd, ingresso.dati + ingresso.len, ingresso.cap - ingresso.len)) < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            ingresso.len += n;
         }
+        ricevuta = metriche_adesso();
 
-        //Lettura del file contenente il Green Pass associato al codice fiscale della tessera sanitaria ricevuto dal Client T
-        if (read(fd, &greenP, sizeof(GP)) < 0) {
-            perror("read() error");
-            exit(1);
+        //Ogni risposta viene contata nel buffer in cui l'ha aggiunta esegui_frame
+        letti = 0;
+        lsn = 0;
+        n_immediate = n_differite = 0;
+        while ((k = proto_estrai_frame(ingresso.dati + letti, ingresso.len - letti, &op, &id, &dati, &len, NULL)) > 0) {
+            dim = differite.len;
+            if (esegui_frame(op, id, dati, len, &immediate, &differite, &lsn) < 0) {
+                k = -1;
+                break;
+            }
+            if (differite.len > dim) n_differite++;
+            else n_immediate++;
+            letti += k;
         }
+        buffer_scarta(&ingresso, letti);
 
-        //Assegnazione del report ricevuto dal Client T al Green Pass corrispondente
-        greenP.report = pacchetto.report;
+        if (immediate.len > 0 && invio_risposte(connectfd, canale, &immediate) < 0) break;
+        immediate.len = 0;
+        metriche_registra_n(&metriche->risposta_immediata, metriche_adesso() - ricevuta, n_immediate);
+        if (differite.len > 0) {
+            attendi_wal(lsn);
+            if (invio_risposte(connectfd, canale, &differite) < 0) break;
+            differite.len = 0;
+            metriche_registra_n(&metriche->risposta_durevole, metriche_adesso() - ricevuta, n_differite);
+        }
+        if (k < 0) {
+            printf("Dato non valido\n\n");
+            break;
+        }
+    }
+    buffer_libera(&ingresso);
+    buffer_libera(&immediate);
+    buffer_libera(&differite);
+}
 
-        //Ci posizioniamo all'inizio dello stream del file
-        lseek(fd, 0, SEEK_SET);
+//Funzione che gestisce una connessione Unix aperta dal ServerG con il bit '5': conferma il bit, riceve l'area ed
+//i descrittori del canale in memoria condivisa (canale.h) e serve con il protocollo a frame le richieste che vi
+//arrivano, finché il ServerG non chiude la connessione
+void comunicazione_canale(int connectfd) {
+    CANALE *canale;
+    RETE r;
+    char bit = '5';
 
-        //Sovrascrittura dei campi del Green Pass nel file binario 
-        if (write(fd, &greenP, sizeof(GP)) < 0) {
-            perror("write() error");
-            exit(1);
+    if (rete_invia_dati(connectfd, &bit, sizeof(char)) < 0 || (canale = canale_apri(connectfd)) == NULL) {
+        perror("canale_apri() error");
+        return;
+    }
+    metriche_conta(&metriche->canali, 1);
+    rete_inizia(&r, connectfd);
+    comunicazione_frame(&r, canale);
+    canale_chiudi(canale);
+    metriche_conta(&metriche->canali, -1);
+}
+
+//Funzione che invia ad una replica, senza attendere richieste, i record durevoli del WAL a partire dall'LSN richiesto
+//(protocollo.h), di cui sono già stati ricevuti n byte, ed ogni REPLICA_BATTITO millisecondi un frame anche senza
+//record, con cui la replica conosce il proprio ritardo. Termina quando la replica chiude la connessione oppure quando
+//i record richiesti non fanno più parte del log
+void invio_replica(int connectfd, const char *ricevuti, size_t n) {
+    char *buf;
+    BUFFER frame = {0};
+    uint64_t lsn, testa[2];
+    int64_t durevole, letti;
+    ssize_t k;
+    int primo;
+
+    if (n > 0) memcpy(&lsn, ricevuti, n);
+    while (n < sizeof(uint64_t)) {
+        if ((k = recv(connectfd, (char *)&lsn + n, sizeof(uint64_t) - n, 0)) < 0 && errno == EINTR) continue;
+        if (k <= 0) return;
+        n += k;
+    }
+    if ((buf = malloc(sizeof(testa) + REPLICA_LOTTO)) == NULL) return;
+
+    //Una replica senza posizione riceve i record che diventeranno durevoli: wal_attendi_durevole con attesa nulla
+    //restituisce l'LSN durevole attuale
+    lsn = be64toh(lsn);
+    if (lsn == REPLICA_ATTUALE && (lsn = wal_attendi_durevole(&wal, 0, 0)) == (uint64_t)-1) lsn = 0;
+    metriche_conta(&metriche->repliche, 1);
+    printf("Replica collegata a partire dall'LSN %llu\n\n", (unsigned long long)lsn);
+    fflush(stdout);
+
+    for (primo = 1;; primo = 0) {
+        //Nella modalità con un processo per connessione il flusso termina con il processo padre del ServerV
+        if (getpid() != pid_padre && getppid() != pid_padre) break;
+        if ((durevole = wal_attendi_durevole(&wal, lsn, primo ? 0 : REPLICA_BATTITO)) < 0) break;
+        letti = 0;
+        if ((uint64_t)durevole < lsn || (durevole > (int64_t)lsn && (letti = wal_leggi(&wal, lsn, durevole, buf + sizeof(testa), REPLICA_LOTTO)) < 0)) {
+            printf("La replica richiede l'LSN %llu, che non fa più parte del WAL\n\n", (unsigned long long)lsn);
+            frame.len = 0;
+            if (proto_aggiungi_frame(&frame, OP_ERRORE, 0, NULL, 0) == 0) invio_buffer(connectfd, &frame);
+            break;
         }
+        testa[0] = htobe64(lsn);
+        testa[1] = htobe64(durevole);
+        memcpy(buf, testa, sizeof(testa));
+        frame.len = 0;
+        if (proto_aggiungi_frame(&frame, OP_REPLICA, 0, buf, sizeof(testa) + letti) < 0 || invio_buffer(connectfd, &frame) < 0) break;
+        lsn += letti;
+    }
+    metriche_conta(&metriche->repliche, -1);
+    printf("Replica scollegata all'LSN %llu\n\n", (unsigned long long)lsn);
+    fflush(stdout);
+    buffer_libera(&frame);
+    free(buf);
+}
 
-        //Sblocchiamo il lock
-        if(flock(fd, LOCK_UN) < 0) {
-            perror("flock() error");
-            exit(1);
+//Funzione che riceve dal primario il prossimo frame, dopo aver scartato i *scarta byte di quello precedente.
+//Restituisce 0 oppure -1 se la connessione si interrompe o il frame non è valido
+int ricezione_primario(int sock_fd, BUFFER *ingresso, int64_t *scarta, uint8_t *op, const char **dati, uint32_t *len) {
+    size_t fabbisogno = PROTO_TESTA;
+    uint32_t id;
+    ssize_t n;
+
+    buffer_scarta(ingresso, *scarta);
+    while ((*scarta = proto_estrai_frame(ingresso->dati, ingresso->len, op, &id, dati, len, &fabbisogno)) == 0) {
+        if (buffer_riserva(ingresso, fabbisogno > ingresso->len + CONN_BUFFER ? fabbisogno : ingresso->len + CONN_BUFFER) < 0) return -1;
+        if ((n = recv(sock_fd, ingresso->dati + ingresso->len, ingresso->cap - ingresso->len, 0)) < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        ingresso->len += n;
+    }
+    return *scarta < 0 ? -1 : 0;
+}
+
+//Funzione che apre una connessione con il primario e la identifica con il bit indicato, seguito dai byte di dati.
+//Un primario che non risponde entro il doppio del battito viene considerato irraggiungibile.
+//Restituisce il descrittore del socket oppure -1
+int connessione_primario(char bit, const void *dati, size_t len) {
+    struct timeval attesa = {2 * REPLICA_BATTITO / 1000, 0};
+    int sock_fd;
+
+    if ((sock_fd = anello_connetti(&replica.primario, 0)) < 0) return -1;
+    setsockopt(sock_fd, SOL_SOCKET, SO_RCVTIMEO, &attesa, sizeof(attesa));
+    setsockopt(sock_fd, SOL_SOCKET, SO_SNDTIMEO, &attesa, sizeof(attesa));
+    if (rete_invia_blocchi(sock_fd, &bit, sizeof(char), dati, len) < 0) {
+        close(sock_fd);
+        return -1;
+    }
+    return sock_fd;
+}
+
+//Funzione che registra la posizione della replica nel suo WAL dopo i record applicati ed attende che siano durevoli
+void registra_posizione(uint64_t lsn, int64_t lsn_wal) {
+    int64_t l;
+
+    if ((l = wal_scrivi(&wal, WAL_POSIZIONE, &lsn, sizeof(uint64_t))) < 0) {
+        perror("wal_scrivi() error");
+        exit(1);
+    }
+    attendi_wal(l > lsn_wal ? l : lsn_wal);
+    __atomic_store_n(&replica.lsn, lsn, __ATOMIC_RELAXED);
+}
+
+//Funzione che copia nell'archivio della replica tutti i Green Pass del primario, report compresi, con OP_ELENCA.
+//Restituisce i Green Pass copiati oppure -1 se la connessione si interrompe
+int64_t copia_primario() {
+    BUFFER richiesta = {0}, ingresso = {0};
+    const char *dati;
+    char bit = '2';
+    uint64_t posizione = 0, copiati = 0, i, n;
+    int64_t k = 0, lsn;
+    uint32_t len;
+    uint8_t op;
+    int sock_fd;
+    GP greenP;
+
+    if ((sock_fd = connessione_primario(bit, NULL, 0)) < 0) return -1;
+    for (;;) {
+        posizione = htobe64(posizione);
+        richiesta.len = 0;
+        if (proto_aggiungi_frame(&richiesta, OP_ELENCA, 0, &posizione, sizeof(uint64_t)) < 0 || invio_buffer(sock_fd, &richiesta) < 0 ||
+            ricezione_primario(sock_fd, &ingresso, &k, &op, &dati, &len) < 0 ||
+            op != (OP_ELENCA | OP_RISPOSTA) || len < sizeof(uint64_t) || (len - sizeof(uint64_t)) % sizeof(GP) != 0) break;
+        memcpy(&posizione, dati, sizeof(uint64_t));
+        posizione = be64toh(posizione);
+        if ((n = (len - sizeof(uint64_t)) / sizeof(GP)) == 0) {
+            close(sock_fd);
+            buffer_libera(&richiesta);
+            buffer_libera(&ingresso);
+            return copiati;
+        }
+        for (i = 0, lsn = 0; i < n; i++) {
+            memcpy(&greenP, dati + sizeof(uint64_t) + i * sizeof(GP), sizeof(GP));
+            lsn = registra_gp(&greenP);
         }
-        report = '0';
+        attendi_wal(lsn);
+        copiati += n;
     }
+    close(sock_fd);
+    buffer_libera(&richiesta);
+    buffer_libera(&ingresso);
+    return -1;
+}
 
-    //Invia il report al ServerG
-    if (full_write(connectfd, &report, sizeof(char)) < 0) {
-        perror("full_write() error");
+//Funzione che applica all'archivio della replica i record del WAL del primario contenuti in dati, con le stesse
+//funzioni usate per le richieste, quindi registrandoli anche nel WAL della replica. I record di altri tipi vengono
+//ignorati. Restituisce l'LSN del WAL della replica che deve essere durevole
+int64_t applica_primario(const char *dati, size_t len) {
+    WAL_RECORD r;
+    REPORT pacchetto;
+    GP greenP;
+    size_t off;
+    int64_t lsn = 0, l;
+    int ripetuti;
+
+    for (off = 0; off + sizeof(r) <= len; off += sizeof(r) + r.len) {
+        memcpy(&r, dati + off, sizeof(r));
+        if (off + sizeof(r) + r.len > len) break;
+        l = 0;
+        if (r.tipo == WAL_INSERIMENTO && r.len == sizeof(GP)) {
+            memcpy(&greenP, dati + off + sizeof(r), sizeof(GP));
+            l = registra_gp(&greenP);
+        } else if (r.tipo == WAL_INSERIMENTO && r.len == sizeof(GP_VECCHIO)) {
+            if (converti_gp((const GP_VECCHIO *)(dati + off + sizeof(r)), &greenP) == 0) l = registra_gp(&greenP);
+        } else if (r.tipo == WAL_REPORT && r.len == sizeof(REPORT)) {
+            //Solo il thread di replica modifica l'archivio: il Green Pass resta occupato solo per poco
+            memcpy(&pacchetto, dati + off + sizeof(r), sizeof(REPORT));
+            while (registra_report(&pacchetto, &l, &ripetuti) < 0);
+        }
+        if (l > lsn) lsn = l;
+        __atomic_fetch_add(&replica.record, 1, __ATOMIC_RELAXED);
+    }
+    return lsn;
+}
+
+//Funzione che segue il flusso del primario su una connessione appena aperta: se la replica non ha una posizione,
+//prima copia l'archivio del primario, poi applica i record ricevuti a partire dalla posizione indicata nel primo frame.
+//Un record già contenuto nella copia viene applicato di nuovo senza effetti, perché i record del WAL vengono
+//applicati nello stesso ordine. Restituisce quando la connessione si interrompe: 1 se il primario non ha più i record
+//richiesti e serve subito una copia, altrimenti 0
+int segui_primario(int sock_fd) {
+    BUFFER ingresso = {0};
+    const char *dati;
+    uint64_t testa[2], inizio, durevole;
+    int64_t k = 0, copiati;
+    uint32_t len;
+    uint8_t op;
+    int allineata = 0, copia = 0;
+
+    while (ricezione_primario(sock_fd, &ingresso, &k, &op, &dati, &len) == 0) {
+        if (op == OP_ERRORE) {
+            printf("Il primario non ha più i record dall'LSN %llu: copia completa del suo archivio\n\n", (unsigned long long)replica.lsn);
+            __atomic_store_n(&replica.valida, 0, __ATOMIC_RELEASE);
+            copia = 1;
+            break;
+        }
+        if (op != OP_REPLICA || len < sizeof(testa)) break;
+        memcpy(testa, dati, sizeof(testa));
+        inizio = be64toh(testa[0]);
+        durevole = be64toh(testa[1]);
+
+        if (!replica.valida) {
+            if ((copiati = copia_primario()) < 0) break;
+            registra_posizione(inizio, 0);
+            __atomic_store_n(&replica.valida, 1, __ATOMIC_RELEASE);
+            __atomic_fetch_add(&replica.copie, 1, __ATOMIC_RELAXED);
+            printf("Copia dell'archivio del primario completata: %lld Green Pass\n\n", (long long)copiati);
+        }
+        if (inizio != replica.lsn) break;
+
+        if (len > sizeof(testa)) registra_posizione(inizio + len - sizeof(testa), applica_primario(dati + sizeof(testa), len - sizeof(testa)));
+        __atomic_store_n(&replica.lsn_primario, durevole, __ATOMIC_RELAXED);
+        if (replica.lsn >= durevole) {
+            __atomic_store_n(&replica.allineata, metriche_adesso(), __ATOMIC_RELAXED);
+            if (!allineata) printf("Replica allineata al primario all'LSN %llu\n\n", (unsigned long long)replica.lsn);
+            allineata = 1;
+        }
+        fflush(stdout);
+    }
+    buffer_libera(&ingresso);
+    return copia;
+}
+
+//Thread di una replica: segue il primario, ricollegandosi con un'attesa crescente quando non è raggiungibile
+void *ricezione_replica(void *arg) {
+    uint64_t lsn;
+    int sock_fd, pausa = 100, avvisato = 0, copia;
+    (void)arg;
+
+    for (;;) {
+        lsn = htobe64(replica.valida ? replica.lsn : REPLICA_ATTUALE);
+        if ((sock_fd = connessione_primario('4', &lsn, sizeof(uint64_t))) >= 0) {
+            printf("Collegata al primario %s:%d\n\n", replica.primario.nodi[0].host, replica.primario.nodi[0].porta);
+            fflush(stdout);
+            __atomic_store_n(&replica.collegata, 1, __ATOMIC_RELAXED);
+            avvisato = 0;
+            pausa = 100;
+            copia = segui_primario(sock_fd);
+            __atomic_store_n(&replica.collegata, 0, __ATOMIC_RELAXED);
+            close(sock_fd);
+            if (copia) continue;
+        }
+        if (!avvisato) printf("Primario %s:%d non raggiungibile, nuovo tentativo fra poco\n\n", replica.primario.nodi[0].host, replica.primario.nodi[0].porta);
+        fflush(stdout);
+        avvisato = 1;
+        usleep(pausa * 1000);
+        pausa = pausa * 2 < REPLICA_PAUSA_MAX ? pausa * 2 : REPLICA_PAUSA_MAX;
+    }
+    return NULL;
+}
+
+//Funzione che avvia la replica del primario host:porta. Una replica senza posizione salvata attende la copia
+//dell'archivio del primario prima di rispondere alle ricerche
+void avvia_replica() {
+    pthread_t tid;
+
+    __atomic_store_n(&replica.allineata, metriche_adesso(), __ATOMIC_RELAXED);
+    if ((errno = pthread_create(&tid, NULL, ricezione_replica, NULL)) != 0) {
+        perror("pthread_create() error");
         exit(1);
     }
+    pthread_detach(tid);
+    if (replica.valida) printf("Replica di %s:%d dall'LSN %llu\n", replica.primario.nodi[0].host, replica.primario.nodi[0].porta, (unsigned long long)replica.lsn);
+    else printf("Replica di %s:%d: in attesa della copia dell'archivio del primario\n", replica.primario.nodi[0].host, replica.primario.nodi[0].porta);
+    fflush(stdout);
+    while (!__atomic_load_n(&replica.valida, __ATOMIC_ACQUIRE)) usleep(100000);
 }
 
+//Funzione che importa nell'archivio i Green Pass salvati con la vecchia organizzazione, un file per ogni tessera sanitaria
+void importa_cartella(const char *cartella) {
+    DIR *dir;
+    struct dirent *voce;
+    char path[BUFF_MAX_SIZE];
+    int fd, importati = 0;
+    GP_VECCHIO vecchio;
+    GP greenP;
 
-  //Funzione che gestisce la comunicazione con il ServerG: Estrae il Green Pass associato al relativo codice fiscale della tessera saniteria ricevuto dal file system e lo invia al ServerG
+    if ((dir = opendir(cartella)) == NULL) {
+        perror("opendir() error");
+        exit(1);
+    }
 
-void comunicazione_SV(int connectfd) {
-    char bit;
+    //Ogni file il cui nome è lungo quanto un codice di tessera sanitaria e che contiene un Green Pass viene inserito
+    while ((voce = readdir(dir)) != NULL) {
+        if (strlen(voce->d_name) != COD_SIZE - 1) continue;
+        snprintf(path, BUFF_MAX_SIZE, "%s/%s", cartella, voce->d_name);
+        if ((fd = open(path, O_RDONLY)) < 0) continue;
+        if (read(fd, &vecchio, sizeof(GP_VECCHIO)) == sizeof(GP_VECCHIO) && strncmp(vecchio.cod_fisc, voce->d_name, COD_SIZE) == 0 &&
+            converti_gp(&vecchio, &greenP) == 0) {
+            if (archivio_inserisci(&archivio, &greenP) < 0) {
+                perror("archivio_inserisci() error");
+                exit(1);
+            }
+            importati++;
+        }
+        close(fd);
+    }
+    closedir(dir);
 
-       // Il ServerV riceve un bit dal ServerG, il quale può assumere come valori 0 o 1, per distinguere due operazioni diverse
-       // Se riceve 0, il ServerV gestirà l'operazione per la modifica del referto di un Green Pass
-       // Se riceve 1, il ServerV gestirà l'operazione per l'invio di un Green Pass al ServerG
-    
+    //I Green Pass importati non sono registrati nel WAL: l'archivio viene reso subito durevole
+    if (wal_checkpoint(&wal) < 0) {
+        perror("wal_checkpoint() error");
+        exit(1);
+    }
+    printf("Importati %d Green Pass dalla cartella %s\n", importati, cartella);
+}
+
+//Funzione che converte un archivio della versione precedente, con i Green Pass nel vecchio formato, in un archivio
+//con i record compressi. Il nuovo archivio viene costruito in un file temporaneo che sostituisce il vecchio solo
+//alla fine, così un'interruzione non perde dati; il vecchio archivio resta salvato con l'estensione .v1
+void aggiorna_archivio(const char *file_archivio) {
+    char nuovo[BUFF_MAX_SIZE], salvato[BUFF_MAX_SIZE];
+    ARCHIVIO_TESTA testa;
+    GP_VECCHIO vecchio;
+    GP greenP;
+    uint64_t n, convertiti = 0;
+    int fd;
 
-    if (full_read(connectfd, &bit, sizeof(char)) < 0) {
-        perror("full_read() error");
+    snprintf(nuovo, BUFF_MAX_SIZE, "%s.nuovo", file_archivio);
+    snprintf(salvato, BUFF_MAX_SIZE, "%s.v1", file_archivio);
+    if ((fd = open(file_archivio, O_RDONLY)) < 0 || pread(fd, &testa, sizeof(testa), 0) != sizeof(testa)) {
+        perror("aggiorna_archivio() error");
         exit(1);
     }
-    if (bit == '0') modifica_report(connectfd);
-    else if (bit == '1') invio_gp(connectfd);
-    else printf("Dato non valido\n\n");
+    if (testa.versione != 1 || testa.dim_record != sizeof(GP_VECCHIO)) {
+        fprintf(stderr, "Archivio %s: versione %u non supportata\n", file_archivio, testa.versione);
+        exit(1);
+    }
+
+    unlink(nuovo);
+    if (archivio_apri(&archivio, nuovo, sizeof(GP)) < 0) {
+        perror("archivio_apri() error");
+        exit(1);
+    }
+    for (n = 0; n < testa.n_record; n++) {
+        if (pread(fd, &vecchio, sizeof(GP_VECCHIO), testa.blocchi_off[n / ARCHIVIO_BLOCCO] + (n % ARCHIVIO_BLOCCO) * testa.dim_record) != sizeof(GP_VECCHIO)) {
+            perror("pread() error");
+            exit(1);
+        }
+        if (converti_gp(&vecchio, &greenP) < 0) continue;
+        if (archivio_inserisci(&archivio, &greenP) < 0) {
+            perror("archivio_inserisci() error");
+            exit(1);
+        }
+        convertiti++;
+    }
+    close(fd);
+
+    //Il file aperto viene rinominato: l'archivio resta aperto e bloccato
+    unlink(salvato);
+    if (archivio_sincronizza(&archivio) < 0 || link(file_archivio, salvato) < 0 || rename(nuovo, file_archivio) < 0) {
+        perror("aggiorna_archivio() error");
+        exit(1);
+    }
+    printf("Archivio %s convertito nel nuovo formato: %llu Green Pass, archivio precedente in %s\n", file_archivio, (unsigned long long)convertiti, salvato);
 }
 
-//Funzione che gestisce la comunicazione con il Centro Vaccinale. Inoltre salva i dati ricevuti dal Centro Vaccinale in un filesystem
-void comunicazione_CV(int connectfd) {
+//Fasi del protocollo di una connessione gestita nella modalità ad eventi
+enum {
+    ATTESA_CLIENT,      //in attesa del bit che distingue il Centro Vaccinale dal ServerG
+    ATTESA_OPERAZIONE,  //in attesa del bit che distingue la modifica del report dalla richiesta di un Green Pass
+    ATTESA_GP,          //in attesa del Green Pass inviato dal Centro Vaccinale
+    ATTESA_REPORT,      //in attesa del pacchetto REPORT inoltrato dal ServerG
+    ATTESA_CODICE,      //in attesa del codice della tessera sanitaria inoltrato dal ServerG
+    ATTESA_VERIFICA,    //in attesa del codice di cui il ServerG chiede solo l'esito della verifica
+    ATTESA_FRAME,       //protocollo a frame del ServerG: in attesa della prossima richiesta
+    CONCLUSA            //il Centro Vaccinale ha inviato il Green Pass, non sono previste altre richieste
+};
+
+//Stato di una connessione nella modalità ad eventi
+typedef struct CONNESSIONE {
     int fd;
+    int stato;
+    BUFFER ingresso;                //byte ricevuti, i primi letti sono già stati elaborati
+    size_t letti;
+    BUFFER uscita;                  //risposte pronte da inviare, i primi inviati sono già stati inviati
+    size_t inviati;
+    BUFFER differite;               //risposte che possono essere inviate solo quando il WAL è durevole fino a lsn
+    int64_t lsn;
+    int differita;                  //1 se la connessione è nella lista di attesa del WAL (anche senza byte da inviare)
+    int persistente;                //connessione del ServerG, resta aperta dopo ogni risposta
+    int chiusa;                     //il client ha chiuso la connessione: si chiude dopo aver eseguito le richieste ricevute
+    int rotta;                      //connessione da chiudere appena uscita dalla lista di attesa del WAL
+    int scrittura;                  //1 se la connessione attende l'evento di scrittura invece di quello di lettura
+    BUFFER in_invio;                //con io_uring, risposte passate al kernel e già inviate fino a inviati
+    int ricezione;                  //con io_uring, 1 se c'è una ricezione in corso
+    int invio;                      //con io_uring, 1 se c'è un invio in corso
+    uint64_t accettata;             //istante dell'accept
+    uint64_t ricevuta;              //istante dell'ultima ricezione, da cui si misurano le risposte
+    uint64_t inizio_differite;      //ricezione della prima risposta differita in attesa
+    uint64_t n_immediate;           //risposte aggiunte ad uscita dall'ultima misura
+    uint64_t n_differite;           //risposte aggiunte a differite dall'ultima misura
+    struct CONNESSIONE *prossima;   //lista delle connessioni in attesa del WAL
+} CONNESSIONE;
+
+//Parametri di un thread della modalità ad eventi
+typedef struct {
+    int id;
+    int listenfd;
+    int listen_locale;              //socket Unix di ascolto, -1 se non attivo
+} LAVORATORE;
+
+//Funzione che conta una risposta differita della connessione: la sua latenza verrà misurata quando il WAL è durevole
+void conta_differita(CONNESSIONE *c) {
+    if (c->n_differite++ == 0) c->inizio_differite = c->ricevuta;
+}
+
+//Funzione che elabora i byte ricevuti seguendo le stesse fasi di comunicazione_CV, comunicazione_SV e comunicazione_frame.
+//Le risposte vengono aggiunte ad uscita, oppure a differite se devono attendere il WAL.
+//Restituisce 0 quando servono altri byte, -1 se la connessione va chiusa, -2 se è la connessione di una replica,
+//-3 se il ServerG apre un canale in memoria condivisa
+int elabora_connessione(CONNESSIONE *c) {
+    char bit, risposta[2];
     GP greenP;
+    REPORT pacchetto;
+    int trovato, ripetuti;
+    int64_t k;
+    size_t disponibili;
+    uint8_t op;
+    uint32_t id, len;
+    const char *dati;
+    size_t dim;
 
-    //Ricezione del Green Pass dal Centro Vaccinale
-    if (full_read(connectfd, &greenP, sizeof(GP)) < 0) {
-        perror("full_write() error");
+    for (;;) {
+        disponibili = c->ingresso.len - c->letti;
+
+        //Con il vecchio protocollo le risposte seguono l'ordine delle richieste: si attende quella differita
+        if (c->differita && c->stato != ATTESA_FRAME) return 0;
+
+        switch (c->stato) {
+        case ATTESA_CLIENT:
+        case ATTESA_OPERAZIONE:
+            if (disponibili < sizeof(char)) return 0;
+            bit = c->ingresso.dati[c->letti++];
+            if (sola_lettura && ((c->stato == ATTESA_CLIENT && bit == '1') || (c->stato == ATTESA_OPERAZIONE && bit == '0'))) {
+                metriche_conta(&metriche->errori, 1);
+                return -1;
+            }
+            if (c->stato == ATTESA_CLIENT && bit == '4') return -2;
+            if (c->stato == ATTESA_CLIENT && bit == '5') return -3;
+            if (c->stato == ATTESA_CLIENT && bit == '1') c->stato = ATTESA_GP;
+            else if (c->stato == ATTESA_CLIENT && (bit == '0' || bit == '2')) {
+                c->stato = bit == '0' ? ATTESA_OPERAZIONE : ATTESA_FRAME;
+                c->persistente = 1;
+            }
+            else if (c->stato == ATTESA_OPERAZIONE && bit == '0') c->stato = ATTESA_REPORT;
+            else if (c->stato == ATTESA_OPERAZIONE && bit == '1') c->stato = ATTESA_CODICE;
+            else if (c->stato == ATTESA_OPERAZIONE && bit == '3') c->stato = ATTESA_VERIFICA;
+            else if (c->stato == ATTESA_OPERAZIONE && bit == '2') {
+                //Controllo della connessione da parte del pool del ServerG
+                if (buffer_aggiungi(&c->uscita, &bit, sizeof(char)) < 0) return -1;
+                metriche_conta(&metriche->ping, 1);
+                c->n_immediate++;
+            }
+            else {
+                metriche_conta(&metriche->errori, 1);
+                return -1;
+            }
+            break;
+
+        case ATTESA_GP:
+            if (disponibili < sizeof(GP)) return 0;
+            memcpy(&greenP, c->ingresso.dati + c->letti, sizeof(GP));
+            c->letti += sizeof(GP);
+
+            //Un Green Pass appena generato è valido di default; il Centro Vaccinale non attende risposta
+            c->stato = CONCLUSA;
+            if (prepara_gp(&greenP) < 0) break;
+            c->lsn = registra_gp(&greenP);
+            c->differita = 1;
+            conta_differita(c);
+            break;
+
+        case ATTESA_REPORT:
+            if (disponibili < sizeof(REPORT)) return 0;
+            memcpy(&pacchetto, c->ingresso.dati + c->letti, sizeof(REPORT));
+            c->letti += sizeof(REPORT);
+
+            trovato = registra_report(&pacchetto, &c->lsn, &ripetuti);
+            risposta[0] = trovato > 0 ? '0' : trovato ? '3' : '1';
+            risposta[1] = ripetuti;
+            if (buffer_aggiungi(trovato > 0 ? &c->differite : &c->uscita, risposta, trovato < 0 ? 2 : sizeof(char)) < 0) return -1;
+            c->differita = trovato > 0;
+            if (trovato > 0) conta_differita(c);
+            else c->n_immediate++;
+            c->stato = ATTESA_OPERAZIONE;
+            break;
+
+        case ATTESA_CODICE:
+            if (disponibili < COD_SIZE) return 0;
+            trovato = cerca_gp(c->ingresso.dati + c->letti, &greenP);
+            c->letti += COD_SIZE;
+
+            risposta[0] = trovato ? '1' : '2';
+            if (buffer_aggiungi(&c->uscita, risposta, sizeof(char)) < 0) return -1;
+            if (trovato && buffer_aggiungi(&c->uscita, &greenP, sizeof(GP)) < 0) return -1;
+            c->n_immediate++;
+            c->stato = ATTESA_OPERAZIONE;
+            break;
+
+        case ATTESA_VERIFICA:
+            if (disponibili < COD_SIZE) return 0;
+            risposta[0] = verifica_gp(c->ingresso.dati + c->letti);
+            c->letti += COD_SIZE;
+
+            if (buffer_aggiungi(&c->uscita, risposta, sizeof(char)) < 0) return -1;
+            c->n_immediate++;
+            c->stato = ATTESA_OPERAZIONE;
+            break;
+
+        case ATTESA_FRAME:
+            if ((k = proto_estrai_frame(c->ingresso.dati + c->letti, disponibili, &op, &id, &dati, &len, NULL)) <= 0) return k;
+            dim = c->differite.len;
+            if (esegui_frame(op, id, dati, len, &c->uscita, &c->differite, &c->lsn) < 0) return -1;
+            if (c->differite.len > dim) conta_differita(c);
+            else c->n_immediate++;
+            c->letti += k;
+            if (c->differite.len > 0) c->differita = 1;
+            break;
+
+        default:
+            //Eventuali byte successivi al Green Pass del Centro Vaccinale vengono ignorati
+            c->letti = c->ingresso.len;
+            return 0;
+        }
+    }
+}
+
+//Funzione che chiude una connessione della modalità ad eventi, rimuovendola automaticamente dall'epoll.
+//Una connessione nella lista di attesa del WAL viene chiusa quando ne esce
+void chiudi_connessione(CONNESSIONE *c) {
+    if (c->differita) {
+        c->rotta = 1;
+        return;
+    }
+    if (c->stato == CONCLUSA) metriche_registra_da(&metriche->connessione_cv, c->accettata);
+    close(c->fd);
+    buffer_libera(&c->ingresso);
+    buffer_libera(&c->uscita);
+    buffer_libera(&c->differite);
+    buffer_libera(&c->in_invio);
+    free(c);
+}
+
+//Funzione che invia le risposte pronte senza bloccarsi: se il socket è pieno attende l'evento di scrittura.
+//Restituisce 1 se le risposte sono state inviate completamente, 0 se l'invio proseguirà con l'evento di scrittura,
+//-1 se la connessione è stata chiusa. Le connessioni del Centro Vaccinale vengono chiuse quando il Green Pass è
+//durevole, quelle del ServerG restano in attesa di nuove operazioni finché il ServerG non le chiude
+int invia_risposta(int epfd, CONNESSIONE *c) {
+    struct epoll_event ev;
+    ssize_t n;
+
+    while (c->inviati < c->uscita.len) {
+        if ((n = send(c->fd, c->uscita.dati + c->inviati, c->uscita.len - c->inviati, MSG_NOSIGNAL)) < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) {
+                if (!c->scrittura) {
+                    ev.events = EPOLLOUT;
+                    ev.data.ptr = c;
+                    if (epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev) < 0) break;
+                    c->scrittura = 1;
+                }
+                return 0;
+            }
+            break;
+        }
+        c->inviati += n;
+    }
+
+    if (c->inviati < c->uscita.len || ((c->stato == CONCLUSA || c->chiusa) && !c->differita)) {
+        chiudi_connessione(c);
+        return -1;
+    }
+    c->uscita.len = c->inviati = 0;
+
+    //Se le risposte sono state completate dall'evento di scrittura si torna ad attendere la lettura
+    if (c->scrittura) {
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+        c->scrittura = 0;
+    }
+    return 1;
+}
+
+//Parametri del thread che invia il WAL ad una replica nella modalità ad eventi
+typedef struct {
+    int fd;
+    size_t n;
+    char ricevuti[sizeof(uint64_t)];    //byte dell'LSN richiesto già ricevuti
+} INVIO_REPLICA;
+
+void *thread_replica(void *arg) {
+    INVIO_REPLICA *r = arg;
+
+    invio_replica(r->fd, r->ricevuti, r->n);
+    close(r->fd);
+    free(r);
+    return NULL;
+}
+
+//Thread che serve un canale in memoria condivisa: le sue richieste non passano dal socket, quindi non generano eventi
+void *thread_canale(void *arg) {
+    INVIO_REPLICA *r = arg;
+
+    comunicazione_canale(r->fd);
+    close(r->fd);
+    free(r);
+    return NULL;
+}
+
+//Funzione che affida ad un thread dedicato, che esegue thread, la connessione di una replica, perché il flusso dei
+//record si blocca in attesa del WAL, oppure quella di un canale in memoria condivisa: la connessione esce dall'epoll
+//(epfd -1 con io_uring) e torna bloccante
+void stacca_connessione(int epfd, CONNESSIONE *c, void *(*thread)(void *)) {
+    INVIO_REPLICA *r;
+    pthread_t tid;
+
+    if (epfd >= 0) epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    if ((r = calloc(1, sizeof(INVIO_REPLICA))) != NULL) {
+        r->fd = c->fd;
+        r->n = c->ingresso.len - c->letti < sizeof(uint64_t) ? c->ingresso.len - c->letti : sizeof(uint64_t);
+        memcpy(r->ricevuti, c->ingresso.dati + c->letti, r->n);
+        fcntl(r->fd, F_SETFL, fcntl(r->fd, F_GETFL) & ~O_NONBLOCK);
+        if (pthread_create(&tid, NULL, thread, r) == 0) pthread_detach(tid);
+        else {
+            close(r->fd);
+            free(r);
+        }
+    } else close(c->fd);
+    buffer_libera(&c->ingresso);
+    buffer_libera(&c->uscita);
+    buffer_libera(&c->differite);
+    buffer_libera(&c->in_invio);
+    free(c);
+}
+
+//Funzione che elabora tutte le richieste complete presenti nel buffer della connessione ed invia le risposte pronte.
+//Le connessioni con risposte che devono attendere il WAL vengono aggiunte alla lista in_attesa
+void servi_connessione(int epfd, CONNESSIONE *c, CONNESSIONE **in_attesa, int64_t *lsn_max) {
+    int differita = c->differita, esito;
+    uint64_t ricevuta, n_immediate;
+
+    if ((esito = elabora_connessione(c)) == -2 || esito == -3) {
+        stacca_connessione(epfd, c, esito == -2 ? thread_replica : thread_canale);
+        return;
+    }
+    if (esito < 0) {
+        chiudi_connessione(c);
+        return;
+    }
+    if (c->differita) {
+        if (!differita) {
+            c->prossima = *in_attesa;
+            *in_attesa = c;
+        }
+        if (c->lsn > *lsn_max) *lsn_max = c->lsn;
+    }
+
+    //Le risposte immediate, come le ricerche del protocollo a frame, non attendono il WAL. La connessione può essere
+    //chiusa da invia_risposta, quindi i dati della misura vengono copiati prima
+    ricevuta = c->ricevuta;
+    n_immediate = c->n_immediate;
+    c->n_immediate = 0;
+    invia_risposta(epfd, c);
+    metriche_registra_n(&metriche->risposta_immediata, metriche_adesso() - ricevuta, n_immediate);
+}
+
+//Funzione che legge i byte disponibili sul socket senza bloccarsi.
+//Restituisce 0 se il socket è vuoto, -1 se il client ha chiuso la connessione o in caso di errore
+int ricevi_connessione(CONNESSIONE *c) {
+    ssize_t n;
+
+    //I byte già elaborati vengono scartati per fare spazio a quelli nuovi
+    c->ricevuta = metriche_adesso();
+    if (c->letti > 0) {
+        buffer_scarta(&c->ingresso, c->letti);
+        c->letti = 0;
+    }
+
+    //Oltre la dimensione massima di un frame si smette di leggere: il resto verrà letto al prossimo evento
+    while (c->ingresso.len < PROTO_MAX_FRAME) {
+        if (buffer_riserva(&c->ingresso, c->ingresso.len + CONN_BUFFER) < 0) return -1;
+        if ((n = recv(c->fd, c->ingresso.dati + c->ingresso.len, c->ingresso.cap - c->ingresso.len, 0)) < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN ? 0 : -1;
+        }
+        if (n == 0) return -1;
+        c->ingresso.len += n;
+    }
+    return 0;
+}
+
+//Thread della modalità ad eventi: possiede un'epoll con il socket di ascolto condiviso e le proprie connessioni.
+//Le risposte alle scritture vengono raccolte durante un giro di eventi ed inviate dopo un'unica attesa del WAL
+void *lavoratore(void *arg) {
+    LAVORATORE *l = arg;
+    struct epoll_event ev, eventi[EVENTI_MAX];
+    CONNESSIONE *c, *in_attesa, *prossima;
+    cpu_set_t cpu;
+    int epfd, connectfd, n, i, attivo = 1;
+    int64_t lsn_max;
+
+    //Ogni thread viene assegnato ad un core diverso
+    CPU_ZERO(&cpu);
+    CPU_SET(l->id % sysconf(_SC_NPROCESSORS_ONLN), &cpu);
+    if ((errno = pthread_setaffinity_np(pthread_self(), sizeof(cpu), &cpu)) != 0) perror("pthread_setaffinity_np() error");
+
+    if ((epfd = epoll_create1(0)) < 0) {
+        perror("epoll_create1() error");
         exit(1);
     }
 
-    //Un Green Pass appena generato è valido di default
-    greenP.report = '1';
+    //EPOLLEXCLUSIVE: una nuova connessione risveglia un solo thread invece di tutti. Il socket Unix di ascolto si
+    //distingue da quello TCP per il puntatore al thread
+    ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, l->listenfd, &ev) < 0) {
+        perror("epoll_ctl() error");
+        exit(1);
+    }
+    ev.data.ptr = l;
+    if (l->listen_locale >= 0 && epoll_ctl(epfd, EPOLL_CTL_ADD, l->listen_locale, &ev) < 0) {
+        perror("epoll_ctl() error");
+        exit(1);
+    }
 
-    //Si crea un file contenente i dati ricevuti per ogni tessera sanitaria 
-    if ((fd = open(greenP.cod_fisc, O_WRONLY| O_CREAT | O_TRUNC, 0777)) < 0) {
-        perror("open() error");
+    for (;;) {
+        if ((n = epoll_wait(epfd, eventi, EVENTI_MAX, -1)) < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait() error");
+            exit(1);
+        }
+
+        in_attesa = NULL;
+        lsn_max = 0;
+        for (i = 0; i < n; i++) {
+            //Nuove connessioni su uno dei socket di ascolto
+            if (eventi[i].data.ptr == NULL || eventi[i].data.ptr == l) {
+                while ((connectfd = accept4(eventi[i].data.ptr == NULL ? l->listenfd : l->listen_locale, NULL, NULL, SOCK_NONBLOCK)) >= 0) {
+                    if ((c = calloc(1, sizeof(CONNESSIONE))) == NULL) {
+                        close(connectfd);
+                        continue;
+                    }
+                    c->fd = connectfd;
+                    c->stato = ATTESA_CLIENT;
+                    //Come in comunicazione_frame, le risposte differite non attendono l'ACK TCP di quelle immediate
+                    setsockopt(connectfd, IPPROTO_TCP, TCP_NODELAY, &attivo, sizeof(attivo));
+                    c->accettata = c->ricevuta = metriche_adesso();
+                    metriche_conta(&metriche->connessioni, 1);
+                    ev.events = EPOLLIN;
+                    ev.data.ptr = c;
+                    if (epoll_ctl(epfd, EPOLL_CTL_ADD, connectfd, &ev) < 0) chiudi_connessione(c);
+                }
+                continue;
+            }
+
+            c = eventi[i].data.ptr;
+            if (c->scrittura) {
+                if (invia_risposta(epfd, c) == 1) servi_connessione(epfd, c, &in_attesa, &lsn_max);
+                continue;
+            }
+
+            //Se il client chiude dopo aver inviato le richieste complete, queste vengono comunque eseguite
+            if (ricevi_connessione(c) < 0) c->chiusa = 1;
+            servi_connessione(epfd, c, &in_attesa, &lsn_max);
+        }
+
+        //Un'unica attesa del WAL per tutte le scritture di questo giro di eventi; poi vengono elaborate le
+        //richieste che con il vecchio protocollo attendevano la risposta differita
+        while (in_attesa != NULL) {
+            attendi_wal(lsn_max);
+            c = in_attesa;
+            in_attesa = NULL;
+            lsn_max = 0;
+            for (; c != NULL; c = prossima) {
+                prossima = c->prossima;
+                c->differita = 0;
+                c->lsn = 0;
+                metriche_registra_n(&metriche->risposta_durevole, metriche_adesso() - c->inizio_differite, c->n_differite);
+                c->n_differite = 0;
+                if (c->rotta || buffer_aggiungi(&c->uscita, c->differite.dati, c->differite.len) < 0) {
+                    chiudi_connessione(c);
+                    continue;
+                }
+                c->differite.len = 0;
+                servi_connessione(epfd, c, &in_attesa, &lsn_max);
+            }
+        }
+    }
+    return NULL;
+}
+
+//Operazioni della modalità io_uring, salvate nei due bit bassi del dato di ogni richiesta insieme alla connessione
+enum {URING_ACCETTA, URING_RICEVI, URING_INVIA, URING_ACCETTA_LOCALE};
+
+//Funzione che chiude una connessione della modalità io_uring. Con una ricezione o un invio in corso il socket viene
+//chiuso in lettura e scrittura, così le richieste terminano subito, e la connessione viene liberata dall'ultimo
+//completamento
+void chiudi_uring(CONNESSIONE *c) {
+    if (c->ricezione || c->invio) {
+        shutdown(c->fd, SHUT_RDWR);
+        c->rotta = 1;
+        return;
+    }
+    chiudi_connessione(c);
+}
+
+//Funzione che prepara l'invio delle risposte pronte, se non ce n'è già uno in corso: il buffer passa al kernel e le
+//nuove risposte si accumulano in uscita. Restituisce 0 oppure -1 se la richiesta non può essere preparata
+int avvia_invio(URING *u, CONNESSIONE *c) {
+    BUFFER b;
+
+    if (c->invio || c->uscita.len == 0) return 0;
+    b = c->in_invio;
+    c->in_invio = c->uscita;
+    c->uscita = b;
+    c->uscita.len = c->inviati = 0;
+    if (uring_prepara_rw(u, IORING_OP_SEND, c->fd, c->in_invio.dati, c->in_invio.len, (uint64_t)(uintptr_t)c | URING_INVIA) < 0) return -1;
+    c->invio = 1;
+    return 0;
+}
+
+//Funzione che prepara la ricezione dei prossimi byte, se non ce n'è già una in corso. I byte già elaborati vengono
+//scartati solo qui, quando il kernel non sta scrivendo nel buffer. Restituisce 0 oppure -1 in caso di errore
+int avvia_ricezione(URING *u, CONNESSIONE *c) {
+    if (c->ricezione || c->chiusa || c->stato == CONCLUSA) return 0;
+    if (c->letti > 0) {
+        buffer_scarta(&c->ingresso, c->letti);
+        c->letti = 0;
+    }
+    //Oltre la dimensione massima di un frame si smette di leggere finché le richieste non vengono elaborate
+    if (c->ingresso.len >= PROTO_MAX_FRAME) return 0;
+    if (buffer_riserva(&c->ingresso, c->ingresso.len + CONN_BUFFER) < 0) return -1;
+    if (uring_prepara_rw(u, IORING_OP_RECV, c->fd, c->ingresso.dati + c->ingresso.len, c->ingresso.cap - c->ingresso.len, (uint64_t)(uintptr_t)c | URING_RICEVI) < 0) return -1;
+    c->ricezione = 1;
+    return 0;
+}
+
+//Funzione che elabora le richieste ricevute come servi_connessione e prepara l'invio delle risposte e la ricezione
+//successiva. Le connessioni del Centro Vaccinale vengono chiuse quando il Green Pass è durevole ed inviata la risposta
+void servi_uring(URING *u, CONNESSIONE *c, CONNESSIONE **in_attesa, int64_t *lsn_max) {
+    int differita = c->differita, esito;
+    uint64_t n_immediate;
+
+    //La connessione di una replica o di un canale arriva qui dalla sua prima ricezione, senza altre richieste in corso
+    if (((esito = elabora_connessione(c)) == -2 || esito == -3) && !c->ricezione && !c->invio) {
+        stacca_connessione(-1, c, esito == -2 ? thread_replica : thread_canale);
+        return;
+    }
+    if (esito < 0) {
+        chiudi_uring(c);
+        return;
+    }
+    if (c->differita) {
+        if (!differita) {
+            c->prossima = *in_attesa;
+            *in_attesa = c;
+        }
+        if (c->lsn > *lsn_max) *lsn_max = c->lsn;
+    }
+
+    n_immediate = c->n_immediate;
+    c->n_immediate = 0;
+    if (avvia_invio(u, c) < 0) {
+        chiudi_uring(c);
+        return;
+    }
+    metriche_registra_n(&metriche->risposta_immediata, metriche_adesso() - c->ricevuta, n_immediate);
+    if (!c->invio && !c->differita && (c->stato == CONCLUSA || c->chiusa)) {
+        chiudi_uring(c);
+        return;
+    }
+    if (avvia_ricezione(u, c) < 0) chiudi_uring(c);
+}
+
+//Funzione che prepara l'accept della prossima connessione sul socket di ascolto condiviso, TCP con URING_ACCETTA
+//oppure Unix con URING_ACCETTA_LOCALE
+void avvia_accept(URING *u, int listenfd, uint64_t tipo) {
+    if (uring_prepara(u, IORING_OP_ACCEPT, listenfd, tipo) == NULL) {
+        perror("io_uring accept error");
+        exit(1);
+    }
+}
+
+//Thread della modalità io_uring: come lavoratore, ma accept, ricezioni ed invii sono richieste all'anello del thread.
+//Tutte le richieste preparate durante un giro vengono inviate con l'unica chiamata io_uring_enter che attende i
+//completamenti del giro successivo
+void *lavoratore_uring(void *arg) {
+    LAVORATORE *l = arg;
+    CONNESSIONE *c, *in_attesa, *prossima;
+    URING u;
+    cpu_set_t cpu;
+    int32_t risultato;
+    uint64_t dato;
+    int64_t lsn_max;
+    int attivo = 1;
+
+    CPU_ZERO(&cpu);
+    CPU_SET(l->id % sysconf(_SC_NPROCESSORS_ONLN), &cpu);
+    if ((errno = pthread_setaffinity_np(pthread_self(), sizeof(cpu), &cpu)) != 0) perror("pthread_setaffinity_np() error");
+
+    if (uring_apri(&u, URING_VOCI) < 0) {
+        perror("io_uring_setup() error");
         exit(1);
     }
+    avvia_accept(&u, l->listenfd, URING_ACCETTA);
+    if (l->listen_locale >= 0) avvia_accept(&u, l->listen_locale, URING_ACCETTA_LOCALE);
 
-	//Scrittura dei campi del Green Pass nel file binario    
-     if (write(fd, &greenP, sizeof(GP)) < 0) {
-        perror("write() error");
+    for (;;) {
+        if (uring_invia(&u, 1) < 0) {
+            if (errno == EINTR) continue;
+            perror("io_uring_enter() error");
+            exit(1);
+        }
+        metriche_conta(&metriche->uring_chiamate, 1);
+
+        in_attesa = NULL;
+        lsn_max = 0;
+        while (uring_completamento(&u, &risultato, &dato)) {
+            c = (CONNESSIONE *)(uintptr_t)(dato & ~(uint64_t)3);
+
+            if ((dato & 3) == URING_ACCETTA || (dato & 3) == URING_ACCETTA_LOCALE) {
+                avvia_accept(&u, (dato & 3) == URING_ACCETTA ? l->listenfd : l->listen_locale, dato & 3);
+                if (risultato < 0) {
+                    if (risultato != -EINTR && risultato != -EAGAIN && risultato != -ECONNABORTED) fprintf(stderr, "accept() error: %s\n", strerror(-risultato));
+                    continue;
+                }
+                if ((c = calloc(1, sizeof(CONNESSIONE))) == NULL) {
+                    close(risultato);
+                    continue;
+                }
+                c->fd = risultato;
+                c->stato = ATTESA_CLIENT;
+                c->accettata = c->ricevuta = metriche_adesso();
+                metriche_conta(&metriche->connessioni, 1);
+                setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &attivo, sizeof(attivo));
+                if (avvia_ricezione(&u, c) < 0) chiudi_uring(c);
+                continue;
+            }
+
+            if ((dato & 3) == URING_RICEVI) c->ricezione = 0;
+            else c->invio = 0;
+            if (c->rotta) {
+                if (!c->ricezione && !c->invio && !c->differita) chiudi_connessione(c);
+                continue;
+            }
+
+            if ((dato & 3) == URING_RICEVI) {
+                //Se il client chiude dopo aver inviato le richieste complete, queste vengono comunque eseguite
+                c->ricevuta = metriche_adesso();
+                if (risultato > 0) c->ingresso.len += risultato;
+                else c->chiusa = 1;
+            } else {
+                if (risultato < 0) {
+                    chiudi_uring(c);
+                    continue;
+                }
+                //Un invio parziale prosegue dal primo byte non inviato
+                c->inviati += risultato;
+                if (c->inviati < c->in_invio.len) {
+                    if (uring_prepara_rw(&u, IORING_OP_SEND, c->fd, c->in_invio.dati + c->inviati, c->in_invio.len - c->inviati, dato) < 0) chiudi_uring(c);
+                    else c->invio = 1;
+                    continue;
+                }
+                c->in_invio.len = c->inviati = 0;
+            }
+            servi_uring(&u, c, &in_attesa, &lsn_max);
+        }
+
+        //Come in lavoratore, un'unica attesa del WAL per tutte le scritture di questo giro
+        while (in_attesa != NULL) {
+            attendi_wal(lsn_max);
+            c = in_attesa;
+            in_attesa = NULL;
+            lsn_max = 0;
+            for (; c != NULL; c = prossima) {
+                prossima = c->prossima;
+                c->differita = 0;
+                c->lsn = 0;
+                metriche_registra_n(&metriche->risposta_durevole, metriche_adesso() - c->inizio_differite, c->n_differite);
+                c->n_differite = 0;
+                if (c->rotta || buffer_aggiungi(&c->uscita, c->differite.dati, c->differite.len) < 0) {
+                    chiudi_uring(c);
+                    continue;
+                }
+                c->differite.len = 0;
+                servi_uring(&u, c, &in_attesa, &lsn_max);
+            }
+        }
+    }
+    return NULL;
+}
+
+//Funzione che avvia la modalità ad eventi con n_thread thread, al posto di un processo figlio per ogni connessione,
+//sul socket di ascolto TCP e su quello Unix se listen_locale non è -1.
+//Con uring i thread usano io_uring, se il kernel lo permette, altrimenti epoll
+void avvia_eventi(int listenfd, int listen_locale, int n_thread, int uring) {
+    pthread_t *thread;
+    LAVORATORE *lavoratori;
+    URING prova;
+    int i;
+
+    if (uring && uring_apri(&prova, 8) < 0) {
+        printf("io_uring non disponibile (%s): modalità ad eventi con epoll\n", strerror(errno));
+        uring = 0;
+    } else if (uring) uring_chiudi(&prova);
+
+    //Con epoll il socket di ascolto non deve bloccare: più thread possono essere risvegliati dalla stessa
+    //connessione. Con io_uring ogni accept attende nel kernel la propria connessione
+    if (!uring && (fcntl(listenfd, F_SETFL, fcntl(listenfd, F_GETFL) | O_NONBLOCK) < 0 ||
+                   (listen_locale >= 0 && fcntl(listen_locale, F_SETFL, fcntl(listen_locale, F_GETFL) | O_NONBLOCK) < 0))) {
+        perror("fcntl() error");
         exit(1);
     }
+    if (n_thread <= 0) n_thread = sysconf(_SC_NPROCESSORS_ONLN);
+    thread = calloc(n_thread, sizeof(pthread_t));
+    lavoratori = calloc(n_thread, sizeof(LAVORATORE));
 
-    close(fd);
+    printf("Modalità ad eventi con %d thread (%s)\n\n", n_thread, uring ? "io_uring" : "epoll");
+    for (i = 0; i < n_thread; i++) {
+        lavoratori[i].id = i;
+        lavoratori[i].listenfd = listenfd;
+        lavoratori[i].listen_locale = listen_locale;
+        if ((errno = pthread_create(&thread[i], NULL, uring ? lavoratore_uring : lavoratore, &lavoratori[i])) != 0) {
+            perror("pthread_create() error");
+            exit(1);
+        }
+    }
+    for (i = 0; i < n_thread; i++) pthread_join(thread[i], NULL);
+}
+
+//Funzione che apre il socket Unix di ascolto percorso, per il ServerG ed il Centro Vaccinale sulla stessa macchina.
+//Un file rimasto da un avvio precedente viene sostituito. In caso di errore termina il programma
+int apri_ascolto_locale(const char *percorso) {
+    struct sockaddr_un addr;
+    int listenfd;
+
+    if (strlen(percorso) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Percorso del socket Unix troppo lungo: %s\n", percorso);
+        exit(1);
+    }
+    if ((listenfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        perror("socket() error");
+        exit(1);
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, percorso);
+    unlink(percorso);
+    if (bind(listenfd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("bind() error");
+        exit(1);
+    }
+    if (listen(listenfd, 1024) < 0) {
+        perror("listen() error");
+        exit(1);
+    }
+    printf("In ascolto anche sul socket Unix %s\n", percorso);
+    return listenfd;
 }
 
-int main() {
-    int listenfd, connectfd, dim_pacchetto;
+int main(int argc, char **argv) {
+    int listenfd, listen_locale = -1, connectfd, dim_pacchetto, opt;
+    struct pollfd ascolto[2];
     struct sockaddr_in servaddr;
     pid_t pid;
-    char bit;
-    signal(SIGINT,handler); //Cattura il segnale CTRL-C
+    char bit, ricevuti[sizeof(uint64_t)], *file_archivio = "greenpass.db", *file_wal = "greenpass.wal", *cartella = NULL;
+    RETE rete;
+    unsigned finestra_us = 0;
+    int64_t riapplicati;
+    int n_thread = -1, riuso = 1, porta_admin = PORTA_ADMIN, porta = PORTA, uring = 0;
+    char *primario = NULL, *separatore, *percorso_locale = NULL;
+    FILE *f;
+    unsigned long long lsn;
+    uint64_t capacita = 1 << 20;
+    struct stat st;
+    sigset_t segnali;
+    pthread_t uscita;
+    pid_padre = getpid();
+
+    //Il segnale CTRL-C viene bloccato prima di creare i thread, che ereditano la maschera, ed atteso da thread_uscita
+    sigemptyset(&segnali);
+    sigaddset(&segnali, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &segnali, NULL);
+
+    //Opzioni: -f file dell'archivio, -l file del WAL, -W finestra del group commit in microsecondi,
+    //-m cartella da cui importare i Green Pass salvati un file per tessera,
+    //-e modalità ad eventi con il numero di thread indicato (0 = uno per core),
+    //-U modalità ad eventi con io_uring invece di epoll, se il kernel lo permette,
+    //-b numero di Green Pass previsti, per dimensionare il filtro di Bloom,
+    //-r tentativi ripetuti di modificare un Green Pass occupato prima di rispondere al ServerG che è occupato,
+    //-a porta locale delle metriche (0 = disattivata), -p porta del ServerV, diversa per ogni ServerV di un cluster,
+    //-R indirizzo:porta del primario di cui questo ServerV è una replica in sola lettura,
+    //-u percorso di un socket Unix su cui accettare connessioni anche dai processi della stessa macchina
+    while ((opt = getopt(argc, argv, "f:l:W:m:e:Ub:r:a:p:R:u:")) != -1) {
+        if (opt == 'f') file_archivio = optarg;
+        else if (opt == 'e') n_thread = atoi(optarg);
+        else if (opt == 'U') uring = 1;
+        else if (opt == 'l') file_wal = optarg;
+        else if (opt == 'W') finestra_us = atoi(optarg);
+        else if (opt == 'm') cartella = optarg;
+        else if (opt == 'b') capacita = strtoull(optarg, NULL, 10);
+        else if (opt == 'r') tentativi_report = atoi(optarg) > 0 && atoi(optarg) < 128 ? atoi(optarg) : REPORT_TENTATIVI;
+        else if (opt == 'a') porta_admin = atoi(optarg);
+        else if (opt == 'p') porta = atoi(optarg);
+        else if (opt == 'R') primario = optarg;
+        else if (opt == 'u') percorso_locale = optarg;
+        else {
+            fprintf(stderr, "usage: %s [-f archivio] [-l wal] [-W finestra group commit us] [-m cartella da importare] [-e thread] [-U] [-b Green Pass previsti] [-r tentativi] [-a porta metriche] [-p porta] [-R primario:porta] [-u socket Unix]\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    //Apertura dell'archivio dei Green Pass, ereditato da tutti i processi figli. Un archivio della versione
+    //precedente viene convertito; il WAL che segue può contenere Green Pass in entrambi i formati
+    if (archivio_apri(&archivio, file_archivio, sizeof(GP)) < 0) {
+        if (errno != EPROTO) {
+            perror("archivio_apri() error");
+            exit(1);
+        }
+        archivio_chiudi(&archivio);
+        aggiorna_archivio(file_archivio);
+    }
+
+    //Una replica riprende dalla posizione salvata all'ultimo checkpoint, aggiornata dai record WAL_POSIZIONE del suo
+    //WAL; senza posizione copierà l'intero archivio del primario
+    if (primario != NULL) {
+        if ((separatore = strrchr(primario, ':')) == NULL) {
+            fprintf(stderr, "Primario non valido: %s (indirizzo:porta)\n", primario);
+            exit(1);
+        }
+        *separatore = 0;
+        if (anello_aggiungi(&replica.primario, "primario", primario, atoi(separatore + 1), 1) < 0) {
+            perror("anello_aggiungi() error");
+            exit(1);
+        }
+        sola_lettura = 1;
+        snprintf(replica.posizione, sizeof(replica.posizione), "%s.replica", file_archivio);
+        if ((f = fopen(replica.posizione, "r")) != NULL) {
+            if (fscanf(f, "%llu", &lsn) == 1) {
+                replica.lsn = lsn;
+                replica.valida = 1;
+            }
+            fclose(f);
+        }
+    }
+
+    //Un WAL non vuoto indica che il ServerV si è interrotto senza checkpoint: la tabella hash potrebbe essere
+    //incompleta, quindi viene ricostruita dai record prima di riapplicare il log
+    if (stat(file_wal, &st) == 0 && st.st_size > (off_t)sizeof(WAL_TESTA) && archivio_ricostruisci_indice(&archivio) < 0) {
+        perror("archivio_ricostruisci_indice() error");
+        exit(1);
+    }
+    if ((riapplicati = wal_apri(&wal, file_wal, finestra_us, applica_wal, sincronizza_archivio, &archivio)) < 0) {
+        perror("wal_apri() error");
+        exit(1);
+    }
+    if (riapplicati > 0) printf("Ripristinate %lld operazioni dal WAL %s\n", (long long)riapplicati, file_wal);
+    if (cartella != NULL) importa_cartella(cartella);
+    printf("Archivio %s: %llu Green Pass\n", file_archivio, (unsigned long long)archivio_dimensione(&archivio));
+
+    //Il filtro viene ricostruito ad ogni avvio dai codici presenti nell'archivio, dopo il ripristino del WAL
+    costruisci_filtro(capacita);
+
+    //Da qui un CTRL-C, anche se arrivato durante il ripristino, esegue il checkpoint sull'archivio completo
+    if ((errno = pthread_create(&uscita, NULL, thread_uscita, &segnali)) != 0) {
+        perror("pthread_create() error");
+        exit(1);
+    }
+
+    //Il giorno corrente usato dalle verifiche viene aggiornato da un thread del processo padre
+    if (data_avvia() < 0) {
+        perror("data_avvia() error");
+        exit(1);
+    }
+
+    //Le metriche vengono create prima dei processi figli; la porta di amministrazione è servita da un thread del
+    //processo padre. Se la porta è occupata il ServerV prosegue senza
+    if ((metriche = metriche_crea(sizeof(METRICHE))) == NULL) {
+        perror("metriche_crea() error");
+        exit(1);
+    }
+    if (porta_admin > 0 && metriche_avvia_admin(porta_admin, stampa_metriche) < 0) perror("metriche_avvia_admin() error");
+    else if (porta_admin > 0) printf("Metriche sulla porta locale %d\n", porta_admin);
+    if (sola_lettura) avvia_replica();
+    printf("\n");
+
+    //Il socket Unix è pronto prima di quello TCP: chi attende la porta 1025 può già usarlo
+    if (percorso_locale != NULL) listen_locale = apri_ascolto_locale(percorso_locale);
    
     //Creazione descrizione del socket
     if ((listenfd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
@@ -284,7 +2067,13 @@ int main() {
     
     servaddr.sin_family = AF_INET;
     servaddr.sin_addr.s_addr = htonl(INADDR_ANY); //INADDR_ANY: Viene utilizzato come indirizzo del server, l’applicazione accetterà connessioni da qualsiasi indirizzo associato al server.
-    servaddr.sin_port = htons(1025);
+    servaddr.sin_port = htons(porta);
+
+    //Permette di riavviare subito il ServerV anche se restano connessioni chiuse da poco sulla porta
+    if (setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &riuso, sizeof(riuso)) < 0) {
+        perror("setsockopt() error");
+        exit(1);
+    }
 
     //Mette il socket in modalità di ascolto in attesa di nuove connessioni
     if (bind(listenfd, (struct sockaddr *)&servaddr, sizeof(servaddr)) < 0) {
@@ -298,15 +2087,33 @@ int main() {
         exit(1);
     }
 
+    if (uring && n_thread < 0) n_thread = 0;
+    if (n_thread >= 0) {
+        avvia_eventi(listenfd, listen_locale, n_thread, uring);
+        exit(0);
+    }
+    ascolto[0].fd = listenfd;
+    ascolto[1].fd = listen_locale;
+    ascolto[0].events = ascolto[1].events = POLLIN;
+
     for (;;) {
 
     printf("In attesa di nuovi dati\n\n");
 
+        //Attende una connessione sul socket TCP o su quello Unix (un descrittore -1 viene ignorato da poll)
+        if (poll(ascolto, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll() error");
+            exit(1);
+        }
+
         //Accetta una nuova connessione
-        if ((connectfd = accept(listenfd, (struct sockaddr *)NULL, NULL)) < 0) {
+        if ((connectfd = accept(ascolto[0].revents ? listenfd : listen_locale, (struct sockaddr *)NULL, NULL)) < 0) {
             perror("accept() error");
             exit(1);
         }
+        accettata = metriche_adesso();
+        metriche_conta(&metriche->connessioni, 1);
 
         //Creazione del processo figlio
         if ((pid = fork()) < 0) {
@@ -317,20 +2124,36 @@ int main() {
         //Codice eseguito dal processo figlio
         if (pid == 0) {
             close(listenfd);
+            if (listen_locale >= 0) close(listen_locale);
+            //Il processo figlio non ha thread_uscita: un CTRL-C lo termina subito, il checkpoint resta al padre
+            signal(SIGINT, SIG_DFL);
+            pthread_sigmask(SIG_UNBLOCK, &segnali, NULL);
 
-                // Il ServerV riceve come primo messaggio un bit, il quale può assumere come valori 0 o 1, per distinguere due connessioni diverse
+                // Il ServerV riceve come primo messaggio un bit, il quale può assumere come valori 0, 1 o 2, per distinguere le connessioni
                 // Se riceve 1, il processo figlio gestirà la connessione con il Centro Vaccinale
-                // Invece se riceve 0, il processo figlio gestirà la connessione con il ServerV
+                // Invece se riceve 0, il processo figlio gestirà la connessione con il ServerG
+                // Se riceve 2, il ServerG userà il protocollo a frame descritto in protocollo.h
+                // Se riceve 4, una replica riceverà i record del WAL (protocollo.h)
+                // Se riceve 5, il ServerG sulla stessa macchina apre un canale in memoria condivisa (canale.h)
 
-            if (full_read(connectfd, &bit, sizeof(char)) < 0) {
-                perror("full_read() error");
+            rete_inizia(&rete, connectfd);
+            if (rete_leggi(&rete, &bit, sizeof(char)) != 0) {
+                perror("rete_leggi() error");
                 exit(1);
             }
-            if (bit == '1') comunicazione_CV(connectfd);
-            else if (bit == '0') comunicazione_SV(connectfd);
-            else printf("Client inesistente!\n\n");
+            if (bit == '1') comunicazione_CV(&rete);
+            else if (bit == '0') comunicazione_SV(&rete);
+            else if (bit == '2') comunicazione_frame(&rete, NULL);
+            else if (bit == '5') comunicazione_canale(connectfd);
+            else if (bit == '4') invio_replica(connectfd, ricevuti, rete_estrai(&rete, ricevuti, sizeof(uint64_t)));
+            else {
+                printf("Client inesistente!\n\n");
+                metriche_conta(&metriche->errori, 1);
+            }
 
+            rete_invia(&rete);
             close(connectfd);
+            if (bit == '1') metriche_registra_da(&metriche->connessione_cv, accettata);
             exit(0);
         } else close(connectfd); //Codice eseguito dal processo padre
     }
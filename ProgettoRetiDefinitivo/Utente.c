@@ -7,6 +7,8 @@
 #include <sys/types.h>
 #include <sys/socket.h> //contiene le definizioni dei socket
 #include <arpa/inet.h>  // contiene le definizioni per le operazioni Internet
+#include "registrazione.h" //messaggi della registrazione scambiati con il Centro Vaccinale
+#include "rete.h"       //lettura e scrittura bufferizzate dei messaggi a campi
 #define BUFF_MAX_SIZE 1024   //dimensione massima del buffer size
 #define COD_SIZE 17      //dimensione del codice di tessera sanitaria 16 byte ed 1 del terminatore
 #define ACK_SIZE 64     //dimensione del messaggio di ACK ricevuto dal Centro Vaccinale
@@ -18,41 +20,6 @@ typedef struct {
     char cod_fisc[COD_SIZE];
 } VACCINAZIONE;
 
-//Legge esattamente count byte s iterando opportunamente le letture
-ssize_t full_read(int fd, void *buffer, size_t count) {
-    size_t n_left;
-    ssize_t n_read;
-    n_left = count;
-    while (n_left > 0) {  // ciclo ripetuto fintanto che non vengono letti tutti i bytes
-        if ((n_read = read(fd, buffer, n_left)) < 0) {
-            if (errno == EINTR) continue; 
-            else exit(n_read);
-        } else if (n_read == 0) break; // se sono 0 si chiude il descrittore,si esce dal ciclo e viene restituito n_left
-        n_left -= n_read;
-        buffer += n_read;
-    }
-    buffer = 0;
-    return n_left;
-}
-
-
-//Scrive esattamente count byte s iterando opportunamente le scritture
-ssize_t full_write(int fd, const void *buffer, size_t count) {
-    size_t n_left;
-    ssize_t n_written;
-    n_left = count;
-    while (n_left > 0) {          // ciclo ripetuto fintanto che non vengono scritti tutti i bytes
-        if ((n_written = write(fd, buffer, n_left)) < 0) {
-            if (errno == EINTR) continue; 
-            else exit(n_written); //Se non è una System Call, esci con un errore
-        }
-        n_left -= n_written;
-        buffer += n_written;
-    }
-    buffer = 0;
-    return n_left;
-}
-
 //Funzione per la creazione del pacchetto da inviare al CentroVaccinale
 VACCINAZIONE crea_pacchetto() {
     char buffer[BUFF_MAX_SIZE];
@@ -95,13 +62,15 @@ VACCINAZIONE crea_pacchetto() {
 }
 
 int main(int argc, char **argv) {
-    int sock_fd, benvenuto, dim_pacchetto;
+    int sock_fd, benvenuto, dim_pacchetto, versione;
     struct sockaddr_in serveraddr;
     VACCINAZIONE pacchetto;
-    char buffer[BUFF_MAX_SIZE];
+    char buffer[BUFF_MAX_SIZE], registrazione[REG_TESTA + 2 * REG_MAX_NOME];
+    unsigned char len_ack;
     char **alias;
     char *addr;
 	struct hostent *data; //struttura per utilizzare la gethostbyname
+    RETE rete;
 
     if (argc != 2) {
         perror("usage: <host name>"); //perror: Produce un messaggio sullo standard error che descrive l’ultimo errore avvenuto durante una System call o una funzione di libreria.
@@ -142,31 +111,52 @@ int main(int argc, char **argv) {
         perror("connect() error");
         exit(1);
     }
-    //FullRead per leggere quanti byte invia il Centro Vaccinale
-    if (full_read(sock_fd, &benvenuto, sizeof(int)) < 0) {
-        perror("full_read() error");
+    //Lettura di quanti byte invia il Centro Vaccinale: il benvenuto arriva con la stessa recv
+    rete_inizia(&rete, sock_fd);
+    if (rete_leggi(&rete, &benvenuto, sizeof(int)) != 0) {
+        perror("rete_leggi() error");
         exit(1);
     }
     //Ricezione del benevenuto dal CentroVaccinale
-    if (full_read(sock_fd, buffer, benvenuto) < 0) {
-        perror("full_read() error");
+    if (benvenuto <= 0 || benvenuto > BUFF_MAX_SIZE || rete_leggi(&rete, buffer, benvenuto) != 0) {
+        printf("Benvenuto del Centro Vaccinale non valido\n");
         exit(1);
     }
+
+    //Il byte che segue il testo del benvenuto è la versione del protocollo supportata dal Centro Vaccinale
+    versione = reg_versione_benvenuto(buffer, benvenuto);
+    if (strnlen(buffer, benvenuto) == (size_t)benvenuto) buffer[benvenuto - 1] = 0;
     printf("%s\n", buffer);
 
     //Creazione del pacchetto da inviare al Centro Vaccinale
     pacchetto = crea_pacchetto();
 
-    //Invio del pacchetto richiesto al Centro Vaccinale
-    if (full_write(sock_fd, &pacchetto, sizeof(pacchetto)) < 0) {
-        perror("full_write() error");
-        exit(1);
-    }
+    //Invio al Centro Vaccinale della registrazione compatta, oppure del pacchetto completo se il Centro Vaccinale è
+    //di una versione precedente
+    if (versione >= 2) {
+        dim_pacchetto = reg_codifica(registrazione, pacchetto.nome, pacchetto.cognome, pacchetto.cod_fisc);
+        if (rete_scrivi(&rete, registrazione, dim_pacchetto) < 0) {
+            perror("rete_scrivi() error");
+            exit(1);
+        }
 
-    //Ricezione dell'ack
-    if (full_read(sock_fd, buffer, ACK_SIZE) < 0) {
-        perror("full_read() error");
-        exit(1);
+        //Ricezione dell'ack, preceduto dalla sua lunghezza
+        if (rete_leggi(&rete, &len_ack, sizeof(len_ack)) != 0 || rete_leggi(&rete, buffer, len_ack) != 0) {
+            printf("Connessione con il Centro Vaccinale interrotta\n");
+            exit(1);
+        }
+        buffer[len_ack] = 0;
+    } else {
+        if (rete_scrivi(&rete, &pacchetto, sizeof(pacchetto)) < 0) {
+            perror("rete_scrivi() error");
+            exit(1);
+        }
+
+        //Ricezione dell'ack
+        if (rete_leggi(&rete, buffer, ACK_SIZE) != 0) {
+            perror("rete_leggi() error");
+            exit(1);
+        }
     }
     printf("%s\n\n", buffer);
 
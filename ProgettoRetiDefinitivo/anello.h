@@ -0,0 +1,268 @@
+//Anello di hashing consistente che assegna ogni codice della tessera sanitaria ad uno dei ServerV di un cluster.
+//
+//Ogni ServerV (nodo) occupa ANELLO_PUNTI punti per unità di peso sull'anello degli hash a 64 bit, nelle posizioni
+//date dall'hash di "nome#k"; un codice appartiene al nodo del primo punto che segue il suo hash. Aggiungendo un nodo
+//cambiano proprietario solo i codici che cadono nei tratti occupati dai suoi punti, in media la sua quota, tutti
+//verso il nuovo nodo. I punti dipendono solo dai nomi e dai pesi, quindi ServerG, Centro Vaccinale e lo strumento di
+//ribilanciamento calcolano lo stesso proprietario a partire dallo stesso file di configurazione:
+//  # nome  indirizzo  porta  [peso]
+//  sv1     127.0.0.1  1025
+//  sv2     127.0.0.1  1027   2
+//  sv2r    127.0.0.1  1031   replica sv2
+//  sv3     /tmp/sv3.sock  0
+//Una riga con "replica" ed il nome di un ServerV già elencato descrive una sua replica in sola lettura: non occupa
+//punti sull'anello, ma il ServerG le invia le ricerche dei codici del suo primario.
+//Un indirizzo che inizia con '/' è il percorso del socket Unix di un ServerV sulla stessa macchina (opzione -u del
+//ServerV): la porta viene ignorata.
+//Senza file di configurazione l'anello contiene il solo ServerV predefinito, 127.0.0.1:1025.
+#ifndef ANELLO_H
+#define ANELLO_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+
+#define ANELLO_MAX_NODI 64              //ServerV di un cluster
+#define ANELLO_PUNTI 160                //punti sull'anello per unità di peso di un nodo
+#define ANELLO_MAX_PESO 16
+#define ANELLO_CARATTERI 16             //caratteri del codice della tessera sanitaria usati per l'hash
+#define ANELLO_MAX_REPLICHE 8           //repliche di un ServerV
+
+typedef struct {
+    char nome[64];
+    char host[64];
+    int porta;
+    int peso;                           //0 per una replica
+    struct sockaddr_in addr;
+    int locale;                         //1 se il nodo si raggiunge con il socket Unix addr_locale
+    struct sockaddr_un addr_locale;
+    int primario;                       //nodo di cui è replica, -1 per un primario
+    int n_repliche;
+    int repliche[ANELLO_MAX_REPLICHE];
+} NODO_ANELLO;
+
+typedef struct {
+    uint64_t hash;
+    int nodo;
+} PUNTO_ANELLO;
+
+typedef struct {
+    int n;                              //numero di nodi
+    NODO_ANELLO nodi[ANELLO_MAX_NODI];
+    int n_punti;
+    PUNTO_ANELLO *punti;                //ordinati per hash
+} ANELLO;
+
+//Hash FNV-1a dei len byte indicati, mescolato con il finalizzatore di MurmurHash3 perché i punti dei nomi simili
+//("sv1#0", "sv1#1"...) siano distribuiti su tutto l'anello. Con maiuscole le lettere minuscole valgono come maiuscole
+uint64_t anello_hash(const char *s, size_t len, int maiuscole) {
+    uint64_t h = 0xCBF29CE484222325ULL;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        h ^= maiuscole ? toupper((unsigned char)s[i]) : (unsigned char)s[i];
+        h *= 0x100000001B3ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+int anello_confronta(const void *a, const void *b) {
+    const PUNTO_ANELLO *p = a, *q = b;
+
+    if (p->hash != q->hash) return p->hash < q->hash ? -1 : 1;
+    return p->nodo - q->nodo;
+}
+
+//Aggiunge all'anello il nodo indicato, risolvendone l'indirizzo. Restituisce 0 oppure -1 in caso di errore
+int anello_aggiungi(ANELLO *a, const char *nome, const char *host, int porta, int peso) {
+    NODO_ANELLO *nodo;
+    struct addrinfo richiesta, *risultato;
+    int i;
+
+    if (a->n == ANELLO_MAX_NODI || (host[0] != '/' && (porta <= 0 || porta > 65535)) || peso <= 0 || peso > ANELLO_MAX_PESO ||
+        strlen(nome) >= sizeof(nodo->nome) || strlen(host) >= sizeof(nodo->host)) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (i = 0; i < a->n; i++) {
+        if (strcmp(a->nodi[i].nome, nome) == 0) {
+            errno = EEXIST;
+            return -1;
+        }
+    }
+    nodo = &a->nodi[a->n];
+    memset(nodo, 0, sizeof(NODO_ANELLO));
+    strcpy(nodo->nome, nome);
+    strcpy(nodo->host, host);
+    nodo->porta = porta;
+    nodo->peso = peso;
+    nodo->primario = -1;
+
+    if (host[0] == '/') {
+        nodo->locale = 1;
+        nodo->addr_locale.sun_family = AF_UNIX;
+        strcpy(nodo->addr_locale.sun_path, host);
+        a->n++;
+        return 0;
+    }
+    memset(&richiesta, 0, sizeof(richiesta));
+    richiesta.ai_family = AF_INET;
+    richiesta.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, NULL, &richiesta, &risultato) != 0) {
+        errno = EHOSTUNREACH;
+        return -1;
+    }
+    memcpy(&nodo->addr, risultato->ai_addr, sizeof(struct sockaddr_in));
+    nodo->addr.sin_port = htons(porta);
+    freeaddrinfo(risultato);
+    a->n++;
+    return 0;
+}
+
+//Aggiunge all'anello la replica nome del nodo primario, già presente. Restituisce 0 oppure -1 in caso di errore
+int anello_aggiungi_replica(ANELLO *a, const char *nome, const char *host, int porta, const char *primario) {
+    int p;
+
+    for (p = 0; p < a->n && strcmp(a->nodi[p].nome, primario) != 0; p++);
+    if (p == a->n || a->nodi[p].primario >= 0 || a->nodi[p].n_repliche == ANELLO_MAX_REPLICHE) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (anello_aggiungi(a, nome, host, porta, 1) < 0) return -1;
+    a->nodi[a->n - 1].peso = 0;
+    a->nodi[a->n - 1].primario = p;
+    a->nodi[p].repliche[a->nodi[p].n_repliche++] = a->n - 1;
+    return 0;
+}
+
+//Calcola e ordina i punti di tutti i nodi. Restituisce 0 oppure -1 se la memoria non è sufficiente
+int anello_costruisci(ANELLO *a) {
+    char punto[sizeof(a->nodi[0].nome) + 16];
+    int i, k, len;
+
+    free(a->punti);
+    a->n_punti = 0;
+    for (i = 0; i < a->n; i++) a->n_punti += a->nodi[i].peso * ANELLO_PUNTI;
+    if ((a->punti = malloc(a->n_punti * sizeof(PUNTO_ANELLO))) == NULL) return -1;
+    a->n_punti = 0;
+    for (i = 0; i < a->n; i++) {
+        for (k = 0; k < a->nodi[i].peso * ANELLO_PUNTI; k++) {
+            len = snprintf(punto, sizeof(punto), "%s#%d", a->nodi[i].nome, k);
+            a->punti[a->n_punti].hash = anello_hash(punto, len, 0);
+            a->punti[a->n_punti++].nodo = i;
+        }
+    }
+    qsort(a->punti, a->n_punti, sizeof(PUNTO_ANELLO), anello_confronta);
+    return 0;
+}
+
+//Anello con il solo ServerV indicato
+int anello_singolo(ANELLO *a, const char *host, int porta) {
+    memset(a, 0, sizeof(ANELLO));
+    if (anello_aggiungi(a, "sv", host, porta, 1) < 0) return -1;
+    return anello_costruisci(a);
+}
+
+//Carica l'anello dal file di configurazione path. In caso di errore stampa la riga non valida e restituisce -1
+int anello_carica(ANELLO *a, const char *path) {
+    FILE *f;
+    char riga[256], nome[64], host[64], quarto[64], primario[64], *fine;
+    int porta, peso, campi, numero = 0, esito;
+
+    memset(a, 0, sizeof(ANELLO));
+    if ((f = fopen(path, "r")) == NULL) return -1;
+    while (fgets(riga, sizeof(riga), f) != NULL) {
+        numero++;
+        riga[strcspn(riga, "#\r\n")] = 0;
+        if ((campi = sscanf(riga, "%63s %63s %d %63s %63s", nome, host, &porta, quarto, primario)) <= 0) continue;
+        if (campi == 5 && strcmp(quarto, "replica") == 0) esito = anello_aggiungi_replica(a, nome, host, porta, primario);
+        else {
+            peso = campi == 4 ? strtol(quarto, &fine, 10) : 1;
+            esito = campi == 3 || (campi == 4 && *fine == 0) ? anello_aggiungi(a, nome, host, porta, peso) : -1;
+        }
+        if (esito < 0) {
+            fprintf(stderr, "%s:%d: nodo non valido (nome indirizzo porta [peso | replica primario])\n", path, numero);
+            fclose(f);
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    fclose(f);
+    if (a->n == 0) {
+        fprintf(stderr, "%s: nessun nodo\n", path);
+        errno = EINVAL;
+        return -1;
+    }
+    return anello_costruisci(a);
+}
+
+//Restituisce l'indice del nodo con il nome indicato, oppure -1 se non fa parte dell'anello
+int anello_cerca_nome(const ANELLO *a, const char *nome) {
+    int i;
+
+    for (i = 0; i < a->n; i++) if (strcmp(a->nodi[i].nome, nome) == 0) return i;
+    return -1;
+}
+
+//Restituisce l'indice del nodo a cui appartiene il codice della tessera sanitaria (i primi ANELLO_CARATTERI
+//caratteri, senza distinguere maiuscole e minuscole)
+int anello_nodo(const ANELLO *a, const char *cod_fisc) {
+    uint64_t h;
+    int basso, alto, medio;
+
+    if (a->n == 1) return 0;
+    h = anello_hash(cod_fisc, strnlen(cod_fisc, ANELLO_CARATTERI), 1);
+    for (basso = 0, alto = a->n_punti; basso < alto;) {
+        medio = (basso + alto) / 2;
+        if (a->punti[medio].hash < h) basso = medio + 1;
+        else alto = medio;
+    }
+    return a->punti[basso == a->n_punti ? 0 : basso].nodo;
+}
+
+//Restituisce il nodo a cui inviare la k-esima ricerca dei codici del primario s: a turno una delle sue repliche,
+//oppure s stesso se non ne ha
+int anello_lettura(const ANELLO *a, int s, unsigned k) {
+    return a->nodi[s].n_repliche > 0 ? a->nodi[s].repliche[k % a->nodi[s].n_repliche] : s;
+}
+
+//Restituisce l'indirizzo del nodo i, TCP oppure Unix, e ne salva la lunghezza in len
+const struct sockaddr *anello_indirizzo(const ANELLO *a, int i, socklen_t *len) {
+    *len = a->nodi[i].locale ? sizeof(struct sockaddr_un) : sizeof(struct sockaddr_in);
+    return a->nodi[i].locale ? (const struct sockaddr *)&a->nodi[i].addr_locale : (const struct sockaddr *)&a->nodi[i].addr;
+}
+
+//Crea un socket non ancora connesso della famiglia del nodo i. Restituisce il descrittore oppure -1
+int anello_socket(const ANELLO *a, int i) {
+    return socket(a->nodi[i].locale ? AF_UNIX : AF_INET, SOCK_STREAM, 0);
+}
+
+//Apre una connessione con il nodo i. Restituisce il descrittore del socket oppure -1
+int anello_connetti(const ANELLO *a, int i) {
+    const struct sockaddr *indirizzo;
+    socklen_t len;
+    int sock_fd;
+
+    indirizzo = anello_indirizzo(a, i, &len);
+    if ((sock_fd = anello_socket(a, i)) < 0) return -1;
+    if (connect(sock_fd, indirizzo, len) < 0) {
+        close(sock_fd);
+        return -1;
+    }
+    return sock_fd;
+}
+
+#endif
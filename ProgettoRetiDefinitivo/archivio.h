@@ -0,0 +1,599 @@
+//Archivio dei Green Pass: un unico file mappato in memoria che contiene record di dimensione fissa
+//indicizzati da una tabella hash ad indirizzamento aperto (scansione lineare) sul codice della tessera sanitaria,
+//compresso nei primi ARCHIVIO_CHIAVE byte di ogni record (greenpass.h).
+//
+//Organizzazione del file:
+//  [testata][tabella hash][blocco di record 0][blocco di record 1]...[nuova tabella hash][blocco di record N]...
+//I record vengono allocati in blocchi da ARCHIVIO_BLOCCO elementi aggiunti in coda al file. Quando la tabella hash
+//supera il fattore di carico ne viene costruita una grande il doppio, sempre in coda al file, e la testata viene
+//aggiornata per puntare a quella nuova. Nessun dato viene mai spostato: il file viene mappato all'interno di una
+//regione di indirizzi riservata all'apertura, che viene estesa man mano che il file cresce.
+//
+//Le ricerche non usano il lock: i record sono protetti da contatori di versione (seqlock) in memoria condivisa,
+//che chi modifica rende dispari durante la scrittura; chi legge ripete la lettura se la versione è cambiata.
+//Un contatore analogo protegge la sostituzione della tabella hash. Il lock serve solo a chi inserisce record; chi
+//modifica un record esistente acquisisce solo il suo contatore, con un compare-and-swap.
+#ifndef ARCHIVIO_H
+#define ARCHIVIO_H
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#define ARCHIVIO_MAGIC 0x42445047        //"GPDB" letto in little endian
+#define ARCHIVIO_VERSIONE 2              //la versione 1 aveva chiavi da 16 byte (il codice non compresso)
+#define ARCHIVIO_CHIAVE 12               //byte della chiave: il codice compresso della tessera sanitaria
+#define ARCHIVIO_BLOCCO 65536            //numero di record contenuti in un blocco
+#define ARCHIVIO_MAX_BLOCCHI 2048        //numero massimo di blocchi (circa 134 milioni di record)
+#define ARCHIVIO_INDICE_MIN 65536        //numero iniziale di slot della tabella hash (potenza di 2)
+#define ARCHIVIO_RISERVA (1ULL << 38)    //spazio di indirizzi riservato per la mappatura del file (256 GB)
+#define ARCHIVIO_STRISCE 4096            //contatori di versione dei record, condivisi dai record con lo stesso resto
+#define ARCHIVIO_TENTATIVI 64            //letture senza lock ripetute prima di cercare con il lock
+#define ARCHIVIO_ATTESA_MAX 1024         //attesa massima in microsecondi fra due tentativi di acquisire un gruppo
+#define ARCHIVIO_ANTICIPO 16             //ricerche di archivio_cerca_molti di cui si anticipa insieme il caricamento
+
+//Testata del file, sempre mappata all'inizio della regione riservata
+typedef struct {
+    uint32_t magic;
+    uint32_t versione;
+    uint32_t dim_record;                 //byte occupati da un record
+    uint32_t n_blocchi;                  //blocchi di record allocati
+    uint64_t n_record;                   //record presenti nell'archivio
+    uint64_t dim_file;                   //dimensione attuale del file
+    uint64_t indice_off;                 //posizione nel file della tabella hash in uso
+    uint64_t indice_cap;                 //numero di slot della tabella hash in uso
+    pthread_mutex_t lock;                //mutua esclusione fra processi e thread che modificano l'archivio
+    uint64_t blocchi_off[ARCHIVIO_MAX_BLOCCHI]; //posizione nel file di ogni blocco di record
+} ARCHIVIO_TESTA;
+
+//Slot della tabella hash
+typedef struct {
+    uint32_t tag;                        //32 bit alti dell'hash della chiave, evitano confronti inutili
+    uint32_t rec;                        //numero del record + 1, 0 indica uno slot libero
+} ARCHIVIO_SLOT;
+
+//Contatori di versione delle letture senza lock. Non fanno parte del file: sono in memoria condivisa anonima creata
+//all'apertura, quindi condivisi dai processi figli e dai thread
+typedef struct {
+    uint64_t struttura;                  //dispari mentre viene sostituita la tabella hash
+    uint64_t record[ARCHIVIO_STRISCE];   //dispari mentre un record del gruppo viene modificato
+    pid_t proprietari[ARCHIVIO_STRISCE]; //processo che ha acquisito il gruppo, 0 se libero
+    int64_t trattenuto;                  //gruppo acquisito da chi possiede il lock, rilasciato da archivio_sblocca
+} ARCHIVIO_VERSIONI;
+
+//Descrittore dell'archivio posseduto da ogni processo
+typedef struct {
+    int fd;
+    char *base;                          //inizio della regione riservata, coincide con la testata
+    uint64_t mappati;                    //byte del file attualmente mappati
+    ARCHIVIO_TESTA *testa;
+    ARCHIVIO_VERSIONI *versioni;
+} ARCHIVIO;
+
+//Arrotonda una dimensione al multiplo successivo della pagina di memoria
+uint64_t archivio_allinea(uint64_t dim) {
+    uint64_t pagina = sysconf(_SC_PAGESIZE);
+    return (dim + pagina - 1) / pagina * pagina;
+}
+
+//Hash a 64 bit della chiave: i primi 8 byte e gli ultimi 4 vengono letti come interi e mescolati con il
+//finalizzatore di MurmurHash3
+uint64_t archivio_hash(const char chiave[ARCHIVIO_CHIAVE]) {
+    uint64_t h;
+    uint32_t l;
+    memcpy(&h, chiave, 8);
+    memcpy(&l, chiave + 8, 4);
+    h ^= l * 0x9E3779B97F4A7C15ULL;
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+//Estende la mappatura del file fino a dim byte all'interno della regione riservata
+int archivio_mappa(ARCHIVIO *a, uint64_t dim) {
+    if (dim <= a->mappati) return 0;
+    if (mmap(a->base + a->mappati, dim - a->mappati, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, a->fd, a->mappati) == MAP_FAILED) return -1;
+    __atomic_store_n(&a->mappati, dim, __ATOMIC_RELEASE);  //letto senza lock dalle ricerche degli altri thread
+    return 0;
+}
+
+//Aggiunge dim byte in coda al file e restituisce la loro posizione, 0 in caso di errore
+uint64_t archivio_cresci(ARCHIVIO *a, uint64_t dim) {
+    uint64_t off = a->testa->dim_file;
+
+    if (off + dim > ARCHIVIO_RISERVA) {
+        errno = ENOSPC;
+        return 0;
+    }
+    if (ftruncate(a->fd, off + dim) < 0) return 0;
+    if (archivio_mappa(a, off + dim) < 0) return 0;
+    a->testa->dim_file = off + dim;
+    return off;
+}
+
+//Restituisce l'indirizzo del record numero n
+char *archivio_record(ARCHIVIO *a, uint64_t n) {
+    return a->base + a->testa->blocchi_off[n / ARCHIVIO_BLOCCO] + (n % ARCHIVIO_BLOCCO) * a->testa->dim_record;
+}
+
+//Restituisce la tabella hash in uso
+ARCHIVIO_SLOT *archivio_indice(ARCHIVIO *a) {
+    return (ARCHIVIO_SLOT *)(a->base + a->testa->indice_off);
+}
+
+//Rende dispari il contatore di versione della tabella hash prima di sostituirla; il chiamante possiede il lock
+void archivio_inizia_modifica(uint64_t *versione) {
+    __atomic_store_n(versione, *versione + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+//Rende di nuovo pari il contatore di versione al termine della modifica
+void archivio_termina_modifica(uint64_t *versione) {
+    __atomic_store_n(versione, *versione + 1, __ATOMIC_RELEASE);
+}
+
+//Acquisisce il gruppo di record g rendendo dispari il suo contatore di versione: le ricerche senza lock ripetono la
+//lettura e le altre modifiche del gruppo attendono il rilascio. Il processo acquisisce prima la posizione del
+//proprietario con un compare-and-swap, poi rende dispari il contatore, così un gruppo occupato ha sempre un
+//proprietario noto. Se il gruppo è occupato l'acquisizione viene ripetuta con un'attesa crescente, al più tentativi
+//volte (0 = senza limite); un gruppo rimasto occupato da un processo terminato viene liberato da chi lo acquisisce.
+//Restituisce i tentativi ripetuti oppure -1 se sono esauriti
+int archivio_acquisisci_gruppo(ARCHIVIO *a, uint64_t g, int tentativi) {
+    ARCHIVIO_VERSIONI *v = a->versioni;
+    struct timespec attesa;
+    uint64_t versione;
+    pid_t proprietario, pid = getpid();
+    long us;
+    int ripetuti;
+
+    for (ripetuti = 0; ; ripetuti++) {
+        proprietario = 0;
+        if (__atomic_compare_exchange_n(&v->proprietari[g], &proprietario, pid, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED) ||
+            //Il processo che aveva acquisito il gruppo è terminato, forse durante la modifica: il gruppo passa a
+            //questo processo ed il contatore, se era rimasto dispari, torna pari
+            (kill(proprietario, 0) < 0 && errno == ESRCH &&
+             __atomic_compare_exchange_n(&v->proprietari[g], &proprietario, pid, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))) {
+            versione = __atomic_load_n(&v->record[g], __ATOMIC_RELAXED);
+            if (versione & 1) versione++;
+            __atomic_store_n(&v->record[g], versione + 1, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_RELEASE);
+            return ripetuti;
+        }
+
+        if (tentativi > 0 && ripetuti == tentativi) return -1;
+        us = ripetuti < 10 ? 1L << ripetuti : ARCHIVIO_ATTESA_MAX;
+        attesa.tv_sec = 0;
+        attesa.tv_nsec = (us < ARCHIVIO_ATTESA_MAX ? us : ARCHIVIO_ATTESA_MAX) * 1000L;
+        nanosleep(&attesa, NULL);
+    }
+}
+
+//Rilascia il gruppo di record g, rendendo di nuovo pari il suo contatore di versione prima di liberare il proprietario
+void archivio_rilascia_gruppo(ARCHIVIO *a, uint64_t g) {
+    __atomic_store_n(&a->versioni->record[g], a->versioni->record[g] + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&a->versioni->proprietari[g], 0, __ATOMIC_RELEASE);
+}
+
+//Acquisisce il gruppo del record n per chi possiede il lock dell'archivio: resta acquisito fino ad archivio_sblocca,
+//così il chiamante può registrare la modifica nel WAL prima che una modifica concorrente dello stesso record la segua
+void archivio_trattieni(ARCHIVIO *a, uint64_t n) {
+    int64_t g = n % ARCHIVIO_STRISCE;
+
+    if (a->versioni->trattenuto == g) return;
+    if (a->versioni->trattenuto >= 0) archivio_rilascia_gruppo(a, a->versioni->trattenuto);
+    archivio_acquisisci_gruppo(a, g, 0);
+    a->versioni->trattenuto = g;
+}
+
+//Scrive uno slot della tabella hash con un'unica scrittura, visibile alle ricerche senza lock solo quando completo
+void archivio_pubblica_slot(ARCHIVIO_SLOT *slot, uint32_t tag, uint32_t rec) {
+    ARCHIVIO_SLOT nuovo = {tag, rec};
+    uint64_t valore;
+
+    memcpy(&valore, &nuovo, sizeof(valore));
+    __atomic_store_n((uint64_t *)slot, valore, __ATOMIC_RELEASE);
+}
+
+//Cerca la chiave nella tabella hash: restituisce il numero del record oppure -1 se la chiave non è presente.
+//Se slot non è NULL vi salva la posizione dello slot trovato o del primo slot libero.
+int64_t archivio_trova(ARCHIVIO *a, const char chiave[ARCHIVIO_CHIAVE], uint64_t h, uint64_t *slot) {
+    ARCHIVIO_SLOT *indice = archivio_indice(a);
+    uint64_t maschera = a->testa->indice_cap - 1, i;
+    uint32_t tag = h >> 32;
+
+    for (i = h & maschera; indice[i].rec != 0; i = (i + 1) & maschera) {
+        if (indice[i].tag == tag && memcmp(archivio_record(a, indice[i].rec - 1), chiave, ARCHIVIO_CHIAVE) == 0) {
+            if (slot) *slot = i;
+            return indice[i].rec - 1;
+        }
+    }
+    if (slot) *slot = i;
+    return -1;
+}
+
+//Costruisce in coda al file una tabella hash grande il doppio e vi reinserisce tutti i record.
+//Lo spazio della tabella precedente non viene riutilizzato: al massimo raddoppia lo spazio occupato dall'indice.
+int archivio_raddoppia_indice(ARCHIVIO *a) {
+    uint64_t cap = a->testa->indice_cap * 2, maschera = cap - 1, off, n, i, h;
+    ARCHIVIO_SLOT *indice;
+
+    if ((off = archivio_cresci(a, archivio_allinea(cap * sizeof(ARCHIVIO_SLOT)))) == 0) return -1;
+    indice = (ARCHIVIO_SLOT *)(a->base + off);
+
+    for (n = 0; n < a->testa->n_record; n++) {
+        h = archivio_hash(archivio_record(a, n));
+        for (i = h & maschera; indice[i].rec != 0; i = (i + 1) & maschera);
+        indice[i].tag = h >> 32;
+        indice[i].rec = n + 1;
+    }
+
+    //Le ricerche senza lock che leggono posizione e dimensione della tabella durante il cambio vengono ripetute
+    archivio_inizia_modifica(&a->versioni->struttura);
+    a->testa->indice_off = off;
+    a->testa->indice_cap = cap;
+    archivio_termina_modifica(&a->versioni->struttura);
+    return 0;
+}
+
+//Acquisisce la mutua esclusione sull'archivio ed aggiorna la mappatura se un altro processo ha fatto crescere il file
+int archivio_blocca(ARCHIVIO *a) {
+    int err = pthread_mutex_lock(&a->testa->lock);
+
+    //Il processo che possedeva il lock è terminato: l'archivio viene comunque considerato consistente ed i contatori
+    //di versione che aveva reso dispari tornano pari, altrimenti le ricerche senza lock li attenderebbero per sempre
+    if (err == EOWNERDEAD) {
+        if (a->versioni->struttura & 1) archivio_termina_modifica(&a->versioni->struttura);
+        if (a->versioni->trattenuto >= 0) archivio_rilascia_gruppo(a, a->versioni->trattenuto);
+        a->versioni->trattenuto = -1;
+        err = pthread_mutex_consistent(&a->testa->lock);
+    }
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    if (archivio_mappa(a, a->testa->dim_file) < 0) {
+        pthread_mutex_unlock(&a->testa->lock);
+        return -1;
+    }
+    return 0;
+}
+
+void archivio_sblocca(ARCHIVIO *a) {
+    if (a->versioni->trattenuto >= 0) {
+        archivio_rilascia_gruppo(a, a->versioni->trattenuto);
+        a->versioni->trattenuto = -1;
+    }
+    pthread_mutex_unlock(&a->testa->lock);
+}
+
+//Apre (o crea) l'archivio contenuto nel file path con record di dim_record byte, la cui chiave sono i primi
+//ARCHIVIO_CHIAVE byte. Un archivio di un'altra versione non viene aperto (errno EPROTO).
+//Il file viene bloccato con flock, quindi un solo ServerV alla volta può utilizzarlo.
+int archivio_apri(ARCHIVIO *a, const char *path, uint32_t dim_record) {
+    struct stat st;
+    ARCHIVIO_TESTA testa;
+    pthread_mutexattr_t attr;
+    uint64_t dim_testa = archivio_allinea(sizeof(ARCHIVIO_TESTA));
+
+    if ((a->fd = open(path, O_RDWR | O_CREAT, 0666)) < 0) return -1;
+    if (flock(a->fd, LOCK_EX | LOCK_NB) < 0) return -1;
+    if (fstat(a->fd, &st) < 0) return -1;
+
+    //Riserva lo spazio di indirizzi in cui verrà mappato il file
+    if ((a->base = mmap(NULL, ARCHIVIO_RISERVA, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0)) == MAP_FAILED) return -1;
+    a->mappati = 0;
+    a->testa = (ARCHIVIO_TESTA *)a->base;
+    if ((a->versioni = mmap(NULL, sizeof(ARCHIVIO_VERSIONI), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) return -1;
+    a->versioni->trattenuto = -1;
+
+    if (st.st_size == 0) {
+        //Archivio nuovo: testata seguita dalla tabella hash iniziale vuota
+        uint64_t dim_indice = archivio_allinea(ARCHIVIO_INDICE_MIN * sizeof(ARCHIVIO_SLOT));
+        if (ftruncate(a->fd, dim_testa + dim_indice) < 0) return -1;
+        if (archivio_mappa(a, dim_testa + dim_indice) < 0) return -1;
+        a->testa->magic = ARCHIVIO_MAGIC;
+        a->testa->versione = ARCHIVIO_VERSIONE;
+        a->testa->dim_record = dim_record;
+        a->testa->n_blocchi = 0;
+        a->testa->n_record = 0;
+        a->testa->dim_file = dim_testa + dim_indice;
+        a->testa->indice_off = dim_testa;
+        a->testa->indice_cap = ARCHIVIO_INDICE_MIN;
+    } else {
+        if ((uint64_t)st.st_size < dim_testa || pread(a->fd, &testa, sizeof(testa), 0) != sizeof(testa)) {
+            errno = EINVAL;
+            return -1;
+        }
+        if (testa.magic == ARCHIVIO_MAGIC && testa.versione != ARCHIVIO_VERSIONE) {
+            errno = EPROTO;
+            return -1;
+        }
+        if (testa.magic != ARCHIVIO_MAGIC || testa.dim_record != dim_record || testa.dim_file < dim_testa || testa.dim_file > (uint64_t)st.st_size) {
+            errno = EINVAL;
+            return -1;
+        }
+        //archivio_cresci estende il file prima di aggiornare la testata: dopo un'interruzione fra le due operazioni
+        //la parte in più non contiene nulla di registrato e viene tolta
+        if (testa.dim_file < (uint64_t)st.st_size && ftruncate(a->fd, testa.dim_file) < 0) return -1;
+        if (archivio_mappa(a, testa.dim_file) < 0) return -1;
+    }
+
+    //Il mutex salvato nel file viene sempre reinizializzato: all'apertura nessun altro processo lo sta usando
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&a->testa->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    return 0;
+}
+
+//Cerca la chiave senza lock nella tabella hash in uso, che può essere sostituita durante la ricerca: il chiamante
+//deve verificare che il contatore di versione della struttura non sia cambiato. Restituisce il numero del record,
+//-1 se la chiave non è presente, -2 se una parte del file non è ancora mappata da questo processo
+int64_t archivio_sonda(ARCHIVIO *a, const char chiave[ARCHIVIO_CHIAVE], uint64_t h, uint64_t mappati) {
+    ARCHIVIO_TESTA *t = a->testa;
+    ARCHIVIO_SLOT *indice, slot;
+    uint64_t off, cap, maschera, i, k, pos, valore;
+    uint32_t tag = h >> 32;
+
+    off = __atomic_load_n(&t->indice_off, __ATOMIC_RELAXED);
+    cap = __atomic_load_n(&t->indice_cap, __ATOMIC_RELAXED);
+    if (off + cap * sizeof(ARCHIVIO_SLOT) > mappati) return -2;
+    indice = (ARCHIVIO_SLOT *)(a->base + off);
+    maschera = cap - 1;
+
+    //Lo slot pubblicato garantisce che il record ed il suo blocco siano già stati scritti
+    for (i = h & maschera, k = 0; k < cap; i = (i + 1) & maschera, k++) {
+        valore = __atomic_load_n((uint64_t *)&indice[i], __ATOMIC_ACQUIRE);
+        memcpy(&slot, &valore, sizeof(slot));
+        if (slot.rec == 0) break;
+        if (slot.tag != tag || (slot.rec - 1) / ARCHIVIO_BLOCCO >= ARCHIVIO_MAX_BLOCCHI) continue;
+        pos = t->blocchi_off[(slot.rec - 1) / ARCHIVIO_BLOCCO] + ((slot.rec - 1) % ARCHIVIO_BLOCCO) * t->dim_record;
+        if (pos + t->dim_record > mappati) return -2;
+        if (memcmp(a->base + pos, chiave, ARCHIVIO_CHIAVE) == 0) return slot.rec - 1;
+    }
+    return -1;
+}
+
+//Cerca la chiave senza lock. Restituisce 1 se il record esiste, copiandolo in rec, 0 se non esiste, -1 se la ricerca
+//deve essere ripetuta con il lock: scritture concorrenti per ARCHIVIO_TENTATIVI volte, oppure una parte del file
+//non ancora mappata da questo processo
+int archivio_cerca_senza_lock(ARCHIVIO *a, const char chiave[ARCHIVIO_CHIAVE], uint64_t h, void *rec) {
+    uint64_t mappati = __atomic_load_n(&a->mappati, __ATOMIC_ACQUIRE), struttura, versione, *contatore;
+    int64_t n;
+    int tentativo;
+
+    for (tentativo = 0; tentativo < ARCHIVIO_TENTATIVI; tentativo++) {
+        if ((struttura = __atomic_load_n(&a->versioni->struttura, __ATOMIC_ACQUIRE)) & 1) continue;
+        if ((n = archivio_sonda(a, chiave, h, mappati)) == -2) return -1;
+
+        //Copia del record: valida solo se nessuna modifica è iniziata o terminata nel frattempo
+        if (n >= 0) {
+            contatore = &a->versioni->record[n % ARCHIVIO_STRISCE];
+            if ((versione = __atomic_load_n(contatore, __ATOMIC_ACQUIRE)) & 1) continue;
+            memcpy(rec, archivio_record(a, n), a->testa->dim_record);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(contatore, __ATOMIC_RELAXED) != versione) continue;
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&a->versioni->struttura, __ATOMIC_RELAXED) != struttura) continue;
+        return n >= 0;
+    }
+    return -1;
+}
+
+//Cerca la chiave con hash h, senza lock se possibile: restituisce 1 copiando il record in rec, 0 se non esiste,
+//-1 in caso di errore
+int archivio_cerca_hash(ARCHIVIO *a, const char chiave[ARCHIVIO_CHIAVE], uint64_t h, void *rec) {
+    int64_t n;
+    int esito;
+
+    if ((esito = archivio_cerca_senza_lock(a, chiave, h, rec)) >= 0) return esito;
+
+    if (archivio_blocca(a) < 0) return -1;
+    if ((n = archivio_trova(a, chiave, h, NULL)) >= 0) memcpy(rec, archivio_record(a, n), a->testa->dim_record);
+    archivio_sblocca(a);
+    return n >= 0;
+}
+
+//Copia in rec il record associato alla chiave: restituisce 1 se esiste, 0 se non esiste, -1 in caso di errore.
+//Di norma non acquisisce il lock, quindi le ricerche non attendono le modifiche né le altre ricerche
+int archivio_cerca(ARCHIVIO *a, const char chiave[ARCHIVIO_CHIAVE], void *rec) {
+    return archivio_cerca_hash(a, chiave, archivio_hash(chiave), rec);
+}
+
+//Cerca n chiavi, la k-esima in chiavi + k * ARCHIVIO_CHIAVE con hash hash[k], salvando in esiti[k] il risultato di
+//archivio_cerca ed il record in rec + k * dim_record. Le ricerche procedono a gruppi di ARCHIVIO_ANTICIPO: prima
+//viene anticipato il caricamento degli slot iniziali di tutto il gruppo, poi quello dei record e dei contatori di
+//versione indicati da quegli slot, infine le ricerche vengono risolte; così le attese della memoria delle diverse
+//chiavi si sovrappongono invece di sommarsi. Gli slot letti per anticipare non vengono validati: un valore cambiato
+//nel frattempo rende inutile l'anticipo, non la ricerca. Restituisce 0 oppure -1 in caso di errore
+int archivio_cerca_molti(ARCHIVIO *a, int n, const char *chiavi, const uint64_t *hash, void *rec, int *esiti) {
+    ARCHIVIO_TESTA *t = a->testa;
+    ARCHIVIO_SLOT *indice, slot;
+    uint64_t mappati, off, cap, valore, pos;
+    int inizio, fine, k;
+
+    for (inizio = 0; inizio < n; inizio = fine) {
+        fine = inizio + ARCHIVIO_ANTICIPO < n ? inizio + ARCHIVIO_ANTICIPO : n;
+        mappati = __atomic_load_n(&a->mappati, __ATOMIC_ACQUIRE);
+        off = __atomic_load_n(&t->indice_off, __ATOMIC_RELAXED);
+        cap = __atomic_load_n(&t->indice_cap, __ATOMIC_RELAXED);
+        indice = (ARCHIVIO_SLOT *)(a->base + off);
+
+        if (off + cap * sizeof(ARCHIVIO_SLOT) <= mappati) {
+            for (k = inizio; k < fine; k++) __builtin_prefetch(&indice[hash[k] & (cap - 1)]);
+            for (k = inizio; k < fine; k++) {
+                valore = __atomic_load_n((uint64_t *)&indice[hash[k] & (cap - 1)], __ATOMIC_RELAXED);
+                memcpy(&slot, &valore, sizeof(slot));
+                if (slot.rec == 0 || slot.tag != hash[k] >> 32 || (slot.rec - 1) / ARCHIVIO_BLOCCO >= ARCHIVIO_MAX_BLOCCHI) continue;
+                pos = t->blocchi_off[(slot.rec - 1) / ARCHIVIO_BLOCCO] + ((slot.rec - 1) % ARCHIVIO_BLOCCO) * t->dim_record;
+                if (pos + t->dim_record > mappati) continue;
+                __builtin_prefetch(a->base + pos);
+                __builtin_prefetch(&a->versioni->record[(slot.rec - 1) % ARCHIVIO_STRISCE]);
+            }
+        }
+        for (k = inizio; k < fine; k++) {
+            if ((esiti[k] = archivio_cerca_hash(a, chiavi + (size_t)k * ARCHIVIO_CHIAVE, hash[k], (char *)rec + (size_t)k * t->dim_record)) < 0) return -1;
+        }
+    }
+    return 0;
+}
+
+//Inserisce un record, sovrascrivendo quello con la stessa chiave se già presente. Il chiamante deve possedere il lock
+//dell'archivio; il gruppo del record resta acquisito fino ad archivio_sblocca (vedi archivio_trattieni).
+//Restituisce 0 oppure -1 in caso di errore
+int archivio_inserisci_bloccato(ARCHIVIO *a, const void *rec) {
+    const char *chiave = rec;
+    char *dest;
+    uint64_t h = archivio_hash(chiave), slot, off;
+    int64_t n;
+
+    if ((n = archivio_trova(a, chiave, h, &slot)) < 0) {
+        //Mantiene il fattore di carico della tabella hash sotto il 70%
+        if ((a->testa->n_record + 1) * 10 > a->testa->indice_cap * 7) {
+            if (archivio_raddoppia_indice(a) < 0) return -1;
+            archivio_trova(a, chiave, h, &slot);
+        }
+
+        //Alloca un nuovo blocco quando quelli esistenti sono pieni
+        n = a->testa->n_record;
+        if (n == (int64_t)a->testa->n_blocchi * ARCHIVIO_BLOCCO) {
+            if (a->testa->n_blocchi == ARCHIVIO_MAX_BLOCCHI) {
+                errno = ENOSPC;
+                return -1;
+            }
+            if ((off = archivio_cresci(a, archivio_allinea((uint64_t)ARCHIVIO_BLOCCO * a->testa->dim_record))) == 0) return -1;
+            a->testa->blocchi_off[a->testa->n_blocchi++] = off;
+        }
+
+        dest = archivio_record(a, n);
+        archivio_trattieni(a, n);
+        memcpy(dest, rec, a->testa->dim_record);
+        archivio_pubblica_slot(&archivio_indice(a)[slot], h >> 32, n + 1);
+        a->testa->n_record++;
+    } else {
+        dest = archivio_record(a, n);
+        archivio_trattieni(a, n);
+        memcpy(dest, rec, a->testa->dim_record);
+    }
+    return 0;
+}
+
+int archivio_inserisci(ARCHIVIO *a, const void *rec) {
+    int esito;
+
+    if (archivio_blocca(a) < 0) return -1;
+    esito = archivio_inserisci_bloccato(a, rec);
+    archivio_sblocca(a);
+    return esito;
+}
+
+//Acquisisce senza il lock dell'archivio il record associato alla chiave, con archivio_acquisisci_gruppo, così il
+//chiamante può modificarlo mentre le altre modifiche e gli inserimenti proseguono. Restituisce 1 salvando in n il
+//numero del record, da rilasciare con archivio_rilascia, 0 se il codice non esiste, -2 se il record è rimasto
+//occupato per tutti i tentativi, -1 in caso di errore. In ripetuti vengono salvati i tentativi ripetuti
+int archivio_acquisisci(ARCHIVIO *a, const char chiave[ARCHIVIO_CHIAVE], int tentativi, int *ripetuti, uint64_t *n) {
+    uint64_t h = archivio_hash(chiave), struttura, mappati = __atomic_load_n(&a->mappati, __ATOMIC_ACQUIRE);
+    int64_t trovato = -2;
+    int tentativo;
+
+    *ripetuti = 0;
+
+    //Un record non viene mai spostato: basta che la tabella hash non sia cambiata durante la ricerca
+    for (tentativo = 0; tentativo < ARCHIVIO_TENTATIVI; tentativo++) {
+        if ((struttura = __atomic_load_n(&a->versioni->struttura, __ATOMIC_ACQUIRE)) & 1) continue;
+        if ((trovato = archivio_sonda(a, chiave, h, mappati)) == -2) break;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&a->versioni->struttura, __ATOMIC_RELAXED) == struttura) break;
+        trovato = -2;
+    }
+    if (trovato == -2) {
+        //Il lock aggiorna anche la mappatura del file
+        if (archivio_blocca(a) < 0) return -1;
+        trovato = archivio_trova(a, chiave, h, NULL);
+        archivio_sblocca(a);
+    }
+    if (trovato < 0) return 0;
+
+    if ((*ripetuti = archivio_acquisisci_gruppo(a, trovato % ARCHIVIO_STRISCE, tentativi)) < 0) {
+        *ripetuti = tentativi;
+        return -2;
+    }
+    *n = trovato;
+    return 1;
+}
+
+//Rilascia il record acquisito con archivio_acquisisci
+void archivio_rilascia(ARCHIVIO *a, uint64_t n) {
+    archivio_rilascia_gruppo(a, n % ARCHIVIO_STRISCE);
+}
+
+//Ricostruisce la tabella hash a partire dai record, usata dopo un'interruzione improvvisa del ServerV
+int archivio_ricostruisci_indice(ARCHIVIO *a) {
+    uint64_t maschera = a->testa->indice_cap - 1, n, i, h;
+    ARCHIVIO_SLOT *indice = archivio_indice(a);
+
+    if (archivio_blocca(a) < 0) return -1;
+    memset(indice, 0, a->testa->indice_cap * sizeof(ARCHIVIO_SLOT));
+    for (n = 0; n < a->testa->n_record; n++) {
+        h = archivio_hash(archivio_record(a, n));
+        for (i = h & maschera; indice[i].rec != 0; i = (i + 1) & maschera) {
+            //Chiave duplicata: vale l'ultimo record scritto
+            if (indice[i].tag == (uint32_t)(h >> 32) && memcmp(archivio_record(a, indice[i].rec - 1), archivio_record(a, n), ARCHIVIO_CHIAVE) == 0) break;
+        }
+        indice[i].tag = h >> 32;
+        indice[i].rec = n + 1;
+    }
+    archivio_sblocca(a);
+    return 0;
+}
+
+//Scrive su disco tutte le modifiche dell'archivio, comprese quelle eseguite dagli altri processi attraverso la mappatura
+int archivio_sincronizza(ARCHIVIO *a) {
+    return fsync(a->fd);
+}
+
+//Numero di record presenti nell'archivio
+uint64_t archivio_dimensione(ARCHIVIO *a) {
+    return a->testa->n_record;
+}
+
+//Copia in rec fino a max record a partire dal record numero inizio, nell'ordine di inserimento, per scorrere l'intero
+//archivio a più riprese. Il lock esclude gli inserimenti; ogni record viene copiato dopo averne acquisito il gruppo,
+//che attende la fine di una modifica del report in corso e libera un gruppo rimasto occupato da un processo
+//terminato. Restituisce i record copiati, 0 alla fine dell'archivio,
+//oppure -1 in caso di errore
+int64_t archivio_scorri(ARCHIVIO *a, uint64_t inizio, uint64_t max, void *rec) {
+    uint64_t n;
+    char *destinazione = rec;
+
+    if (archivio_blocca(a) < 0) return -1;
+    for (n = inizio; n < a->testa->n_record && n - inizio < max; n++, destinazione += a->testa->dim_record) {
+        archivio_acquisisci_gruppo(a, n % ARCHIVIO_STRISCE, 0);
+        memcpy(destinazione, archivio_record(a, n), a->testa->dim_record);
+        archivio_rilascia_gruppo(a, n % ARCHIVIO_STRISCE);
+    }
+    archivio_sblocca(a);
+    return n > inizio ? n - inizio : 0;
+}
+
+void archivio_chiudi(ARCHIVIO *a) {
+    msync(a->base, a->mappati, MS_SYNC);
+    munmap(a->base, ARCHIVIO_RISERVA);
+    munmap(a->versioni, sizeof(ARCHIVIO_VERSIONI));
+    close(a->fd);
+}
+
+#endif
@@ -0,0 +1,101 @@
+//Filtro di Bloom sui codici delle tessere sanitarie presenti nell'archivio: permette di rispondere che un codice non
+//esiste senza consultare l'archivio. Il filtro è diviso in blocchi da 512 bit (una linea di cache): i k bit di una
+//chiave appartengono tutti allo stesso blocco, così ogni verifica legge una sola linea di memoria.
+//
+//Il filtro è in memoria condivisa anonima: va creato prima dei processi figli, che lo aggiornano con operazioni
+//atomiche. I bit non vengono mai azzerati, quindi un codice inserito non viene mai escluso (nessun falso negativo).
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#include <stdint.h>
+#include <sys/mman.h>
+
+#define BLOOM_PAROLE 8              //parole da 64 bit di un blocco
+#define BLOOM_MAX_K 7               //bit per chiave: 7 gruppi da 9 bit dell'hash
+
+typedef struct {
+    uint64_t n_blocchi;             //potenza di 2
+    uint32_t k;                     //bit impostati per ogni chiave
+    uint64_t inseriti;              //chiavi aggiunte
+    uint64_t negativi;              //ricerche escluse dal filtro
+    uint64_t falsi_positivi;        //ricerche ammesse dal filtro ma assenti dall'archivio
+    uint64_t bit[];
+} BLOOM;
+
+//Crea un filtro per capacita chiavi con bit_per_chiave bit ciascuna. Restituisce NULL in caso di errore
+BLOOM *bloom_crea(uint64_t capacita, uint32_t bit_per_chiave) {
+    BLOOM *b;
+    uint64_t n_blocchi = 1;
+
+    while (n_blocchi * BLOOM_PAROLE * 64 < capacita * bit_per_chiave) n_blocchi *= 2;
+    b = mmap(NULL, sizeof(BLOOM) + n_blocchi * BLOOM_PAROLE * sizeof(uint64_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (b == MAP_FAILED) return NULL;
+
+    //Numero ottimo di bit per chiave: bit_per_chiave * ln 2
+    b->n_blocchi = n_blocchi;
+    b->k = (bit_per_chiave * 693 + 500) / 1000;
+    if (b->k < 1) b->k = 1;
+    if (b->k > BLOOM_MAX_K) b->k = BLOOM_MAX_K;
+    return b;
+}
+
+//Byte occupati dal filtro
+uint64_t bloom_memoria(BLOOM *b) {
+    return sizeof(BLOOM) + b->n_blocchi * BLOOM_PAROLE * sizeof(uint64_t);
+}
+
+//Il blocco viene scelto con i 32 bit alti dell'hash, i bit all'interno del blocco con i gruppi da 9 bit
+//dell'hash rimescolato
+uint64_t *bloom_blocco(BLOOM *b, uint64_t h, uint64_t *g) {
+    *g = h * 0x9E3779B97F4A7C15ULL;
+    return b->bit + ((h >> 32) & (b->n_blocchi - 1)) * BLOOM_PAROLE;
+}
+
+//Aggiunge la chiave con hash h
+void bloom_aggiungi(BLOOM *b, uint64_t h) {
+    uint64_t g, *blocco = bloom_blocco(b, h, &g);
+    uint32_t i, pos;
+
+    for (i = 0; i < b->k; i++) {
+        pos = (g >> (64 - 9 * (i + 1))) & 511;
+        __atomic_fetch_or(&blocco[pos >> 6], 1ULL << (pos & 63), __ATOMIC_RELEASE);
+    }
+    __atomic_fetch_add(&b->inseriti, 1, __ATOMIC_RELAXED);
+}
+
+//Anticipa il caricamento del blocco della chiave con hash h, prima di una verifica successiva
+void bloom_anticipa(BLOOM *b, uint64_t h) {
+    uint64_t g;
+    __builtin_prefetch(bloom_blocco(b, h, &g));
+}
+
+//Restituisce 0 se la chiave con hash h sicuramente non è stata aggiunta, 1 se potrebbe esserlo
+int bloom_contiene(BLOOM *b, uint64_t h) {
+    uint64_t g, *blocco = bloom_blocco(b, h, &g);
+    uint32_t i, pos;
+
+    for (i = 0; i < b->k; i++) {
+        pos = (g >> (64 - 9 * (i + 1))) & 511;
+        if (!(__atomic_load_n(&blocco[pos >> 6], __ATOMIC_ACQUIRE) & (1ULL << (pos & 63)))) return 0;
+    }
+    return 1;
+}
+
+//Probabilità di falso positivo stimata dalla frazione di bit impostati, elevata al numero di bit per chiave
+double bloom_fpr_stimata(BLOOM *b) {
+    uint64_t i, impostati = 0, n_parole = b->n_blocchi * BLOOM_PAROLE;
+    double p = 1;
+    uint32_t j;
+
+    for (i = 0; i < n_parole; i++) impostati += __builtin_popcountll(b->bit[i]);
+    for (j = 0; j < b->k; j++) p *= (double)impostati / (n_parole * 64);
+    return p;
+}
+
+//Frazione osservata di falsi positivi fra le ricerche di codici inesistenti
+double bloom_fpr_osservata(BLOOM *b) {
+    uint64_t fp = __atomic_load_n(&b->falsi_positivi, __ATOMIC_RELAXED), neg = __atomic_load_n(&b->negativi, __ATOMIC_RELAXED);
+    return fp + neg ? (double)fp / (fp + neg) : 0;
+}
+
+#endif
@@ -0,0 +1,332 @@
+//Canale in memoria condivisa fra un ServerG ed un ServerV sulla stessa macchina, al posto del socket di una
+//connessione del pool: i frame del protocollo a frame passano per due code circolari di byte in un'area creata con
+//memfd_create, le richieste dal ServerG al ServerV e le risposte in senso opposto, senza attraversare lo stack TCP.
+//
+//Ogni coda ha un solo produttore ed un solo consumatore (le scritture di una connessione del pool sono serializzate,
+//le letture sono del suo thread lettore; nel ServerV un solo thread serve il canale). Le posizioni di testa e coda
+//crescono senza mai tornare indietro e ciascuna è scritta da un solo lato, quindi non servono lock. Chi attende
+//(il consumatore una coda vuota, il produttore una coda piena) lo segnala con un flag e dorme su un eventfd, che
+//l'altro lato scrive solo se il flag è attivo: finché entrambi lavorano non c'è alcuna chiamata di sistema.
+//
+//Il canale nasce su una connessione Unix fra i due processi: il ServerG apre la connessione con il bit '5', attende
+//lo stesso bit dal ServerV e gli passa con SCM_RIGHTS il memfd ed i quattro eventfd. La connessione resta aperta
+//senza altri dati ed ogni attesa la controlla insieme all'eventfd: si chiude quando uno dei due processi termina,
+//oppure con shutdown per interrompere il canale dallo stesso lato.
+//
+//L'area è scritta anche dall'altro processo, quindi nessun lato si fida delle sue posizioni: le proprie sono tenute
+//anche fuori dall'area, quelle dell'altro lato vengono lette una volta sola per operazione ed una distanza maggiore
+//di CANALE_DIM interrompe il canale (EPROTO). Il memfd è sigillato contro il ridimensionamento, così l'altro processo
+//non può accorciare l'area mappata.
+#ifndef CANALE_H
+#define CANALE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+
+#define CANALE_DIM (1 << 18)            //byte di ogni coda, potenza di 2
+#define CANALE_GIRI 2000                //controlli della coda prima di dormire sull'eventfd, con più di un core
+#define CANALE_DATI 0                   //eventfd: dati pubblicati in una coda
+#define CANALE_SPAZIO 1                 //eventfd: spazio liberato in una coda
+
+//Coda circolare di byte: testa ed attesa_dati sono scritte dal consumatore, coda ed attesa_spazio dal produttore,
+//su linee di cache diverse perché i due lati non si contendano la stessa linea
+typedef struct {
+    uint64_t testa __attribute__((aligned(64)));    //byte consumati
+    uint32_t attesa_dati;                           //1 se il consumatore dorme in attesa di dati
+    uint64_t coda __attribute__((aligned(64)));     //byte pubblicati
+    uint32_t attesa_spazio;                         //1 se il produttore dorme in attesa di spazio
+    char dati[CANALE_DIM] __attribute__((aligned(64)));
+} CODA_CANALE;
+
+//Area condivisa: la coda delle richieste è la prima
+typedef struct {
+    CODA_CANALE code[2];
+} AREA_CANALE;
+
+//Spazio per i descrittori passati con SCM_RIGHTS, allineato come l'intestazione del messaggio di controllo
+typedef union {
+    char buf[CMSG_SPACE(5 * sizeof(int))];
+    struct cmsghdr allineamento;
+} CONTROLLO_CANALE;
+
+//Lato di un canale: legge da ingresso e scrive su uscita
+typedef struct {
+    int fd;                             //connessione Unix con l'altro processo
+    AREA_CANALE *area;
+    CODA_CANALE *ingresso, *uscita;
+    int eventi_ingresso[2];             //eventfd della coda di ingresso, indicizzati da CANALE_DATI e CANALE_SPAZIO
+    int eventi_uscita[2];
+    uint64_t letti;                     //testa della coda di ingresso, scritta nell'area ma mai riletta
+    uint64_t scritti;                   //coda della coda di uscita, come letti
+} CANALE;
+
+//Segnala un evento all'altro lato se sta dormendo: il flag viene letto dopo aver pubblicato la nuova posizione, con
+//accessi sequenzialmente consistenti come quelli di canale_attendi, quindi almeno uno dei due lati vede l'altro
+void canale_segnala(uint32_t *attesa, int evento) {
+    uint64_t uno = 1;
+
+    if (__atomic_load_n(attesa, __ATOMIC_SEQ_CST)) while (write(evento, &uno, sizeof(uno)) < 0 && errno == EINTR);
+}
+
+//Attende che pronto(q) sia vero, prima controllando la coda per CANALE_GIRI volte, poi dormendo sull'eventfd. Con
+//un solo core l'altro lato non può avanzare mentre si controlla la coda, quindi si dorme subito.
+//timeout in millisecondi, -1 senza limite. Restituisce 0, oppure -1 con errno EPIPE se la connessione Unix è stata
+//chiusa o ETIMEDOUT
+int canale_attendi(CANALE *c, CODA_CANALE *q, uint32_t *attesa, int evento, int (*pronto)(CODA_CANALE *), int timeout) {
+    static int giri = -1;
+    struct pollfd p[2];
+    struct timespec ora, scadenza;
+    uint64_t letto;
+    int i, resto = timeout;
+
+    if (giri < 0) giri = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? CANALE_GIRI : 0;
+    for (i = 0; i < giri; i++) if (pronto(q)) return 0;
+    if (timeout >= 0) {
+        clock_gettime(CLOCK_MONOTONIC, &scadenza);
+        scadenza.tv_sec += timeout / 1000;
+        scadenza.tv_nsec += (long)(timeout % 1000) * 1000000;
+    }
+    for (;;) {
+        __atomic_store_n(attesa, 1, __ATOMIC_SEQ_CST);
+        if (pronto(q)) break;
+        p[0].fd = evento;
+        p[0].events = POLLIN;
+        p[1].fd = c->fd;
+        p[1].events = POLLIN;
+        if (poll(p, 2, resto) < 0) {
+            if (errno == EINTR) continue;
+            __atomic_store_n(attesa, 0, __ATOMIC_SEQ_CST);
+            return -1;
+        }
+        if (p[1].revents) {
+            __atomic_store_n(attesa, 0, __ATOMIC_SEQ_CST);
+            errno = EPIPE;
+            return -1;
+        }
+        if (p[0].revents & POLLIN) while (read(evento, &letto, sizeof(letto)) < 0 && errno == EINTR);
+        if (pronto(q)) break;
+        if (timeout >= 0) {
+            clock_gettime(CLOCK_MONOTONIC, &ora);
+            resto = (scadenza.tv_sec - ora.tv_sec) * 1000 + (scadenza.tv_nsec - ora.tv_nsec) / 1000000;
+            if (resto <= 0) {
+                __atomic_store_n(attesa, 0, __ATOMIC_SEQ_CST);
+                errno = ETIMEDOUT;
+                return -1;
+            }
+        }
+    }
+    __atomic_store_n(attesa, 0, __ATOMIC_SEQ_CST);
+    return 0;
+}
+
+int canale_ci_sono_dati(CODA_CANALE *q) {
+    return __atomic_load_n(&q->coda, __ATOMIC_SEQ_CST) != q->testa;
+}
+
+int canale_c_e_spazio(CODA_CANALE *q) {
+    return q->coda - __atomic_load_n(&q->testa, __ATOMIC_SEQ_CST) < CANALE_DIM;
+}
+
+//Legge in buf fino a max byte disponibili, attendendo se la coda di ingresso è vuota, come una read su un socket.
+//Restituisce i byte letti, 0 se l'altro lato ha chiuso il canale, -1 con errno in caso di errore
+ssize_t canale_leggi(CANALE *c, void *buf, size_t max) {
+    CODA_CANALE *q = c->ingresso;
+    uint64_t testa = c->letti, n;
+    size_t i, k;
+
+    if (canale_attendi(c, q, &q->attesa_dati, c->eventi_ingresso[CANALE_DATI], canale_ci_sono_dati, -1) < 0) return errno == EPIPE ? 0 : -1;
+    if ((n = __atomic_load_n(&q->coda, __ATOMIC_ACQUIRE) - testa) > CANALE_DIM) {
+        errno = EPROTO;
+        return -1;
+    }
+    if (n > max) n = max;
+    i = testa & (CANALE_DIM - 1);
+    k = n < CANALE_DIM - i ? n : CANALE_DIM - i;
+    memcpy(buf, q->dati + i, k);
+    memcpy((char *)buf + k, q->dati, n - k);
+    c->letti = testa + n;
+    __atomic_store_n(&q->testa, c->letti, __ATOMIC_SEQ_CST);
+    canale_segnala(&q->attesa_spazio, c->eventi_ingresso[CANALE_SPAZIO]);
+    return n;
+}
+
+//Scrive tutti i len byte di buf nella coda di uscita, attendendo lo spazio al più timeout millisecondi ogni volta che
+//la coda è piena (-1 senza limite). Restituisce 0 oppure -1 con errno EPIPE o ETIMEDOUT
+int canale_scrivi(CANALE *c, const void *buf, size_t len, int timeout) {
+    CODA_CANALE *q = c->uscita;
+    const char *p = buf;
+    uint64_t coda = c->scritti, n;
+    size_t i, k;
+
+    while (len > 0) {
+        if (canale_attendi(c, q, &q->attesa_spazio, c->eventi_uscita[CANALE_SPAZIO], canale_c_e_spazio, timeout) < 0) return -1;
+        if ((n = coda - __atomic_load_n(&q->testa, __ATOMIC_ACQUIRE)) > CANALE_DIM) {
+            errno = EPROTO;
+            return -1;
+        }
+        if ((n = CANALE_DIM - n) > len) n = len;
+        i = coda & (CANALE_DIM - 1);
+        k = n < CANALE_DIM - i ? n : CANALE_DIM - i;
+        memcpy(q->dati + i, p, k);
+        memcpy(q->dati, p + k, n - k);
+        coda += n;
+        c->scritti = coda;
+        __atomic_store_n(&q->coda, coda, __ATOMIC_SEQ_CST);
+        canale_segnala(&q->attesa_dati, c->eventi_uscita[CANALE_DATI]);
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+//Collega il lato c all'area ed agli eventfd eventi (dati e spazio delle richieste, poi delle risposte).
+//Il ServerG scrive le richieste e legge le risposte, il ServerV il contrario
+void canale_collega(CANALE *c, int fd, AREA_CANALE *area, const int *eventi, int server) {
+    c->fd = fd;
+    c->area = area;
+    c->ingresso = &area->code[server ? 0 : 1];
+    c->uscita = &area->code[server ? 1 : 0];
+    memcpy(c->eventi_ingresso, eventi + (server ? 0 : 2), 2 * sizeof(int));
+    memcpy(c->eventi_uscita, eventi + (server ? 2 : 0), 2 * sizeof(int));
+}
+
+//Crea un canale sulla connessione Unix fd, già aperta con il bit '5' e confermata dal ServerV, e gli passa l'area ed
+//i descrittori degli eventi. Restituisce il lato del ServerG oppure NULL con errno
+CANALE *canale_crea(int fd) {
+    CANALE *c;
+    AREA_CANALE *area = MAP_FAILED;
+    int memfd, eventi[4], i, n = 0, e;
+    char bit = '5';
+    CONTROLLO_CANALE controllo;
+    struct iovec v = {&bit, sizeof(char)};
+    struct msghdr m;
+    struct cmsghdr *cm;
+
+    if ((c = calloc(1, sizeof(CANALE))) == NULL) return NULL;
+    if ((memfd = memfd_create("canale", MFD_CLOEXEC | MFD_ALLOW_SEALING)) < 0) goto errore;
+    if (ftruncate(memfd, sizeof(AREA_CANALE)) < 0) goto errore;
+    if (fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) goto errore;
+    if ((area = mmap(NULL, sizeof(AREA_CANALE), PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0)) == MAP_FAILED) goto errore;
+    for (n = 0; n < 4; n++) if ((eventi[n] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) goto errore;
+
+    memset(&m, 0, sizeof(m));
+    memset(&controllo, 0, sizeof(controllo));
+    m.msg_iov = &v;
+    m.msg_iovlen = 1;
+    m.msg_control = controllo.buf;
+    m.msg_controllen = sizeof(controllo.buf);
+    cm = CMSG_FIRSTHDR(&m);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(5 * sizeof(int));
+    memcpy(CMSG_DATA(cm), &memfd, sizeof(int));
+    memcpy(CMSG_DATA(cm) + sizeof(int), eventi, 4 * sizeof(int));
+    while (sendmsg(fd, &m, MSG_NOSIGNAL) < 0) if (errno != EINTR) goto errore;
+
+    //L'area resta mappata anche dopo la chiusura del memfd
+    close(memfd);
+    canale_collega(c, fd, area, eventi, 0);
+    return c;
+
+errore:
+    e = errno;
+    for (i = 0; i < n; i++) close(eventi[i]);
+    if (area != MAP_FAILED) munmap(area, sizeof(AREA_CANALE));
+    if (memfd >= 0) close(memfd);
+    free(c);
+    errno = e;
+    return NULL;
+}
+
+//Riceve dal ServerG, sulla connessione Unix fd, l'area e gli eventi di un canale creato con canale_crea.
+//Restituisce il lato del ServerV oppure NULL con errno
+CANALE *canale_apri(int fd) {
+    CANALE *c;
+    AREA_CANALE *area;
+    int descrittori[5], i, n = 0, e, estranei = 0, sigilli;
+    char bit;
+    CONTROLLO_CANALE controllo;
+    struct iovec v = {&bit, sizeof(char)};
+    struct msghdr m;
+    struct cmsghdr *cm;
+    struct stat st;
+    ssize_t k;
+
+    memset(&m, 0, sizeof(m));
+    m.msg_iov = &v;
+    m.msg_iovlen = 1;
+    m.msg_control = controllo.buf;
+    m.msg_controllen = sizeof(controllo.buf);
+    while ((k = recvmsg(fd, &m, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR);
+    if (k <= 0) {
+        if (k == 0) errno = ECONNRESET;
+        return NULL;
+    }
+    //Il numero dei descrittori viene dall'altro processo: vengono copiati solo se sono esattamente 5, altrimenti
+    //quelli ricevuti vengono chiusi direttamente dal messaggio
+    for (cm = CMSG_FIRSTHDR(&m); cm != NULL; cm = CMSG_NXTHDR(&m, cm)) {
+        if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS || cm->cmsg_len < CMSG_LEN(0)) continue;
+        k = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        if (k == 5 && n == 0) {
+            memcpy(descrittori, CMSG_DATA(cm), sizeof(descrittori));
+            n = 5;
+            continue;
+        }
+        for (i = 0; i < k; i++) {
+            memcpy(&e, CMSG_DATA(cm) + i * sizeof(int), sizeof(int));
+            close(e);
+        }
+        estranei = 1;
+    }
+    if (n != 5 || estranei || bit != '5' || (m.msg_flags & MSG_CTRUNC)) {
+        errno = EPROTO;
+        goto errore;
+    }
+    //Senza il sigillo l'altro processo potrebbe accorciare l'area dopo il controllo della dimensione (SIGBUS)
+    if ((sigilli = fcntl(descrittori[0], F_GET_SEALS)) < 0 || fstat(descrittori[0], &st) < 0) goto errore;
+    if (!(sigilli & F_SEAL_SHRINK) || st.st_size < (off_t)sizeof(AREA_CANALE)) {
+        errno = EPROTO;
+        goto errore;
+    }
+    //Un descrittore che non è un eventfd non deve poter bloccare le attese e le segnalazioni
+    for (i = 1; i < 5; i++) if (fcntl(descrittori[i], F_SETFL, O_NONBLOCK) < 0) goto errore;
+    if ((c = calloc(1, sizeof(CANALE))) == NULL) goto errore;
+    if ((area = mmap(NULL, sizeof(AREA_CANALE), PROT_READ | PROT_WRITE, MAP_SHARED, descrittori[0], 0)) == MAP_FAILED) {
+        free(c);
+        goto errore;
+    }
+    close(descrittori[0]);
+    canale_collega(c, fd, area, descrittori + 1, 1);
+    return c;
+
+errore:
+    e = errno;
+    for (i = 0; i < n; i++) close(descrittori[i]);
+    errno = e;
+    return NULL;
+}
+
+//Libera un lato del canale; la connessione Unix resta al chiamante
+void canale_chiudi(CANALE *c) {
+    int i;
+
+    if (c == NULL) return;
+    for (i = 0; i < 2; i++) {
+        close(c->eventi_ingresso[i]);
+        close(c->eventi_uscita[i]);
+    }
+    munmap(c->area, sizeof(AREA_CANALE));
+    free(c);
+}
+
+#endif
@@ -0,0 +1,256 @@
+//Coda durevole dei Green Pass emessi dal Centro Vaccinale e non ancora confermati dal ServerV.
+//
+//Organizzazione del file:
+//  [testata: magic, versione, inviati][GP][GP]...
+//dove inviati è il numero dei primi record già confermati dal ServerV. I processi figli aggiungono i record in fondo
+//al file (O_APPEND, quindi le aggiunte concorrenti non si sovrappongono) e lo sincronizzano prima di rispondere
+//all'Utente; un solo thread legge i record successivi ai primi inviati e aggiorna la testata dopo ogni conferma.
+//Quando tutti i record sono confermati il file viene svuotato. Se invece ne arrivano sempre di nuovi, dopo
+//CODA_COMPATTA record confermati quelli in attesa vengono copiati in un nuovo file che sostituisce la coda con
+//rename. Le aggiunte acquisiscono un lock condiviso (flock) sul file, lo svuotamento e la compattazione quello
+//esclusivo, così un record aggiunto mentre il file viene svuotato o sostituito non va perso: un'aggiunta che ottiene
+//il lock su un file già sostituito lo riapre.
+#ifndef CODA_H
+#define CODA_H
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <poll.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "greenpass.h"
+
+#define CODA_MAGIC 0x51435047                   //"GPCQ" letto in little endian
+#define CODA_VERSIONE 1
+#define CODA_COMPATTA 4096                      //record confermati oltre i quali il file viene compattato
+
+//Testata del file della coda
+typedef struct {
+    uint32_t magic;
+    uint32_t versione;
+    uint64_t inviati;           //record già confermati dal ServerV
+} CODA_TESTA;
+
+typedef struct {
+    const char *path;
+    int fd;                     //descrittore del thread di invio, aperto da coda_apri
+    int notifica[2];            //pipe con cui i processi figli segnalano un nuovo record al thread di invio
+    uint64_t inviati;
+} CODA;
+
+int coda_pwrite(int fd, const void *buffer, size_t count, off_t off) {
+    ssize_t n;
+
+    while (count > 0) {
+        if ((n = pwrite(fd, buffer, count, off)) < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buffer = (const char *)buffer + n;
+        count -= n;
+        off += n;
+    }
+    return 0;
+}
+
+int coda_scrivi_testa(CODA *c) {
+    CODA_TESTA testa;
+
+    testa.magic = CODA_MAGIC;
+    testa.versione = CODA_VERSIONE;
+    testa.inviati = c->inviati;
+    return coda_pwrite(c->fd, &testa, sizeof(testa), 0);
+}
+
+//Apre la coda, creandola se non esiste. Va chiamata prima di creare i processi figli. Un record scritto solo in parte
+//durante un'interruzione improvvisa viene eliminato. Restituisce i record in attesa di conferma oppure -1 in caso di errore
+int64_t coda_apri(CODA *c, const char *path) {
+    struct stat st;
+    CODA_TESTA testa;
+    uint64_t totale;
+
+    c->path = path;
+    c->inviati = 0;
+    if ((c->fd = open(path, O_RDWR | O_CREAT, 0666)) < 0) return -1;
+    if (fstat(c->fd, &st) < 0) return -1;
+
+    if (st.st_size == 0) {
+        if (coda_scrivi_testa(c) < 0 || fdatasync(c->fd) < 0) return -1;
+        totale = 0;
+    } else {
+        if (st.st_size < (off_t)sizeof(testa) || pread(c->fd, &testa, sizeof(testa), 0) != sizeof(testa) ||
+            testa.magic != CODA_MAGIC || testa.versione != CODA_VERSIONE) {
+            errno = EINVAL;
+            return -1;
+        }
+        totale = (st.st_size - sizeof(testa)) / sizeof(GP);
+        if (ftruncate(c->fd, sizeof(testa) + totale * sizeof(GP)) < 0) return -1;
+
+        //Lo svuotamento accorcia il file prima di azzerare la testata: dopo un'interruzione fra le due operazioni
+        //la testata può contare più record di quelli presenti. Va corretta sul disco prima di accodare altri record,
+        //altrimenti ad un nuovo riavvio quelli aggiunti verrebbero considerati già inviati
+        c->inviati = testa.inviati < totale ? testa.inviati : totale;
+        if (testa.inviati > totale && (coda_scrivi_testa(c) < 0 || fdatasync(c->fd) < 0)) return -1;
+    }
+
+    if (pipe(c->notifica) < 0) return -1;
+    fcntl(c->notifica[0], F_SETFL, O_NONBLOCK);
+    fcntl(c->notifica[1], F_SETFL, O_NONBLOCK);
+    fcntl(c->notifica[0], F_SETFD, FD_CLOEXEC);
+    return totale - c->inviati;
+}
+
+//Aggiunge un Green Pass in fondo alla coda e lo rende durevole, poi avvisa il thread di invio. Usa un descrittore
+//proprio, perché il lock di flock appartiene al file aperto e non al processo. Restituisce 0 oppure -1 in caso di errore
+int coda_accoda(CODA *c, const GP *greenP) {
+    struct stat aperto, attuale;
+    int fd, esito = -1, sostituito;
+    char avviso = 0;
+
+    do {
+        if ((fd = open(c->path, O_WRONLY | O_APPEND)) < 0) return -1;
+        if (flock(fd, LOCK_SH) < 0) {
+            close(fd);
+            return -1;
+        }
+        //La compattazione può aver sostituito il file fra open e flock
+        if (fstat(fd, &aperto) < 0 || stat(c->path, &attuale) < 0) sostituito = -1;
+        else sostituito = aperto.st_ino != attuale.st_ino || aperto.st_dev != attuale.st_dev;
+        if (sostituito == 0 && write(fd, greenP, sizeof(GP)) == sizeof(GP) && fdatasync(fd) == 0) esito = 0;
+        flock(fd, LOCK_UN);
+        close(fd);
+    } while (sostituito == 1);
+
+    //Se la pipe è piena il thread di invio ha già avvisi da leggere
+    if (esito == 0) while (write(c->notifica[1], &avviso, sizeof(avviso)) < 0 && errno == EINTR);
+    return esito;
+}
+
+//Record presenti nella coda ed in attesa di conferma, oppure -1 in caso di errore
+int64_t coda_in_attesa(CODA *c) {
+    struct stat st;
+
+    if (fstat(c->fd, &st) < 0) return -1;
+    return (st.st_size - (off_t)sizeof(CODA_TESTA)) / (off_t)sizeof(GP) - c->inviati;
+}
+
+//Legge i primi n record in attesa di conferma. Restituisce 0 oppure -1 in caso di errore
+int coda_leggi(CODA *c, int n, GP *greenP) {
+    size_t dim = n * sizeof(GP), letti = 0;
+    off_t off = sizeof(CODA_TESTA) + c->inviati * sizeof(GP);
+    ssize_t k;
+
+    while (letti < dim) {
+        if ((k = pread(c->fd, (char *)greenP + letti, dim - letti, off + letti)) < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (k == 0) {
+            errno = EIO;
+            return -1;
+        }
+        letti += k;
+    }
+    return 0;
+}
+
+//Rende durevole la voce del file path nella sua cartella. Restituisce 0 oppure -1 in caso di errore
+int coda_sincronizza_cartella(const char *path) {
+    char cartella[4096];
+    const char *fine = strrchr(path, '/');
+    int fd, esito;
+
+    if (fine == NULL) strcpy(cartella, ".");
+    else if ((size_t)(fine - path) >= sizeof(cartella)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    } else snprintf(cartella, sizeof(cartella), "%.*s", fine == path ? 1 : (int)(fine - path), path);
+    if ((fd = open(cartella, O_RDONLY | O_DIRECTORY)) < 0) return -1;
+    esito = fsync(fd);
+    close(fd);
+    return esito;
+}
+
+//Copia i record in attesa in un nuovo file, durevole prima di sostituire la coda con rename, e vi sposta il
+//descrittore del thread di invio. Va chiamata con il lock esclusivo, che il chiamante rilascia sul vecchio descrittore
+//prima di chiuderlo: un'aggiunta in attesa del lock troverà il file sostituito e riaprirà quello nuovo.
+//Restituisce 0 oppure -1 in caso di errore; se il file non è stato sostituito la coda resta invariata
+int coda_compatta(CODA *c) {
+    char temp[4096];
+    GP greenP[256];
+    CODA origine = *c, nuova = *c;
+    int64_t attesa;
+    uint64_t copiati;
+    int n;
+
+    if ((attesa = coda_in_attesa(c)) < 0) return -1;
+    if (snprintf(temp, sizeof(temp), "%s.tmp", c->path) >= (int)sizeof(temp)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    if ((nuova.fd = open(temp, O_RDWR | O_CREAT | O_TRUNC, 0666)) < 0) return -1;
+    nuova.inviati = 0;
+    if (coda_scrivi_testa(&nuova) < 0) goto errore;
+    for (copiati = 0; copiati < (uint64_t)attesa; copiati += n, origine.inviati += n) {
+        n = (uint64_t)attesa - copiati < 256 ? (int)((uint64_t)attesa - copiati) : 256;
+        if (coda_leggi(&origine, n, greenP) < 0 ||
+            coda_pwrite(nuova.fd, greenP, n * sizeof(GP), sizeof(CODA_TESTA) + copiati * sizeof(GP)) < 0) goto errore;
+    }
+    if (fdatasync(nuova.fd) < 0 || rename(temp, c->path) < 0) goto errore;
+
+    c->fd = nuova.fd;
+    c->inviati = 0;
+    return coda_sincronizza_cartella(c->path);
+
+errore:
+    close(nuova.fd);
+    unlink(temp);
+    return -1;
+}
+
+//Conferma i primi n record in attesa. Se non ne restano altri e nessun processo sta aggiungendo un record il file viene
+//svuotato, se i record confermati sono più di CODA_COMPATTA il file viene compattato, altrimenti viene aggiornata la
+//testata; in ogni caso con un'unica sincronizzazione. Restituisce 0 oppure -1 in caso di errore
+int coda_conferma(CODA *c, uint64_t n) {
+    int esito, vecchio;
+
+    c->inviati += n;
+    if (coda_in_attesa(c) == 0 && flock(c->fd, LOCK_EX | LOCK_NB) == 0) {
+        if (coda_in_attesa(c) == 0) {
+            if (ftruncate(c->fd, sizeof(CODA_TESTA)) < 0) {
+                flock(c->fd, LOCK_UN);
+                return -1;
+            }
+            c->inviati = 0;
+        }
+        esito = coda_scrivi_testa(c) == 0 && fdatasync(c->fd) == 0 ? 0 : -1;
+        flock(c->fd, LOCK_UN);
+        return esito;
+    }
+    if (c->inviati >= CODA_COMPATTA && flock(c->fd, LOCK_EX) == 0) {
+        vecchio = c->fd;
+        esito = coda_compatta(c);
+        flock(vecchio, LOCK_UN);
+        if (c->fd != vecchio) close(vecchio);
+        //Se la copia non è riuscita resta da rendere durevole la conferma nel vecchio file
+        if (esito < 0 && c->fd == vecchio) return coda_scrivi_testa(c) == 0 && fdatasync(c->fd) == 0 ? 0 : -1;
+        return esito;
+    }
+    return coda_scrivi_testa(c) == 0 && fdatasync(c->fd) == 0 ? 0 : -1;
+}
+
+//Attende al massimo ms millisecondi l'avviso di un nuovo record, poi scarta gli avvisi ricevuti
+void coda_attendi(CODA *c, int ms) {
+    struct pollfd p;
+    char avvisi[256];
+
+    p.fd = c->notifica[0];
+    p.events = POLLIN;
+    if (poll(&p, 1, ms) > 0) while (read(c->notifica[0], avvisi, sizeof(avvisi)) > 0);
+}
+
+#endif
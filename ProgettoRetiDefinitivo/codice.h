@@ -0,0 +1,136 @@
+//Validazione del codice fiscale riportato sulla tessera sanitaria, prima di qualsiasi richiesta al ServerV.
+//
+//  posizione  0-5    6-7   8     9-10  11      12-14  15
+//             lettere anno mese  giorno comune  comune carattere di controllo
+//
+//Le cifre (posizioni 6, 7, 9, 10, 12, 13, 14) possono essere sostituite dalle lettere LMNPQRSTUV per distinguere
+//codici altrimenti uguali (omocodia); il mese è una delle lettere ABCDEHLMPRST. Il carattere di controllo è la somma
+//dei valori dei primi 15 caratteri modulo 26: i caratteri in posizione pari (dispari contando da 1) hanno i valori
+//della tabella codice_dispari, gli altri valgono la cifra o la posizione della lettera nell'alfabeto. Le lettere
+//minuscole valgono come maiuscole, come in gp_codifica.
+//
+//Sui processori x86 con SSSE3 un codice di 16 caratteri occupa esattamente un registro a 128 bit: classi dei
+//caratteri, valori e somma vengono calcolati su tutti i caratteri insieme. Altrimenti si usa la versione scalare.
+//Entrambe le versioni leggono sempre 16 byte, quindi il codice deve essere in un buffer di almeno 16 byte.
+#ifndef CODICE_H
+#define CODICE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CODICE_SIMD 1
+#endif
+
+#define CODICE_CARATTERI 16
+#define CODICE_LETTERE 0x893F           //posizioni che contengono solo lettere: 0-5, 8, 11, 15
+#define CODICE_CIFRE 0x76C0             //posizioni che contengono cifre o lettere di omocodia: 6, 7, 9, 10, 12-14
+#define CODICE_MESI 0xE989F             //lettere dei mesi ABCDEHLMPRST, un bit per lettera a partire da A
+
+//Valori dei caratteri in posizione pari nel calcolo del carattere di controllo, per 0-9 seguiti da A-Z
+static const uint8_t codice_dispari[36] = {
+    1, 0, 5, 7, 9, 13, 15, 17, 19, 21,
+    1, 0, 5, 7, 9, 13, 15, 17, 19, 21, 2, 4, 18, 20, 11, 3, 6, 8, 12, 14, 16, 10, 22, 25, 24, 23
+};
+
+//Restituisce il carattere di controllo dei primi 15 caratteri del codice, oppure 0 se contengono caratteri diversi da
+//cifre e lettere
+char codice_controllo(const char *cod_fisc) {
+    int i, c, v, somma = 0;
+
+    for (i = 0; i < CODICE_CARATTERI - 1; i++) {
+        c = (unsigned char)cod_fisc[i];
+        if (c >= 'a' && c <= 'z') c -= 'a' - 'A';
+        if (c >= '0' && c <= '9') v = c - '0';
+        else if (c >= 'A' && c <= 'Z') v = c - 'A' + 10;
+        else return 0;
+        somma += i % 2 == 0 ? codice_dispari[v] : v < 10 ? v : v - 10;
+    }
+    return 'A' + somma % 26;
+}
+
+//Versione scalare della validazione. Restituisce 1 se il codice è valido, 0 altrimenti
+int codice_valido_scalare(const char *cod_fisc) {
+    int i, c, cifra, lettera, omocodia;
+
+    for (i = 0; i < CODICE_CARATTERI; i++) {
+        c = (unsigned char)cod_fisc[i];
+        if (c >= 'a' && c <= 'z') c -= 'a' - 'A';
+        cifra = c >= '0' && c <= '9';
+        lettera = c >= 'A' && c <= 'Z';
+        omocodia = c >= 'L' && c <= 'V' && c != 'O';
+        if ((CODICE_LETTERE >> i & 1) && !lettera) return 0;
+        if ((CODICE_CIFRE >> i & 1) && !cifra && !omocodia) return 0;
+        if (i == 8 && !(CODICE_MESI >> (c - 'A') & 1)) return 0;
+        if (i == CODICE_CARATTERI - 1 && c != codice_controllo(cod_fisc)) return 0;
+    }
+    return 1;
+}
+
+#ifdef CODICE_SIMD
+//Byte del registro compresi fra min e min + n - 1, come maschera di byte a 0xFF
+__attribute__((target("ssse3"))) static inline __m128i codice_intervallo(__m128i c, char min, char n) {
+    __m128i d = _mm_sub_epi8(c, _mm_set1_epi8(min));
+    return _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(n - 1)), d);
+}
+
+//Versione vettoriale della validazione, con le istruzioni SSSE3. Restituisce 1 se il codice è valido, 0 altrimenti
+__attribute__((target("ssse3"))) int codice_valido_simd(const char *cod_fisc) {
+    //Posizioni pari da 0 a 14 e dispari da 1 a 13: il carattere di controllo non fa parte della somma
+    const __m128i pari = _mm_set_epi8(0, -1, 0, -1, 0, -1, 0, -1, 0, -1, 0, -1, 0, -1, 0, -1);
+    const __m128i dispari = _mm_set_epi8(0, 0, -1, 0, -1, 0, -1, 0, -1, 0, -1, 0, -1, 0, -1, 0);
+    __m128i c, cifre, lettere, omocodia, valori, tabella, somme;
+    int mese, somma;
+
+    //Lettere minuscole convertite in maiuscole, poi classi di tutti i caratteri
+    c = _mm_loadu_si128((const __m128i *)cod_fisc);
+    c = _mm_sub_epi8(c, _mm_and_si128(codice_intervallo(c, 'a', 26), _mm_set1_epi8('a' - 'A')));
+    cifre = codice_intervallo(c, '0', 10);
+    lettere = codice_intervallo(c, 'A', 26);
+    omocodia = _mm_andnot_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('O')), codice_intervallo(c, 'L', 11));
+    if ((_mm_movemask_epi8(lettere) & CODICE_LETTERE) != CODICE_LETTERE) return 0;
+    if ((_mm_movemask_epi8(_mm_or_si128(cifre, omocodia)) & CODICE_CIFRE) != CODICE_CIFRE) return 0;
+    mese = (unsigned char)_mm_extract_epi16(c, 4) - 'A';
+    if (!(CODICE_MESI >> mese & 1)) return 0;
+
+    //Indice dei caratteri nella tabella codice_dispari: cifre 0-9, lettere 10-35. I valori dei caratteri in
+    //posizione pari vengono presi dalla tabella con tre pshufb da 16 valori, gli altri sono l'indice stesso meno 10
+    //per le lettere
+    valori = _mm_or_si128(_mm_and_si128(cifre, _mm_sub_epi8(c, _mm_set1_epi8('0'))),
+                          _mm_and_si128(lettere, _mm_sub_epi8(c, _mm_set1_epi8('A' - 10))));
+    tabella = _mm_and_si128(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)codice_dispari), valori), codice_intervallo(valori, 0, 16));
+    tabella = _mm_or_si128(tabella, _mm_and_si128(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(codice_dispari + 16)), valori), codice_intervallo(valori, 16, 16)));
+    tabella = _mm_or_si128(tabella, _mm_and_si128(_mm_shuffle_epi8(_mm_set_epi32(0, 0, 0, 23 << 24 | 24 << 16 | 25 << 8 | 22), valori), codice_intervallo(valori, 32, 4)));
+    valori = _mm_sub_epi8(valori, _mm_and_si128(lettere, _mm_set1_epi8(10)));
+    valori = _mm_or_si128(_mm_and_si128(tabella, pari), _mm_and_si128(valori, dispari));
+
+    //Somma dei 15 valori con psadbw, che somma gli 8 byte di ciascuna metà del registro
+    somme = _mm_sad_epu8(valori, _mm_setzero_si128());
+    somma = _mm_cvtsi128_si32(somme) + _mm_extract_epi16(somme, 4);
+    return _mm_extract_epi16(c, 7) >> 8 == 'A' + somma % 26;
+}
+#endif
+
+//Restituisce 1 se il codice fiscale è valido, 0 altrimenti, con la versione vettoriale se il processore la supporta
+int codice_valido(const char *cod_fisc) {
+#ifdef CODICE_SIMD
+    if (__builtin_cpu_supports("ssse3")) return codice_valido_simd(cod_fisc);
+#endif
+    return codice_valido_scalare(cod_fisc);
+}
+
+//Valida n codici, il k-esimo in codici + k * passo, salvando in validi[k] 1 se è valido, 0 altrimenti. La scelta della
+//versione avviene una sola volta per tutto il gruppo
+void codice_valida_molti(int n, const char *codici, size_t passo, char *validi) {
+    int k;
+
+#ifdef CODICE_SIMD
+    if (__builtin_cpu_supports("ssse3")) {
+        for (k = 0; k < n; k++) validi[k] = codice_valido_simd(codici + (size_t)k * passo);
+        return;
+    }
+#endif
+    for (k = 0; k < n; k++) validi[k] = codice_valido_scalare(codici + (size_t)k * passo);
+}
+
+#endif
@@ -0,0 +1,103 @@
+//Date come giorni trascorsi dal 1 gennaio 1970 (calendario gregoriano): confronti e scadenze sono operazioni fra
+//interi. Il giorno corrente, nel fuso orario locale, viene calcolato da un thread subito dopo ogni mezzanotte e
+//comunque ogni minuto, invece che ad ogni richiesta: localtime acquisisce il lock del fuso orario. Il valore è in
+//memoria condivisa anonima, quindi i processi figli creati dopo data_avvia vedono gli aggiornamenti del padre.
+#ifndef DATA_H
+#define DATA_H
+
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#define DATA_CONTROLLO 60               //secondi massimi fra due aggiornamenti del giorno corrente
+
+int32_t *data_oggi_condiviso;           //giorno corrente, NULL prima di data_avvia
+
+//Giorni dal 1 gennaio 1970 della data indicata. Giorni e mesi fuori intervallo proseguono nel mese o nell'anno
+//successivo, come con mktime
+int32_t giorni_da_data(int giorno, int mese, int anno) {
+    int32_t era, anno_era, giorno_anno, anni = (mese > 0 ? mese - 1 : mese - 12) / 12;
+
+    anno += anni;
+    mese -= anni * 12;
+    anno -= mese <= 2;
+    era = (anno >= 0 ? anno : anno - 399) / 400;
+    anno_era = anno - era * 400;
+    giorno_anno = (153 * (mese > 2 ? mese - 3 : mese + 9) + 2) / 5 + giorno - 1;
+    return era * 146097 + anno_era * 365 + anno_era / 4 - anno_era / 100 + giorno_anno - 719468;
+}
+
+//Data corrispondente ai giorni trascorsi dal 1 gennaio 1970
+void data_da_giorni(int32_t giorni, int *giorno, int *mese, int *anno) {
+    int32_t era, giorno_era, anno_era, giorno_anno, m;
+
+    giorni += 719468;
+    era = (giorni >= 0 ? giorni : giorni - 146096) / 146097;
+    giorno_era = giorni - era * 146097;
+    anno_era = (giorno_era - giorno_era / 1460 + giorno_era / 36524 - giorno_era / 146096) / 365;
+    giorno_anno = giorno_era - (365 * anno_era + anno_era / 4 - anno_era / 100);
+    m = (5 * giorno_anno + 2) / 153;
+    *giorno = giorno_anno - (153 * m + 2) / 5 + 1;
+    *mese = m < 10 ? m + 3 : m - 9;
+    *anno = anno_era + era * 400 + (*mese <= 2);
+}
+
+//Stesso giorno mesi mesi dopo; se quel mese è più corto si ferma al suo ultimo giorno (31 ottobre + 4 mesi = 28
+//o 29 febbraio)
+int32_t data_piu_mesi(int32_t giorni, int mesi) {
+    int giorno, mese, anno, ultimo;
+
+    data_da_giorni(giorni, &giorno, &mese, &anno);
+    ultimo = giorni_da_data(1, mese + mesi + 1, anno) - giorni_da_data(1, mese + mesi, anno);
+    return giorni_da_data(giorno < ultimo ? giorno : ultimo, mese + mesi, anno);
+}
+
+//Giorno dell'istante t nel fuso orario locale
+int32_t data_giorno(time_t t) {
+    struct tm data;
+
+    localtime_r(&t, &data);
+    return giorni_da_data(data.tm_mday, data.tm_mon + 1, data.tm_year + 1900);
+}
+
+//Giorno corrente: quello aggiornato dal thread, se avviato, altrimenti calcolato ora
+int32_t data_oggi() {
+    if (data_oggi_condiviso != NULL) return __atomic_load_n(data_oggi_condiviso, __ATOMIC_RELAXED);
+    return data_giorno(time(NULL));
+}
+
+//Thread che aggiorna il giorno corrente subito dopo la mezzanotte, o prima se l'orologio o il fuso orario cambiano
+void *data_aggiorna(void *arg) {
+    struct tm data;
+    time_t adesso;
+    int mancanti;
+    (void)arg;
+
+    for (;;) {
+        adesso = time(NULL);
+        localtime_r(&adesso, &data);
+        __atomic_store_n(data_oggi_condiviso, giorni_da_data(data.tm_mday, data.tm_mon + 1, data.tm_year + 1900), __ATOMIC_RELAXED);
+        mancanti = 86400 - (data.tm_hour * 3600 + data.tm_min * 60 + data.tm_sec);
+        sleep(mancanti < DATA_CONTROLLO ? mancanti : DATA_CONTROLLO);
+    }
+    return NULL;
+}
+
+//Avvia l'aggiornamento del giorno corrente. Va chiamata prima di creare i processi figli.
+//Restituisce 0 oppure -1 in caso di errore
+int data_avvia() {
+    pthread_t tid;
+    int32_t *oggi;
+
+    oggi = mmap(NULL, sizeof(int32_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (oggi == MAP_FAILED) return -1;
+    *oggi = data_giorno(time(NULL));
+    data_oggi_condiviso = oggi;
+    if (pthread_create(&tid, NULL, data_aggiorna, NULL) != 0) return -1;
+    pthread_detach(tid);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,80 @@
+//Record del Green Pass condiviso da Centro Vaccinale, ServerV e ServerG: è lo stesso nell'archivio, nel WAL e nei
+//messaggi fra i server, quindi un solo formato per tutti.
+//
+//  [codice: 12 byte][inizio: 2 byte][fine: 2 byte][flags: 1 byte][versione: 1 byte]     18 byte
+//
+//Il codice della tessera sanitaria (16 caratteri alfanumerici) è compresso a 6 bit per carattere ed è la chiave
+//dell'archivio, quindi occupa i primi byte del record. Le date sono giorni trascorsi dal 1 gennaio 1970 (fino al
+//2149). La versione permette a chi riceve un record di rifiutare quelli di un formato diverso invece di
+//interpretarli male. I campi a 16 bit sono nell'ordine dei byte della macchina, come gli altri interi scambiati
+//fra i server.
+#ifndef GREENPASS_H
+#define GREENPASS_H
+
+#include <stdint.h>
+#include <ctype.h>
+#include "data.h"
+
+#define GP_VERSIONE 1
+#define GP_CARATTERI 16                 //caratteri del codice della tessera sanitaria
+#define GP_CODICE 12                    //byte del codice compresso
+#define GP_VALIDO 0x01                  //flag: Green Pass valido (tampone negativo o nessun referto)
+
+typedef struct {
+    uint8_t codice[GP_CODICE];
+    uint16_t inizio;                    //data di inizio validità, in giorni dal 1 gennaio 1970
+    uint16_t fine;                      //data di fine validità
+    uint8_t flags;
+    uint8_t versione;
+} GP;
+
+_Static_assert(sizeof(GP) == 18, "formato del record del Green Pass");
+
+//Comprime il codice della tessera sanitaria: cifre e lettere (maiuscole o minuscole) diventano valori da 0 a 35 su
+//6 bit. Restituisce 0 oppure -1 se il codice non è composto da 16 caratteri alfanumerici
+int gp_codifica(uint8_t codice[GP_CODICE], const char *cod_fisc) {
+    uint32_t accumulo = 0;
+    int i, j = 0, bit = 0, c;
+
+    for (i = 0; i < GP_CARATTERI; i++) {
+        c = toupper((unsigned char)cod_fisc[i]);
+        if (c >= '0' && c <= '9') c -= '0';
+        else if (c >= 'A' && c <= 'Z') c -= 'A' - 10;
+        else return -1;
+        accumulo = accumulo << 6 | c;
+        for (bit += 6; bit >= 8; bit -= 8) codice[j++] = accumulo >> (bit - 8);
+        accumulo &= (1u << bit) - 1;
+    }
+    return 0;
+}
+
+//Ricostruisce il codice della tessera sanitaria, con il terminatore, a partire da quello compresso
+void gp_decodifica(char cod_fisc[GP_CARATTERI + 1], const uint8_t codice[GP_CODICE]) {
+    uint32_t accumulo = 0;
+    int i, j = 0, bit = 0, c;
+
+    for (i = 0; i < GP_CARATTERI; i++) {
+        for (; bit < 6; bit += 8) accumulo = accumulo << 8 | codice[j++];
+        bit -= 6;
+        c = (accumulo >> bit) & 63;
+        cod_fisc[i] = c < 10 ? '0' + c : c < 36 ? 'A' + c - 10 : '?';
+    }
+    cod_fisc[GP_CARATTERI] = 0;
+}
+
+//Giorni dal 1 gennaio 1970 limitati all'intervallo di un campo data del record
+uint16_t gp_giorno_limitato(int32_t g) {
+    return g < 0 ? 0 : g > UINT16_MAX ? UINT16_MAX : g;
+}
+
+uint16_t gp_giorno(int giorno, int mese, int anno) {
+    return gp_giorno_limitato(giorni_da_data(giorno, mese, anno));
+}
+
+//Restituisce 1 se il Green Pass è valido nel giorno oggi: iniziato, non scaduto (il giorno di fine è ancora valido)
+//e con il flag di validità. Senza salti, così il risultato non dipende dalla previsione dei salti
+int gp_valido(const GP *greenP, int32_t oggi) {
+    return (greenP->inizio <= oggi) & (oggi <= greenP->fine) & (greenP->flags & GP_VALIDO);
+}
+
+#endif
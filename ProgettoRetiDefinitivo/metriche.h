@@ -0,0 +1,169 @@
+//Metriche dei server: contatori ed istogrammi delle latenze aggiornati senza lock con operazioni atomiche, in memoria
+//condivisa anonima creata prima dei processi figli. Gli istogrammi sono logaritmico-lineari come quelli di HDR
+//Histogram: ogni potenza di 2 è divisa in METRICHE_SOTTO intervalli, quindi ogni valore viene conservato con un errore
+//relativo inferiore al 6,25%, da 1 ns a oltre un'ora, con una dimensione fissa.
+//
+//Le metriche vengono esposte in formato testo su una porta di amministrazione locale: ad ogni connessione il server
+//invia una riga per contatore ed una per istogramma, poi chiude la connessione (ad esempio nc 127.0.0.1 1125).
+#ifndef METRICHE_H
+#define METRICHE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#define METRICHE_BIT_SOTTO 4                    //bit dopo il più significativo che distinguono gli intervalli
+#define METRICHE_SOTTO (1 << METRICHE_BIT_SOTTO)
+#define METRICHE_SECCHI ((44 - METRICHE_BIT_SOTTO + 1) * METRICHE_SOTTO) //valori fino a 2^44 ns (circa 4,9 ore)
+
+typedef struct {
+    uint64_t conteggio;
+    uint64_t somma;                 //nanosecondi
+    uint64_t max;
+    uint64_t secchi[METRICHE_SECCHI];
+} ISTOGRAMMA;
+
+//Funzione che stampa le metriche del server sullo stream della connessione di amministrazione
+typedef void (*STAMPA_METRICHE)(FILE *f);
+
+//Crea in memoria condivisa anonima lo spazio per dim byte di metriche, azzerate. Restituisce NULL in caso di errore
+void *metriche_crea(size_t dim) {
+    void *m = mmap(NULL, dim, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    return m == MAP_FAILED ? NULL : m;
+}
+
+uint64_t metriche_adesso() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+void metriche_conta(uint64_t *contatore, uint64_t n) {
+    __atomic_fetch_add(contatore, n, __ATOMIC_RELAXED);
+}
+
+//Secchio del valore v: i valori piccoli hanno un secchio ciascuno, gli altri vengono divisi per potenza di 2
+uint32_t metriche_secchio(uint64_t v) {
+    uint32_t e;
+
+    if (v < METRICHE_SOTTO) return v;
+    e = 63 - __builtin_clzll(v);
+    if (e >= 44) return METRICHE_SECCHI - 1;
+    return (e - METRICHE_BIT_SOTTO + 1) * METRICHE_SOTTO + ((v >> (e - METRICHE_BIT_SOTTO)) & (METRICHE_SOTTO - 1));
+}
+
+//Valore centrale del secchio s
+uint64_t metriche_valore(uint32_t s) {
+    uint32_t e;
+
+    if (s < METRICHE_SOTTO) return s;
+    e = s / METRICHE_SOTTO + METRICHE_BIT_SOTTO - 1;
+    return ((uint64_t)(METRICHE_SOTTO + s % METRICHE_SOTTO) << (e - METRICHE_BIT_SOTTO)) + (1ULL << (e - METRICHE_BIT_SOTTO)) / 2;
+}
+
+//Registra n latenze uguali di ns nanosecondi, ad esempio per le risposte inviate con un'unica scrittura
+void metriche_registra_n(ISTOGRAMMA *h, uint64_t ns, uint64_t n) {
+    uint64_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+
+    if (n == 0) return;
+    __atomic_fetch_add(&h->secchi[metriche_secchio(ns)], n, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->somma, ns * n, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->conteggio, n, __ATOMIC_RELAXED);
+    while (ns > max && !__atomic_compare_exchange_n(&h->max, &max, ns, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+void metriche_registra(ISTOGRAMMA *h, uint64_t ns) {
+    metriche_registra_n(h, ns, 1);
+}
+
+//Registra il tempo trascorso da inizio, ottenuto con metriche_adesso
+void metriche_registra_da(ISTOGRAMMA *h, uint64_t inizio) {
+    metriche_registra_n(h, metriche_adesso() - inizio, 1);
+}
+
+//Stampa una riga con conteggio, media, percentili e massimo dell'istogramma, in microsecondi. Le letture non sono
+//sincronizzate con le registrazioni concorrenti: i valori possono differire di poche registrazioni
+void metriche_stampa_istogramma(FILE *f, const char *nome, ISTOGRAMMA *h) {
+    static const double quantili[] = {0.5, 0.9, 0.99, 0.999};
+    static const char *nomi[] = {"p50", "p90", "p99", "p999"};
+    uint64_t secchi[METRICHE_SECCHI], totale = 0, cumulato, soglia;
+    uint32_t s, q;
+
+    for (s = 0; s < METRICHE_SECCHI; s++) totale += secchi[s] = __atomic_load_n(&h->secchi[s], __ATOMIC_RELAXED);
+    fprintf(f, "istogramma %s conteggio=%llu media_us=%.1f", nome, (unsigned long long)totale,
+            totale ? __atomic_load_n(&h->somma, __ATOMIC_RELAXED) / 1000.0 / totale : 0);
+    for (q = 0; q < sizeof(quantili) / sizeof(quantili[0]); q++) {
+        soglia = (uint64_t)(quantili[q] * totale + 0.5);
+        if (soglia == 0) soglia = 1;
+        for (s = 0, cumulato = 0; s < METRICHE_SECCHI - 1 && cumulato + secchi[s] < soglia; s++) cumulato += secchi[s];
+        fprintf(f, " %s_us=%.1f", nomi[q], totale ? metriche_valore(s) / 1000.0 : 0);
+    }
+    fprintf(f, " max_us=%.1f\n", __atomic_load_n(&h->max, __ATOMIC_RELAXED) / 1000.0);
+}
+
+void metriche_stampa_contatore(FILE *f, const char *nome, uint64_t *contatore) {
+    fprintf(f, "contatore %s %llu\n", nome, (unsigned long long)__atomic_load_n(contatore, __ATOMIC_RELAXED));
+}
+
+typedef struct {
+    int listenfd;
+    STAMPA_METRICHE stampa;
+} ADMIN;
+
+//Thread della porta di amministrazione: invia le metriche ad ogni connessione e la chiude. Il testo viene preparato
+//in memoria ed inviato senza SIGPIPE, così un client che chiude prima della fine non termina il server
+void *metriche_admin(void *arg) {
+    ADMIN *a = arg;
+    FILE *f;
+    char *testo;
+    size_t len, inviati;
+    ssize_t n;
+    int connectfd;
+
+    for (;;) {
+        if ((connectfd = accept(a->listenfd, NULL, NULL)) < 0) continue;
+        if ((f = open_memstream(&testo, &len)) != NULL) {
+            a->stampa(f);
+            fclose(f);
+            for (inviati = 0; inviati < len; inviati += n) {
+                if ((n = send(connectfd, testo + inviati, len - inviati, MSG_NOSIGNAL)) <= 0) break;
+            }
+            free(testo);
+        }
+        close(connectfd);
+    }
+    return NULL;
+}
+
+//Apre la porta di amministrazione, raggiungibile solo in locale, ed avvia il thread che la serve.
+//Restituisce 0 oppure -1 in caso di errore
+int metriche_avvia_admin(int porta, STAMPA_METRICHE stampa) {
+    static ADMIN a;
+    struct sockaddr_in addr;
+    pthread_t tid;
+    int riuso = 1;
+
+    if ((a.listenfd = socket(AF_INET, SOCK_STREAM, 0)) < 0) return -1;
+    setsockopt(a.listenfd, SOL_SOCKET, SO_REUSEADDR, &riuso, sizeof(riuso));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(porta);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(a.listenfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(a.listenfd, 16) < 0) {
+        close(a.listenfd);
+        return -1;
+    }
+    a.stampa = stampa;
+    if (pthread_create(&tid, NULL, metriche_admin, &a) != 0) return -1;
+    pthread_detach(tid);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,133 @@
+//Protocollo a frame fra ServerG e ServerV.
+//
+//Dopo il bit '2' di apertura, ogni messaggio in entrambe le direzioni è un frame:
+//  [lunghezza: 4 byte][operazione: 1 byte][id richiesta: 4 byte][dati]
+//dove la lunghezza (in network order come l'id) conta i byte che la seguono. La risposta ad una richiesta ha
+//lo stesso id e l'operazione con il bit OP_RISPOSTA: il ServerG può quindi inviare molte richieste sulla stessa
+//connessione senza attendere le risposte, ed il ServerV può rispondere in un ordine diverso, per esempio inviando
+//subito le ricerche ed attendendo il WAL solo per le scritture.
+//
+//Dati delle richieste e delle risposte:
+//  OP_CERCA      richiesta: codice della tessera sanitaria (COD_SIZE byte)  risposta: '1' seguito dal GP, '2' se inesistente
+//  OP_REPORT     richiesta: pacchetto REPORT                                risposta: '0' eseguita, '1' se inesistente
+//                                                                           '3' e tentativi ripetuti (1 byte) se occupato
+//  OP_INSERISCI  richiesta: GP                                              risposta: '0' quando il Green Pass è durevole
+//  OP_PING       richiesta e risposta senza dati
+//  OP_VERIFICA   richiesta: codice della tessera sanitaria                  risposta: '1' valido, '0' scaduto o tampone
+//                                                                           positivo, '2' se inesistente
+//  OP_CERCA_MOLTI     richiesta: n codici di COD_SIZE byte  risposta: per ogni codice 1 + sizeof(GP) byte, '1' seguito
+//                                                           dal GP oppure '2' seguito da zeri se inesistente
+//  OP_VERIFICA_MOLTI  richiesta: n codici di COD_SIZE byte  risposta: n byte con gli esiti di OP_VERIFICA
+//  OP_TRASFERISCI     richiesta: GP                         risposta: '0' quando il Green Pass è durevole; a differenza
+//                                                           di OP_INSERISCI il report viene conservato
+//  OP_ELENCA          richiesta: posizione nell'archivio    risposta: posizione successiva seguita dai Green Pass
+//                     (8 byte in network order)             dell'archivio a partire da quella richiesta, nessuno alla fine
+//Una richiesta non riconosciuta riceve una risposta OP_ERRORE senza dati.
+//
+//Una replica apre la connessione con il bit '4' seguito dall'LSN (8 byte in network order) del primo record del WAL
+//che le manca, oppure da REPLICA_ATTUALE per ricevere i record a partire da quelli che diventeranno durevoli. Il
+//primario invia solo frame OP_REPLICA, senza attendere richieste:
+//  [LSN del primo record: 8 byte][LSN durevole del primario: 8 byte][record del WAL: WAL_RECORD e dati]...
+//con i record durevoli nell'ordine del log, ed almeno uno al secondo anche senza record. Se l'LSN richiesto non fa
+//più parte del log il primario invia un frame OP_ERRORE e chiude la connessione.
+//
+//Un ServerG sulla stessa macchina può aprire una connessione Unix con il bit '5': dopo la conferma del ServerV (lo
+//stesso bit) gli passa un canale in memoria condivisa (canale.h) in cui viaggiano gli stessi frame.
+#ifndef PROTOCOLLO_H
+#define PROTOCOLLO_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#define PROTO_TESTA 9                   //byte di intestazione di un frame
+#define PROTO_MAX_FRAME (1 << 20)       //lunghezza massima accettata per un frame
+#define OP_CERCA 1
+#define OP_REPORT 2
+#define OP_INSERISCI 3
+#define OP_PING 4
+#define OP_VERIFICA 5
+#define OP_CERCA_MOLTI 6
+#define OP_VERIFICA_MOLTI 7
+#define OP_TRASFERISCI 8
+#define OP_ELENCA 9
+#define OP_REPLICA 10
+#define REPLICA_ATTUALE UINT64_MAX      //LSN richiesto da una replica senza posizione
+#define OP_RISPOSTA 0x80                //bit che distingue una risposta dalla richiesta
+#define OP_ERRORE 0xFF
+
+//Buffer di dimensione variabile usato per accumulare i byte ricevuti e le risposte da inviare
+typedef struct {
+    char *dati;
+    size_t len;
+    size_t cap;
+} BUFFER;
+
+//Garantisce che il buffer possa contenere almeno dim byte. Restituisce 0 oppure -1 se la memoria non è sufficiente
+int buffer_riserva(BUFFER *b, size_t dim) {
+    size_t cap;
+    char *dati;
+
+    if (dim <= b->cap) return 0;
+    for (cap = b->cap ? b->cap : 256; cap < dim; cap *= 2);
+    if ((dati = realloc(b->dati, cap)) == NULL) return -1;
+    b->dati = dati;
+    b->cap = cap;
+    return 0;
+}
+
+int buffer_aggiungi(BUFFER *b, const void *dati, size_t len) {
+    if (buffer_riserva(b, b->len + len) < 0) return -1;
+    memcpy(b->dati + b->len, dati, len);
+    b->len += len;
+    return 0;
+}
+
+//Elimina i primi n byte del buffer
+void buffer_scarta(BUFFER *b, size_t n) {
+    memmove(b->dati, b->dati + n, b->len - n);
+    b->len -= n;
+}
+
+void buffer_libera(BUFFER *b) {
+    free(b->dati);
+    b->dati = NULL;
+    b->len = b->cap = 0;
+}
+
+//Aggiunge al buffer un frame con i dati indicati
+int proto_aggiungi_frame(BUFFER *b, uint8_t op, uint32_t id, const void *dati, uint32_t len) {
+    char testa[PROTO_TESTA];
+    uint32_t lunghezza = htonl(1 + sizeof(uint32_t) + len);
+
+    id = htonl(id);
+    memcpy(testa, &lunghezza, sizeof(uint32_t));
+    testa[4] = op;
+    memcpy(testa + 5, &id, sizeof(uint32_t));
+    if (buffer_aggiungi(b, testa, PROTO_TESTA) < 0) return -1;
+    return buffer_aggiungi(b, dati, len);
+}
+
+//Estrae il primo frame dai len byte ricevuti. Restituisce i byte occupati dal frame, 0 se il frame non è ancora
+//completo (in fabbisogno vengono salvati i byte necessari, se noti) oppure -1 se il frame non è valido
+int64_t proto_estrai_frame(const char *buf, size_t len, uint8_t *op, uint32_t *id, const char **dati, uint32_t *dlen, size_t *fabbisogno) {
+    uint32_t lunghezza;
+
+    if (len < PROTO_TESTA) return 0;
+    memcpy(&lunghezza, buf, sizeof(uint32_t));
+    lunghezza = ntohl(lunghezza);
+    if (lunghezza < 1 + sizeof(uint32_t) || lunghezza > PROTO_MAX_FRAME) return -1;
+    if (len < sizeof(uint32_t) + lunghezza) {
+        if (fabbisogno) *fabbisogno = sizeof(uint32_t) + lunghezza;
+        return 0;
+    }
+    *op = buf[4];
+    memcpy(id, buf + 5, sizeof(uint32_t));
+    *id = ntohl(*id);
+    *dati = buf + PROTO_TESTA;
+    *dlen = lunghezza - 1 - sizeof(uint32_t);
+    return sizeof(uint32_t) + lunghezza;
+}
+
+#endif
@@ -0,0 +1,91 @@
+//Messaggi della registrazione fra Utente e Centro Vaccinale.
+//
+//Il benvenuto è preceduto dalla sua lunghezza (int) e contiene il testo con il terminatore, seguito da un byte con la
+//versione più recente del protocollo supportata dal Centro Vaccinale: un Utente precedente stampa il testo ed ignora
+//il byte. Con la versione 1 l'Utente invia il pacchetto VACCINAZIONE di dimensione fissa (2065 byte) e riceve un ack
+//di ACK_SIZE byte. Dalla versione 2 invia invece la registrazione compatta
+//  [versione: 1 byte][lunghezza nome: 2 byte][lunghezza cognome: 2 byte][codice: 16 byte][nome][cognome]
+//con le lunghezze in network order e nome e cognome senza terminatore, e riceve l'ack come
+//  [lunghezza: 1 byte][testo senza terminatore]
+//Il byte di versione è REG_MARCA | versione: i byte da 0xF8 in su non possono iniziare un testo UTF-8, quindi non
+//possono essere il primo byte del nome di un pacchetto VACCINAZIONE, ed il Centro Vaccinale riconosce il formato dal
+//primo byte ricevuto.
+#ifndef REGISTRAZIONE_H
+#define REGISTRAZIONE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#define REG_VERSIONE 2                  //versione più recente del protocollo
+#define REG_MARCA 0xF8                  //bit del primo byte della registrazione compatta
+#define REG_CODICE 16                   //caratteri del codice della tessera sanitaria
+#define REG_TESTA (1 + 2 * sizeof(uint16_t) + REG_CODICE)
+#define REG_MAX_NOME 1023               //lunghezza massima di nome e cognome, come nel pacchetto VACCINAZIONE
+
+//Prepara in buf (di almeno sizeof(int) + strlen(testo) + 2 byte) il benvenuto con la sua lunghezza.
+//Restituisce i byte da inviare
+size_t reg_benvenuto(char *buf, const char *testo) {
+    int len = strlen(testo) + 2;
+
+    memcpy(buf, &len, sizeof(int));
+    memcpy(buf + sizeof(int), testo, len - 1);
+    buf[sizeof(int) + len - 1] = REG_VERSIONE;
+    return sizeof(int) + len;
+}
+
+//Versione del protocollo indicata dal benvenuto di len byte: il byte di versione è l'ultimo e segue il terminatore
+//del testo. Restituisce 1 per un benvenuto di un Centro Vaccinale precedente, che invia un buffer di 1024 byte con
+//il testo seguito da byte non inizializzati
+int reg_versione_benvenuto(const char *buf, int len) {
+    size_t testo = strnlen(buf, len);
+
+    return testo + 2 == (size_t)len ? (unsigned char)buf[testo + 1] : 1;
+}
+
+//Versione di una registrazione compatta a partire dal suo primo byte, oppure 1 se si tratta del primo byte del nome
+//di un pacchetto VACCINAZIONE
+int reg_versione(char primo) {
+    return ((unsigned char)primo & REG_MARCA) == REG_MARCA ? (unsigned char)primo & ~REG_MARCA : 1;
+}
+
+//Prepara in buf (di almeno REG_TESTA + 2 * REG_MAX_NOME byte) la registrazione compatta. Nome e cognome più lunghi di
+//REG_MAX_NOME vengono troncati. Restituisce i byte da inviare
+size_t reg_codifica(char *buf, const char *nome, const char *cognome, const char *cod_fisc) {
+    size_t len_nome = strnlen(nome, REG_MAX_NOME), len_cognome = strnlen(cognome, REG_MAX_NOME);
+    uint16_t l;
+
+    buf[0] = REG_MARCA | REG_VERSIONE;
+    l = htons(len_nome);
+    memcpy(buf + 1, &l, sizeof(l));
+    l = htons(len_cognome);
+    memcpy(buf + 1 + sizeof(l), &l, sizeof(l));
+    memcpy(buf + 1 + 2 * sizeof(l), cod_fisc, REG_CODICE);
+    memcpy(buf + REG_TESTA, nome, len_nome);
+    memcpy(buf + REG_TESTA + len_nome, cognome, len_cognome);
+    return REG_TESTA + len_nome + len_cognome;
+}
+
+//Legge le lunghezze di nome e cognome dall'intestazione di REG_TESTA byte di una registrazione compatta.
+//Restituisce 0 oppure -1 se superano REG_MAX_NOME
+int reg_lunghezze(const char *testa, size_t *len_nome, size_t *len_cognome) {
+    uint16_t l;
+
+    memcpy(&l, testa + 1, sizeof(l));
+    *len_nome = ntohs(l);
+    memcpy(&l, testa + 1 + sizeof(l), sizeof(l));
+    *len_cognome = ntohs(l);
+    return *len_nome > REG_MAX_NOME || *len_cognome > REG_MAX_NOME ? -1 : 0;
+}
+
+//Prepara in buf (di almeno 256 byte) l'ack compatto con il testo indicato, troncato a 255 caratteri.
+//Restituisce i byte da inviare
+size_t reg_ack(char *buf, const char *testo) {
+    size_t len = strnlen(testo, 255);
+
+    buf[0] = len;
+    memcpy(buf + 1, testo, len);
+    return 1 + len;
+}
+
+#endif
@@ -0,0 +1,143 @@
+//Lettura e scrittura dei messaggi a campi di lunghezza fissa su una connessione bloccante, condivise da tutti i
+//programmi al posto delle vecchie full_read e full_write.
+//
+//Ogni connessione ha un buffer di ricezione: una recv chiede tutti i byte che ci stanno, ed i campi successivi già
+//arrivati vengono estratti dal buffer senza altre chiamate di sistema. Un campo grande almeno quanto il buffer viene
+//ricevuto direttamente nella destinazione.
+//Le scritture vengono accumulate in un buffer di invio e partono tutte insieme prima di una lettura che deve
+//attendere nuovi byte, perché l'altro capo potrebbe aspettarle per rispondere, oppure con rete_invia. Un campo che
+//non ci sta parte con i byte accumulati in un'unica scrittura a vettore.
+//
+//Nessuna funzione termina il processo ed i socket non generano SIGPIPE: gli errori vengono restituiti al chiamante,
+//che distingue una connessione chiusa fra due messaggi da una chiusa a metà di un campo.
+#ifndef RETE_H
+#define RETE_H
+
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#define RETE_BUFFER 4096    //byte del buffer di ricezione e di quello di invio di ogni connessione
+
+typedef struct {
+    int fd;
+    size_t inizio, fine;    //byte ricevuti e non ancora letti: ingresso[inizio, fine)
+    size_t in_uscita;       //byte scritti e non ancora inviati
+    char ingresso[RETE_BUFFER];
+    char uscita[RETE_BUFFER];
+} RETE;
+
+void rete_inizia(RETE *r, int fd) {
+    r->fd = fd;
+    r->inizio = r->fine = r->in_uscita = 0;
+}
+
+//Invia tutti i byte dei len_a byte di a seguiti dai len_b di b, con una sola chiamata se il kernel li accetta tutti:
+//sendmsg è la writev dei socket, con MSG_NOSIGNAL. Restituisce 0 oppure -1 con errno
+int rete_invia_blocchi(int fd, const void *a, size_t len_a, const void *b, size_t len_b) {
+    struct iovec v[2];
+    struct msghdr m;
+    ssize_t n;
+    size_t k;
+    int i;
+
+    memset(&m, 0, sizeof(m));
+    v[0].iov_base = (void *)a;
+    v[0].iov_len = len_a;
+    v[1].iov_base = (void *)b;
+    v[1].iov_len = len_b;
+    m.msg_iov = v;
+    m.msg_iovlen = 2;
+    while (v[0].iov_len + v[1].iov_len > 0) {
+        if ((n = sendmsg(fd, &m, MSG_NOSIGNAL)) < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        //Invio parziale: si riparte dal primo byte non inviato
+        for (i = 0; i < 2; i++) {
+            k = (size_t)n < v[i].iov_len ? (size_t)n : v[i].iov_len;
+            v[i].iov_base = (char *)v[i].iov_base + k;
+            v[i].iov_len -= k;
+            n -= k;
+        }
+    }
+    return 0;
+}
+
+//Invia tutti i len byte di buf senza passare dal buffer di una connessione. Restituisce 0 oppure -1 con errno
+int rete_invia_dati(int fd, const void *buf, size_t len) {
+    return rete_invia_blocchi(fd, buf, len, NULL, 0);
+}
+
+//Invia i byte accumulati con rete_scrivi. Restituisce 0 oppure -1 con errno; in caso di errore i byte sono scartati
+int rete_invia(RETE *r) {
+    size_t n = r->in_uscita;
+
+    r->in_uscita = 0;
+    return n > 0 ? rete_invia_dati(r->fd, r->uscita, n) : 0;
+}
+
+//Scrive count byte sulla connessione: vengono accumulati nel buffer di invio se ci stanno, altrimenti partono subito
+//insieme a quelli accumulati. Restituisce 0 oppure -1 con errno
+int rete_scrivi(RETE *r, const void *buf, size_t count) {
+    size_t n = r->in_uscita;
+
+    if (n + count <= RETE_BUFFER) {
+        memcpy(r->uscita + n, buf, count);
+        r->in_uscita += count;
+        return 0;
+    }
+    r->in_uscita = 0;
+    return rete_invia_blocchi(r->fd, r->uscita, n, buf, count);
+}
+
+//Legge esattamente count byte in buf, inviando prima i byte accumulati se deve attenderne di nuovi.
+//Restituisce 0; 1 se l'altro capo ha chiuso la connessione prima del primo byte, cioè fra due messaggi (errno
+//ECONNRESET); -1 con errno in caso di errore, EPROTO se la connessione è stata chiusa a metà del campo
+int rete_leggi(RETE *r, void *buf, size_t count) {
+    char *p = buf;
+    size_t k, richiesti = count;
+    ssize_t n;
+
+    while (count > 0) {
+        if (r->inizio < r->fine) {
+            k = r->fine - r->inizio < count ? r->fine - r->inizio : count;
+            memcpy(p, r->ingresso + r->inizio, k);
+            r->inizio += k;
+            p += k;
+            count -= k;
+            continue;
+        }
+        if (rete_invia(r) < 0) return -1;
+
+        r->inizio = r->fine = 0;
+        if ((n = recv(r->fd, count >= RETE_BUFFER ? p : r->ingresso, count >= RETE_BUFFER ? count : RETE_BUFFER, 0)) < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (n == 0) {
+            errno = count == richiesti ? ECONNRESET : EPROTO;
+            return count == richiesti ? 1 : -1;
+        }
+        if (count < RETE_BUFFER) r->fine = n;
+        else {
+            p += n;
+            count -= n;
+        }
+    }
+    return 0;
+}
+
+//Sposta in buf fino a max byte già ricevuti e non ancora letti, senza chiamate di sistema: servono a chi prosegue
+//sulla stessa connessione con un proprio buffer, per esempio con il protocollo a frame. Restituisce i byte spostati
+size_t rete_estrai(RETE *r, void *buf, size_t max) {
+    size_t k = r->fine - r->inizio < max ? r->fine - r->inizio : max;
+
+    memcpy(buf, r->ingresso + r->inizio, k);
+    r->inizio += k;
+    return k;
+}
+
+#endif
@@ -0,0 +1,141 @@
+//Interfaccia minima ad io_uring, senza liburing: le richieste di I/O vengono scritte nella coda di invio condivisa con
+//il kernel (SQ) ed i risultati letti dalla coda dei completamenti (CQ), entrambe mappate in memoria. Una sola
+//chiamata io_uring_enter invia tutte le richieste preparate ed attende i completamenti, quindi un ciclo di eventi
+//che serve molte connessioni esegue una chiamata di sistema per giro invece di una per ogni recv e send.
+//
+//Ogni anello appartiene ad un solo thread. L'array degli indici della SQ viene riempito una volta all'apertura con
+//l'identità, così la posizione di una richiesta è data direttamente dalla coda.
+#ifndef URING_H
+#define URING_H
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+
+typedef struct {
+    int fd;
+    unsigned *sq_testa, *sq_coda, sq_maschera;
+    struct io_uring_sqe *sqe;
+    unsigned coda;                  //coda della SQ comprese le richieste preparate e non ancora pubblicate
+    unsigned preparate;             //richieste scritte nella SQ e non ancora inviate al kernel
+    unsigned *cq_testa, *cq_coda, cq_maschera;
+    struct io_uring_cqe *cqe;
+    void *sq_mem, *cq_mem;
+    size_t sq_dim, cq_dim, sqe_dim;
+} URING;
+
+//Apre un anello con voci posizioni nella SQ (il kernel ne alloca il doppio nella CQ).
+//Restituisce 0 oppure -1 con errno, per esempio ENOSYS o EPERM se il kernel non permette io_uring
+int uring_apri(URING *u, unsigned voci) {
+    struct io_uring_params p;
+    unsigned *indici, i;
+
+    memset(u, 0, sizeof(URING));
+    memset(&p, 0, sizeof(p));
+    if ((u->fd = syscall(__NR_io_uring_setup, voci, &p)) < 0) return -1;
+
+    u->sq_dim = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_dim = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    //Con IORING_FEAT_SINGLE_MMAP le due code condividono la stessa mappatura
+    if (p.features & IORING_FEAT_SINGLE_MMAP) u->sq_dim = u->cq_dim = u->sq_dim > u->cq_dim ? u->sq_dim : u->cq_dim;
+    u->sqe_dim = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    u->sq_mem = mmap(NULL, u->sq_dim, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if (u->sq_mem == MAP_FAILED) goto errore;
+    if (p.features & IORING_FEAT_SINGLE_MMAP) u->cq_mem = u->sq_mem;
+    else if ((u->cq_mem = mmap(NULL, u->cq_dim, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING)) == MAP_FAILED) goto errore;
+    u->sqe = mmap(NULL, u->sqe_dim, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->sqe == MAP_FAILED) goto errore;
+
+    u->sq_testa = (unsigned *)((char *)u->sq_mem + p.sq_off.head);
+    u->sq_coda = (unsigned *)((char *)u->sq_mem + p.sq_off.tail);
+    u->coda = *u->sq_coda;
+    u->sq_maschera = *(unsigned *)((char *)u->sq_mem + p.sq_off.ring_mask);
+    indici = (unsigned *)((char *)u->sq_mem + p.sq_off.array);
+    for (i = 0; i < p.sq_entries; i++) indici[i] = i;
+    u->cq_testa = (unsigned *)((char *)u->cq_mem + p.cq_off.head);
+    u->cq_coda = (unsigned *)((char *)u->cq_mem + p.cq_off.tail);
+    u->cq_maschera = *(unsigned *)((char *)u->cq_mem + p.cq_off.ring_mask);
+    u->cqe = (struct io_uring_cqe *)((char *)u->cq_mem + p.cq_off.cqes);
+    return 0;
+
+errore:
+    i = errno;
+    if (u->sq_mem != NULL && u->sq_mem != MAP_FAILED) munmap(u->sq_mem, u->sq_dim);
+    if (u->cq_mem != NULL && u->cq_mem != MAP_FAILED && u->cq_mem != u->sq_mem) munmap(u->cq_mem, u->cq_dim);
+    close(u->fd);
+    errno = i;
+    return -1;
+}
+
+//Invia al kernel le richieste preparate ed attende almeno attesi completamenti.
+//Restituisce 0 oppure -1 con errno (EINTR se l'attesa è stata interrotta da un segnale)
+int uring_invia(URING *u, unsigned attesi) {
+    int n;
+
+    //Le richieste preparate diventano visibili al kernel solo dopo essere state scritte completamente
+    __atomic_store_n(u->sq_coda, u->coda, __ATOMIC_RELEASE);
+    for (;;) {
+        n = syscall(__NR_io_uring_enter, u->fd, u->preparate, attesi, attesi > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (n < 0) return -1;
+        u->preparate -= n;
+        if (u->preparate == 0 || attesi > 0) return 0;
+    }
+}
+
+//Restituisce la prossima posizione libera della SQ, azzerata, con l'operazione op sul descrittore fd ed il valore
+//dato che tornerà nel completamento. Se la SQ è piena invia prima le richieste preparate
+struct io_uring_sqe *uring_prepara(URING *u, uint8_t op, int fd, uint64_t dato) {
+    struct io_uring_sqe *s;
+
+    while (u->coda - __atomic_load_n(u->sq_testa, __ATOMIC_ACQUIRE) > u->sq_maschera) {
+        if (uring_invia(u, 0) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) return NULL;
+    }
+    s = &u->sqe[u->coda++ & u->sq_maschera];
+    memset(s, 0, sizeof(struct io_uring_sqe));
+    s->opcode = op;
+    s->fd = fd;
+    s->user_data = dato;
+    u->preparate++;
+    return s;
+}
+
+//Prepara una ricezione di al massimo len byte in buf, oppure un invio con op IORING_OP_SEND.
+//Restituisce 0 oppure -1 se la richiesta non può essere preparata
+int uring_prepara_rw(URING *u, uint8_t op, int fd, void *buf, size_t len, uint64_t dato) {
+    struct io_uring_sqe *s;
+
+    if ((s = uring_prepara(u, op, fd, dato)) == NULL) return -1;
+    s->addr = (uint64_t)(uintptr_t)buf;
+    s->len = len;
+    if (op == IORING_OP_SEND) s->msg_flags = MSG_NOSIGNAL;
+    return 0;
+}
+
+//Legge il prossimo completamento, se c'è: restituisce 1 e salva risultato e dato, altrimenti 0
+int uring_completamento(URING *u, int32_t *risultato, uint64_t *dato) {
+    unsigned testa = *u->cq_testa;
+    struct io_uring_cqe *c;
+
+    if (testa == __atomic_load_n(u->cq_coda, __ATOMIC_ACQUIRE)) return 0;
+    c = &u->cqe[testa & u->cq_maschera];
+    *risultato = c->res;
+    *dato = c->user_data;
+    //La posizione torna al kernel dopo averla letta
+    __atomic_store_n(u->cq_testa, testa + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+void uring_chiudi(URING *u) {
+    munmap(u->sqe, u->sqe_dim);
+    if (u->cq_mem != u->sq_mem) munmap(u->cq_mem, u->cq_dim);
+    munmap(u->sq_mem, u->sq_dim);
+    close(u->fd);
+}
+
+#endif
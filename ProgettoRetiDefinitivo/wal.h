@@ -0,0 +1,378 @@
+//Write-ahead log (WAL) del ServerV: file in sola aggiunta in cui viene registrata ogni modifica dell'archivio.
+//
+//Ogni record è identificato dal suo LSN (log sequence number), cioè la posizione logica del record nel log,
+//che cresce in modo monotono anche quando il file viene svuotato dal checkpoint.
+//Organizzazione del file:
+//  [testata: magic, versione, lsn_base][record][record]...
+//dove ogni record è composto da WAL_RECORD seguito da len byte di dati. Il CRC permette di riconoscere un record
+//scritto solo in parte durante un'interruzione improvvisa, l'LSN salvato nel record permette di riconoscere i record
+//di un log già svuotato dal checkpoint.
+//
+//Group commit: chi deve rendere durevole un record attende che l'LSN durevole lo superi. Il primo processo (o thread)
+//che trova la sincronizzazione libera ne diventa il responsabile: attende la finestra configurata per raccogliere
+//altri record, esegue un'unica fdatasync per tutti e risveglia gli altri. Lo stato condiviso risiede in una
+//regione di memoria anonima condivisa creata prima della fork, quindi viene usato sia dai processi figli che dai thread.
+//
+//Le repliche ricevono i record durevoli letti dal file con wal_leggi, senza lock: ogni record viene riconosciuto dal suo
+//LSN e dal CRC, quindi un record sovrascritto dopo un checkpoint concorrente non viene mai restituito.
+#ifndef WAL_H
+#define WAL_H
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define WAL_MAGIC 0x4C575047                    //"GPWL" letto in little endian
+#define WAL_VERSIONE 1
+#define WAL_MAX_DATI 4096                       //dimensione massima dei dati di un record
+#define WAL_SOGLIA_CHECKPOINT (64ULL << 20)     //dimensione del log oltre la quale viene eseguito il checkpoint
+
+//Testata del file di log
+typedef struct {
+    uint32_t magic;
+    uint32_t versione;
+    uint64_t lsn_base;          //LSN del primo record contenuto nel file
+} WAL_TESTA;
+
+//Intestazione di ogni record del log
+typedef struct {
+    uint32_t crc;               //CRC32 calcolato sul resto dell'intestazione e sui dati
+    uint16_t len;               //byte di dati che seguono l'intestazione
+    uint8_t tipo;               //tipo di operazione, interpretato da chi usa il log
+    uint8_t riservato;
+    uint64_t lsn;               //LSN del record
+} WAL_RECORD;
+
+//Stato del log condiviso fra tutti i processi e thread del ServerV
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;        //segnala l'avanzamento dell'LSN durevole
+    uint64_t lsn_base;          //LSN corrispondente all'inizio dei record nel file
+    uint64_t lsn_scritto;       //LSN successivo all'ultimo record scritto
+    uint64_t lsn_durevole;      //LSN fino al quale il log è stato sincronizzato su disco
+    int sincronizzazione;       //1 se un processo sta eseguendo la sincronizzazione
+    pid_t responsabile;         //processo che sta eseguendo la sincronizzazione
+} WAL_CONDIVISO;
+
+//Descrittore del log, ereditato dai processi figli
+typedef struct {
+    int fd;
+    unsigned finestra_us;                       //attesa prima della sincronizzazione per raccogliere altri record
+    int (*sincronizza)(void *arg);              //rende durevole lo stato applicato prima di svuotare il log
+    void *arg;
+    WAL_CONDIVISO *c;
+} WAL;
+
+//CRC32 (polinomio 0xEDB88320) calcolato con una tabella costruita al primo utilizzo
+uint32_t wal_crc32(uint32_t crc, const void *dati, size_t len) {
+    static uint32_t tabella[256];
+    const unsigned char *p = dati;
+    uint32_t c;
+    int i, j;
+
+    if (tabella[1] == 0) {
+        for (i = 0; i < 256; i++) {
+            for (c = i, j = 0; j < 8; j++) c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            tabella[i] = c;
+        }
+    }
+    crc = ~crc;
+    while (len--) crc = tabella[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+//CRC di un record: copre l'intestazione, escluso il campo crc, ed i dati
+uint32_t wal_crc_record(const WAL_RECORD *r, const void *dati) {
+    return wal_crc32(wal_crc32(0, (const char *)r + sizeof(r->crc), sizeof(WAL_RECORD) - sizeof(r->crc)), dati, r->len);
+}
+
+//Scrive esattamente count byte a partire dalla posizione off
+int wal_pwrite(int fd, const void *buffer, size_t count, off_t off) {
+    ssize_t n_written;
+
+    while (count > 0) {
+        if ((n_written = pwrite(fd, buffer, count, off)) < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        count -= n_written;
+        buffer = (const char *)buffer + n_written;
+        off += n_written;
+    }
+    return 0;
+}
+
+//Acquisisce il lock condiviso; se il processo che lo possedeva è terminato lo stato viene comunque considerato consistente
+int wal_blocca(WAL *w) {
+    int err = pthread_mutex_lock(&w->c->lock);
+
+    if (err == EOWNERDEAD) err = pthread_mutex_consistent(&w->c->lock);
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+//Svuota il log dopo aver reso durevole lo stato applicato. Il chiamante deve possedere il lock.
+//La testata viene scritta prima di troncare il file: se l'operazione si interrompe, i record rimasti hanno un LSN
+//precedente a lsn_base e vengono ignorati dal ripristino.
+int wal_checkpoint_bloccato(WAL *w) {
+    WAL_TESTA testa;
+
+    if (w->sincronizza(w->arg) < 0) return -1;
+
+    testa.magic = WAL_MAGIC;
+    testa.versione = WAL_VERSIONE;
+    testa.lsn_base = w->c->lsn_scritto;
+    if (wal_pwrite(w->fd, &testa, sizeof(testa), 0) < 0) return -1;
+    if (ftruncate(w->fd, sizeof(testa)) < 0) return -1;
+    if (fdatasync(w->fd) < 0) return -1;
+
+    w->c->lsn_base = w->c->lsn_scritto;
+    w->c->lsn_durevole = w->c->lsn_scritto;
+    return 0;
+}
+
+int wal_checkpoint(WAL *w) {
+    int esito;
+
+    if (wal_blocca(w) < 0) return -1;
+    esito = wal_checkpoint_bloccato(w);
+    pthread_mutex_unlock(&w->c->lock);
+    return esito;
+}
+
+//Apre (o crea) il log, riapplica con la funzione applica tutti i record validi ed infine esegue il checkpoint.
+//Restituisce il numero di record riapplicati oppure -1 in caso di errore
+int64_t wal_apri(WAL *w, const char *path, unsigned finestra_us,
+                 int (*applica)(uint8_t tipo, const void *dati, uint16_t len),
+                 int (*sincronizza)(void *arg), void *arg) {
+    struct stat st;
+    WAL_TESTA testa;
+    WAL_RECORD r;
+    pthread_mutexattr_t mattr;
+    pthread_condattr_t cattr;
+    char *file = NULL;
+    uint64_t off;
+    int64_t riapplicati = 0;
+
+    w->finestra_us = finestra_us;
+    w->sincronizza = sincronizza;
+    w->arg = arg;
+
+    if ((w->fd = open(path, O_RDWR | O_CREAT, 0666)) < 0) return -1;
+    if (fstat(w->fd, &st) < 0) return -1;
+
+    if (st.st_size == 0) {
+        testa.magic = WAL_MAGIC;
+        testa.versione = WAL_VERSIONE;
+        testa.lsn_base = 0;
+        if (wal_pwrite(w->fd, &testa, sizeof(testa), 0) < 0) return -1;
+        st.st_size = sizeof(testa);
+    } else {
+        if (st.st_size < (off_t)sizeof(testa) || pread(w->fd, &testa, sizeof(testa), 0) != sizeof(testa) ||
+            testa.magic != WAL_MAGIC || testa.versione != WAL_VERSIONE) {
+            errno = EINVAL;
+            return -1;
+        }
+        if ((file = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, w->fd, 0)) == MAP_FAILED) return -1;
+    }
+
+    //Riapplica i record fino al primo incompleto, corrotto o appartenente ad un log già svuotato
+    off = sizeof(testa);
+    while (file != NULL && off + sizeof(r) <= (uint64_t)st.st_size) {
+        memcpy(&r, file + off, sizeof(r));
+        if (off + sizeof(r) + r.len > (uint64_t)st.st_size) break;
+        if (r.lsn != testa.lsn_base + (off - sizeof(testa))) break;
+        if (r.crc != wal_crc_record(&r, file + off + sizeof(r))) break;
+        if (applica(r.tipo, file + off + sizeof(r), r.len) < 0) {
+            munmap(file, st.st_size);
+            return -1;
+        }
+        off += sizeof(r) + r.len;
+        riapplicati++;
+    }
+    if (file != NULL) munmap(file, st.st_size);
+
+    //Stato condiviso, creato prima della fork in modo che sia ereditato dai processi figli
+    if ((w->c = mmap(NULL, sizeof(WAL_CONDIVISO), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) return -1;
+    pthread_mutexattr_init(&mattr);
+    pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&mattr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&w->c->lock, &mattr);
+    pthread_mutexattr_destroy(&mattr);
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+    pthread_cond_init(&w->c->cond, &cattr);
+    pthread_condattr_destroy(&cattr);
+    w->c->lsn_base = testa.lsn_base;
+    w->c->lsn_scritto = testa.lsn_base + (off - sizeof(testa));
+    w->c->lsn_durevole = w->c->lsn_scritto;
+    w->c->sincronizzazione = 0;
+
+    if (wal_checkpoint(w) < 0) return -1;
+    return riapplicati;
+}
+
+//Attende al massimo ms millisecondi che il log diventi durevole oltre lsn. Restituisce l'LSN durevole oppure -1
+int64_t wal_attendi_durevole(WAL *w, uint64_t lsn, int ms) {
+    struct timespec scadenza;
+    int64_t durevole;
+    int err = 0;
+
+    clock_gettime(CLOCK_REALTIME, &scadenza);
+    scadenza.tv_sec += ms / 1000;
+    scadenza.tv_nsec += (ms % 1000) * 1000000L;
+    if (scadenza.tv_nsec >= 1000000000L) {
+        scadenza.tv_sec++;
+        scadenza.tv_nsec -= 1000000000L;
+    }
+    if (wal_blocca(w) < 0) return -1;
+    while (w->c->lsn_durevole <= lsn && err != ETIMEDOUT) {
+        err = pthread_cond_timedwait(&w->c->cond, &w->c->lock, &scadenza);
+        if (err == EOWNERDEAD) pthread_mutex_consistent(&w->c->lock);
+    }
+    durevole = w->c->lsn_durevole;
+    pthread_mutex_unlock(&w->c->lock);
+    return durevole;
+}
+
+//Copia in buf (di max byte, almeno sizeof(WAL_RECORD) + WAL_MAX_DATI) i record completi del log da lsn a fine, che
+//deve essere durevole. Restituisce i byte copiati, oppure -1 con errno ENOENT se lsn non fa più parte del log perché
+//è stato svuotato dal checkpoint, o non ne ha mai fatto parte
+int64_t wal_leggi(WAL *w, uint64_t lsn, uint64_t fine, char *buf, size_t max) {
+    WAL_RECORD r;
+    uint64_t base;
+    size_t dim, off = 0;
+    ssize_t letti;
+
+    if (wal_blocca(w) < 0) return -1;
+    base = w->c->lsn_base;
+    pthread_mutex_unlock(&w->c->lock);
+    if (lsn < base || lsn > fine) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    dim = fine - lsn < max ? fine - lsn : max;
+    while ((letti = pread(w->fd, buf, dim, sizeof(WAL_TESTA) + (lsn - base))) < 0 && errno == EINTR);
+    if (letti < 0) return -1;
+
+    //Solo i record interi, con l'LSN atteso ed il CRC corretto
+    while (off + sizeof(r) <= (size_t)letti) {
+        memcpy(&r, buf + off, sizeof(r));
+        if (off + sizeof(r) + r.len > (size_t)letti || r.lsn != lsn + off || r.crc != wal_crc_record(&r, buf + off + sizeof(r))) break;
+        off += sizeof(r) + r.len;
+    }
+
+    //Nessun record valido: il log è stato svuotato dopo la lettura di lsn_base
+    if (off == 0 && dim > 0) {
+        if (wal_blocca(w) < 0) return -1;
+        base = w->c->lsn_base;
+        pthread_mutex_unlock(&w->c->lock);
+        if (lsn < base) {
+            errno = ENOENT;
+            return -1;
+        }
+    }
+    return off;
+}
+
+//Aggiunge un record al log e restituisce l'LSN successivo al record, da passare a wal_attendi, oppure -1.
+//Le scritture avvengono sotto il lock, quindi tutti i record fino a lsn_scritto sono completi nel file.
+int64_t wal_scrivi(WAL *w, uint8_t tipo, const void *dati, uint16_t len) {
+    char buffer[sizeof(WAL_RECORD) + WAL_MAX_DATI];
+    WAL_RECORD r;
+    int64_t fine;
+
+    if (len > WAL_MAX_DATI) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (wal_blocca(w) < 0) return -1;
+
+    r.len = len;
+    r.tipo = tipo;
+    r.riservato = 0;
+    r.lsn = w->c->lsn_scritto;
+    r.crc = wal_crc_record(&r, dati);
+    memcpy(buffer, &r, sizeof(r));
+    memcpy(buffer + sizeof(r), dati, len);
+
+    if (wal_pwrite(w->fd, buffer, sizeof(r) + len, sizeof(WAL_TESTA) + (r.lsn - w->c->lsn_base)) < 0) {
+        pthread_mutex_unlock(&w->c->lock);
+        return -1;
+    }
+    w->c->lsn_scritto += sizeof(r) + len;
+    fine = w->c->lsn_scritto;
+
+    pthread_mutex_unlock(&w->c->lock);
+    return fine;
+}
+
+//Attende che il log sia durevole almeno fino a lsn, eseguendo la sincronizzazione se nessun altro la sta eseguendo
+int wal_attendi(WAL *w, uint64_t lsn) {
+    struct timespec scadenza, finestra;
+    uint64_t obiettivo;
+    int err;
+
+    if (wal_blocca(w) < 0) return -1;
+    while (w->c->lsn_durevole < lsn) {
+        if (!w->c->sincronizzazione) {
+            //Questo processo diventa responsabile della sincronizzazione per tutti i record scritti finora
+            w->c->sincronizzazione = 1;
+            w->c->responsabile = getpid();
+            pthread_mutex_unlock(&w->c->lock);
+
+            if (w->finestra_us > 0) {
+                finestra.tv_sec = w->finestra_us / 1000000;
+                finestra.tv_nsec = (w->finestra_us % 1000000) * 1000L;
+                while (nanosleep(&finestra, &finestra) < 0 && errno == EINTR);
+            }
+
+            if (wal_blocca(w) < 0) return -1;
+            obiettivo = w->c->lsn_scritto;
+            pthread_mutex_unlock(&w->c->lock);
+
+            err = fdatasync(w->fd);
+
+            if (wal_blocca(w) < 0) return -1;
+            w->c->sincronizzazione = 0;
+            if (err == 0 && obiettivo > w->c->lsn_durevole) w->c->lsn_durevole = obiettivo;
+            pthread_cond_broadcast(&w->c->cond);
+            if (err < 0) {
+                pthread_mutex_unlock(&w->c->lock);
+                return -1;
+            }
+
+            //Il log è diventato troppo grande: l'archivio viene reso durevole ed il log svuotato
+            if (w->c->lsn_scritto - w->c->lsn_base > WAL_SOGLIA_CHECKPOINT && wal_checkpoint_bloccato(w) < 0) {
+                pthread_mutex_unlock(&w->c->lock);
+                return -1;
+            }
+        } else {
+            //Attesa con scadenza, per accorgersi se il responsabile della sincronizzazione è terminato
+            clock_gettime(CLOCK_REALTIME, &scadenza);
+            scadenza.tv_nsec += 100000000L;
+            if (scadenza.tv_nsec >= 1000000000L) {
+                scadenza.tv_sec++;
+                scadenza.tv_nsec -= 1000000000L;
+            }
+            err = pthread_cond_timedwait(&w->c->cond, &w->c->lock, &scadenza);
+            if (err == EOWNERDEAD) pthread_mutex_consistent(&w->c->lock);
+            if (err == ETIMEDOUT && w->c->sincronizzazione && kill(w->c->responsabile, 0) < 0 && errno == ESRCH) w->c->sincronizzazione = 0;
+        }
+    }
+    pthread_mutex_unlock(&w->c->lock);
+    return 0;
+}
+
+#endif